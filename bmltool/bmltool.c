@@ -27,9 +27,15 @@
 #ifndef _WIN32
 #include <unistd.h>
 #include <inttypes.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
 #include "prs.h"
+#include "prs-cache.h"
+#include "prs-verify.h"
 
 #if defined(__BIG_ENDIAN__) || defined(WORDS_BIGENDIAN)
 #define LE32(x) (((x >> 24) & 0x00FF) | \
@@ -53,49 +59,97 @@ typedef struct bml_entry {
 struct update_cxt {
     FILE *fp;
     const char *fn;
-    const char *path;
     long fpos;
     long wpos;
     int is_pvm;
+
+    /* The new (compressed) file to put in. */
+    uint8_t *buf;
+    uint32_t ncs;
+    uint32_t nus;
+
+    /* Where the entry being updated lives in the existing archive. */
+    int found;
+    uint32_t idx;
+    uint32_t offset;
+    uint32_t poffset;
+    bml_entry_t ent;
 };
 
-static uint8_t xbuf[512];
+static struct prs_arena dec_arena = PRS_ARENA_INIT;
+static int level = PRS_LEVEL_DEFAULT;
 
 #ifdef _WIN32
 /* In windows_compat.c */
 char *basename(char *input);
 int my_rename(const char *old, const char *new);
 #define rename my_rename
-#endif
+int mkstemp(char *tmpl);
+
+typedef void *pthread_t;
+int pthread_create(pthread_t *thd, const void *attr, void *(*func)(void *),
+                   void *arg);
+int pthread_join(pthread_t thd, void **rv);
+
+typedef void *pthread_mutex_t;
+typedef void *pthread_cond_t;
+int pthread_mutex_init(pthread_mutex_t *m, const void *attr);
+int pthread_mutex_destroy(pthread_mutex_t *m);
+int pthread_mutex_lock(pthread_mutex_t *m);
+int pthread_mutex_unlock(pthread_mutex_t *m);
+int pthread_cond_init(pthread_cond_t *c, const void *attr);
+int pthread_cond_destroy(pthread_cond_t *c);
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m);
+int pthread_cond_broadcast(pthread_cond_t *c);
+
+void *map_file(const char *fn, size_t *size);
+void unmap_file(void *addr, size_t size);
+#else
 
-static int copy_file(FILE *dst, FILE *src, uint32_t size) {
-    /* Read in the file in 512-byte chunks, writing each one out to the
-       output file (incuding the last chunk, which may be less than 512
-       bytes in length). */
-    while(size > 512) {
-        if(fread(xbuf, 1, 512, src) != 512) {
-            printf("Error reading file: %s\n", strerror(errno));
-            return -1;
-        }
+/* Map a whole file into memory, read-only. */
+static void *map_file(const char *fn, size_t *size) {
+    struct stat st;
+    void *rv;
+    int fd;
 
-        if(fwrite(xbuf, 1, 512, dst) != 512) {
-            printf("Error writing file: %s\n", strerror(errno));
-            return -2;
-        }
+    if((fd = open(fn, O_RDONLY)) < 0)
+        return NULL;
 
-        size -= 512;
+    if(fstat(fd, &st)) {
+        close(fd);
+        return NULL;
     }
 
-    if(size) {
-        if(fread(xbuf, 1, size, src) != size) {
-            printf("Error reading file: %s\n", strerror(errno));
-            return -3;
-        }
+    /* There's no mapping an empty file, and nothing to use in one anyway. */
+    if(!st.st_size) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
 
-        if(fwrite(xbuf, 1, size, dst) != size) {
-            printf("Error writing file: %s\n", strerror(errno));
-            return -4;
-        }
+    rv = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(rv == MAP_FAILED)
+        return NULL;
+
+    /* We're (almost) always going to go straight through it. */
+    madvise(rv, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    *size = (size_t)st.st_size;
+    return rv;
+}
+
+static void unmap_file(void *addr, size_t size) {
+    munmap(addr, size);
+}
+#endif
+
+static int copy_file(FILE *dst, const uint8_t *src, uint32_t size) {
+    /* The whole archive is mapped, so this is just one big write. */
+    if(fwrite(src, 1, size, dst) != size) {
+        printf("Error writing file: %s\n", strerror(errno));
+        return -1;
     }
 
     return 0;
@@ -105,8 +159,9 @@ static long pad_file(FILE *fp, int boundary) {
     long pos = ftell(fp);
     uint8_t tmp = 0;
 
-    /* If we aren't actually padding, don't do anything. */
-    if(boundary <= 0)
+    /* If we aren't actually padding (or are already aligned), don't do
+       anything. */
+    if(boundary <= 0 || !(pos & (boundary - 1)))
         return pos;
 
     pos = (pos & ~(boundary - 1)) + boundary;
@@ -160,18 +215,44 @@ static FILE *open_bml(const char *fn, uint32_t *entries) {
     return fp;
 }
 
-static int scan_bml(const char *fn, int (*p)(FILE *, bml_entry_t *, uint32_t,
-                                             uint32_t, uint32_t, void *),
-                    void *userdata) {
-    FILE *fp;
-    int rv = 0;
-    uint32_t entries, i, offset, poffset, eoffset;
-    long next;
-    bml_entry_t ent;
+typedef int (*scan_func_t)(const uint8_t *, bml_entry_t *, uint32_t, uint32_t,
+                           uint32_t, void *);
 
-    /* Open up the file */
-    if(!(fp = open_bml(fn, &entries)))
-        return -1;
+/* Map an archive into memory and make sure it looks like a sane BML file. */
+static uint8_t *map_bml(const char *fn, size_t *size, uint32_t *entries) {
+    uint8_t *map;
+
+    if(!(map = (uint8_t *)map_file(fn, size))) {
+        printf("Cannot open %s: %s\n", fn, strerror(errno));
+        return NULL;
+    }
+
+    if(*size < 64 || map[0] != 0 || map[1] != 0 || map[2] != 0 ||
+       map[3] != 0 || map[8] != 0x50 || map[9] != 0x01 || map[10] != 0 ||
+       map[11] != 0) {
+        printf("%s is not an BML archive!\n", fn);
+        unmap_file(map, *size);
+        return NULL;
+    }
+
+    *entries = (map[4]) | (map[5] << 8) | (map[6] << 16) | (map[7] << 24);
+
+    if(*entries > (*size - 64) / 64) {
+        printf("Error reading file %s: File table is truncated\n", fn);
+        unmap_file(map, *size);
+        return NULL;
+    }
+
+    return map;
+}
+
+/* Walk through every entry in a mapped archive, passing each one to p along
+   with the archive itself and where its data is in there. */
+static int walk_bml(const char *fn, const uint8_t *map, size_t size,
+                    uint32_t entries, scan_func_t p, void *userdata) {
+    int rv;
+    uint32_t i, offset, poffset, eoffset;
+    bml_entry_t ent;
 
     /* Gonna guess that this will never be a problem, considering we shouldn't
        have anywhere near a 2GiB BML file. */
@@ -183,14 +264,10 @@ static int scan_bml(const char *fn, int (*p)(FILE *, bml_entry_t *, uint32_t,
     if((offset & 0x7FF))
         offset = (offset + 0x800) & 0xFFFFF800;
 
-    /* Read in each file in the archive, writing each one out. */
+    /* Go through each file in the archive. */
     for(i = 0; i < entries; ++i) {
-        /* Read in the header of the file. */
-        if(fread(&ent, 1, sizeof(ent), fp) != sizeof(ent)) {
-            printf("Error reading file %s: %s\n", fn, strerror(errno));
-            rv = -2;
-            goto out;
-        }
+        /* Grab the header of the file. */
+        memcpy(&ent, map + 64 + i * 64, sizeof(ent));
 
         /* Swap the endianness, if needed. */
         ent.csize = LE32(ent.csize);
@@ -204,7 +281,6 @@ static int scan_bml(const char *fn, int (*p)(FILE *, bml_entry_t *, uint32_t,
             poffset = (poffset + 0x20) & 0xFFFFFFE0;
 
         eoffset = poffset;
-        next = ftell(fp);
 
         /* Adjust the next offset if there's a PVM attached. */
         if(ent.pvm_csize) {
@@ -213,25 +289,39 @@ static int scan_bml(const char *fn, int (*p)(FILE *, bml_entry_t *, uint32_t,
                 eoffset = (eoffset + 0x20) & 0xFFFFFFE0;
         }
 
-        if((rv = p(fp, &ent, i, offset, poffset, userdata)))
-            goto out;
+        /* Make sure everything the entry refers to is actually there. */
+        if((uint64_t)offset + ent.csize > size ||
+           (ent.pvm_csize && (uint64_t)poffset + ent.pvm_csize > size)) {
+            printf("Error reading file %s: Data for '%.32s' is truncated\n",
+                   fn, ent.filename);
+            return -2;
+        }
+
+        if((rv = p(map, &ent, i, offset, poffset, userdata)))
+            return rv;
 
         /* Adjust things for the next iteration... */
         offset = eoffset;
-
-        if(fseek(fp, next, SEEK_SET) < 0) {
-            printf("Seek error: %s\n", strerror(errno));
-            rv = -3;
-            goto out;
-        }
     }
 
-out:
-    fclose(fp);
+    return (int)entries;
+}
+
+static int scan_bml(const char *fn, scan_func_t p, void *userdata) {
+    uint8_t *map;
+    size_t size;
+    uint32_t entries;
+    int rv;
+
+    if(!(map = map_bml(fn, &size, &entries)))
+        return -1;
+
+    rv = walk_bml(fn, map, size, entries, p, userdata);
+    unmap_file(map, size);
     return rv;
 }
 
-static int print_file_info(FILE *fp, bml_entry_t *ent, uint32_t i,
+static int print_file_info(const uint8_t *map, bml_entry_t *ent, uint32_t i,
                            uint32_t offset, uint32_t poffset, void *d) {
 #ifndef _WIN32
     printf("File %4" PRIu32 " '%s'\n    compressed size: %" PRIu32 " "
@@ -257,7 +347,7 @@ static int print_file_info(FILE *fp, bml_entry_t *ent, uint32_t i,
     return 0;
 }
 
-static int extract_file(FILE *fp, bml_entry_t *ent, uint32_t i,
+static int extract_file(const uint8_t *map, bml_entry_t *ent, uint32_t i,
                         uint32_t offset, uint32_t poffset, void *d) {
     FILE *ofp;
     char fn[50];
@@ -275,14 +365,8 @@ static int extract_file(FILE *fp, bml_entry_t *ent, uint32_t i,
         return -1;
     }
 
-    if(fseek(fp, offset, SEEK_SET) < 0) {
-        printf("Seek error: %s\n", strerror(errno));
-        fclose(ofp);
-        return -2;
-    }
-
     /* Copy the data out into its new file. */
-    if(copy_file(ofp, fp, ent->csize)) {
+    if(copy_file(ofp, map + offset, ent->csize)) {
         fclose(ofp);
         return -3;
     }
@@ -301,14 +385,8 @@ static int extract_file(FILE *fp, bml_entry_t *ent, uint32_t i,
             return -4;
         }
 
-        if(fseek(fp, poffset, SEEK_SET) < 0) {
-            printf("Seek error: %s\n", strerror(errno));
-            fclose(ofp);
-            return -5;
-        }
-
         /* Copy the data out into its new file. */
-        if(copy_file(ofp, fp, ent->csize)) {
+        if(copy_file(ofp, map + poffset, ent->pvm_csize)) {
             fclose(ofp);
             return -6;
         }
@@ -320,39 +398,16 @@ static int extract_file(FILE *fp, bml_entry_t *ent, uint32_t i,
     return 0;
 }
 
-static int read_and_dec(FILE *fp, uint32_t offset, uint32_t cs, uint32_t ds,
-                        const char *fn) {
+static int read_and_dec(struct prs_arena *arena, const uint8_t *comp,
+                        uint32_t cs, uint32_t ds, const char *fn) {
     FILE *ofp;
-    uint8_t *comp, *decomp;
     int rv;
 
-    if(fseek(fp, offset, SEEK_SET) < 0) {
-        printf("Seek error: %s\n", strerror(errno));
-        return -1;
-    }
-
-    /* Allocate both of the buffers we'll need. */
-    if(!(comp = (uint8_t *)malloc(cs))) {
-        printf("Cannot allocate memory: %s\n", strerror(errno));
-        return -2;
-    }
-
-    if(!(decomp = (uint8_t *)malloc(ds))) {
-        printf("Cannot allocate memory: %s\n", strerror(errno));
-        free(comp);
-        return -3;
-    }
-
-    /* Read into the compressed buffer. */
-    if(fread(comp, 1, cs, fp) != cs) {
-        printf("File read error: %s\n", strerror(errno));
-        free(decomp);
-        free(comp);
-        return -4;
-    }
-
-    /* Decompress it. */
-    if((rv = prs_decompress_buf2(comp, decomp, cs, ds)) != ds) {
+    /* Decompress it straight out of the mapped archive. The decompressed data
+       goes into the arena, which gets reused for every file we extract. We
+       already know how big it should be, so there's no need for a separate pass
+       to figure that out. */
+    if((rv = prs_decompress_arena(arena, comp, cs, ds)) != (int)ds) {
         printf("Error decompressing file %s: ", fn);
 
         if(rv >= 0)
@@ -360,61 +415,317 @@ static int read_and_dec(FILE *fp, uint32_t offset, uint32_t cs, uint32_t ds,
         else
             printf("%s\n", strerror(-rv));
 
-        free(decomp);
-        free(comp);
         return -5;
     }
 
-    /* Free the compressed buffer, since we're done with it. */
-    free(comp);
-
     /* Open the output file. */
     if(!(ofp = fopen(fn, "wb"))) {
         printf("Cannot open file '%s' for write: %s\n", fn, strerror(errno));
-        free(decomp);
         return -6;
     }
 
     /* Write it out. */
-    if(fwrite(decomp, 1, ds, ofp) != ds) {
+    if(fwrite(arena->buf, 1, ds, ofp) != ds) {
         printf("File write error '%s': %s\n", fn, strerror(errno));
-        free(decomp);
         fclose(ofp);
         return -7;
     }
 
     /* We're done, so clean up. */
     fclose(ofp);
-    free(decomp);
 
     return 0;
 }
 
-static int decompress_file(FILE *fp, bml_entry_t *ent, uint32_t i,
-                           uint32_t offset, uint32_t poffset, void *d) {
+static int decompress_entry(struct prs_arena *arena, const uint8_t *map,
+                            const bml_entry_t *ent, uint32_t offset,
+                            uint32_t poffset) {
     char fn[50];
 
+    if(read_and_dec(arena, map + offset, ent->csize, ent->usize,
+                    ent->filename))
+        return -1;
+
+    if(ent->pvm_csize) {
+        sprintf(fn, "%s.pvm", ent->filename);
+
+        if(read_and_dec(arena, map + poffset, ent->pvm_csize, ent->pvm_usize,
+                        fn))
+            return -2;
+    }
+
+    return 0;
+}
+
+static int decompress_file(const uint8_t *map, bml_entry_t *ent, uint32_t i,
+                           uint32_t offset, uint32_t poffset, void *d) {
     /* If we're only extracting one file, then make sure we have the right one
        before we extract it. */
     if(d && strcmp((const char *)d, ent->filename))
         return 0;
 
-    if(read_and_dec(fp, offset, ent->csize, ent->usize, ent->filename))
+    return decompress_entry(&dec_arena, map, ent, offset, poffset);
+}
+
+/* One entry to be extracted by one of the extraction threads. */
+struct extract_job {
+    bml_entry_t ent;
+    uint32_t offset;
+    uint32_t poffset;
+};
+
+struct extract_worker {
+    pthread_t thd;
+    const uint8_t *map;
+    struct extract_job *jobs;
+    uint32_t count;
+    uint32_t start;
+    uint32_t step;
+    int decompress;
+    struct prs_verify *verify;
+    int rv;
+};
+
+static int collect_entry(const uint8_t *map, bml_entry_t *ent, uint32_t i,
+                         uint32_t offset, uint32_t poffset, void *d) {
+    struct extract_job *job = (struct extract_job *)d + i;
+
+    memcpy(&job->ent, ent, sizeof(bml_entry_t));
+    job->offset = offset;
+    job->poffset = poffset;
+
+    return 0;
+}
+
+/* Extract every step'th entry, starting at start. Each thread has its own
+   arena to decompress into, but they all share the one mapping of the
+   archive. */
+static void *extract_thd(void *d) {
+    struct extract_worker *w = (struct extract_worker *)d;
+    struct prs_arena arena = PRS_ARENA_INIT;
+    struct extract_job *job;
+    uint32_t i;
+
+    for(i = w->start; i < w->count; i += w->step) {
+        job = &w->jobs[i];
+
+        if(w->decompress)
+            w->rv = decompress_entry(&arena, w->map, &job->ent, job->offset,
+                                     job->poffset);
+        else
+            w->rv = extract_file(w->map, &job->ent, i, job->offset,
+                                 job->poffset, NULL);
+
+        if(w->rv)
+            break;
+    }
+
+    prs_arena_free(&arena);
+    return NULL;
+}
+
+static int extract_bml(const char *fn, int decompress, int threads) {
+    uint8_t *map;
+    size_t size;
+    uint32_t entries, i, started;
+    struct extract_job *jobs = NULL;
+    struct extract_worker *workers = NULL;
+    int err, rv = -1;
+
+    if(threads == 1)
+        return scan_bml(fn, decompress ? &decompress_file : &extract_file,
+                        NULL);
+
+    /* Read the whole file table first, then split it up among the threads. */
+    if(!(map = map_bml(fn, &size, &entries)))
         return -1;
 
-    if(ent->pvm_csize) {
-        sprintf(fn, "%s.pvm", ent->filename);
+    if(!entries) {
+        rv = 0;
+        goto out;
+    }
 
-        if(read_and_dec(fp, poffset, ent->pvm_csize, ent->pvm_usize, fn))
-            return -2;
+    if((uint32_t)threads > entries)
+        threads = (int)entries;
+
+    jobs = (struct extract_job *)malloc(entries * sizeof(*jobs));
+    workers = (struct extract_worker *)calloc(threads, sizeof(*workers));
+
+    if(!jobs || !workers) {
+        printf("Cannot allocate memory: %s\n", strerror(errno));
+        goto out;
     }
 
-    return 0;
+    if(walk_bml(fn, map, size, entries, &collect_entry, jobs) < 0)
+        goto out;
+
+    rv = 0;
+
+    for(started = 0; started < (uint32_t)threads; ++started) {
+        workers[started].map = map;
+        workers[started].jobs = jobs;
+        workers[started].count = entries;
+        workers[started].start = started;
+        workers[started].step = (uint32_t)threads;
+        workers[started].decompress = decompress;
+
+        if((err = pthread_create(&workers[started].thd, NULL, &extract_thd,
+                                 &workers[started]))) {
+            printf("Cannot create thread: %s\n", strerror(err));
+            rv = -1;
+            break;
+        }
+    }
+
+    for(i = 0; i < started; ++i) {
+        pthread_join(workers[i].thd, NULL);
+
+        if(workers[i].rv)
+            rv = -1;
+    }
+
+out:
+    free(workers);
+    free(jobs);
+    unmap_file(map, size);
+    return rv;
+}
+
+/* Decompress one file into the arena and check it. Something that won't
+   decompress is just as wrong as something that doesn't match, so it counts
+   as a problem rather than stopping everything. */
+static int verify_one(struct prs_verify *v, struct prs_arena *arena,
+                      const uint8_t *comp, uint32_t cs, uint32_t ds,
+                      uint32_t i, const char *fn) {
+    int rv;
+
+    if((rv = prs_decompress_arena(arena, comp, cs, ds)) != (int)ds) {
+        printf("Error decompressing file %s: %s\n", fn,
+               rv >= 0 ? "Size mismatch!" : strerror(-rv));
+        return 1;
+    }
+
+    if((rv = prs_verify_file(v, i, fn, arena->buf, ds)) < 0) {
+        printf("Cannot check file %s: %s\n", fn, strerror(-rv));
+        return 1;
+    }
+
+    return rv;
+}
+
+/* Check every step'th entry (and its PVM), starting at start. Each entry gets
+   two slots in the checker, so a PVM has somewhere to go too. */
+static void *verify_thd(void *d) {
+    struct extract_worker *w = (struct extract_worker *)d;
+    struct prs_arena arena = PRS_ARENA_INIT;
+    struct extract_job *job;
+    uint32_t i;
+    char fn[50];
+
+    for(i = w->start; i < w->count; i += w->step) {
+        job = &w->jobs[i];
+        w->rv += verify_one(w->verify, &arena, w->map + job->offset,
+                            job->ent.csize, job->ent.usize, i * 2,
+                            job->ent.filename);
+
+        if(job->ent.pvm_csize) {
+            sprintf(fn, "%s.pvm", job->ent.filename);
+            w->rv += verify_one(w->verify, &arena, w->map + job->poffset,
+                                job->ent.pvm_csize, job->ent.pvm_usize,
+                                i * 2 + 1, fn);
+        }
+    }
+
+    prs_arena_free(&arena);
+    return NULL;
+}
+
+/* Check the decompressed contents of an archive against a directory or a
+   manifest, or print a manifest for it if against is NULL. Nothing gets
+   written to disk: each thread decompresses into its own arena, straight out
+   of the mapped archive. Returns the number of problems found, or -1 if the
+   checking couldn't be done at all. */
+static int verify_bml(const char *fn, const char *against, int threads) {
+    uint8_t *map;
+    size_t size;
+    uint32_t entries, i, started;
+    struct extract_job *jobs = NULL;
+    struct extract_worker *workers = NULL;
+    struct prs_verify *v = NULL;
+    int err, rv = -1, bad = 0;
+
+    if(!(map = map_bml(fn, &size, &entries)))
+        return -1;
+
+    if((uint32_t)threads > entries)
+        threads = entries ? (int)entries : 1;
+
+    jobs = (struct extract_job *)malloc((entries ? entries : 1) *
+                                        sizeof(*jobs));
+    workers = (struct extract_worker *)calloc(threads, sizeof(*workers));
+
+    if(!jobs || !workers) {
+        printf("Cannot allocate memory: %s\n", strerror(errno));
+        goto out;
+    }
+
+    if(walk_bml(fn, map, size, entries, &collect_entry, jobs) < 0)
+        goto out;
+
+    if((rv = prs_verify_begin(&v, against, entries * 2, stdout))) {
+        printf("Cannot read %s: %s\n", against ? against : fn,
+               strerror(-rv));
+        rv = -1;
+        goto out;
+    }
+
+    for(started = 0; started < (uint32_t)threads; ++started) {
+        workers[started].map = map;
+        workers[started].jobs = jobs;
+        workers[started].count = entries;
+        workers[started].start = started;
+        workers[started].step = (uint32_t)threads;
+        workers[started].verify = v;
+
+        if(threads == 1) {
+            verify_thd(&workers[0]);
+        }
+        else if((err = pthread_create(&workers[started].thd, NULL, &verify_thd,
+                                      &workers[started]))) {
+            printf("Cannot create thread: %s\n", strerror(err));
+            rv = -1;
+            break;
+        }
+    }
+
+    for(i = 0; i < started; ++i) {
+        if(threads > 1)
+            pthread_join(workers[i].thd, NULL);
+
+        bad += workers[i].rv;
+    }
+
+    bad += prs_verify_end(v);
+
+    if(!rv) {
+        rv = bad;
+
+        if(against)
+            printf("%s: %d problem(s) found\n", fn, bad);
+    }
+
+out:
+    free(workers);
+    free(jobs);
+    unmap_file(map, size);
+    return rv;
 }
 
-static uint8_t *read_and_cmp(const char *fn, uint32_t *cs, uint32_t *ds) {
+static uint8_t *read_and_cmp(const char *fn, uint32_t *cs, uint32_t *ds,
+                             struct prs_comp_ctx *ctx) {
+    struct prs_cache_key key;
     FILE *fp;
-    uint8_t *comp, *decomp;
+    uint8_t *comp, *decomp, *tmp;
     int rv;
     long len;
 
@@ -459,9 +770,39 @@ static uint8_t *read_and_cmp(const char *fn, uint32_t *cs, uint32_t *ds) {
 
     fclose(fp);
 
-    /* Compress it. */
-    if((rv = prs_compress(decomp, &comp, len)) < 0) {
-        printf("Error compressing file %s: %s", fn, strerror(-rv));
+    /* If this exact data has been compressed before, the cache might still
+       have it. Otherwise, compress it. If we have a context, compress straight
+       into a buffer of our own (so that it doesn't get overwritten the next
+       time the context is used), then trim it down to size. */
+    prs_cache_key(&key, decomp, len, PRS_CACHE_MODE_LEVEL(level));
+
+    if(!(comp = (uint8_t *)malloc(prs_max_compressed_size(len)))) {
+        printf("Cannot allocate memory: %s\n", strerror(errno));
+        free(decomp);
+        return NULL;
+    }
+
+    if((rv = prs_cache_get(&key, comp, prs_max_compressed_size(len))) < 0) {
+        if(ctx) {
+            rv = prs_compress_into(ctx, decomp, len, comp,
+                                   prs_max_compressed_size(len));
+        }
+        else {
+            free(comp);
+            rv = prs_compress_level(decomp, &comp, len, level);
+        }
+
+        if(rv >= 0)
+            prs_cache_put(&key, comp, rv);
+    }
+
+    if(rv > 0 && (tmp = (uint8_t *)realloc(comp, rv)))
+        comp = tmp;
+    else if(rv < 0 && ctx)
+        free(comp);
+
+    if(rv < 0) {
+        printf("Error compressing file %s: %s\n", fn, strerror(-rv));
         free(decomp);
         return NULL;
     }
@@ -474,19 +815,15 @@ static uint8_t *read_and_cmp(const char *fn, uint32_t *cs, uint32_t *ds) {
     return comp;
 }
 
-static int copy_update(FILE *fp, bml_entry_t *ent, uint32_t i, uint32_t offset,
-                       uint32_t poffset, void *d) {
+static int copy_update(const uint8_t *map, bml_entry_t *ent, uint32_t i,
+                       uint32_t offset, uint32_t poffset, void *d) {
     struct update_cxt *cxt = (struct update_cxt *)d;
-    uint32_t cs = ent->csize, pcs = ent->pvm_csize, ncs, nus;
-    uint8_t *buf;
+    uint32_t cs = ent->csize, pcs = ent->pvm_csize, ncs = cxt->ncs;
+    uint32_t nus = cxt->nus;
+    uint8_t *buf = cxt->buf;
 
     /* Look if we're supposed to update this one. */
     if(!strcmp(cxt->fn, ent->filename)) {
-        /* Read in the file we're replacing this one with, compressing it as we
-           do so. */
-        if(!(buf = read_and_cmp(cxt->path, &ncs, &nus)))
-            return -10;
-
         /* Write the header out. */
         if(fseek(cxt->fp, cxt->fpos, SEEK_SET)) {
             printf("Seek error: %s\n", strerror(errno));
@@ -528,12 +865,7 @@ static int copy_update(FILE *fp, bml_entry_t *ent, uint32_t i, uint32_t offset,
             }
         }
         else {
-            if(fseek(fp, offset, SEEK_SET)) {
-                printf("Seek error: %s\n", strerror(errno));
-                return -17;
-            }
-
-            if(copy_file(cxt->fp, fp, cs))
+            if(copy_file(cxt->fp, map + offset, cs))
                 return -18;
         }
 
@@ -544,12 +876,7 @@ static int copy_update(FILE *fp, bml_entry_t *ent, uint32_t i, uint32_t offset,
         /* Deal with the PVM, if there is one. */
         if(pcs || cxt->is_pvm) {
             if(!cxt->is_pvm) {
-                if(fseek(fp, poffset, SEEK_SET)) {
-                    printf("Seek error: %s\n", strerror(errno));
-                    return -17;
-                }
-
-                if(copy_file(cxt->fp, fp, pcs))
+                if(copy_file(cxt->fp, map + poffset, pcs))
                     return -18;
             }
             else {
@@ -564,7 +891,6 @@ static int copy_update(FILE *fp, bml_entry_t *ent, uint32_t i, uint32_t offset,
                 return -19;
         }
 
-        free(buf);
         return 0;
     }
 
@@ -593,13 +919,8 @@ static int copy_update(FILE *fp, bml_entry_t *ent, uint32_t i, uint32_t offset,
         return -3;
     }
 
-    if(fseek(fp, offset, SEEK_SET)) {
-        printf("Seek error: %s\n", strerror(errno));
-        return -4;
-    }
-
     /* Copy the file over from the old archive to the new one. */
-    if(copy_file(cxt->fp, fp, cs))
+    if(copy_file(cxt->fp, map + offset, cs))
         return -5;
 
     /* Add padding, as needed. */
@@ -608,12 +929,7 @@ static int copy_update(FILE *fp, bml_entry_t *ent, uint32_t i, uint32_t offset,
 
     /* Deal with the PVM, if there is one. */
     if(pcs) {
-        if(fseek(fp, poffset, SEEK_SET)) {
-            printf("Seek error: %s\n", strerror(errno));
-            return -7;
-        }
-
-        if(copy_file(cxt->fp, fp, pcs))
+        if(copy_file(cxt->fp, map + poffset, pcs))
             return -8;
 
         /* Add padding, as needed. */
@@ -624,35 +940,139 @@ static int copy_update(FILE *fp, bml_entry_t *ent, uint32_t i, uint32_t offset,
     return 0;
 }
 
-int update_bml(const char *fn, const char *file, const char *path, int pvm) {
-    int fd;
-    char tmpfn[16];
-    uint32_t entries, hdrlen;
-    struct update_cxt cxt;
-    FILE *fp;
-    uint8_t hdrbuf[64] = { 0 };
+/* Find the entry being updated, and remember where it is. */
+static int find_update(const uint8_t *map, bml_entry_t *ent, uint32_t i,
+                       uint32_t offset, uint32_t poffset, void *d) {
+    struct update_cxt *cxt = (struct update_cxt *)d;
 
-#ifndef _WIN32
-    mode_t mask;
-#endif
+    if(strcmp(cxt->fn, ent->filename))
+        return 0;
 
-    /* Parse out all the entries for the context first. */
-    memset(&cxt, 0, sizeof(cxt));
-    cxt.fn = file;
-    cxt.path = path;
-    cxt.is_pvm = pvm;
+    cxt->found = 1;
+    cxt->idx = i;
+    cxt->offset = offset;
+    cxt->poffset = poffset;
+    memcpy(&cxt->ent, ent, sizeof(bml_entry_t));
 
-    /* Figure out how many entries are in the existing file. */
-    if(!(fp = open_bml(fn, &entries)))
-        return -1;
+    return 1;
+}
 
-    fclose(fp);
+/* Try to put the new file right where the old one was, without touching any
+   other part of the archive. Since nothing in a BML says where each file is,
+   only how long each one is, this only works if the new data pads out to
+   exactly the same spot as the old data did (otherwise, everything after it
+   would have to move). Returns 1 if it doesn't fit and the archive needs to be
+   rewritten instead. */
+static int update_in_place(const char *fn, struct update_cxt *cxt) {
+    static const uint8_t zeros[32] = { 0 };
+    bml_entry_t *ent = &cxt->ent;
+    FILE *fp;
+    uint32_t start, end, old_cs;
 
-    /* Figure out the size of the header. */
-    /* Figure out the length of the header based on the number of entries. */
-    hdrlen = (entries + 1) * 64;
+    if(scan_bml(fn, &find_update, cxt) < 0)
+        return -1;
 
-    if((hdrlen & 0x7FF))
+    if(!cxt->found)
+        return 1;
+
+    if(!cxt->is_pvm) {
+        start = cxt->offset;
+        old_cs = ent->csize;
+    }
+    else {
+        /* If there isn't already a PVM attached, there's no room for one. */
+        if(!ent->pvm_csize)
+            return 1;
+
+        start = cxt->poffset;
+        old_cs = ent->pvm_csize;
+    }
+
+    end = (start + old_cs + 0x1F) & 0xFFFFFFE0;
+
+    if(((start + cxt->ncs + 0x1F) & 0xFFFFFFE0) != end)
+        return 1;
+
+    if(!(fp = fopen(fn, "r+b"))) {
+        printf("Cannot open %s: %s\n", fn, strerror(errno));
+        return -2;
+    }
+
+    /* Write the data (and clear out whatever's left of the slot), then fix up
+       the header to match. */
+    if(fseek(fp, start, SEEK_SET)) {
+        printf("Seek error: %s\n", strerror(errno));
+        fclose(fp);
+        return -3;
+    }
+
+    if(fwrite(cxt->buf, 1, cxt->ncs, fp) != cxt->ncs ||
+       fwrite(zeros, 1, end - start - cxt->ncs, fp) !=
+       end - start - cxt->ncs) {
+        printf("Write error: %s\n", strerror(errno));
+        fclose(fp);
+        return -4;
+    }
+
+    if(!cxt->is_pvm) {
+        ent->csize = cxt->ncs;
+        ent->usize = cxt->nus;
+    }
+    else {
+        ent->pvm_csize = cxt->ncs;
+        ent->pvm_usize = cxt->nus;
+    }
+
+    /* Swap the endianness, if needed. */
+    ent->csize = LE32(ent->csize);
+    ent->unk = LE32(ent->unk);
+    ent->usize = LE32(ent->usize);
+    ent->pvm_csize = LE32(ent->pvm_csize);
+    ent->pvm_usize = LE32(ent->pvm_usize);
+
+    if(fseek(fp, 64 + cxt->idx * 64, SEEK_SET)) {
+        printf("Seek error: %s\n", strerror(errno));
+        fclose(fp);
+        return -5;
+    }
+
+    if(fwrite(ent, 1, 64, fp) != 64) {
+        printf("Cannot write to file: %s\n", strerror(errno));
+        fclose(fp);
+        return -6;
+    }
+
+    if(fclose(fp)) {
+        printf("Cannot write to file: %s\n", strerror(errno));
+        return -7;
+    }
+
+    return 0;
+}
+
+/* Rewrite the whole archive into a new file, with the updated file swapped in,
+   then move that over the original. */
+static int rewrite_bml(const char *fn, struct update_cxt *cxt) {
+    int fd;
+    char tmpfn[16];
+    uint32_t entries, hdrlen;
+    FILE *fp;
+    uint8_t hdrbuf[64] = { 0 };
+
+#ifndef _WIN32
+    mode_t mask;
+#endif
+
+    /* Figure out how many entries are in the existing file. */
+    if(!(fp = open_bml(fn, &entries)))
+        return -1;
+
+    fclose(fp);
+    /* Figure out the size of the header. */
+    /* Figure out the length of the header based on the number of entries. */
+    hdrlen = (entries + 1) * 64;
+
+    if((hdrlen & 0x7FF))
         hdrlen = (hdrlen + 0x800) & 0xFFFFF800;
 
     /* Open up a temporary file for writing. */
@@ -662,25 +1082,25 @@ int update_bml(const char *fn, const char *file, const char *path, int pvm) {
         return -2;
     }
 
-    if(!(cxt.fp = fdopen(fd, "wb"))) {
+    if(!(cxt->fp = fdopen(fd, "wb"))) {
         printf("Cannot open temporary file: %s\n", strerror(errno));
         close(fd);
         unlink(tmpfn);
         return -3;
     }
 
-    if(fseek(cxt.fp, hdrlen, SEEK_SET)) {
+    if(fseek(cxt->fp, hdrlen, SEEK_SET)) {
         printf("Cannot create blank file table: %s\n", strerror(errno));
-        fclose(cxt.fp);
+        fclose(cxt->fp);
         unlink(tmpfn);
         return -4;
     }
 
     /* Save where we'll write the first file and move back to the file table. */
-    cxt.wpos = ftell(cxt.fp);
-    if(fseek(cxt.fp, 0, SEEK_SET)) {
+    cxt->wpos = ftell(cxt->fp);
+    if(fseek(cxt->fp, 0, SEEK_SET)) {
         printf("Seek error: %s\n", strerror(errno));
-        fclose(cxt.fp);
+        fclose(cxt->fp);
         unlink(tmpfn);
         return -5;
     }
@@ -693,17 +1113,17 @@ int update_bml(const char *fn, const char *file, const char *path, int pvm) {
     hdrbuf[8] = 0x50;
     hdrbuf[9] = 0x01;
 
-    if(fwrite(hdrbuf, 1, 64, cxt.fp) != 64) {
+    if(fwrite(hdrbuf, 1, 64, cxt->fp) != 64) {
         printf("Write error: %s\n", strerror(errno));
-        fclose(cxt.fp);
+        fclose(cxt->fp);
         unlink(tmpfn);
         return -6;
     }
 
-    cxt.fpos = 64;
+    cxt->fpos = 64;
 
-    if(scan_bml(fn, &copy_update, &cxt) < 0) {
-        fclose(cxt.fp);
+    if(scan_bml(fn, &copy_update, cxt) < 0) {
+        fclose(cxt->fp);
         unlink(tmpfn);
         return -7;
     }
@@ -712,15 +1132,443 @@ int update_bml(const char *fn, const char *file, const char *path, int pvm) {
 #ifndef _WIN32
     mask = umask(0);
     umask(mask);
-    fchmod(fileno(cxt.fp), (~mask) & 0666);
+    fchmod(fileno(cxt->fp), (~mask) & 0666);
 #endif
 
-    fclose(cxt.fp);
+    fclose(cxt->fp);
     rename(tmpfn, fn);
 
     return 0;
 }
 
+
+int update_bml(const char *fn, const char *file, const char *path, int pvm) {
+    struct update_cxt cxt;
+    int rv;
+
+    memset(&cxt, 0, sizeof(cxt));
+    cxt.fn = file;
+    cxt.is_pvm = pvm;
+
+    /* Read in the file we're replacing this one with, compressing it as we
+       do so. */
+    if(!(cxt.buf = read_and_cmp(path, &cxt.ncs, &cxt.nus, NULL)))
+        return -10;
+
+    /* Only rewrite the whole thing if we have to. */
+    if((rv = update_in_place(fn, &cxt)) == 1) {
+        memset(&cxt.ent, 0, sizeof(cxt.ent));
+        rv = rewrite_bml(fn, &cxt);
+    }
+
+    free(cxt.buf);
+    return rv;
+}
+
+/* One file to be compressed and added to a new archive. */
+struct create_job {
+    const char *path;
+    char name[32];
+    int pvm;
+    int is_pvm;
+
+    /* How much memory the job is counted as using: enough to read and
+       compress the file at first, then just the compressed data until it has
+       been written out. */
+    size_t mem;
+    int done;
+
+    uint8_t *buf;
+    uint32_t cs;
+    uint32_t ds;
+};
+
+/* Everything the compression threads and the thread writing the archive share.
+   The threads pick up files in the order they go in the archive, so the writer
+   can put each one out as soon as it is ready (and free it) while the rest are
+   still being read and compressed. */
+struct create_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+    struct create_job *jobs;
+    int *order;
+    int count;
+    int next;
+    int failed;
+
+    /* Don't start on another file if it would put more than mem_max bytes in
+       flight (0 for no limit). */
+    size_t mem_max;
+    size_t mem_used;
+};
+
+/* Read and compress files until there aren't any left. A file is only taken
+   once there's room for it under the memory limit, and always in order, so
+   the file the writer is waiting on has always been started already. If
+   nothing else is in flight, the file is let through no matter how big it is,
+   or it would never get done. */
+static void *create_thd(void *d) {
+    struct create_pipe *p = (struct create_pipe *)d;
+    struct prs_comp_ctx *ctx;
+    struct create_job *job;
+    uint8_t *buf;
+    uint32_t cs, ds;
+
+    if(!(ctx = prs_comp_ctx_new())) {
+        printf("Cannot allocate memory: %s\n", strerror(errno));
+        pthread_mutex_lock(&p->lock);
+        p->failed = 1;
+        pthread_cond_broadcast(&p->cv);
+        pthread_mutex_unlock(&p->lock);
+        return NULL;
+    }
+
+    prs_comp_ctx_set_level(ctx, level);
+
+    for(;;) {
+        pthread_mutex_lock(&p->lock);
+
+        while(!p->failed && p->next < p->count && p->mem_max && p->mem_used &&
+              p->mem_used + p->jobs[p->order[p->next]].mem > p->mem_max)
+            pthread_cond_wait(&p->cv, &p->lock);
+
+        if(p->failed || p->next >= p->count) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+
+        job = &p->jobs[p->order[p->next++]];
+        p->mem_used += job->mem;
+        pthread_mutex_unlock(&p->lock);
+
+        buf = read_and_cmp(job->path, &cs, &ds, ctx);
+
+        pthread_mutex_lock(&p->lock);
+
+        if(buf) {
+            job->buf = buf;
+            job->cs = cs;
+            job->ds = ds;
+            p->mem_used -= job->mem - cs;
+            job->mem = cs;
+            job->done = 1;
+        }
+        else {
+            p->failed = 1;
+        }
+
+        pthread_cond_broadcast(&p->cv);
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    prs_comp_ctx_free(ctx);
+    return NULL;
+}
+
+static int write_entry(FILE *fp, const struct create_job *job,
+                       const struct create_job *pvm) {
+    bml_entry_t ent;
+
+    memset(&ent, 0, sizeof(ent));
+    strcpy(ent.filename, job->name);
+    ent.csize = LE32(job->cs);
+    ent.usize = LE32(job->ds);
+
+    if(pvm) {
+        ent.pvm_csize = LE32(pvm->cs);
+        ent.pvm_usize = LE32(pvm->ds);
+    }
+
+    if(fwrite(&ent, 1, sizeof(ent), fp) != sizeof(ent)) {
+        printf("Cannot write to archive: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int write_data(FILE *fp, const struct create_job *job) {
+    if(fwrite(job->buf, 1, job->cs, fp) != job->cs) {
+        printf("Cannot write to archive: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(pad_file(fp, 32) < 0)
+        return -1;
+
+    return 0;
+}
+
+/* Write each file out as soon as it has been compressed, in archive order.
+   The header goes in last, since it needs the sizes of everything. */
+static int write_bml(FILE *fp, struct create_pipe *p, uint32_t entries) {
+    struct create_job *job;
+    uint32_t hdrlen;
+    uint8_t hdrbuf[64] = { 0 };
+    int i, failed;
+
+    hdrlen = (entries + 1) * 64;
+
+    if((hdrlen & 0x7FF))
+        hdrlen = (hdrlen + 0x800) & 0xFFFFF800;
+
+    if(fseek(fp, hdrlen, SEEK_SET)) {
+        printf("Seek error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for(i = 0; i < p->count; ++i) {
+        job = &p->jobs[p->order[i]];
+
+        pthread_mutex_lock(&p->lock);
+
+        while(!job->done && !p->failed)
+            pthread_cond_wait(&p->cv, &p->lock);
+
+        failed = p->failed;
+        pthread_mutex_unlock(&p->lock);
+
+        if(failed || write_data(fp, job))
+            return -1;
+
+        free(job->buf);
+        job->buf = NULL;
+
+        pthread_mutex_lock(&p->lock);
+        p->mem_used -= job->mem;
+        pthread_cond_broadcast(&p->cv);
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    hdrbuf[4] = (uint8_t)(entries);
+    hdrbuf[5] = (uint8_t)(entries >> 8);
+    hdrbuf[6] = (uint8_t)(entries >> 16);
+    hdrbuf[7] = (uint8_t)(entries >> 24);
+    hdrbuf[8] = 0x50;
+    hdrbuf[9] = 0x01;
+
+    if(fseek(fp, 0, SEEK_SET)) {
+        printf("Seek error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(fwrite(hdrbuf, 1, 64, fp) != 64) {
+        printf("Cannot write to archive: %s\n", strerror(errno));
+        return -1;
+    }
+
+    for(i = 0; i < p->count; ++i) {
+        job = &p->jobs[i];
+
+        if(job->is_pvm)
+            continue;
+
+        if(write_entry(fp, job, job->pvm >= 0 ? &p->jobs[job->pvm] : NULL))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int create_bml(const char *fn, int count, const char *files[],
+                      int threads, size_t mem_max) {
+    struct create_pipe p;
+    struct create_job *jobs;
+    pthread_t *thds = NULL;
+    struct stat st;
+    uint32_t entries = 0;
+    char *tmp, *base, *ext, *tmpfn = NULL;
+    int i, j, k, fd, err, started = 0, rv = -1;
+    FILE *fp = NULL;
+
+#ifndef _WIN32
+    mode_t mask;
+#endif
+
+    memset(&p, 0, sizeof(p));
+
+    if(!(jobs = (struct create_job *)calloc(count, sizeof(*jobs))) ||
+       !(p.order = (int *)malloc(count * sizeof(int)))) {
+        printf("Cannot allocate memory: %s\n", strerror(errno));
+        free(jobs);
+        return -1;
+    }
+
+    if(threads > count)
+        threads = count;
+
+    if(!(thds = (pthread_t *)calloc(threads, sizeof(pthread_t)))) {
+        printf("Cannot allocate memory: %s\n", strerror(errno));
+        goto out;
+    }
+
+    /* Figure out the name of each file in the archive, and how much memory it
+       will take to compress it. */
+    for(i = 0; i < count; ++i) {
+        jobs[i].path = files[i];
+        jobs[i].pvm = -1;
+
+        if(stat(files[i], &st)) {
+            printf("Cannot open '%s': %s\n", files[i], strerror(errno));
+            goto out;
+        }
+
+        if((st.st_mode & S_IFMT) != S_IFREG) {
+            printf("Cannot add '%s' to archive: Not a regular file\n",
+                   files[i]);
+            goto out;
+        }
+
+        jobs[i].mem = (size_t)st.st_size +
+            prs_max_compressed_size((size_t)st.st_size);
+
+        if(!(tmp = strdup(files[i]))) {
+            printf("Cannot allocate memory: %s\n", strerror(errno));
+            goto out;
+        }
+
+        base = basename(tmp);
+
+        if(strlen(base) >= 32) {
+            printf("Filename too long for archive: %s\n", files[i]);
+            free(tmp);
+            goto out;
+        }
+
+        strcpy(jobs[i].name, base);
+        free(tmp);
+    }
+
+    /* Any name.pvm goes along with the file called name, if there is one. */
+    for(i = 0; i < count; ++i) {
+        if(!(ext = strrchr(jobs[i].name, '.')) || strcmp(ext, ".pvm"))
+            continue;
+
+        for(j = 0; j < count; ++j) {
+            if(j != i && !jobs[j].is_pvm && jobs[j].pvm == -1 &&
+               strlen(jobs[j].name) == (size_t)(ext - jobs[i].name) &&
+               !strncmp(jobs[j].name, jobs[i].name, ext - jobs[i].name)) {
+                jobs[j].pvm = i;
+                jobs[i].is_pvm = 1;
+                break;
+            }
+        }
+    }
+
+    /* The data goes in the order the files were given to us, with each PVM
+       right after the file it goes with. */
+    for(i = k = 0; i < count; ++i) {
+        if(jobs[i].is_pvm)
+            continue;
+
+        ++entries;
+        p.order[k++] = i;
+
+        if(jobs[i].pvm >= 0)
+            p.order[k++] = jobs[i].pvm;
+    }
+
+    /* Build the archive in a temporary file next to where it's going, then
+       move it into place once it's all there, so that anything going wrong
+       partway through leaves an existing archive alone. */
+    if(!(tmpfn = (char *)malloc(strlen(fn) + 16))) {
+        printf("Cannot allocate memory: %s\n", strerror(errno));
+        goto out;
+    }
+
+    strcpy(tmpfn, fn);
+    base = strrchr(tmpfn, '/');
+#ifdef _WIN32
+    if(strrchr(tmpfn, '\\') > base)
+        base = strrchr(tmpfn, '\\');
+#endif
+    strcpy(base ? base + 1 : tmpfn, "bmltoolXXXXXX");
+
+    if((fd = mkstemp(tmpfn)) < 0) {
+        printf("Cannot create temporary file: %s\n", strerror(errno));
+        goto out;
+    }
+
+    if(!(fp = fdopen(fd, "wb"))) {
+        printf("Cannot open temporary file: %s\n", strerror(errno));
+        close(fd);
+        unlink(tmpfn);
+        goto out;
+    }
+
+    p.jobs = jobs;
+    p.count = count;
+    p.mem_max = mem_max;
+
+    if((err = pthread_mutex_init(&p.lock, NULL))) {
+        printf("Cannot create lock: %s\n", strerror(err));
+        goto out;
+    }
+
+    if((err = pthread_cond_init(&p.cv, NULL))) {
+        printf("Cannot create condition variable: %s\n", strerror(err));
+        pthread_mutex_destroy(&p.lock);
+        goto out;
+    }
+
+    /* Compress all the files, writing them out as they're done. */
+    for(started = 0; started < threads; ++started) {
+        if((err = pthread_create(&thds[started], NULL, &create_thd, &p))) {
+            printf("Cannot create thread: %s\n", strerror(err));
+            break;
+        }
+    }
+
+    if(started && !write_bml(fp, &p, entries))
+        rv = 0;
+
+    /* If anything went wrong, make sure the other threads stop too. */
+    if(rv) {
+        pthread_mutex_lock(&p.lock);
+        p.failed = 1;
+        pthread_cond_broadcast(&p.cv);
+        pthread_mutex_unlock(&p.lock);
+    }
+
+    for(i = 0; i < started; ++i)
+        pthread_join(thds[i], NULL);
+
+    pthread_cond_destroy(&p.cv);
+    pthread_mutex_destroy(&p.lock);
+
+out:
+    if(fp) {
+#ifndef _WIN32
+        mask = umask(0);
+        umask(mask);
+        fchmod(fileno(fp), (~mask) & 0666);
+#endif
+
+        if(fclose(fp) && !rv) {
+            printf("Cannot write to archive: %s\n", strerror(errno));
+            rv = -1;
+        }
+
+        if(!rv && rename(tmpfn, fn)) {
+            printf("Cannot move archive into place: %s\n", strerror(errno));
+            rv = -1;
+        }
+
+        if(rv)
+            unlink(tmpfn);
+    }
+
+    for(i = 0; i < count; ++i)
+        free(jobs[i].buf);
+
+    free(tmpfn);
+
+    free(thds);
+    free(p.order);
+    free(jobs);
+    return rv;
+}
+
 /* Print information about this program to stdout. */
 static void print_program_info(void) {
 #if defined(VERSION)
@@ -748,18 +1596,25 @@ static void print_help(const char *bin) {
     printf("Usage:\n"
            "To list the files in an archive:\n"
            "    %s -t bml_archive\n"
-           "To extract all files from an archive:\n"
-           "    %s -x bml_archive\n"
+           "To extract all files from an archive (using N threads):\n"
+           "    %s -x [-j N] bml_archive\n"
            "To extract and decompress all files from an archive:\n"
-           "    %s -xd bml_archive\n"
+           "    %s -xd [-j N] bml_archive\n"
+           "To check the decompressed files in an archive against a\n"
+           "directory or a manifest, without writing anything out:\n"
+           "    %s -v [-j N] bml_archive directory_or_manifest\n"
+           "To print a manifest for the decompressed files in an archive:\n"
+           "    %s -vm [-j N] bml_archive\n"
            "To extract a single file from an archive:\n"
            "    %s -xs bml_archive file_in_archive\n"
            "To extract and decompress a single file from an archive:\n"
            "    %s -xsd bml_archive file_in_archive\n"
            "To update a file in an archive (or replace it with another file):\n"
-           "    %s -u bml_archive file_in_archive filename\n"
+           "    %s -u [-L] bml_archive file_in_archive filename\n"
            "To update a PVM file (attached to a file in the archive):\n"
-           "    %s -up bml_archive parent_file_in_archive filename\n"
+           "    %s -up [-L] bml_archive parent_file_in_archive filename\n"
+           "To create a new archive (using N threads to compress the files):\n"
+           "    %s -c [-j N] [-m MiB] [-L] bml_archive file1 [file2 ...]\n"
            "To print this help message:\n"
            "    %s --help\n"
            "To print version information:\n"
@@ -767,12 +1622,42 @@ static void print_help(const char *bin) {
            "Note that when extracting a single file, if there is an attached\n"
            "PVM file to the specified file, it will also be extracted.\n\n"
            "Also, for updating a file, you must provide the uncompressed file\n"
-           "to be added. This program will compress it as appropriate.\n",
-           bin, bin, bin, bin, bin, bin, bin, bin, bin);
+           "to be added. This program will compress it as appropriate.\n\n"
+           "When creating an archive, any file called name.pvm is attached as\n"
+           "the PVM of the file called name, if there is one. Files are put\n"
+           "in the archive in the order given, no matter how many threads\n"
+           "are used. Each file is written out as soon as it and everything\n"
+           "before it are compressed. -m stops the threads from starting on\n"
+           "more files once about that many MiB of them are in memory.\n\n"
+           "-L is a compression level, from -0 (no compression at all)\n"
+           "through -9 (smallest, and by far the slowest). The default is\n"
+           "-6. Levels -8 and -9 use the optimal parser.\n\n"
+           "Set PRS_CACHE_DIR to a directory to keep compressed files in\n"
+           "between runs, so that files that haven't changed don't have to\n"
+           "be compressed again. PRS_CACHE_SIZE limits the size of the cache\n"
+           "in MiB (256 by default).\n\n"
+           "Set PRS_KERNEL to scalar, sse4.2, avx2 or neon to override the\n"
+           "choice of PRS code used for this CPU.\n\n"
+           "A manifest has a line for each file with its XXH64 hash (16 hex\n"
+           "digits), its size and its name.\n\n"
+           "Put --stats before any of the above to print counters from inside\n"
+           "the PRS code when done (if libprs was built with make STATS=1).\n",
+           bin, bin, bin, bin, bin, bin, bin, bin, bin, bin, bin, bin);
+}
+
+/* If arg is a compression level (-0 through -9), use it and return 1. */
+static int parse_level(const char *arg) {
+    if(arg[0] != '-' || arg[1] < '0' || arg[1] > '9' || arg[2])
+        return 0;
+
+    level = arg[1] - '0';
+    return 1;
 }
 
 /* Parse any command-line arguments passed in. */
 static void parse_command_line(int argc, const char *argv[]) {
+    int i, threads = 1, mem = 0;
+
     if(argc < 2) {
         print_help(argv[0]);
         exit(EXIT_FAILURE);
@@ -793,22 +1678,44 @@ static void parse_command_line(int argc, const char *argv[]) {
         if(scan_bml(argv[2], &print_file_info, NULL) < 0)
             exit(EXIT_FAILURE);
     }
-    else if(!strcmp(argv[1], "-x")) {
-        if(argc != 3) {
+    else if(!strcmp(argv[1], "-x") || !strcmp(argv[1], "-xd")) {
+        i = 2;
+
+        if(argc > 3 && !strcmp(argv[2], "-j")) {
+            if((threads = atoi(argv[3])) < 1) {
+                printf("Invalid thread count: %s\n", argv[3]);
+                exit(EXIT_FAILURE);
+            }
+
+            i = 4;
+        }
+
+        if(argc != i + 1) {
             print_help(argv[0]);
             exit(EXIT_FAILURE);
         }
 
-        if(scan_bml(argv[2], &extract_file, NULL) < 0)
+        if(extract_bml(argv[i], !strcmp(argv[1], "-xd"), threads) < 0)
             exit(EXIT_FAILURE);
     }
-    else if(!strcmp(argv[1], "-xd")) {
-        if(argc != 3) {
+    else if(!strcmp(argv[1], "-v") || !strcmp(argv[1], "-vm")) {
+        i = 2;
+
+        if(argc > 3 && !strcmp(argv[2], "-j")) {
+            if((threads = atoi(argv[3])) < 1) {
+                printf("Invalid thread count: %s\n", argv[3]);
+                exit(EXIT_FAILURE);
+            }
+
+            i = 4;
+        }
+
+        if(argc != i + (!strcmp(argv[1], "-v") ? 2 : 1)) {
             print_help(argv[0]);
             exit(EXIT_FAILURE);
         }
 
-        if(scan_bml(argv[2], &decompress_file, NULL) < 0)
+        if(verify_bml(argv[i], argv[i + 1], threads))
             exit(EXIT_FAILURE);
     }
     else if(!strcmp(argv[1], "-xs")) {
@@ -829,22 +1736,58 @@ static void parse_command_line(int argc, const char *argv[]) {
         if(scan_bml(argv[2], &decompress_file, (void *)argv[3]) < 0)
             exit(EXIT_FAILURE);
     }
-    else if(!strcmp(argv[1], "-u")) {
-        if(argc != 5) {
+    else if(!strcmp(argv[1], "-u") || !strcmp(argv[1], "-up")) {
+        i = (argc > 2 && parse_level(argv[2])) ? 3 : 2;
+
+        if(argc != i + 3) {
             print_help(argv[0]);
             exit(EXIT_FAILURE);
         }
 
-        if(update_bml(argv[2], argv[3], argv[4], 0))
+        prs_cache_init();
+
+        if(update_bml(argv[i], argv[i + 1], argv[i + 2],
+                      !strcmp(argv[1], "-up")))
             exit(EXIT_FAILURE);
     }
-    else if(!strcmp(argv[1], "-up")) {
-        if(argc != 5) {
+    else if(!strcmp(argv[1], "-c")) {
+        i = 2;
+
+        /* The options can come in either order. */
+        for(;;) {
+            if(argc > i + 1 && !strcmp(argv[i], "-j")) {
+                if((threads = atoi(argv[i + 1])) < 1) {
+                    printf("Invalid thread count: %s\n", argv[i + 1]);
+                    exit(EXIT_FAILURE);
+                }
+
+                i += 2;
+            }
+            else if(argc > i + 1 && !strcmp(argv[i], "-m")) {
+                if((mem = atoi(argv[i + 1])) < 1) {
+                    printf("Invalid memory limit: %s\n", argv[i + 1]);
+                    exit(EXIT_FAILURE);
+                }
+
+                i += 2;
+            }
+            else if(argc > i && parse_level(argv[i])) {
+                ++i;
+            }
+            else {
+                break;
+            }
+        }
+
+        if(argc < i + 2) {
             print_help(argv[0]);
             exit(EXIT_FAILURE);
         }
 
-        if(update_bml(argv[2], argv[3], argv[4], 1))
+        prs_cache_init();
+
+        if(create_bml(argv[i], argc - i - 1, argv + i + 1, threads,
+                      (size_t)mem << 20))
             exit(EXIT_FAILURE);
     }
     else {
@@ -856,7 +1799,29 @@ static void parse_command_line(int argc, const char *argv[]) {
     exit(EXIT_SUCCESS);
 }
 
+static void print_stats(void) {
+    struct prs_stats st;
+
+    if(prs_stats_get(&st)) {
+        printf("No PRS statistics: libprs was built without them (build it "
+               "with make STATS=1)\n");
+        return;
+    }
+
+    prs_stats_print(stdout, &st);
+}
+
 int main(int argc, const char *argv[]) {
+    /* Take --stats off the front, so everything else sees the same arguments
+       it would have without it. Everything finishes up with exit(), so print
+       the counters on the way out. */
+    if(argc > 1 && !strcmp(argv[1], "--stats")) {
+        atexit(&print_stats);
+        argv[1] = argv[0];
+        ++argv;
+        --argc;
+    }
+
     /* Parse the command line... */
     parse_command_line(argc, argv);
 
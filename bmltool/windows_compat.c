@@ -26,6 +26,7 @@
 #include <windows.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
 
@@ -142,6 +143,164 @@ char *basename(char *input) {
     return output;
 }
 
+/* Just enough of pthreads to start up a few worker threads and wait for them to
+   finish. */
+typedef void *pthread_t;
+
+struct thd_start {
+    void *(*func)(void *);
+    void *arg;
+};
+
+static DWORD WINAPI thd_entry(LPVOID d) {
+    struct thd_start st = *(struct thd_start *)d;
+
+    free(d);
+    st.func(st.arg);
+    return 0;
+}
+
+int pthread_create(pthread_t *thd, const void *attr, void *(*func)(void *),
+                   void *arg) {
+    struct thd_start *st;
+    HANDLE h;
+
+    (void)attr;
+
+    if(!(st = (struct thd_start *)malloc(sizeof(struct thd_start))))
+        return ENOMEM;
+
+    st->func = func;
+    st->arg = arg;
+
+    if(!(h = CreateThread(NULL, 0, &thd_entry, st, 0, NULL))) {
+        free(st);
+        return EAGAIN;
+    }
+
+    *thd = (pthread_t)h;
+    return 0;
+}
+
+int pthread_join(pthread_t thd, void **rv) {
+    WaitForSingleObject((HANDLE)thd, INFINITE);
+    CloseHandle((HANDLE)thd);
+
+    if(rv)
+        *rv = NULL;
+
+    return 0;
+}
+
+/* ...and just enough for them to hand work to each other. The caller only sees
+   pointers, so it doesn't need windows.h for the types. */
+typedef void *pthread_mutex_t;
+typedef void *pthread_cond_t;
+
+int pthread_mutex_init(pthread_mutex_t *m, const void *attr) {
+    CRITICAL_SECTION *cs;
+
+    (void)attr;
+
+    if(!(cs = (CRITICAL_SECTION *)malloc(sizeof(CRITICAL_SECTION))))
+        return ENOMEM;
+
+    InitializeCriticalSection(cs);
+    *m = cs;
+    return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *m) {
+    DeleteCriticalSection((CRITICAL_SECTION *)*m);
+    free(*m);
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *m) {
+    EnterCriticalSection((CRITICAL_SECTION *)*m);
+    return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *m) {
+    LeaveCriticalSection((CRITICAL_SECTION *)*m);
+    return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *c, const void *attr) {
+    CONDITION_VARIABLE *cv;
+
+    (void)attr;
+
+    if(!(cv = (CONDITION_VARIABLE *)malloc(sizeof(CONDITION_VARIABLE))))
+        return ENOMEM;
+
+    InitializeConditionVariable(cv);
+    *c = cv;
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *c) {
+    free(*c);
+    return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m) {
+    SleepConditionVariableCS((CONDITION_VARIABLE *)*c,
+                             (CRITICAL_SECTION *)*m, INFINITE);
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *c) {
+    WakeAllConditionVariable((CONDITION_VARIABLE *)*c);
+    return 0;
+}
+
+/* Map a whole file into memory, read-only. The view keeps the mapping (and the
+   file) open on its own, so the handles can be closed right away. */
+void *map_file(const char *fn, size_t *size) {
+    HANDLE fh, mh;
+    LARGE_INTEGER sz;
+    void *rv;
+
+    fh = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                     FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if(fh == INVALID_HANDLE_VALUE) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    if(!GetFileSizeEx(fh, &sz) || !sz.QuadPart) {
+        CloseHandle(fh);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    mh = CreateFileMapping(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(fh);
+
+    if(!mh) {
+        errno = EIO;
+        return NULL;
+    }
+
+    rv = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mh);
+
+    if(!rv) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    *size = (size_t)sz.QuadPart;
+    return rv;
+}
+
+void unmap_file(void *addr, size_t size) {
+    (void)size;
+    UnmapViewOfFile(addr);
+}
+
 /* Really? rename() won't overwrite existing files on Windows? */
 int my_rename(const char *old, const char *new) {
     if(!MoveFileEx(old, new, MOVEFILE_REPLACE_EXISTING |
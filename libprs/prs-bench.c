@@ -0,0 +1,1128 @@
+/*
+    Sylverant PSO Tools
+    PRS Benchmark
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* This runs every compression and decompression function in prs.h over a set
+   of files, checking that everything round-trips through prs_decompress_buf2
+   and timing how long it all takes. If given a baseline file from an earlier
+   run, it fails if anything got slower by more than the threshold.
+
+   Unless given files on the command line, the files used are generated here.
+   They're made to look like the things PSO actually compresses (the ItemPMT,
+   quest .bin and .dat files, models from BML files and PVM textures), but are
+   not actual game data, which can't be shipped with this. Files on the command
+   line that end in .prs are decompressed first, so the real ItemPMT.prs can be
+   used directly.
+
+   When built with PRS_BENCH_WRAP defined (and linked with --wrap for malloc,
+   calloc, realloc and free), calls to the allocator are counted as well. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "prs.h"
+
+#ifdef PRS_BENCH_WRAP
+#include <malloc.h>
+#endif
+
+#define MAX_FILES       64
+#define BENCH_BLOCKS    4
+#define ROUND_NS        20000000LL
+
+/* Allocation counting. Sizes are taken from malloc_usable_size, since that's
+   all that free gets to see. live can go negative if something frees memory
+   that the C library allocated internally, so peaks are always measured from
+   wherever it was at the start of a call. */
+static long long alloc_count, alloc_live, alloc_peak;
+
+#ifdef PRS_BENCH_WRAP
+extern void *__real_malloc(size_t sz);
+extern void *__real_calloc(size_t n, size_t sz);
+extern void *__real_realloc(void *ptr, size_t sz);
+extern void __real_free(void *ptr);
+
+static void alloc_add(void *ptr) {
+    ++alloc_count;
+    alloc_live += (long long)malloc_usable_size(ptr);
+
+    if(alloc_live > alloc_peak)
+        alloc_peak = alloc_live;
+}
+
+void *__wrap_malloc(size_t sz) {
+    void *rv = __real_malloc(sz);
+
+    if(rv)
+        alloc_add(rv);
+
+    return rv;
+}
+
+void *__wrap_calloc(size_t n, size_t sz) {
+    void *rv = __real_calloc(n, sz);
+
+    if(rv)
+        alloc_add(rv);
+
+    return rv;
+}
+
+void *__wrap_realloc(void *ptr, size_t sz) {
+    size_t old = ptr ? malloc_usable_size(ptr) : 0;
+    void *rv = __real_realloc(ptr, sz);
+
+    if(rv) {
+        alloc_live -= (long long)old;
+        alloc_add(rv);
+    }
+
+    return rv;
+}
+
+void __wrap_free(void *ptr) {
+    if(ptr)
+        alloc_live -= (long long)malloc_usable_size(ptr);
+
+    __real_free(ptr);
+}
+#endif
+
+static void alloc_reset(void) {
+    alloc_count = 0;
+    alloc_peak = alloc_live;
+}
+
+typedef struct bench_file {
+    char name[64];
+    uint8_t *data;
+    size_t len;
+
+    /* The output of prs_compress, for the decompression modes to use. */
+    uint8_t *comp;
+    size_t comp_len;
+} bench_file_t;
+
+/* Everything that the modes need to keep around between calls. Whatever a
+   mode returns is only valid until the next call. */
+typedef struct bench_state {
+    struct prs_comp_ctx *ctx[BENCH_BLOCKS];
+    struct prs_dec_state *dec;
+    struct prs_arena arena;
+    uint8_t *owned;
+    uint8_t *scratch;
+    size_t scratch_len;
+    uint8_t *out;
+    size_t out_len;
+} bench_state_t;
+
+/* Compression modes set *dst to the compressed data and return its size.
+   Decompression modes decompress f->comp into s->out (or set *dst to wherever
+   the output is) and return its size. */
+typedef int (*bench_func_t)(bench_state_t *s, const bench_file_t *f,
+                            const uint8_t **dst);
+
+typedef struct bench_mode {
+    const char *name;
+    bench_func_t func;
+    int decomp;
+
+    /* Totals over all the files. */
+    long long ns;
+    size_t in_bytes;
+    size_t out_bytes;
+    long long allocs;
+    long long peak;
+    int calls;
+} bench_mode_t;
+
+static void free_owned(bench_state_t *s) {
+    free(s->owned);
+    s->owned = NULL;
+}
+
+static int m_greedy(bench_state_t *s, const bench_file_t *f,
+                    const uint8_t **dst) {
+    int rv;
+
+    free_owned(s);
+    rv = prs_compress(f->data, &s->owned, f->len);
+    *dst = s->owned;
+    return rv;
+}
+
+static int m_optimal(bench_state_t *s, const bench_file_t *f,
+                     const uint8_t **dst) {
+    int rv;
+
+    free_owned(s);
+    rv = prs_compress_optimal(f->data, &s->owned, f->len);
+    *dst = s->owned;
+    return rv;
+}
+
+/* Each compression level gets a mode of its own. */
+static int m_level(bench_state_t *s, const bench_file_t *f,
+                   const uint8_t **dst, int level) {
+    int rv;
+
+    free_owned(s);
+    rv = prs_compress_level(f->data, &s->owned, f->len, level);
+    *dst = s->owned;
+    return rv;
+}
+
+#define LEVEL_FUNC(l) \
+    static int m_level##l(bench_state_t *s, const bench_file_t *f, \
+                          const uint8_t **dst) { \
+        return m_level(s, f, dst, l); \
+    }
+
+LEVEL_FUNC(0) LEVEL_FUNC(1) LEVEL_FUNC(2) LEVEL_FUNC(3) LEVEL_FUNC(4)
+LEVEL_FUNC(5) LEVEL_FUNC(6) LEVEL_FUNC(7) LEVEL_FUNC(8) LEVEL_FUNC(9)
+
+static int m_archive(bench_state_t *s, const bench_file_t *f,
+                     const uint8_t **dst) {
+    int rv;
+
+    free_owned(s);
+    rv = prs_archive(f->data, &s->owned, f->len);
+    *dst = s->owned;
+    return rv;
+}
+
+static int m_ctx(bench_state_t *s, const bench_file_t *f,
+                 const uint8_t **dst) {
+    return prs_compress_ctx(s->ctx[0], f->data, f->len, dst);
+}
+
+static int m_into(bench_state_t *s, const bench_file_t *f,
+                  const uint8_t **dst) {
+    *dst = s->scratch;
+    return prs_compress_into(s->ctx[0], f->data, f->len, s->scratch,
+                             s->scratch_len);
+}
+
+/* Compress in blocks, like it would be done on multiple threads (but all on
+   this one), then stitch the blocks back together. */
+static int m_blocks(bench_state_t *s, const bench_file_t *f,
+                    const uint8_t **dst) {
+    const uint8_t *bufs[BENCH_BLOCKS];
+    size_t lens[BENCH_BLOCKS];
+    size_t bsz = (f->len + BENCH_BLOCKS - 1) / BENCH_BLOCKS, off, len;
+    int i, rv;
+
+    for(i = 0; i < BENCH_BLOCKS; ++i) {
+        off = bsz * i;
+
+        if(off > f->len)
+            off = f->len;
+
+        len = f->len - off < bsz ? f->len - off : bsz;
+
+        if((rv = prs_compress_block(s->ctx[i], f->data + off, off, len,
+                                    &bufs[i])) < 0)
+            return rv;
+
+        lens[i] = (size_t)rv;
+    }
+
+    free_owned(s);
+    rv = prs_stitch(bufs, lens, BENCH_BLOCKS, &s->owned);
+    *dst = s->owned;
+    return rv;
+}
+
+static int m_stream(bench_state_t *s, const bench_file_t *f,
+                    const uint8_t **dst) {
+    FILE *in, *out;
+    long pos;
+    int rv;
+
+    if(!(in = fmemopen(f->data, f->len, "rb")))
+        return -errno;
+
+    if(!(out = fmemopen(s->scratch, s->scratch_len, "w+b"))) {
+        rv = -errno;
+        fclose(in);
+        return rv;
+    }
+
+    if(!(rv = prs_compress_stream(in, out))) {
+        pos = ftell(out);
+        rv = pos < 0 ? -errno : (int)pos;
+    }
+
+    fclose(out);
+    fclose(in);
+    *dst = s->scratch;
+    return rv;
+}
+
+static int m_buf2(bench_state_t *s, const bench_file_t *f,
+                  const uint8_t **dst) {
+    *dst = s->out;
+    return prs_decompress_buf2(f->comp, s->out, f->comp_len, s->out_len);
+}
+
+static int m_buf(bench_state_t *s, const bench_file_t *f,
+                 const uint8_t **dst) {
+    int rv;
+
+    free_owned(s);
+    rv = prs_decompress_buf(f->comp, &s->owned, f->comp_len);
+    *dst = s->owned;
+    return rv;
+}
+
+static int m_exact(bench_state_t *s, const bench_file_t *f,
+                   const uint8_t **dst) {
+    *dst = s->out;
+    return prs_decompress_exact(f->comp, s->out, f->comp_len, f->len);
+}
+
+static int m_arena(bench_state_t *s, const bench_file_t *f,
+                   const uint8_t **dst) {
+    int rv;
+
+    rv = prs_decompress_arena(&s->arena, f->comp, f->comp_len, 0);
+    *dst = s->arena.buf;
+    return rv;
+}
+
+static int m_feed(bench_state_t *s, const bench_file_t *f,
+                  const uint8_t **dst) {
+    size_t in = 0, out = 0, len;
+    int rv;
+
+    prs_dec_reset(s->dec);
+    *dst = s->out;
+
+    for(;;) {
+        if(in < f->comp_len) {
+            len = f->comp_len - in < 4096 ? f->comp_len - in : 4096;
+
+            if((rv = prs_dec_feed(s->dec, f->comp + in, len)) < 0)
+                return rv;
+
+            in += (size_t)rv;
+        }
+
+        /* s->out has a bit more room than needed, so this never asks for 0
+           bytes while there's still output to come. */
+        len = s->out_len - out < 4096 ? s->out_len - out : 4096;
+        rv = prs_dec_pull(s->dec, s->out + out, len);
+
+        if(rv == -EAGAIN) {
+            if(in >= f->comp_len)
+                return -EBADMSG;
+
+            continue;
+        }
+        else if(rv < 0) {
+            return rv;
+        }
+        else if(!rv) {
+            return (int)out;
+        }
+
+        out += (size_t)rv;
+    }
+}
+
+static int m_size(bench_state_t *s, const bench_file_t *f,
+                  const uint8_t **dst) {
+    (void)s;
+    *dst = f->data;
+    return prs_decompress_size(f->comp, f->comp_len);
+}
+
+#define MODE(name, func, decomp) { name, func, decomp, 0, 0, 0, 0, 0, 0 }
+
+static bench_mode_t modes[] = {
+    MODE("greedy", m_greedy, 0),
+    MODE("optimal", m_optimal, 0),
+    MODE("ctx", m_ctx, 0),
+    MODE("into", m_into, 0),
+    MODE("blocks", m_blocks, 0),
+    MODE("stream", m_stream, 0),
+    MODE("archive", m_archive, 0),
+    MODE("level0", m_level0, 0),
+    MODE("level1", m_level1, 0),
+    MODE("level2", m_level2, 0),
+    MODE("level3", m_level3, 0),
+    MODE("level4", m_level4, 0),
+    MODE("level5", m_level5, 0),
+    MODE("level6", m_level6, 0),
+    MODE("level7", m_level7, 0),
+    MODE("level8", m_level8, 0),
+    MODE("level9", m_level9, 0),
+    MODE("buf2", m_buf2, 1),
+    MODE("buf", m_buf, 1),
+    MODE("exact", m_exact, 1),
+    MODE("arena", m_arena, 1),
+    MODE("feed", m_feed, 1),
+    MODE("size", m_size, 1),
+    MODE(NULL, NULL, 0)
+};
+
+/* Generating the corpus... Everything comes from this, so it's the same on
+   every run (and every machine). */
+static uint32_t rng_state = 0x50525321;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, (uint16_t)v);
+    put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void putf(uint8_t *p, float f) {
+    uint32_t v;
+
+    memcpy(&v, &f, 4);
+    put32(p, v);
+}
+
+static float rngf(float lo, float hi) {
+    return lo + (hi - lo) * (float)(rng() & 0xFFFF) / 65535.0f;
+}
+
+/* An ItemPMT: lots of small fixed-size records with ids counting up and stats
+   in narrow ranges, then a table of pointers to each group of records. */
+static size_t gen_itempmt(uint8_t *buf, size_t len) {
+    size_t pos = 0, ptrs;
+    uint32_t id = 0;
+    int i, j, groups = 0;
+    uint32_t group_pos[256];
+
+    ptrs = len - sizeof(group_pos) * 2;
+
+    while(pos + 0x2C * 64 <= ptrs && groups < 256) {
+        group_pos[groups++] = (uint32_t)pos;
+        j = 8 + (int)(rng() % 56);
+
+        for(i = 0; i < j; ++i, pos += 0x2C) {
+            memset(buf + pos, 0, 0x2C);
+            put32(buf + pos, id++);
+            put16(buf + pos + 4, (uint16_t)(groups - 1));
+            put16(buf + pos + 6, (uint16_t)i);
+            put16(buf + pos + 8, (uint16_t)(5 + i * 3 + rng() % 4));
+            put16(buf + pos + 10, (uint16_t)(10 + i * 4 + rng() % 8));
+            put16(buf + pos + 12, (uint16_t)(rng() % 50));
+            buf[pos + 14] = (uint8_t)(rng() % 4);
+            buf[pos + 16] = (uint8_t)(rng() % 8);
+
+            if(!(rng() & 3))
+                buf[pos + 20] = (uint8_t)(rng() % 40);
+
+            buf[pos + 24] = (uint8_t)(groups & 0x0F);
+        }
+    }
+
+    for(i = 0; i < groups; ++i, pos += 8) {
+        put32(buf + pos, (uint32_t)(group_pos[i + 1 < groups ? i + 1 : i] -
+                                    group_pos[i]) / 0x2C);
+        put32(buf + pos + 4, group_pos[i]);
+    }
+
+    return pos;
+}
+
+static size_t put_utf16(uint8_t *buf, const char *str, size_t max) {
+    size_t i;
+
+    for(i = 0; *str && i + 2 <= max; i += 2, ++str)
+        put16(buf + i, (uint8_t)*str);
+
+    memset(buf + i, 0, max - i);
+    return max;
+}
+
+/* A quest .bin: a header with a title and description, a bunch of script
+   bytecode using a small set of opcodes, then the label table. */
+static size_t gen_quest_bin(uint8_t *buf, size_t len) {
+    static const char *words[] = {
+        "Hunter", "Ragol", "Pioneer", "Principal", "Tyrell", "forest",
+        "caves", "mines", "ruins", "the", "of", "and", "to", "please",
+        "help", "find", "Dr. Montague", "Elly", "Rico"
+    };
+    size_t pos = 0x1D4, lbl_pos;
+    uint32_t labels[1024];
+    int nlabels = 0, i, j;
+    uint8_t *p;
+
+    memset(buf, 0, pos);
+    put32(buf, (uint32_t)pos);
+    put16(buf + 0x0C, 58);
+    put_utf16(buf + 0x14, "Lost HEAT SWORD", 0x40);
+    put_utf16(buf + 0x54, "Retrieve the sword from the forest.", 0x100);
+
+    lbl_pos = len - sizeof(labels);
+
+    while(pos + 512 < lbl_pos) {
+        if(!(rng() % 12) && nlabels < 1024)
+            labels[nlabels++] = (uint32_t)(pos - 0x1D4);
+
+        p = buf + pos;
+
+        switch(rng() % 8) {
+            case 0:
+                /* leti reg, value */
+                p[0] = 0x08; p[1] = (uint8_t)(rng() % 80);
+                put32(p + 2, rng() % 16);
+                pos += 6;
+                break;
+
+            case 1:
+                /* jmp label */
+                p[0] = 0x28;
+                put16(p + 1, (uint16_t)(rng() % (nlabels + 1)));
+                pos += 3;
+                break;
+
+            case 2:
+                /* message with some text */
+                p[0] = 0xF8; p[1] = 0xA5;
+                pos += 2;
+                j = 2 + (int)(rng() % 6);
+
+                for(i = 0; i < j; ++i) {
+                    const char *w = words[rng() % 19];
+                    pos += put_utf16(buf + pos, w, strlen(w) * 2);
+                    put16(buf + pos, ' ');
+                    pos += 2;
+                }
+
+                put16(buf + pos, 0);
+                pos += 2;
+                break;
+
+            case 3:
+                /* arg_pushl value */
+                p[0] = 0x48;
+                put32(p + 1, rng() % 100);
+                pos += 5;
+                break;
+
+            case 4:
+                /* arg_pushr reg */
+                p[0] = 0x49; p[1] = (uint8_t)(rng() % 80);
+                pos += 2;
+                break;
+
+            case 5:
+                /* jmp_= reg, reg, label */
+                p[0] = 0x2C; p[1] = (uint8_t)(rng() % 80);
+                p[2] = (uint8_t)(rng() % 80);
+                put16(p + 3, (uint16_t)(rng() % (nlabels + 1)));
+                pos += 5;
+                break;
+
+            case 6:
+                /* ret */
+                p[0] = 0x01;
+                pos += 1;
+                break;
+
+            default:
+                /* set_floor_handler floor, label */
+                p[0] = 0xF8; p[1] = 0x0C;
+                put32(p + 2, rng() % 18);
+                put16(p + 6, (uint16_t)(rng() % (nlabels + 1)));
+                pos += 8;
+                break;
+        }
+    }
+
+    put32(buf + 4, (uint32_t)pos);
+
+    for(i = 0; i < nlabels; ++i, pos += 4)
+        put32(buf + pos, labels[i]);
+
+    put32(buf + 8, (uint32_t)pos);
+    return pos;
+}
+
+/* A quest .dat: sections of 0x44 byte objects and 0x48 byte enemies, each
+   with a type from a short list and floating point positions. */
+static size_t gen_quest_dat(uint8_t *buf, size_t len) {
+    static const uint16_t objs[] = {
+        0x0000, 0x0001, 0x0002, 0x0003, 0x0008, 0x0012, 0x0088, 0x00C2
+    };
+    static const uint16_t enemies[] = {
+        0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0060, 0x0061, 0x0062,
+        0x0063, 0x00A0, 0x00A1
+    };
+    size_t pos = 0, cnt, hdr;
+    int type, floor, i, sz;
+    uint8_t *p;
+
+    for(floor = 0; ; floor = (floor + 1) % 18) {
+        type = (floor & 1) + 1;
+        sz = type == 1 ? 0x44 : 0x48;
+        cnt = 8 + rng() % 64;
+
+        if(pos + 16 + cnt * sz > len)
+            break;
+
+        hdr = pos;
+        pos += 16;
+
+        for(i = 0; i < (int)cnt; ++i, pos += sz) {
+            p = buf + pos;
+            memset(p, 0, sz);
+
+            if(type == 1)
+                put16(p, objs[rng() % 8]);
+            else
+                put16(p, enemies[rng() % 11]);
+
+            put16(p + 6, (uint16_t)i);
+            put16(p + 8, (uint16_t)floor);
+            put16(p + 0x0C, (uint16_t)(rng() % 20));
+            putf(p + 0x14, (float)(int)rngf(-500.0f, 500.0f));
+            putf(p + 0x18, 0.0f);
+            putf(p + 0x1C, (float)(int)rngf(-500.0f, 500.0f));
+            put32(p + 0x24, (rng() % 4) * 0x4000);
+
+            if(!(rng() & 3))
+                putf(p + 0x2C, rngf(0.0f, 100.0f));
+        }
+
+        put32(buf + hdr, (uint32_t)type);
+        put32(buf + hdr + 4, (uint32_t)(pos - hdr));
+        put32(buf + hdr + 8, (uint32_t)floor);
+        put32(buf + hdr + 12, (uint32_t)(pos - hdr - 16));
+    }
+
+    memset(buf + pos, 0, 16);
+    return pos + 16;
+}
+
+/* A model from a BML file: a chunk header, vertex positions and normals (the
+   positions wander smoothly, like they would around a mesh), then triangle
+   strips that mostly count up through the vertices. */
+static size_t gen_model(uint8_t *buf, size_t len) {
+    size_t pos = 8, strips;
+    float x = 0.0f, y = 0.0f, z = 0.0f;
+    int i, nverts, base = 0, n;
+
+    nverts = (int)((len * 2 / 3) / 24);
+    memcpy(buf, "NJCM", 4);
+
+    for(i = 0; i < nverts; ++i, pos += 24) {
+        x += rngf(-0.5f, 0.5f);
+        y += rngf(-0.5f, 0.5f);
+        z += rngf(-0.5f, 0.5f);
+        putf(buf + pos, x);
+        putf(buf + pos + 4, y);
+        putf(buf + pos + 8, z);
+        putf(buf + pos + 12, 0.0f);
+        putf(buf + pos + 16, (rng() & 1) ? 1.0f : -1.0f);
+        putf(buf + pos + 20, 0.0f);
+    }
+
+    strips = pos;
+
+    while(pos + 8 < len) {
+        n = 3 + (int)(rng() % 16);
+        put16(buf + pos, (uint16_t)n);
+        pos += 2;
+
+        for(i = 0; i < n && pos + 2 <= len; ++i, pos += 2) {
+            if(rng() % 8)
+                put16(buf + pos, (uint16_t)((base + i) % nverts));
+            else
+                put16(buf + pos, (uint16_t)(rng() % nverts));
+        }
+
+        base += n - 2;
+    }
+
+    put32(buf + 4, (uint32_t)(pos - 8));
+    (void)strips;
+    return pos;
+}
+
+/* A PVM with a couple of RGB565 textures: smooth gradients with a bit of
+   noise, each followed by its mipmaps. */
+static size_t gen_pvm(uint8_t *buf, size_t len) {
+    size_t pos = 0x40;
+    int t, x, y, dim, r, g, b;
+
+    memset(buf, 0, pos);
+    memcpy(buf, "PVMH", 4);
+    put32(buf + 4, 0x38);
+    put16(buf + 10, 2);
+
+    for(t = 0; t < 2; ++t) {
+        memcpy(buf + pos, "PVRT", 4);
+        put32(buf + pos + 4, 0);
+        buf[pos + 8] = 0x01;
+        buf[pos + 9] = 0x03;
+        put16(buf + pos + 12, 256);
+        put16(buf + pos + 14, 256);
+        pos += 16;
+
+        for(dim = 256; dim && pos + dim * dim * 2 <= len; dim >>= 1) {
+            for(y = 0; y < dim; ++y) {
+                for(x = 0; x < dim; ++x, pos += 2) {
+                    r = (x * 32 / dim + (int)(rng() % 3)) & 0x1F;
+                    g = ((y * 64 / dim) ^ (t * 16)) & 0x3F;
+                    b = ((x + y) * 16 / dim + (int)(rng() & 1)) & 0x1F;
+                    put16(buf + pos, (uint16_t)((r << 11) | (g << 5) | b));
+                }
+            }
+        }
+    }
+
+    return pos;
+}
+
+static int add_file(bench_file_t *files, int *count, const char *name,
+                    uint8_t *data, size_t len) {
+    if(*count >= MAX_FILES) {
+        fprintf(stderr, "Too many files (at most %d)\n", MAX_FILES);
+        free(data);
+        return -1;
+    }
+
+    snprintf(files[*count].name, sizeof(files[*count].name), "%s", name);
+    files[*count].data = data;
+    files[*count].len = len;
+    ++*count;
+    return 0;
+}
+
+static int gen_corpus(bench_file_t *files, int *count) {
+    static const struct {
+        const char *name;
+        size_t (*gen)(uint8_t *buf, size_t len);
+        size_t len;
+    } gens[] = {
+        { "ItemPMT.bin",  gen_itempmt,   160 * 1024 },
+        { "quest.bin",    gen_quest_bin,  48 * 1024 },
+        { "quest.dat",    gen_quest_dat,  64 * 1024 },
+        { "model.nj",     gen_model,     128 * 1024 },
+        { "texture.pvm",  gen_pvm,       320 * 1024 },
+        { NULL,           NULL,                   0 }
+    };
+    uint8_t *buf;
+    int i;
+
+    for(i = 0; gens[i].name; ++i) {
+        if(!(buf = (uint8_t *)malloc(gens[i].len))) {
+            perror("Cannot generate corpus");
+            return -1;
+        }
+
+        memset(buf, 0, gens[i].len);
+
+        if(add_file(files, count, gens[i].name, buf,
+                    gens[i].gen(buf, gens[i].len)))
+            return -1;
+    }
+
+    return 0;
+}
+
+static int load_file(bench_file_t *files, int *count, const char *fn) {
+    FILE *fp;
+    uint8_t *buf, *dec;
+    long len;
+    size_t l = strlen(fn);
+    const char *base;
+    int rv;
+
+    if(!(fp = fopen(fn, "rb"))) {
+        perror(fn);
+        return -1;
+    }
+
+    if(fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 ||
+       fseek(fp, 0, SEEK_SET)) {
+        perror(fn);
+        fclose(fp);
+        return -1;
+    }
+
+    if(!(buf = (uint8_t *)malloc(len ? (size_t)len : 1))) {
+        perror(fn);
+        fclose(fp);
+        return -1;
+    }
+
+    if(fread(buf, 1, (size_t)len, fp) != (size_t)len) {
+        perror(fn);
+        free(buf);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+
+    if(l > 4 && !strcmp(fn + l - 4, ".prs")) {
+        if((rv = prs_decompress_buf(buf, &dec, (size_t)len)) < 0) {
+            fprintf(stderr, "%s: cannot decompress: %s\n", fn, strerror(-rv));
+            free(buf);
+            return -1;
+        }
+
+        free(buf);
+        buf = dec;
+        len = rv;
+    }
+
+    base = strrchr(fn, '/');
+    return add_file(files, count, base ? base + 1 : fn, buf, (size_t)len);
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Run one mode on one file: once to check the output (and count allocations),
+   then enough times to time it. */
+static int run_one(bench_state_t *s, bench_mode_t *m, const bench_file_t *f,
+                   int runs, int verbose) {
+    const uint8_t *out;
+    long long start, t, best, spent;
+    long long live = alloc_live;
+    int rv, i, n, iters = 1;
+    size_t olen;
+
+    alloc_reset();
+    rv = m->func(s, f, &out);
+    m->allocs += alloc_count;
+
+    if(alloc_peak - live > m->peak)
+        m->peak = alloc_peak - live;
+
+    if(rv < 0) {
+        fprintf(stderr, "%s: %s failed: %s\n", f->name, m->name,
+                strerror(-rv));
+        return -1;
+    }
+
+    olen = (size_t)rv;
+
+    /* Check the result. Compressed output has to come back out through
+       prs_decompress_buf2 as exactly what went in, and decompressed output has
+       to match the original. */
+    if(!m->decomp) {
+        if((rv = prs_decompress_buf2(out, s->out, olen, s->out_len)) < 0) {
+            fprintf(stderr, "%s: %s output doesn't decompress: %s\n",
+                    f->name, m->name, strerror(-rv));
+            return -1;
+        }
+
+        if((size_t)rv != f->len || memcmp(s->out, f->data, f->len)) {
+            fprintf(stderr, "%s: %s output doesn't round-trip\n", f->name,
+                    m->name);
+            return -1;
+        }
+    }
+    else if(olen != f->len || memcmp(out, f->data, f->len)) {
+        fprintf(stderr, "%s: %s output doesn't match\n", f->name, m->name);
+        return -1;
+    }
+
+    ++m->calls;
+
+    /* Figure out how many calls it takes to fill up a round, then take the
+       fastest of the rounds. The last calibration round counts as one of them,
+       and really slow modes stop early once they've had a few seconds. */
+    for(;;) {
+        start = now_ns();
+
+        for(n = 0; n < iters; ++n)
+            m->func(s, f, &out);
+
+        t = now_ns() - start;
+
+        if(t >= ROUND_NS / 2 || iters >= 1 << 20)
+            break;
+
+        iters *= t ? (int)(ROUND_NS / t) + 1 : 16;
+    }
+
+    best = spent = t;
+
+    for(i = 1; i < runs && spent < ROUND_NS * 100; ++i) {
+        start = now_ns();
+
+        for(n = 0; n < iters; ++n)
+            m->func(s, f, &out);
+
+        t = now_ns() - start;
+        spent += t;
+
+        if(t < best)
+            best = t;
+    }
+
+    best /= iters;
+    m->ns += best;
+    m->in_bytes += m->decomp ? f->comp_len : f->len;
+    m->out_bytes += m->decomp ? f->len : olen;
+
+    if(verbose)
+        printf("  %-8s %-16s %10.2f MB/s %8zu -> %8zu\n", m->name, f->name,
+               f->len / (best / 1000.0), m->decomp ? f->comp_len : f->len,
+               m->decomp ? f->len : olen);
+
+    return 0;
+}
+
+/* Speed of a mode, in MB/s of uncompressed data. */
+static double mode_mbps(const bench_mode_t *m) {
+    size_t bytes = m->decomp ? m->out_bytes : m->in_bytes;
+
+    return m->ns ? bytes / (m->ns / 1000.0) : 0.0;
+}
+
+/* Compare against a baseline from an earlier run. Returns the number of modes
+   that got slower by more than the threshold, or -1 if there's no baseline. */
+static int check_baseline(const char *fn, double threshold) {
+    FILE *fp;
+    char name[32];
+    double base, cur;
+    int i, bad = 0;
+
+    if(!(fp = fopen(fn, "r")))
+        return -1;
+
+    while(fscanf(fp, "%31s %lf", name, &base) == 2) {
+        for(i = 0; modes[i].name; ++i) {
+            if(strcmp(modes[i].name, name))
+                continue;
+
+            cur = mode_mbps(&modes[i]);
+
+            if(cur < base / (1.0 + threshold / 100.0)) {
+                printf("%s: %.2f MB/s, down from %.2f MB/s (%.1f%% slower)\n",
+                       name, cur, base, (1.0 - cur / base) * 100.0);
+                ++bad;
+            }
+        }
+    }
+
+    fclose(fp);
+    return bad;
+}
+
+static int write_baseline(const char *fn) {
+    FILE *fp;
+    int i;
+
+    if(!(fp = fopen(fn, "w"))) {
+        perror(fn);
+        return -1;
+    }
+
+    for(i = 0; modes[i].name; ++i)
+        fprintf(fp, "%s %.2f\n", modes[i].name, mode_mbps(&modes[i]));
+
+    fclose(fp);
+    return 0;
+}
+
+static void print_help(const char *bin) {
+    printf("Usage: %s [options] [file ...]\n"
+           "Options:\n"
+           " -b file   Compare against the baseline in file, creating it if\n"
+           "           it doesn't exist yet.\n"
+           " -k name   Use the named kernel (scalar, sse4.2, avx2 or neon)\n"
+           "           instead of the one picked for this CPU.\n"
+           " -u        Update the baseline file with the results of this run.\n"
+           " -t pct    Fail if any mode is more than pct percent slower than\n"
+           "           the baseline (default 10).\n"
+           " -r runs   Time each mode this many times, keeping the fastest\n"
+           "           (default 5).\n"
+           " -v        Show results for each file.\n"
+           "If no files are given, a generated set of files is used instead.\n"
+           "Files ending in .prs are decompressed before use.\n", bin);
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[]) {
+    bench_file_t files[MAX_FILES];
+    bench_state_t s;
+    const char *baseline = NULL;
+    double threshold = 10.0;
+    int count = 0, runs = 5, verbose = 0, update = 0, i, j, rv;
+    int ret = EXIT_FAILURE;
+    size_t total = 0, max_len = 0;
+    struct rusage ru;
+
+    memset(&s, 0, sizeof(s));
+    memset(files, 0, sizeof(files));
+
+    for(i = 1; i < argc; ++i) {
+        if(!strcmp(argv[i], "-b") && i + 1 < argc) {
+            baseline = argv[++i];
+        }
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "-r") && i + 1 < argc) {
+            if((runs = atoi(argv[++i])) < 1)
+                runs = 1;
+        }
+        else if(!strcmp(argv[i], "-k") && i + 1 < argc) {
+            if((rv = prs_set_kernel(argv[++i]))) {
+                fprintf(stderr, "Cannot use kernel %s: %s\n", argv[i],
+                        strerror(-rv));
+                goto out;
+            }
+        }
+        else if(!strcmp(argv[i], "-u")) {
+            update = 1;
+        }
+        else if(!strcmp(argv[i], "-v")) {
+            verbose = 1;
+        }
+        else if(argv[i][0] == '-') {
+            print_help(argv[0]);
+            return EXIT_FAILURE;
+        }
+        else if(load_file(files, &count, argv[i])) {
+            goto out;
+        }
+    }
+
+    if(!count && gen_corpus(files, &count))
+        goto out;
+
+    for(i = 0; i < count; ++i) {
+        total += files[i].len;
+
+        if(files[i].len > max_len)
+            max_len = files[i].len;
+
+        if((rv = prs_compress(files[i].data, &files[i].comp,
+                              files[i].len)) < 0) {
+            fprintf(stderr, "%s: cannot compress: %s\n", files[i].name,
+                    strerror(-rv));
+            count = i;
+            goto out;
+        }
+
+        files[i].comp_len = (size_t)rv;
+    }
+
+    for(i = 0; i < BENCH_BLOCKS; ++i) {
+        if(!(s.ctx[i] = prs_comp_ctx_new())) {
+            perror("Cannot create compression context");
+            goto out;
+        }
+    }
+
+    s.scratch_len = prs_max_compressed_size(max_len) + 1;
+    s.out_len = max_len + 1;
+
+    if(!(s.dec = prs_dec_new()) ||
+       !(s.scratch = (uint8_t *)malloc(s.scratch_len)) ||
+       !(s.out = (uint8_t *)malloc(s.out_len))) {
+        perror("Cannot allocate memory");
+        goto out;
+    }
+
+    printf("Corpus: %d files, %zu bytes\n", count, total);
+    printf("Kernel: %s\n", prs_kernel_name());
+    printf("%-8s %10s %8s %12s %10s\n", "mode", "MB/s", "ratio",
+           "allocs/call", "peak KiB");
+
+    for(i = 0; modes[i].name; ++i) {
+        for(j = 0; j < count; ++j) {
+            if(run_one(&s, &modes[i], &files[j], runs, verbose))
+                goto out;
+        }
+
+        printf("%-8s %10.2f %8.4f ", modes[i].name, mode_mbps(&modes[i]),
+               modes[i].decomp ?
+               (double)modes[i].in_bytes / modes[i].out_bytes :
+               (double)modes[i].out_bytes / modes[i].in_bytes);
+#ifdef PRS_BENCH_WRAP
+        printf("%12.1f %10lld\n", (double)modes[i].allocs / modes[i].calls,
+               (modes[i].peak + 1023) / 1024);
+#else
+        printf("%12s %10s\n", "-", "-");
+#endif
+        fflush(stdout);
+    }
+
+    if(!getrusage(RUSAGE_SELF, &ru))
+        printf("Peak RSS: %ld KiB\n", ru.ru_maxrss);
+
+    ret = EXIT_SUCCESS;
+
+    if(baseline) {
+        if(!update && (rv = check_baseline(baseline, threshold)) >= 0) {
+            if(rv) {
+                printf("%d mode(s) slower than %s by more than %.1f%%\n", rv,
+                       baseline, threshold);
+                ret = EXIT_FAILURE;
+            }
+        }
+        else if(write_baseline(baseline)) {
+            ret = EXIT_FAILURE;
+        }
+        else {
+            printf("Wrote baseline to %s\n", baseline);
+        }
+    }
+
+out:
+    for(i = 0; i < count; ++i) {
+        free(files[i].data);
+        free(files[i].comp);
+    }
+
+    for(i = 0; i < BENCH_BLOCKS; ++i)
+        prs_comp_ctx_free(s.ctx[i]);
+
+    prs_dec_free(s.dec);
+    prs_arena_free(&s.arena);
+    free(s.owned);
+    free(s.scratch);
+    free(s.out);
+
+    return ret;
+}
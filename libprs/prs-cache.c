@@ -0,0 +1,509 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/******************************************************************************
+    PRS Compression Cache
+
+    Each entry is its own file, named for its key and kept in one of 256
+    subdirectories of the cache directory (by the first byte of the hash), so
+    that no one directory gets too big. Entries are written to a temporary
+    file and renamed into place, so two programs filling the same cache at once
+    won't step on each other. The modification time of each entry is bumped
+    whenever it is used, which is what the least-recently-used eviction at exit
+    goes by.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#include <io.h>
+#include <sys/utime.h>
+
+/* In windows_compat.c */
+int mkstemp(char *tmpl);
+int my_rename(const char *old, const char *new);
+#define rename my_rename
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+#include "prs-cache.h"
+
+#define CACHE_MAGIC         0x43535250      /* "PRSC" */
+#define CACHE_HDR_SIZE      16
+#define DEFAULT_CACHE_SIZE  256             /* MiB */
+
+/* dir + "/xx/" + 16 hex digits of hash + "-" + 8 of length + "-" + 8 of mode +
+   ".XXXXXX" for temporary files. */
+#define CACHE_NAME_LEN      48
+
+#ifdef _WIN32
+#define CACHE_INC(x)        InterlockedIncrement(&(x))
+typedef LONG cache_counter_t;
+#else
+#define CACHE_INC(x)        __sync_fetch_and_add(&(x), 1)
+typedef unsigned long cache_counter_t;
+#endif
+
+static char *cache_dir = NULL;
+static uint64_t cache_max;
+static cache_counter_t cache_hits, cache_misses, cache_stores;
+
+/* The hash is XXH64, which goes through about as fast as the data can be read
+   and is plenty good enough at telling apart files that aren't the same. */
+#define PRIME64_1   0x9E3779B185EBCA87ULL
+#define PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3   0x165667B19E3779F9ULL
+#define PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define PRIME64_5   0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r)    (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t get64(const uint8_t *b) {
+    return (uint64_t)b[0] | ((uint64_t)b[1] << 8) | ((uint64_t)b[2] << 16) |
+        ((uint64_t)b[3] << 24) | ((uint64_t)b[4] << 32) |
+        ((uint64_t)b[5] << 40) | ((uint64_t)b[6] << 48) |
+        ((uint64_t)b[7] << 56);
+}
+
+static uint32_t get32(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static void put32(uint8_t *b, uint32_t v) {
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+    b[2] = (uint8_t)(v >> 16);
+    b[3] = (uint8_t)(v >> 24);
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t in) {
+    acc += in * PRIME64_2;
+    acc = ROTL64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t prs_xxh64(const uint8_t *p, size_t len, uint64_t seed) {
+    const uint8_t *end = p + len;
+    uint64_t h, v1, v2, v3, v4;
+
+    if(len >= 32) {
+        v1 = seed + PRIME64_1 + PRIME64_2;
+        v2 = seed + PRIME64_2;
+        v3 = seed;
+        v4 = seed - PRIME64_1;
+
+        do {
+            v1 = xxh_round(v1, get64(p));
+            v2 = xxh_round(v2, get64(p + 8));
+            v3 = xxh_round(v3, get64(p + 16));
+            v4 = xxh_round(v4, get64(p + 24));
+            p += 32;
+        } while(p <= end - 32);
+
+        h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    }
+    else {
+        h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    for(; p + 8 <= end; p += 8) {
+        h ^= xxh_round(0, get64(p));
+        h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+
+    if(p + 4 <= end) {
+        h ^= (uint64_t)get32(p) * PRIME64_1;
+        h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    for(; p < end; ++p) {
+        h ^= (*p) * PRIME64_5;
+        h = ROTL64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+static void cache_path(char *buf, const struct prs_cache_key *key) {
+    sprintf(buf, "%s/%02x/%08lx%08lx-%08lx-%08lx", cache_dir,
+            (unsigned int)(key->hash >> 56),
+            (unsigned long)(key->hash >> 32),
+            (unsigned long)(key->hash & 0xFFFFFFFF),
+            (unsigned long)key->len, (unsigned long)key->mode);
+}
+
+static int make_dir(const char *path) {
+#ifdef _WIN32
+    if(_mkdir(path) && errno != EEXIST)
+#else
+    if(mkdir(path, 0777) && errno != EEXIST)
+#endif
+        return -1;
+
+    return 0;
+}
+
+/* One entry, for figuring out what to throw out. */
+struct cache_ent {
+    char *path;
+    time_t mtime;
+    uint64_t size;
+};
+
+static int ent_cmp(const void *a, const void *b) {
+    const struct cache_ent *e1 = (const struct cache_ent *)a;
+    const struct cache_ent *e2 = (const struct cache_ent *)b;
+
+    if(e1->mtime != e2->mtime)
+        return e1->mtime < e2->mtime ? -1 : 1;
+
+    return 0;
+}
+
+static int add_ent(struct cache_ent **ents, size_t *count, size_t *alloc,
+                   const char *dir, const char *name) {
+    struct cache_ent *tmp;
+    struct stat st;
+    char *path;
+
+    /* Skip anything that isn't one of ours (including a temporary file that is
+       still being written by someone else). */
+    if(strlen(name) != 34 || name[16] != '-' || name[25] != '-')
+        return 0;
+
+    if(!(path = (char *)malloc(strlen(dir) + strlen(name) + 2)))
+        return -1;
+
+    sprintf(path, "%s/%s", dir, name);
+
+    if(stat(path, &st)) {
+        free(path);
+        return 0;
+    }
+
+    if(*count == *alloc) {
+        if(!(tmp = (struct cache_ent *)realloc(*ents, (*alloc + 256) *
+                                               sizeof(struct cache_ent)))) {
+            free(path);
+            return -1;
+        }
+
+        *ents = tmp;
+        *alloc += 256;
+    }
+
+    (*ents)[*count].path = path;
+    (*ents)[*count].mtime = st.st_mtime;
+    (*ents)[*count].size = (uint64_t)st.st_size;
+    ++*count;
+    return 0;
+}
+
+/* Add everything in one of the subdirectories to the list. */
+static int scan_dir(struct cache_ent **ents, size_t *count, size_t *alloc,
+                    const char *dir) {
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h;
+    char pat[MAX_PATH];
+    int rv = 0;
+
+    sprintf(pat, "%s/*", dir);
+
+    if((h = FindFirstFileA(pat, &fd)) == INVALID_HANDLE_VALUE)
+        return 0;
+
+    do {
+        if((rv = add_ent(ents, count, alloc, dir, fd.cFileName)))
+            break;
+    } while(FindNextFileA(h, &fd));
+
+    FindClose(h);
+    return rv;
+#else
+    DIR *d;
+    struct dirent *de;
+    int rv = 0;
+
+    if(!(d = opendir(dir)))
+        return 0;
+
+    while((de = readdir(d))) {
+        if((rv = add_ent(ents, count, alloc, dir, de->d_name)))
+            break;
+    }
+
+    closedir(d);
+    return rv;
+#endif
+}
+
+/* Throw out the least recently used entries until the whole thing fits in the
+   size limit again. */
+static unsigned long cache_evict(void) {
+    struct cache_ent *ents = NULL;
+    size_t count = 0, alloc = 0, i;
+    uint64_t total = 0;
+    unsigned long evicted = 0;
+    char *dir;
+    int j;
+
+    if(!(dir = (char *)malloc(strlen(cache_dir) + 4)))
+        return 0;
+
+    for(j = 0; j < 256; ++j) {
+        sprintf(dir, "%s/%02x", cache_dir, j);
+
+        if(scan_dir(&ents, &count, &alloc, dir))
+            break;
+    }
+
+    free(dir);
+
+    for(i = 0; i < count; ++i)
+        total += ents[i].size;
+
+    if(total > cache_max) {
+        qsort(ents, count, sizeof(struct cache_ent), &ent_cmp);
+
+        for(i = 0; i < count && total > cache_max; ++i) {
+            if(!unlink(ents[i].path)) {
+                total -= ents[i].size;
+                ++evicted;
+            }
+        }
+    }
+
+    for(i = 0; i < count; ++i)
+        free(ents[i].path);
+
+    free(ents);
+    return evicted;
+}
+
+static void cache_exit(void) {
+    unsigned long evicted = cache_evict();
+
+    /* This goes to stderr, so it doesn't get mixed in with anything a tool
+       is printing to stdout. */
+    fprintf(stderr, "PRS cache: %lu hits, %lu misses, %lu stored, "
+            "%lu evicted\n", (unsigned long)cache_hits,
+            (unsigned long)cache_misses, (unsigned long)cache_stores,
+            evicted);
+
+    free(cache_dir);
+    cache_dir = NULL;
+}
+
+/******************************************************************************
+    Public API
+ ******************************************************************************/
+
+int prs_cache_init(void) {
+    const char *dir, *size;
+    char *sub;
+    int i;
+
+    if(cache_dir)
+        return 1;
+
+    if(!(dir = getenv("PRS_CACHE_DIR")) || !*dir)
+        return 0;
+
+    cache_max = DEFAULT_CACHE_SIZE;
+
+    if((size = getenv("PRS_CACHE_SIZE")) && *size)
+        cache_max = strtoul(size, NULL, 0);
+
+    cache_max <<= 20;
+
+    if(!(cache_dir = strdup(dir)) ||
+       !(sub = (char *)malloc(strlen(dir) + 4))) {
+        free(cache_dir);
+        cache_dir = NULL;
+        return 0;
+    }
+
+    /* Make sure everything is there up front, so that nothing later on has to
+       worry about it. */
+    if(make_dir(cache_dir)) {
+        fprintf(stderr, "Cannot create cache directory %s: %s\n", cache_dir,
+                strerror(errno));
+        goto err;
+    }
+
+    for(i = 0; i < 256; ++i) {
+        sprintf(sub, "%s/%02x", cache_dir, i);
+
+        if(make_dir(sub)) {
+            fprintf(stderr, "Cannot create cache directory %s: %s\n", sub,
+                    strerror(errno));
+            goto err;
+        }
+    }
+
+    free(sub);
+    atexit(&cache_exit);
+    return 1;
+
+err:
+    free(sub);
+    free(cache_dir);
+    cache_dir = NULL;
+    return 0;
+}
+
+void prs_cache_key(struct prs_cache_key *key, const uint8_t *src, size_t len,
+                   uint32_t mode) {
+    key->hash = prs_xxh64(src, len, PRS_CACHE_VERSION);
+    key->len = (uint32_t)len;
+    key->mode = mode;
+}
+
+int prs_cache_get(const struct prs_cache_key *key, uint8_t *dst,
+                  size_t dst_len) {
+    char *path;
+    uint8_t hdr[CACHE_HDR_SIZE];
+    FILE *fp;
+    uint32_t len;
+    int rv = -1;
+
+    if(!cache_dir)
+        return -1;
+
+    if(!(path = (char *)malloc(strlen(cache_dir) + CACHE_NAME_LEN)))
+        goto out;
+
+    cache_path(path, key);
+
+    if(!(fp = fopen(path, "rb")))
+        goto out;
+
+    /* Make sure it's really what we were looking for. */
+    if(fread(hdr, 1, CACHE_HDR_SIZE, fp) != CACHE_HDR_SIZE ||
+       get32(hdr) != CACHE_MAGIC || get32(hdr + 4) != PRS_CACHE_VERSION ||
+       get32(hdr + 8) != key->len || (len = get32(hdr + 12)) > dst_len ||
+       len > 0x7FFFFFFF || fread(dst, 1, len, fp) != len) {
+        fclose(fp);
+        goto out;
+    }
+
+    fclose(fp);
+
+    /* Mark it as recently used. */
+    utime(path, NULL);
+    rv = (int)len;
+
+out:
+    free(path);
+
+    if(rv < 0)
+        CACHE_INC(cache_misses);
+    else
+        CACHE_INC(cache_hits);
+
+    return rv;
+}
+
+void prs_cache_put(const struct prs_cache_key *key, const uint8_t *src,
+                   size_t len) {
+    char *path, *tmp;
+    uint8_t hdr[CACHE_HDR_SIZE];
+    FILE *fp = NULL;
+    int fd;
+
+    if(!cache_dir || len > 0x7FFFFFFF)
+        return;
+
+    /* The temporary name is the real one with ".XXXXXX" on the end, so it
+       gets a buffer of its own. */
+    if(!(path = (char *)malloc(strlen(cache_dir) + CACHE_NAME_LEN)))
+        return;
+
+    if(!(tmp = (char *)malloc(strlen(cache_dir) + CACHE_NAME_LEN))) {
+        free(path);
+        return;
+    }
+
+    cache_path(path, key);
+    sprintf(tmp, "%s.XXXXXX", path);
+
+    if((fd = mkstemp(tmp)) < 0 || !(fp = fdopen(fd, "wb"))) {
+        if(fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+
+        goto out;
+    }
+
+    put32(hdr, CACHE_MAGIC);
+    put32(hdr + 4, PRS_CACHE_VERSION);
+    put32(hdr + 8, key->len);
+    put32(hdr + 12, (uint32_t)len);
+
+    if(fwrite(hdr, 1, CACHE_HDR_SIZE, fp) != CACHE_HDR_SIZE ||
+       fwrite(src, 1, len, fp) != len) {
+        fclose(fp);
+        unlink(tmp);
+        goto out;
+    }
+
+    /* If this didn't work out for whatever reason, someone else will just
+       have to compress it again. */
+    if(fclose(fp) || rename(tmp, path))
+        unlink(tmp);
+    else
+        CACHE_INC(cache_stores);
+
+out:
+    free(tmp);
+    free(path);
+}
@@ -0,0 +1,92 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYLVERANT__PRS_CACHE_H
+#define SYLVERANT__PRS_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "prs.h"
+
+/* On-disk cache of compressed data, so that packing the same files over and
+   over again doesn't mean compressing them over and over again.
+
+   The cache is off unless the PRS_CACHE_DIR environment variable names a
+   directory to keep it in. PRS_CACHE_SIZE sets how big it is allowed to get,
+   in MiB (256 by default). When it grows past that, the files that were used
+   least recently are thrown out.
+
+   Entries are looked up by a hash of the uncompressed data, its length, the
+   compression mode and PRS_CACHE_VERSION. Bump PRS_CACHE_VERSION whenever
+   the output of the compressor changes, so that old entries don't get used.
+*/
+#define PRS_CACHE_VERSION       2
+
+/* Compression modes, for the mode part of the key. */
+#define PRS_CACHE_MODE_NORMAL   0   /* prs_compress and friends */
+#define PRS_CACHE_MODE_OPTIMAL  1   /* prs_compress_optimal */
+
+/* The mode for prs_compress_level at level l. The two levels above keep their
+   old modes, so that entries made before there were levels still get used. */
+#define PRS_CACHE_MODE_LEVEL(l) \
+    ((l) == PRS_LEVEL_DEFAULT ? PRS_CACHE_MODE_NORMAL : \
+     (l) == PRS_LEVEL_MAX ? PRS_CACHE_MODE_OPTIMAL : 0x100 | (uint32_t)(l))
+
+struct prs_cache_key {
+    uint64_t hash;
+    uint32_t len;
+    uint32_t mode;
+};
+
+/* Set up the cache from the environment.
+
+   If the cache is to be used, this arranges for it to be trimmed down to size
+   and for the hit and miss counts to be printed when the program exits. It
+   is safe to call more than once. Nothing here is thread-safe, so call it
+   before starting any threads that will use the cache.
+
+   Returns 1 if the cache is enabled, 0 otherwise.
+*/
+extern int prs_cache_init(void);
+
+/* Fill in the key for a buffer of uncompressed data. */
+extern void prs_cache_key(struct prs_cache_key *key, const uint8_t *src,
+                          size_t len, uint32_t mode);
+
+/* Look up compressed data in the cache.
+
+   If there's an entry for key that fits in dst_len bytes, it is read into dst.
+   This (and prs_cache_put) can be called from any number of threads at once.
+
+   Returns the size of the compressed data on a hit, or -1 on a miss (or if
+   the cache isn't enabled).
+*/
+extern int prs_cache_get(const struct prs_cache_key *key, uint8_t *dst,
+                         size_t dst_len);
+
+/* Store compressed data in the cache. Failures are silently ignored, since
+   the cache is only ever an optimization. */
+extern void prs_cache_put(const struct prs_cache_key *key, const uint8_t *src,
+                          size_t len);
+
+/* XXH64 of a buffer. This is what the keys are made from, but it is handy
+   anywhere else a fast hash of some data is wanted, too. */
+extern uint64_t prs_xxh64(const uint8_t *src, size_t len, uint64_t seed);
+
+#endif /* !SYLVERANT__PRS_CACHE_H */
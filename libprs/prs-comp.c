@@ -0,0 +1,1443 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/******************************************************************************
+    PRS Compression Library
+
+    PRS Compression, as used by Sega in many games (including all of the PSO
+    games), is basically just a normal implementation of the Lempel-Ziv '77
+    (LZ77) sliding-window compression algorithm. LZ77 is the basis of many other
+    compression algorithms, including the very popular DEFLATE algorithm (from
+    gzip and zlib). The code in here actually takes a number of cues from
+    DEFLATE and specifically from zlib.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "prs.h"
+#include "prs-kernel.h"
+
+#define MAX_WINDOW   0x2000
+#define WINDOW_MASK  (MAX_WINDOW - 1)
+
+/* The longest copy that can come from the very edge of the window. An offset
+   of -8192 with a length byte would encode the same as the end-of-file marker,
+   so copies from there can only use the two byte form. */
+#define EDGE_MATCH   9
+
+/* Longest string we'll ever get to copy in one go, and the furthest back a
+   short copy can reach. */
+#define MAX_MATCH    256
+#define SHORT_WINDOW 256
+
+/* Strings of three or more bytes are found through a real hash table with
+   chains through the window. Two byte strings can only ever be used as short
+   copies, so they get looked up directly in a table indexed by the two bytes
+   themselves, which only needs to remember the last place it saw each. */
+#define HASH_BITS    15
+#define HASH_SIZE    (1 << HASH_BITS)
+#define HASH3(s)     ((((uint32_t)(s)[0] << 16) | ((uint32_t)(s)[1] << 8) | \
+                       (uint32_t)(s)[2]) * 0x9E3779B1U >> (32 - HASH_BITS))
+#define HASH2(s)     ((uint32_t)(s)[0] | ((uint32_t)(s)[1] << 8))
+#define HASH2_SIZE   (1 << 16)
+
+/* What each compression level does. max_chain is how many entries of a hash
+   chain to look at before giving up: stopping well short of the whole window
+   is what keeps the greedy compressor from going quadratic on long runs of
+   similar records. nice_len is how long a match has to be to stop looking for
+   a longer one. The lazy levels check whether starting a match one byte later
+   would do better, and the optimal levels use the optimal parser instead of
+   picking matches greedily (it is slow anyway, so it can afford to look at
+   nearly everything). Level 0 doesn't compress at all.
+
+   Each greedy level looks at least as far as the one before it. Level 7 looks
+   at the whole window, like prs_compress did before there were levels; the
+   default gives up a tiny bit of that for speed. Level 9 is what
+   prs_compress_optimal has always done. */
+struct prs_level {
+    int max_chain;
+    int nice_len;
+    int lazy;
+    int optimal;
+};
+
+static const struct prs_level levels[PRS_LEVEL_MAX + 1] = {
+    {    0,         0, 0, 0 },
+    {    4,        16, 0, 0 },
+    {   16,        32, 0, 0 },
+    {   64,        64, 0, 0 },
+    {   64,        64, 1, 0 },
+    {  256,       128, 1, 0 },
+    { 1024, MAX_MATCH, 1, 0 },
+    { 8192, MAX_MATCH, 1, 0 },
+    { 1024, MAX_MATCH, 0, 1 },
+    { 4096, MAX_MATCH, 0, 1 }
+};
+
+#define DEFAULT_LEVEL   (&levels[PRS_LEVEL_DEFAULT])
+#define OPTIMAL_LEVEL   (&levels[PRS_LEVEL_MAX])
+
+struct prs_comp_cxt {
+    uint8_t flags;
+
+    int bits_left;
+    const uint8_t *src;
+    uint8_t *dst;
+    uint8_t *flag_ptr;
+
+    size_t src_len;
+    size_t dst_len;
+    size_t src_pos;
+    size_t dst_pos;
+
+#ifdef PRS_STATS
+    struct prs_stats stats;
+#endif
+};
+
+/* Positions in the tables are stored offset by base, which starts out just
+   past MAX_WINDOW. That way a zero entry is always outside of the window and
+   anything can be checked for validity just by looking at its distance. The
+   same trick lets the tables be reused without clearing them: moving base to a
+   full window past top (the end of the last thing hashed) puts every old entry
+   out of reach. */
+struct prs_hash_cxt {
+    uint32_t base;
+    uint32_t top;
+    const struct prs_level *lvl;
+
+    uint32_t hash[HASH_SIZE];
+    uint32_t h_prev[MAX_WINDOW];
+    uint32_t hash2[HASH2_SIZE];
+};
+
+/******************************************************************************
+    Determine the max size of a "compressed" version of a piece of data.
+
+    This function determines the maximum size that a file will be "compressed"
+    to. Note that this value will *always* be greater than the original size of
+    the file. This is used internally to allocate a buffer to start compression
+    into, where the final buffer is resized accordingly.
+
+    The formula for this size is as follows:
+        len + ceil((len + 2) / 8) + 2
+
+    This is derived from the fact that if a file is completely incompressible
+    (no patterns repeat within the window), it will be spat out as a bunch of
+    literals. For every literal spat out by the compressor, one bit of a flag
+    byte is used. At the end of the file, a final two bit pattern is output into
+    the flag byte, as well as two NUL bytes to symbolize the end of the data.
+    Thus, the number of bits in the various flag bytes will be capped at a max
+    of len + 2, leading to ceil((len + 2) / 8) bytes used for flags. The
+    individual data bytes make up the len part of the formula and the two final
+    NUL bytes make up the rest.
+
+    Most of the time, the compressed output will be quite a bit smaller than the
+    value returned here. We just use the maximum value so that we never have to
+    worry about reallocating buffers as we go along.
+ ******************************************************************************/
+size_t prs_max_compressed_size(size_t len) {
+    len += 2;
+    return len + (len >> 3) + ((len & 0x07) ? 1 : 0);
+}
+
+static int set_bit(struct prs_comp_cxt *cxt, int value) {
+    if(!cxt->bits_left--) {
+        if(cxt->dst_pos >= cxt->dst_len)
+            return -ENOSPC;
+
+        /* Write out the flags to their position in the file, and set up the
+           next flag position. */
+        *cxt->flag_ptr = cxt->flags;
+        cxt->flag_ptr = cxt->dst + cxt->dst_pos++;
+        cxt->bits_left = 7;
+    }
+
+    cxt->flags >>= 1;
+    if(value)
+        cxt->flags |= 0x80;
+
+    return 0;
+}
+
+static int write_final_flags(struct prs_comp_cxt *cxt) {
+    cxt->flags >>= cxt->bits_left;
+    *cxt->flag_ptr = cxt->flags;
+
+    return 0;
+}
+
+static int copy_literal(struct prs_comp_cxt *cxt) {
+    if(cxt->dst_pos >= cxt->dst_len)
+        return -ENOSPC;
+
+    if(cxt->src_pos >= cxt->src_len)
+        return -EPERM;
+
+    PRS_STAT(cxt->stats, literals, 1);
+    *(cxt->dst + cxt->dst_pos++) = *(cxt->src + cxt->src_pos++);
+
+    return 0;
+}
+
+static int write_literal(struct prs_comp_cxt *cxt, uint8_t val) {
+    if(cxt->dst_pos >= cxt->dst_len)
+        return -ENOSPC;
+
+    *(cxt->dst + cxt->dst_pos++) = val;
+
+    return 0;
+}
+
+static int write_eof(struct prs_comp_cxt *cxt) {
+    int rv;
+
+    /* Set the last two bits (01) and write the flags to the buffer. */
+    if((rv = set_bit(cxt, 0)))
+        return rv;
+
+    if((rv = set_bit(cxt, 1)))
+        return rv;
+
+    if((rv = write_final_flags(cxt)))
+        return rv;
+
+    /* Write the two NUL bytes that the file must end with. */
+    if((rv = write_literal(cxt, 0)))
+        return rv;
+
+    if((rv = write_literal(cxt, 0)))
+        return rv;
+
+    return 0;
+}
+
+/* Figure out how long the match between the current position and s2 is, up to
+   the longest copy PRS can encode. This gets called for every candidate on
+   every hash chain we look at, which is why it is one of the kernels (see
+   prs-kernel.c) that gets picked for the CPU. */
+static int match_length(struct prs_comp_cxt *cxt, const uint8_t *s2) {
+    size_t left = cxt->src_len - cxt->src_pos;
+
+    return PRS_KERN()->match_len(cxt->src + cxt->src_pos, s2,
+                                 left < MAX_MATCH ? (int)left : MAX_MATCH);
+}
+
+/* The same, for the data dist bytes back, but only as long as a copy from
+   there can actually be. */
+static int copy_length(struct prs_comp_cxt *cxt, int dist) {
+    int mlen = match_length(cxt, cxt->src + cxt->src_pos - dist);
+
+    if(dist == MAX_WINDOW && mlen > EDGE_MATCH)
+        return EDGE_MATCH;
+
+    return mlen;
+}
+
+static void hash_init(struct prs_hash_cxt *hc, const struct prs_level *lvl) {
+    memset(hc, 0, sizeof(struct prs_hash_cxt));
+    hc->base = MAX_WINDOW + 1;
+    hc->top = MAX_WINDOW + 1;
+    hc->lvl = lvl;
+}
+
+/* Get a set of hash tables that have been used before ready to hash len more
+   bytes. This only has to actually clear them out when base would otherwise
+   wrap around, which takes around 4GiB worth of input. */
+static void hash_reuse(struct prs_hash_cxt *hc, const struct prs_level *lvl,
+                       size_t len) {
+    if(len > UINT32_MAX - 2 * MAX_WINDOW ||
+       hc->top > UINT32_MAX - 2 * MAX_WINDOW - len) {
+        hash_init(hc, lvl);
+    }
+    else {
+        hc->base = hc->top + MAX_WINDOW;
+        hc->lvl = lvl;
+    }
+
+    hc->top = hc->base + (uint32_t)len;
+}
+
+/* Add the string at pos to the hash tables. */
+static void add_to_hash(struct prs_comp_cxt *cxt, struct prs_hash_cxt *hc,
+                        size_t pos) {
+    const uint8_t *s = cxt->src + pos;
+    uint32_t cur = hc->base + (uint32_t)pos, h;
+
+    if(pos + 2 < cxt->src_len) {
+        h = HASH3(s);
+        hc->h_prev[cur & WINDOW_MASK] = hc->hash[h];
+        hc->hash[h] = cur;
+    }
+
+    if(pos + 1 < cxt->src_len)
+        hc->hash2[HASH2(s)] = cur;
+}
+
+/* Look for the nearest two byte match, if it's close enough for a short copy.
+   The two byte table is indexed by the bytes themselves, so anything in there
+   that's in range is a real match. Returns the match length (or 0). */
+static int find_short_match(struct prs_comp_cxt *cxt, struct prs_hash_cxt *hc,
+                            int *dist) {
+    const uint8_t *s = cxt->src + cxt->src_pos;
+    uint32_t cur = hc->base + (uint32_t)cxt->src_pos, ent;
+
+    if(cxt->src_pos + 1 >= cxt->src_len)
+        return 0;
+
+    ent = hc->hash2[HASH2(s)];
+
+    if(cur - ent > SHORT_WINDOW)
+        return 0;
+
+    *dist = (int)(cur - ent);
+    return match_length(cxt, s - *dist);
+}
+
+/* Count how a walk down a hash chain ended, if it didn't end because it found
+   what it was looking for. Running out of steps leaves them at -1, and hitting
+   the edge of the window leaves the distance to whatever was past it. */
+#ifdef PRS_STATS
+#define CHAIN_END_STAT(cxt, steps, dist) do {                   \
+        if((steps) < 0)                                         \
+            PRS_STAT((cxt)->stats, chain_limit, 1);             \
+        else if((dist) > MAX_WINDOW)                            \
+            PRS_STAT((cxt)->stats, chain_window, 1);            \
+    } while(0)
+#else
+#define CHAIN_END_STAT(cxt, steps, dist) ((void)0)
+#endif
+
+static int find_longest_match(struct prs_comp_cxt *cxt, struct prs_hash_cxt *hc,
+                              int *pos, int lazy) {
+    const uint8_t *s = cxt->src + cxt->src_pos;
+    uint32_t cur = hc->base + (uint32_t)cxt->src_pos, ent, next;
+    size_t left = cxt->src_len - cxt->src_pos;
+    int mlen, longest, dist, steps = hc->lvl->max_chain;
+    int nice = hc->lvl->nice_len, run = 0, stop = nice;
+
+    if(cxt->src_pos >= cxt->src_len)
+        return 0;
+
+    /* Start with the nearest two byte match, since that will beat anything
+       further away that is the same length. */
+    if((longest = find_short_match(cxt, hc, &dist)))
+        *pos = -dist;
+
+    if(left <= 2 || longest >= nice || (size_t)longest >= left)
+        goto out;
+
+    /* Runs of the same byte (like all the zeroes in quest .dat records) make
+       for really long chains, since every spot in every run is on the same
+       one. Anything that matches past the end of our run has to end its own
+       run in the same place though, so it has the same three bytes where our
+       run ends, at the same distance. That chain only has one spot for each
+       run that ends the same way, so look there instead. */
+    if(s[0] == s[1] && s[0] == s[2]) {
+        run = 1 + PRS_KERN()->match_len(s + 1, s, left < MAX_MATCH ?
+                                        (int)left - 1 : MAX_MATCH - 1);
+
+        if((size_t)run < left && run < nice) {
+            ent = hc->hash[HASH3(s + run - 2)];
+            PRS_STAT(cxt->stats, searches, 1);
+
+            while(steps-- > 0 && ent - hc->base >= (uint32_t)(run - 2) &&
+                  (dist = (int)(cur - ent) + run - 2) <= MAX_WINDOW) {
+                PRS_STAT(cxt->stats, chain_steps, 1);
+
+                if(s[longest - dist] == s[longest] &&
+                   (mlen = copy_length(cxt, dist)) > longest &&
+                   mlen > run) {
+                    longest = mlen;
+                    *pos = -dist;
+
+                    if(mlen >= nice || (size_t)mlen >= left)
+                        break;
+                }
+
+                if((next = hc->h_prev[ent & WINDOW_MASK]) >= ent)
+                    break;
+
+                ent = next;
+            }
+
+            /* Nothing on the other chain can do any better than that. If we
+               didn't find anything, the best it can do is the rest of our
+               run (from a longer run), so stop as soon as we find that. */
+            if(longest > run)
+                goto out;
+
+            stop = run;
+        }
+    }
+
+    /* Follow the chain of three byte matches, nearest first, out to the very
+       edge of the window (where copies can't be as long). */
+    ent = hc->hash[HASH3(s)];
+    PRS_STAT(cxt->stats, searches, 1);
+
+    while(steps-- > 0 && (dist = (int)(cur - ent)) <= MAX_WINDOW) {
+        PRS_STAT(cxt->stats, chain_steps, 1);
+
+        /* Anything that doesn't match at the byte just past the longest match
+           so far can't be any longer, so don't bother with the rest of it. */
+        if(longest >= 3 && s[longest - dist] != s[longest])
+            goto skip;
+
+        /* Hash collisions (and two byte matches out of range of a short copy)
+           are of no use here. */
+        mlen = copy_length(cxt, dist);
+
+        if(mlen >= 3 && mlen > longest) {
+            longest = mlen;
+            *pos = -dist;
+
+            /* Nothing further away can do any better than this (or at least,
+               not enough better to be worth looking for). */
+            if(mlen >= stop || (size_t)mlen >= left)
+                break;
+        }
+
+        /* Something that matches part of our run is a shorter run of the same
+           byte. The spot in that run that is as far from its end as we are
+           from the end of ours is the only one that can match past the end,
+           and it starts with the same three bytes, so it's on this chain too.
+           Go straight to it, instead of stepping through everything between
+           (if it is actually there). */
+        if(mlen >= 3 && mlen < run &&
+           ent - hc->base >= (uint32_t)(run - mlen)) {
+            const uint8_t *r = cxt->src + (ent - hc->base) - (run - mlen);
+
+            if(r[0] == s[0] && r[1] == s[0] && r[2] == s[0]) {
+                ent -= run - mlen;
+                continue;
+            }
+        }
+
+skip:
+        /* The previous-entry table is a ring, so make sure we don't wrap
+           around into something newer. */
+        if((next = hc->h_prev[ent & WINDOW_MASK]) >= ent)
+            break;
+
+        ent = next;
+    }
+
+    CHAIN_END_STAT(cxt, steps, dist);
+
+out:
+    /* Add our current string to the hash. */
+    if(!lazy)
+        add_to_hash(cxt, hc, cxt->src_pos);
+
+    return longest;
+}
+
+/* Find every useful match at the current position. Each entry written to lens
+   and dists is the shortest distance at which a match of at least that length
+   is possible, so both arrays are strictly increasing. Returns the number of
+   entries written (at most MAX_MATCH). This always adds the current position
+   to the hash, since the optimal parser looks at every position. */
+static int find_all_matches(struct prs_comp_cxt *cxt, struct prs_hash_cxt *hc,
+                            int lens[], int dists[]) {
+    const uint8_t *s = cxt->src + cxt->src_pos;
+    uint32_t cur = hc->base + (uint32_t)cxt->src_pos, ent, next;
+    size_t left = cxt->src_len - cxt->src_pos;
+    int mlen, longest, dist, cnt = 0, steps = hc->lvl->max_chain;
+
+    if((longest = find_short_match(cxt, hc, &dist)) >= 2) {
+        lens[cnt] = longest;
+        dists[cnt++] = dist;
+    }
+
+    if(left <= 2 || longest >= MAX_MATCH || (size_t)longest >= left)
+        goto out;
+
+    ent = hc->hash[HASH3(s)];
+    PRS_STAT(cxt->stats, searches, 1);
+
+    while(steps-- > 0 && (dist = (int)(cur - ent)) <= MAX_WINDOW) {
+        PRS_STAT(cxt->stats, chain_steps, 1);
+
+        if(longest >= 3 && s[longest - dist] != s[longest])
+            goto skip;
+
+        mlen = copy_length(cxt, dist);
+
+        if(mlen >= 3 && mlen > longest) {
+            lens[cnt] = longest = mlen;
+            dists[cnt++] = dist;
+
+            if(mlen >= MAX_MATCH || (size_t)mlen >= left)
+                break;
+        }
+
+skip:
+        if((next = hc->h_prev[ent & WINDOW_MASK]) >= ent)
+            break;
+
+        ent = next;
+    }
+
+    CHAIN_END_STAT(cxt, steps, dist);
+
+out:
+    add_to_hash(cxt, hc, cxt->src_pos);
+
+    return cnt;
+}
+
+/* Bit cost of copying len bytes from dist bytes back, or 0 if that can't be
+   encoded at all. These are the real sizes of each token in the bitstream:
+   two flag bits, plus the offset/size bits that follow. */
+static int copy_cost(int len, int dist) {
+    if(len >= 2 && len <= 5 && dist <= 256)
+        return 4 + 8;
+    else if(len >= 3 && len <= 9)
+        return 2 + 16;
+    else if(len > 9 && len <= 256 && dist < MAX_WINDOW)
+        return 2 + 24;
+
+    return 0;
+}
+
+static int write_short_copy(struct prs_comp_cxt *cxt, int mlen, int offset) {
+    int rv;
+
+    PRS_STAT(cxt->stats, short_copies, 1);
+    PRS_STAT(cxt->stats, copy_bytes, mlen);
+
+    if((rv = set_bit(cxt, 0)))
+        return rv;
+
+    if((rv = set_bit(cxt, 0)))
+        return rv;
+
+    if((rv = set_bit(cxt, (mlen - 2) & 0x02)))
+        return rv;
+
+    if((rv = set_bit(cxt, (mlen - 2) & 0x01)))
+        return rv;
+
+    return write_literal(cxt, offset & 0xFF);
+}
+
+static int write_long_copy(struct prs_comp_cxt *cxt, int mlen, int offset) {
+    int rv;
+    uint8_t tmp;
+
+    if((rv = set_bit(cxt, 0)))
+        return rv;
+
+    if((rv = set_bit(cxt, 1)))
+        return rv;
+
+    PRS_STAT(cxt->stats, copy_bytes, mlen);
+
+    /* Long match, short length. */
+    if(mlen <= 9) {
+        PRS_STAT(cxt->stats, long_copies, 1);
+        tmp = ((offset & 0x1f) << 3) | ((mlen - 2) & 0x07);
+        if((rv = write_literal(cxt, tmp)))
+            return rv;
+
+        tmp = offset >> 5;
+        return write_literal(cxt, tmp);
+    }
+
+    /* Long match, long length. */
+    PRS_STAT(cxt->stats, long3_copies, 1);
+    tmp = ((offset & 0x1f) << 3);
+    if((rv = write_literal(cxt, tmp)))
+        return rv;
+
+    tmp = offset >> 5;
+    if((rv = write_literal(cxt, tmp)))
+        return rv;
+
+    return write_literal(cxt, mlen - 1);
+}
+
+static void add_intermediates(struct prs_comp_cxt *cxt, struct prs_hash_cxt *hc,
+                              int len) {
+    int i;
+
+    for(i = 1; i < len; ++i)
+        add_to_hash(cxt, hc, cxt->src_pos + i);
+}
+
+/* Write out whatever should go at the current position (either a match or a
+   literal), using a lazy match evaluation like zlib does. */
+static int greedy_step(struct prs_comp_cxt *cxt, struct prs_hash_cxt *hc) {
+    int rv, mlen, mlen2;
+    int offset, offset2;
+
+    /* Is there a match? */
+    if((mlen = find_longest_match(cxt, hc, &offset, 0))) {
+        if(!hc->lvl->lazy)
+            goto blergh;
+
+        cxt->src_pos++;
+        mlen2 = find_longest_match(cxt, hc, &offset2, 1);
+        cxt->src_pos--;
+
+        /* Did the "lazy match" produce something more compressed? */
+        if(mlen2 > mlen) {
+            /* Check if it is a good idea to switch from a short match to a
+               long one, if we would do that. */
+            if(mlen >= 2 && mlen <= 5 && offset2 < offset) {
+                if(offset >= -256 && offset2 < -256) {
+                    if(mlen2 - mlen < 3) {
+                        PRS_STAT(cxt->stats, lazy_losses, 1);
+                        goto blergh;
+                    }
+                }
+            }
+
+            PRS_STAT(cxt->stats, lazy_wins, 1);
+
+            if((rv = set_bit(cxt, 1)))
+                return rv;
+
+            return copy_literal(cxt);
+        }
+
+        PRS_STAT(cxt->stats, lazy_losses, 1);
+
+blergh:
+        /* What kind of match did we find? */
+        if(mlen >= 2 && mlen <= 5 && offset >= -256) {
+            /* Short match. */
+            if((rv = write_short_copy(cxt, mlen, offset)))
+                return rv;
+
+            add_intermediates(cxt, hc, mlen);
+            cxt->src_pos += mlen;
+            return 0;
+        }
+        else if(mlen >= 3 && mlen <= 9) {
+            /* Long match, short length. */
+            if((rv = write_long_copy(cxt, mlen, offset)))
+                return rv;
+
+            add_intermediates(cxt, hc, mlen);
+            cxt->src_pos += mlen;
+            return 0;
+        }
+        else if(mlen > 9) {
+            /* Long match, long length. */
+            if(mlen > 256)
+                mlen = 256;
+
+            if((rv = write_long_copy(cxt, mlen, offset)))
+                return rv;
+
+            add_intermediates(cxt, hc, mlen);
+            cxt->src_pos += mlen;
+            return 0;
+        }
+    }
+
+    /* If we get here, we didn't find a suitable match, so just write the
+       byte as a literal in the output. */
+    if((rv = set_bit(cxt, 1)))
+        return rv;
+
+    /* Copy the byte over. */
+    return copy_literal(cxt);
+}
+
+/* Write out the source as nothing but literals. The context should already be
+   set up with the source and destination buffers. */
+static int archive_buf(struct prs_comp_cxt *cxt) {
+    size_t len = cxt->src_len;
+    int rv;
+
+    /* Copy each byte, filling in the flags as we go along. */
+    while(len--) {
+        /* Set the bit in the flag since we're just putting a literal in the
+           output. */
+        if((rv = set_bit(cxt, 1)))
+            return rv;
+
+        /* Copy the byte over. */
+        if((rv = copy_literal(cxt)))
+            return rv;
+    }
+
+    return write_eof(cxt);
+}
+
+/* Compress from cxt->src_pos up to end with the optimal parser. Rather than
+   picking matches greedily, this finds every match at every position and then
+   picks the cheapest path through the whole thing, using the exact number of
+   bits each literal or copy takes up in the output. Anything before src_pos
+   has to be in the hash already. Copies are cut off at end, so that this stops
+   right there.
+
+   This keeps 8 bytes of bookkeeping for every byte around while it works. */
+static int optimal_range(struct prs_comp_cxt *cxt, struct prs_hash_cxt *hc,
+                         size_t end) {
+    uint32_t *cost;
+    uint16_t *plen, *pdist;
+    int lens[MAX_MATCH], dists[MAX_MATCH];
+    int rv = 0, cnt, i, len, top, rcost;
+    size_t start = cxt->src_pos, n = end - start, pos, tend;
+    uint32_t c;
+
+    /* The bulk of our work space. */
+    cost = (uint32_t *)malloc((n + 1) * sizeof(uint32_t));
+    plen = (uint16_t *)malloc((n + 1) * sizeof(uint16_t));
+    pdist = (uint16_t *)malloc((n + 1) * sizeof(uint16_t));
+
+    if(!cost || !plen || !pdist) {
+        rv = -errno;
+        goto out;
+    }
+
+    for(pos = 1; pos <= n; ++pos)
+        cost[pos] = UINT32_MAX;
+
+    cost[0] = 0;
+
+    /* Walk forward, relaxing the cost of every position reachable from this
+       one, either by a literal or by any of the copies that we could start
+       here. */
+    for(pos = 0; pos < n; ++pos) {
+        c = cost[pos];
+
+        if(c + 9 < cost[pos + 1]) {
+            cost[pos + 1] = c + 9;
+            plen[pos + 1] = 1;
+        }
+
+        cxt->src_pos = start + pos;
+        cnt = find_all_matches(cxt, hc, lens, dists);
+
+        for(i = 0, len = 2; i < cnt; ++i) {
+            top = n - pos < (size_t)lens[i] ? (int)(n - pos) : lens[i];
+
+            for(; len <= top; ++len) {
+                if(!(rcost = copy_cost(len, dists[i])))
+                    continue;
+
+                if(c + rcost < cost[pos + len]) {
+                    cost[pos + len] = c + rcost;
+                    plen[pos + len] = (uint16_t)len;
+                    pdist[pos + len] = (uint16_t)dists[i];
+                }
+            }
+        }
+    }
+
+    /* Trace back the cheapest path, leaving the choice made at the start of
+       each token in the cost array (which we don't need anymore). */
+    for(pos = n; pos;) {
+        len = plen[pos];
+        tend = pos;
+        pos -= len;
+        cost[pos] = (len == 1) ? 0 : (((uint32_t)len << 16) | pdist[tend]);
+    }
+
+    /* Now that we know what we're writing, actually write it. */
+    cxt->src_pos = start;
+
+    while(cxt->src_pos < end) {
+        c = cost[cxt->src_pos - start];
+
+        if(!c) {
+            if((rv = set_bit(cxt, 1)))
+                goto out;
+
+            if((rv = copy_literal(cxt)))
+                goto out;
+
+            continue;
+        }
+
+        len = (int)(c >> 16);
+        i = -(int)(c & 0xFFFF);
+
+        if(len <= 5 && i >= -256)
+            rv = write_short_copy(cxt, len, i);
+        else
+            rv = write_long_copy(cxt, len, i);
+
+        if(rv)
+            goto out;
+
+        cxt->src_pos += len;
+    }
+
+out:
+    free(pdist);
+    free(plen);
+    free(cost);
+    return rv;
+}
+
+/* Compress from cxt->src_pos up to end, however the level says to, without
+   writing the end of the stream. Anything before src_pos has to be in the
+   hash already. The greedy levels can finish a copy past end (but never past
+   src_len), the others stop right at end. */
+static int compress_range(struct prs_comp_cxt *cxt, struct prs_hash_cxt *hc,
+                          size_t end) {
+    int rv;
+
+    if(hc->lvl->optimal)
+        return optimal_range(cxt, hc, end);
+
+    while(cxt->src_pos < end) {
+        if(!hc->lvl->max_chain) {
+            if((rv = set_bit(cxt, 1)) || (rv = copy_literal(cxt)))
+                return rv;
+        }
+        else if((rv = greedy_step(cxt, hc))) {
+            return rv;
+        }
+    }
+
+    return 0;
+}
+
+/* Compress the source into the destination buffer. The context should already
+   be set up with the source and destination buffers and the hash context must
+   be ready to go (with hash_init or hash_reuse), at the level to use. */
+static int compress_buf(struct prs_comp_cxt *cxt, struct prs_hash_cxt *hc) {
+    int rv;
+
+    /* Meh. Don't feel like dealing with it here, since it's not compressible
+       at all anyway. */
+    if(cxt->src_len <= 3 || !hc->lvl->max_chain)
+        return archive_buf(cxt);
+
+    if(hc->lvl->optimal) {
+        if((rv = optimal_range(cxt, hc, cxt->src_len)))
+            return rv;
+
+        return write_eof(cxt);
+    }
+
+    /* Add the first two "strings" to the hash table. */
+    add_to_hash(cxt, hc, 0);
+    add_to_hash(cxt, hc, 1);
+
+    /* Copy the first two bytes as literals... */
+    if((rv = set_bit(cxt, 1)))
+        return rv;
+
+    if((rv = copy_literal(cxt)))
+        return rv;
+
+    if((rv = set_bit(cxt, 1)))
+        return rv;
+
+    if((rv = copy_literal(cxt)))
+        return rv;
+
+    /* Process each byte. */
+    while(cxt->src_pos < cxt->src_len - 1) {
+        if((rv = greedy_step(cxt, hc)))
+            return rv;
+    }
+
+    /* If we still have a left over byte at the end, put it in as a literal. */
+    if(cxt->src_pos < cxt->src_len) {
+        /* Set the bit in the flag since we're just putting a literal in the
+           output. */
+        if((rv = set_bit(cxt, 1)))
+            return rv;
+
+        /* Copy the byte over. */
+        if((rv = copy_literal(cxt)))
+            return rv;
+    }
+
+    return write_eof(cxt);
+}
+
+/******************************************************************************
+    Archive a buffer of data into PRS format.
+
+    This function archives a buffer of data into a format that can be
+    "decompressed" by a program that handles PRS files. By archive, I mean that
+    the file is not actually compressed -- in fact, the output will be larger
+    than the input data (see prs_max_compressed_size for how big it'll actually
+    be).
+
+    There's really very little reason to ever use this, but it is here for you
+    if you really want it.
+ ******************************************************************************/
+int prs_archive(const uint8_t *src, uint8_t **dst, size_t src_len) {
+    struct prs_comp_cxt cxt;
+    int rv;
+
+    /* Check the input to make sure we've got valid source/destination pointers
+       and something to do. */
+    if(!src || !dst)
+        return -EFAULT;
+
+    if(!src_len)
+        return -EINVAL;
+
+    /* Clear the context and fill in what we need to do our job. */
+    memset(&cxt, 0, sizeof(cxt));
+    cxt.src = src;
+    cxt.src_len = src_len;
+    cxt.dst_len = prs_max_compressed_size(src_len);
+
+    /* Allocate our "compressed" buffer. */
+    if(!(cxt.dst = (uint8_t *)malloc(cxt.dst_len)))
+        return -errno;
+
+    cxt.flag_ptr = cxt.dst;
+    rv = archive_buf(&cxt);
+    PRS_STATS_ADD(cxt.stats);
+
+    if(rv) {
+        free(cxt.dst);
+        return rv;
+    }
+
+    *dst = cxt.dst;
+    return (int)cxt.dst_pos;
+}
+
+/******************************************************************************
+    Compress a buffer of data into PRS format.
+
+    This function compresses a buffer of data with PRS compression, at the
+    given level. This function will never produce output larger than that of
+    the prs_archive function, and will usually produce output that is
+    significantly smaller (apart from at level 0, which is prs_archive).
+ ******************************************************************************/
+int prs_compress_level(const uint8_t *src, uint8_t **dst, size_t src_len,
+                       int level) {
+    struct prs_comp_cxt cxt;
+    struct prs_hash_cxt *hcxt;
+    int rv;
+
+    /* Check the input to make sure we've got valid source/destination pointers
+       and something to do. */
+    if(!src || !dst)
+        return -EFAULT;
+
+    if(!src_len || level < PRS_LEVEL_MIN || level > PRS_LEVEL_MAX)
+        return -EINVAL;
+
+    if(!level)
+        return prs_archive(src, dst, src_len);
+
+    /* Allocate the hash context. */
+    if(!(hcxt = (struct prs_hash_cxt *)malloc(sizeof(struct prs_hash_cxt))))
+        return -errno;
+
+    /* Clear the context and fill in what we need to do our job. */
+    memset(&cxt, 0, sizeof(cxt));
+    cxt.src = src;
+    cxt.src_len = src_len;
+    cxt.dst_len = prs_max_compressed_size(src_len);
+
+    /* Allocate our "compressed" buffer. */
+    if(!(cxt.dst = (uint8_t *)malloc(cxt.dst_len))) {
+        free(hcxt);
+        return -errno;
+    }
+
+    cxt.flag_ptr = cxt.dst;
+
+    hash_init(hcxt, &levels[level]);
+    rv = compress_buf(&cxt, hcxt);
+    PRS_STATS_ADD(cxt.stats);
+    free(hcxt);
+
+    if(rv) {
+        free(cxt.dst);
+        return rv;
+    }
+
+    /* Resize the output (if realloc fails to resize it, then just use the
+       unshortened buffer). */
+    if(!(*dst = realloc(cxt.dst, cxt.dst_pos)))
+        *dst = cxt.dst;
+
+    return (int)cxt.dst_pos;
+}
+
+int prs_compress(const uint8_t *src, uint8_t **dst, size_t src_len) {
+    return prs_compress_level(src, dst, src_len, PRS_LEVEL_DEFAULT);
+}
+
+int prs_compress_optimal(const uint8_t *src, uint8_t **dst, size_t src_len) {
+    return prs_compress_level(src, dst, src_len, PRS_LEVEL_MAX);
+}
+
+/******************************************************************************
+    Reusable compression contexts.
+
+    Compressing a lot of small things in a row with prs_compress spends a good
+    chunk of its time allocating (and clearing) the hash tables and output
+    buffer for each one. A compression context holds on to both of those
+    between calls, so that each thread doing compression can just keep one
+    around and reuse it for everything it does. The tables only get cleared
+    when the context is created; after that, resetting one just moves the base
+    of the hash positions past anything that's already in there.
+ ******************************************************************************/
+struct prs_comp_ctx {
+    struct prs_hash_cxt hc;
+    const struct prs_level *lvl;
+    uint8_t *buf;
+    size_t buf_len;
+};
+
+struct prs_comp_ctx *prs_comp_ctx_new(void) {
+    struct prs_comp_ctx *ctx;
+
+    if(!(ctx = (struct prs_comp_ctx *)malloc(sizeof(struct prs_comp_ctx))))
+        return NULL;
+
+    hash_init(&ctx->hc, DEFAULT_LEVEL);
+    ctx->lvl = DEFAULT_LEVEL;
+    ctx->buf = NULL;
+    ctx->buf_len = 0;
+
+    return ctx;
+}
+
+void prs_comp_ctx_reset(struct prs_comp_ctx *ctx) {
+    if(ctx)
+        hash_reuse(&ctx->hc, ctx->lvl, 0);
+}
+
+int prs_comp_ctx_set_level(struct prs_comp_ctx *ctx, int level) {
+    if(!ctx)
+        return -EFAULT;
+
+    if(level < PRS_LEVEL_MIN || level > PRS_LEVEL_MAX)
+        return -EINVAL;
+
+    ctx->lvl = &levels[level];
+    return 0;
+}
+
+void prs_comp_ctx_free(struct prs_comp_ctx *ctx) {
+    if(ctx) {
+        free(ctx->buf);
+        free(ctx);
+    }
+}
+
+int prs_compress_into(struct prs_comp_ctx *ctx, const uint8_t *src,
+                      size_t src_len, uint8_t *dst, size_t dst_len) {
+    struct prs_comp_cxt cxt;
+    int rv;
+
+    if(!ctx || !src || !dst)
+        return -EFAULT;
+
+    if(!src_len)
+        return -EINVAL;
+
+    memset(&cxt, 0, sizeof(cxt));
+    cxt.src = src;
+    cxt.src_len = src_len;
+    cxt.dst = dst;
+    cxt.dst_len = dst_len;
+    cxt.flag_ptr = cxt.dst;
+
+    /* Even the flag byte needs somewhere to go. */
+    if(!dst_len)
+        return -ENOSPC;
+
+    hash_reuse(&ctx->hc, ctx->lvl, src_len);
+    rv = compress_buf(&cxt, &ctx->hc);
+    PRS_STATS_ADD(cxt.stats);
+
+    if(rv)
+        return rv;
+
+    return (int)cxt.dst_pos;
+}
+
+int prs_compress_ctx(struct prs_comp_ctx *ctx, const uint8_t *src,
+                     size_t src_len, const uint8_t **dst) {
+    size_t len;
+    uint8_t *tmp;
+    int rv;
+
+    if(!ctx || !src || !dst)
+        return -EFAULT;
+
+    if(!src_len)
+        return -EINVAL;
+
+    /* Make sure the output buffer is big enough for the worst case. */
+    len = prs_max_compressed_size(src_len);
+
+    if(ctx->buf_len < len) {
+        if(!(tmp = (uint8_t *)realloc(ctx->buf, len)))
+            return -errno;
+
+        ctx->buf = tmp;
+        ctx->buf_len = len;
+    }
+
+    if((rv = prs_compress_into(ctx, src, src_len, ctx->buf, ctx->buf_len)) < 0)
+        return rv;
+
+    *dst = ctx->buf;
+    return rv;
+}
+
+/******************************************************************************
+    Compress one block of a larger buffer into PRS format.
+
+    This is for splitting up a big buffer to be compressed by a bunch of
+    threads at once. Each block is compressed into its own PRS stream, but with
+    the hash tables primed with the data just before it (up to MAX_WINDOW
+    bytes), so that the block can still refer back to it. The streams can then
+    be joined together into one with prs_stitch.
+ ******************************************************************************/
+int prs_compress_block(struct prs_comp_ctx *ctx, const uint8_t *src,
+                       size_t prime_len, size_t src_len, const uint8_t **dst) {
+    struct prs_comp_cxt cxt;
+    size_t len, i;
+    uint8_t *tmp;
+    int rv;
+
+    if(!ctx || !src || !dst)
+        return -EFAULT;
+
+    if(!src_len)
+        return -EINVAL;
+
+    /* Nothing further back than the window is of any use to us. */
+    if(prime_len > MAX_WINDOW)
+        prime_len = MAX_WINDOW;
+
+    if(!prime_len)
+        return prs_compress_ctx(ctx, src, src_len, dst);
+
+    len = prs_max_compressed_size(src_len);
+
+    if(ctx->buf_len < len) {
+        if(!(tmp = (uint8_t *)realloc(ctx->buf, len)))
+            return -errno;
+
+        ctx->buf = tmp;
+        ctx->buf_len = len;
+    }
+
+    memset(&cxt, 0, sizeof(cxt));
+    cxt.src = src - prime_len;
+    cxt.src_len = prime_len + src_len;
+    cxt.src_pos = prime_len;
+    cxt.dst = ctx->buf;
+    cxt.dst_len = ctx->buf_len;
+    cxt.flag_ptr = cxt.dst;
+
+    /* Fill in the hash with everything from the priming data. */
+    hash_reuse(&ctx->hc, ctx->lvl, cxt.src_len);
+
+    for(i = 0; i < prime_len; ++i)
+        add_to_hash(&cxt, &ctx->hc, i);
+
+    rv = compress_range(&cxt, &ctx->hc, cxt.src_len);
+    PRS_STATS_ADD(cxt.stats);
+
+    if(rv || (rv = write_eof(&cxt)))
+        return rv;
+
+    *dst = ctx->buf;
+    return (int)cxt.dst_pos;
+}
+
+/* Read the next flag bit out of a stream that is being stitched. */
+static int stitch_bit(const uint8_t *src, size_t len, size_t *pos,
+                      uint8_t *flags, int *bits) {
+    int rv;
+
+    if(!*bits) {
+        if(*pos >= len)
+            return -EBADMSG;
+
+        *flags = src[(*pos)++];
+        *bits = 8;
+    }
+
+    rv = *flags & 1;
+    *flags >>= 1;
+    --*bits;
+
+    return rv;
+}
+
+/* Copy all the tokens (other than the end marker) of one stream into the
+   output, exactly as they were encoded. */
+static int stitch_stream(struct prs_comp_cxt *cxt, const uint8_t *src,
+                         size_t len) {
+    size_t pos = 0;
+    uint8_t flags = 0;
+    int bits = 0, b, b2, rv;
+
+    for(;;) {
+        if((b = stitch_bit(src, len, &pos, &flags, &bits)) < 0)
+            return b;
+
+        /* Literal. */
+        if(b) {
+            if(pos >= len)
+                return -EBADMSG;
+
+            if((rv = set_bit(cxt, 1)) || (rv = write_literal(cxt, src[pos++])))
+                return rv;
+
+            continue;
+        }
+
+        if((b = stitch_bit(src, len, &pos, &flags, &bits)) < 0)
+            return b;
+
+        /* Short copy. */
+        if(!b) {
+            if((b = stitch_bit(src, len, &pos, &flags, &bits)) < 0 ||
+               (b2 = stitch_bit(src, len, &pos, &flags, &bits)) < 0)
+                return -EBADMSG;
+
+            if(pos >= len)
+                return -EBADMSG;
+
+            if((rv = set_bit(cxt, 0)) || (rv = set_bit(cxt, 0)) ||
+               (rv = set_bit(cxt, b)) || (rv = set_bit(cxt, b2)) ||
+               (rv = write_literal(cxt, src[pos++])))
+                return rv;
+
+            continue;
+        }
+
+        /* Long copy, or the end of the stream. */
+        if(pos + 1 >= len)
+            return -EBADMSG;
+
+        if(!src[pos] && !src[pos + 1])
+            return 0;
+
+        if((rv = set_bit(cxt, 0)) || (rv = set_bit(cxt, 1)) ||
+           (rv = write_literal(cxt, src[pos])) ||
+           (rv = write_literal(cxt, src[pos + 1])))
+            return rv;
+
+        /* Is there a length byte too? */
+        if(!(src[pos] & 0x07)) {
+            if(pos + 2 >= len)
+                return -EBADMSG;
+
+            if((rv = write_literal(cxt, src[pos + 2])))
+                return rv;
+
+            ++pos;
+        }
+
+        pos += 2;
+    }
+}
+
+/******************************************************************************
+    Join a bunch of PRS streams into one.
+
+    This takes the streams produced by prs_compress_block (in order) and copies
+    their tokens, bit for bit, into a single stream with a single end marker.
+    Since all the flag bits get repacked as they go along, this can't just be
+    done by gluing the bytes together, but it doesn't require actually
+    decompressing anything.
+ ******************************************************************************/
+int prs_stitch(const uint8_t *const *srcs, const size_t *lens, int count,
+               uint8_t **dst) {
+    struct prs_comp_cxt cxt;
+    size_t total = 0;
+    int i, rv;
+
+    if(!srcs || !lens || !dst)
+        return -EFAULT;
+
+    if(count < 1)
+        return -EINVAL;
+
+    /* The joined stream has all the same tokens, packed together at least as
+       tightly as before, so it can't be any bigger than all of them together. */
+    for(i = 0; i < count; ++i)
+        total += lens[i];
+
+    memset(&cxt, 0, sizeof(cxt));
+    cxt.dst_len = total;
+
+    if(!(cxt.dst = (uint8_t *)malloc(cxt.dst_len)))
+        return -errno;
+
+    cxt.flag_ptr = cxt.dst;
+
+    for(i = 0; i < count; ++i) {
+        if((rv = stitch_stream(&cxt, srcs[i], lens[i])))
+            goto out;
+    }
+
+    if((rv = write_eof(&cxt)))
+        goto out;
+
+    if(!(*dst = realloc(cxt.dst, cxt.dst_pos)))
+        *dst = cxt.dst;
+
+    return (int)cxt.dst_pos;
+
+out:
+    free(cxt.dst);
+    return rv;
+}
+
+/* Flush everything in the output buffer up to (but not including) the current
+   flag byte, since that one might still have bits to be filled in. */
+static int flush_output(struct prs_comp_cxt *cxt, FILE *fp) {
+    size_t len = (size_t)(cxt->flag_ptr - cxt->dst);
+
+    if(!len)
+        return 0;
+
+    if(fwrite(cxt->dst, 1, len, fp) != len)
+        return -errno;
+
+    memmove(cxt->dst, cxt->flag_ptr, cxt->dst_pos - len);
+    cxt->dst_pos -= len;
+    cxt->flag_ptr = cxt->dst;
+
+    return 0;
+}
+
+/******************************************************************************
+    Compress a stream of data into PRS format.
+
+    This function works the same as prs_compress, except that rather than
+    needing the whole input in memory (and enough memory for the whole output),
+    it reads the input a block at a time and writes the output as it goes. Only
+    the last MAX_WINDOW bytes of input that have already been compressed are
+    kept around, since nothing can refer further back than that anyway.
+ ******************************************************************************/
+#define STREAM_BLOCK     0x10000
+#define STREAM_LOOKAHEAD (MAX_MATCH * 2)
+#define STREAM_BUF       (MAX_WINDOW + STREAM_BLOCK + STREAM_LOOKAHEAD)
+
+int prs_compress_stream_level(FILE *in, FILE *out, int level) {
+    struct prs_comp_cxt cxt;
+    struct prs_hash_cxt *hcxt;
+    uint8_t *buf;
+    size_t len, end, shift;
+    int rv = 0, eof = 0;
+
+    if(!in || !out)
+        return -EFAULT;
+
+    if(level < PRS_LEVEL_MIN || level > PRS_LEVEL_MAX)
+        return -EINVAL;
+
+    hcxt = (struct prs_hash_cxt *)malloc(sizeof(struct prs_hash_cxt));
+    buf = (uint8_t *)malloc(STREAM_BUF);
+
+    memset(&cxt, 0, sizeof(cxt));
+    /* We never compress more than a buffer's worth at a time before flushing,
+       and there's never more than a flag byte and its tokens left over from
+       the last time. */
+    cxt.dst_len = prs_max_compressed_size(STREAM_BUF) + 32;
+
+    if(!hcxt || !buf || !(cxt.dst = (uint8_t *)malloc(cxt.dst_len))) {
+        rv = -errno;
+        goto out;
+    }
+
+    hash_init(hcxt, &levels[level]);
+    cxt.src = buf;
+    cxt.flag_ptr = cxt.dst;
+
+    while(!eof) {
+        /* Fill up whatever space is left in the buffer. */
+        len = fread(buf + cxt.src_len, 1, STREAM_BUF - cxt.src_len, in);
+
+        if(len < STREAM_BUF - cxt.src_len) {
+            if(ferror(in)) {
+                rv = -errno;
+                goto out;
+            }
+
+            eof = 1;
+        }
+
+        cxt.src_len += len;
+
+        /* Unless this is the end of the input, leave enough data after where
+           we stop for the longest match (and the lazy match after it) to see
+           all the data it needs. */
+        end = eof ? cxt.src_len : cxt.src_len - STREAM_LOOKAHEAD;
+
+        if(cxt.src_pos < end && (rv = compress_range(&cxt, hcxt, end)))
+            goto out;
+
+        if((rv = flush_output(&cxt, out)))
+            goto out;
+
+        /* Slide the window down, keeping the last MAX_WINDOW bytes that we've
+           compressed. Since hash positions are relative to base, moving base
+           up keeps all of the entries in the tables pointing to the right
+           data. */
+        if(!eof && cxt.src_pos > MAX_WINDOW) {
+            shift = cxt.src_pos - MAX_WINDOW;
+            memmove(buf, buf + shift, cxt.src_len - shift);
+            cxt.src_pos -= shift;
+            cxt.src_len -= shift;
+
+            /* If base is about to wrap around, start over with empty tables
+               rather than risk old entries looking like they're in range. That
+               costs a little bit of compression, but only once every 4GiB. */
+            if(hcxt->base > UINT32_MAX - 2 * STREAM_BUF) {
+                hash_init(hcxt, &levels[level]);
+            }
+            else {
+                hcxt->base += (uint32_t)shift;
+            }
+        }
+    }
+
+    if((rv = write_eof(&cxt)))
+        goto out;
+
+    if(fwrite(cxt.dst, 1, cxt.dst_pos, out) != cxt.dst_pos)
+        rv = -errno;
+
+out:
+    PRS_STATS_ADD(cxt.stats);
+    free(cxt.dst);
+    free(buf);
+    free(hcxt);
+    return rv;
+}
+
+int prs_compress_stream(FILE *in, FILE *out) {
+    return prs_compress_stream_level(in, out, PRS_LEVEL_DEFAULT);
+}
@@ -0,0 +1,1032 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prs.h"
+#include "prs-kernel.h"
+
+struct prs_dec_cxt {
+    uint8_t flags;
+
+    int bit_pos;
+    const uint8_t *src;
+    uint8_t *dst;
+    void *udata;
+
+    size_t src_len;
+    size_t dst_len;
+    size_t src_pos;
+    size_t dst_pos;
+
+    int (*copy_byte)(struct prs_dec_cxt *cxt);
+    int (*offset_copy)(struct prs_dec_cxt *cxt, int offset);
+    int (*fetch_bit)(struct prs_dec_cxt *cxt);
+    int (*fetch_byte)(struct prs_dec_cxt *cxt);
+    int (*fetch_short)(struct prs_dec_cxt *cxt);
+
+#ifdef PRS_STATS
+    struct prs_stats stats;
+#endif
+};
+
+/* The end of an initializer for a prs_dec_cxt, for the counters if there are
+   any. */
+#ifdef PRS_STATS
+#define DEC_STATS_INIT  , { 0 }
+#else
+#define DEC_STATS_INIT
+#endif
+
+/******************************************************************************
+    PRS Decompression Function
+
+    This function does the real work of decompressing whatever you throw at it.
+    It uses a bunch of callbacks in the context provided to read the compressed
+    data and do whatever is needed with it.
+ ******************************************************************************/
+static int do_decompress(struct prs_dec_cxt *cxt) {
+    int flag, size;
+    int32_t offset;
+
+    for(;;) {
+        /* Read the flag bit for this pass. */
+        if((flag = cxt->fetch_bit(cxt)) < 0)
+            return flag;
+
+        /* Flag bit = 1 -> Simple byte copy from src to dst. */
+        if(flag) {
+            if((flag = cxt->copy_byte(cxt)) < 0)
+                return flag;
+
+            PRS_STAT(cxt->stats, dec_literals, 1);
+            continue;
+        }
+
+        /* The flag starts with a zero, so it isn't just a simple byte copy.
+           Read the next bit to see what we have left to do. */
+        if((flag = cxt->fetch_bit(cxt)) < 0)
+            return flag;
+
+        /* Flag bit = 1 -> Either long copy or end of file. */
+        if(flag) {
+            if((offset = cxt->fetch_short(cxt)) < 0)
+                return offset;
+
+            /* Two zero bytes implies that this is the end of the file. Return
+               the length of the file. */
+            if(!offset)
+                return (int)cxt->dst_pos;
+
+            /* Do we need to read a size byte, or is it encoded in what we
+               already got? */
+            size = offset & 0x0007;
+            offset >>= 3;
+
+            if(!size) {
+                if((size = cxt->fetch_byte(cxt)) < 0)
+                    return size;
+
+                ++size;
+                PRS_STAT(cxt->stats, dec_long3_copies, 1);
+            }
+            else {
+                size += 2;
+                PRS_STAT(cxt->stats, dec_long_copies, 1);
+            }
+
+            offset |= 0xFFFFE000;
+        }
+        /* Flag bit = 0 -> short copy. */
+        else {
+            /* Fetch the two bits needed to determine the size. */
+            if((flag = cxt->fetch_bit(cxt)) < 0)
+                return flag;
+
+            if((size = cxt->fetch_bit(cxt)) < 0)
+                return size;
+
+            size = (size | (flag << 1)) + 2;
+
+            /* Fetch the offset byte. */
+            if((offset = cxt->fetch_byte(cxt)) < 0)
+                return offset;
+
+            offset |= 0xFFFFFF00;
+            PRS_STAT(cxt->stats, dec_short_copies, 1);
+        }
+
+        PRS_STAT(cxt->stats, dec_copy_bytes, size);
+
+        /* Copy the data. */
+        while(size--) {
+            if((flag = cxt->offset_copy(cxt, offset)) < 0)
+                return flag;
+        }
+    }
+}
+
+/******************************************************************************
+    Memory to Memory Decompression Function
+
+    This is the same decoder as do_decompress, but specialised for the case
+    where both the compressed data and the output live in memory, which is the
+    one that matters most (quest loading, for instance). Rather than calling
+    through the context for every bit and byte, it keeps everything in locals,
+    reads a new flag byte once per eight bits, checks bounds once per token
+    and copies each back-reference in one go.
+
+    If grow is non-zero, *dst must have been allocated with malloc and will be
+    reallocated (doubling in size each time) as needed, with the new size being
+    stored in *dst_len. Otherwise, running out of space is an error (-ENOSPC).
+    Either way, *dst is always left pointing at the output buffer, even on
+    error.
+ ******************************************************************************/
+static int decompress_mem(const uint8_t *src, size_t src_len, uint8_t **dst,
+                          size_t *dst_len, int grow) {
+    const uint8_t *sp = src, *send = src + src_len;
+    uint8_t *out = *dst, *tmp;
+    size_t pos = 0, len = *dst_len, nlen;
+    unsigned int flags = 0;
+    int rv, size;
+    int32_t offset;
+#ifdef PRS_STATS
+    struct prs_stats stats;
+
+    memset(&stats, 0, sizeof(stats));
+#endif
+
+    /* The flag byte has a marker bit set above its top bit, so that once all
+       eight real bits have been shifted out, only the marker is left. */
+#define FETCH_BIT(b) do {                                       \
+        if(flags <= 1) {                                        \
+            if(sp >= send) {                                    \
+                rv = -EBADMSG;                                  \
+                goto out;                                       \
+            }                                                   \
+            flags = *sp++ | 0x100;                              \
+        }                                                       \
+        b = flags & 1;                                          \
+        flags >>= 1;                                            \
+    } while(0)
+
+    for(;;) {
+        FETCH_BIT(rv);
+
+        /* Flag bit = 1 -> Simple byte copy from src to dst. */
+        if(rv) {
+            if(sp >= send) {
+                rv = -EBADMSG;
+                goto out;
+            }
+
+            size = 1;
+            offset = 0;
+        }
+        else {
+            FETCH_BIT(rv);
+
+            /* Flag bit = 1 -> Either long copy or end of file. */
+            if(rv) {
+                if(send - sp < 2) {
+                    rv = -EBADMSG;
+                    goto out;
+                }
+
+                offset = sp[0] | (sp[1] << 8);
+                sp += 2;
+
+                /* Two zero bytes implies that this is the end of the file. */
+                if(!offset) {
+                    rv = (int)pos;
+                    goto out;
+                }
+
+                size = offset & 0x0007;
+                offset >>= 3;
+
+                if(!size) {
+                    if(sp >= send) {
+                        rv = -EBADMSG;
+                        goto out;
+                    }
+
+                    size = *sp++ + 1;
+                    PRS_STAT(stats, dec_long3_copies, 1);
+                }
+                else {
+                    size += 2;
+                    PRS_STAT(stats, dec_long_copies, 1);
+                }
+
+                offset |= 0xFFFFE000;
+            }
+            /* Flag bit = 0 -> short copy. */
+            else {
+                FETCH_BIT(size);
+                FETCH_BIT(rv);
+                size = ((size << 1) | rv) + 2;
+
+                if(sp >= send) {
+                    rv = -EBADMSG;
+                    goto out;
+                }
+
+                offset = *sp++ | 0xFFFFFF00;
+                PRS_STAT(stats, dec_short_copies, 1);
+            }
+
+            /* Make sure the offset is valid. */
+            if((size_t)-offset > pos) {
+                rv = -EBADMSG;
+                goto out;
+            }
+        }
+
+        /* Make sure we have space for the whole token in the output. */
+        if(len - pos < (size_t)size) {
+            if(!grow) {
+                rv = -ENOSPC;
+                goto out;
+            }
+
+            for(nlen = len * 2; nlen - pos < (size_t)size; nlen *= 2) ;
+
+            if(!(tmp = (uint8_t *)realloc(out, nlen))) {
+                rv = -errno;
+                goto out;
+            }
+
+            out = tmp;
+            len = nlen;
+            PRS_STAT(stats, dec_reallocs, 1);
+        }
+
+        /* Copy the data. Back-references go through the kernel picked for
+           this CPU (see prs-kernel.c). */
+        if(!offset) {
+            out[pos++] = *sp++;
+            PRS_STAT(stats, dec_literals, 1);
+        }
+        else {
+            PRS_KERN()->copy(out + pos, (size_t)-offset, size);
+            pos += size;
+            PRS_STAT(stats, dec_copy_bytes, size);
+        }
+    }
+
+#undef FETCH_BIT
+
+out:
+    PRS_STATS_ADD(stats);
+    *dst = out;
+    *dst_len = len;
+    return rv;
+}
+
+/******************************************************************************
+    Internal utility functions.
+
+    Depending on how the compressed data is to be obtained, different sets of
+    these functions will be used.
+ ******************************************************************************/
+static int fetch_bit(struct prs_dec_cxt *cxt) {
+    int rv;
+
+    /* Did we finish with a full byte last time we were in here? */
+    if(!cxt->bit_pos) {
+        /* Make sure we won't fall off the end of the file by reading the byte
+           from it. */
+        if(cxt->src_pos >= cxt->src_len)
+            return -EBADMSG;
+
+        cxt->flags = *cxt->src++;
+        ++cxt->src_pos;
+        cxt->bit_pos = 8;
+    }
+
+    /* Fetch the bit and shift it off the end of the byte. */
+    rv = cxt->flags & 1;
+    cxt->flags >>= 1;
+    --cxt->bit_pos;
+
+    return rv;
+}
+
+static int fetch_byte(struct prs_dec_cxt *cxt) {
+    uint8_t rv;
+
+    /* Make sure we still have data left in the input buffer. */
+    if(cxt->src_pos >= cxt->src_len)
+        return -EBADMSG;
+
+    /* Read the byte from the buffer. */
+    rv = *cxt->src++;
+    ++cxt->src_pos;
+
+    return (int)rv;
+}
+
+static int fetch_short(struct prs_dec_cxt *cxt) {
+    uint16_t rv;
+
+    /* Make sure we still have data left in the input buffer. */
+    if(cxt->src_pos + 1 >= cxt->src_len)
+        return -EBADMSG;
+
+    /* Read the two bytes from the buffer. */
+    rv = *cxt->src++;
+    ++cxt->src_pos;
+    rv |= *cxt->src++ << 8;
+    ++cxt->src_pos;
+
+    return (int)rv;
+}
+
+static int nocopy_byte(struct prs_dec_cxt *cxt) {
+    /* Make sure we still have data left in the input buffer. */
+    if(cxt->src_pos >= cxt->src_len)
+        return -EBADMSG;
+
+    /* Increment the counters/pointers. */
+    ++cxt->src;
+    ++cxt->src_pos;
+    ++cxt->dst_pos;
+
+    return 0;
+}
+
+static int offset_nocopy(struct prs_dec_cxt *cxt, int offset) {
+    int tmp = (int)cxt->dst_pos + offset;
+
+    /* Make sure the offset is valid. */
+    if(tmp < 0)
+        return -EBADMSG;
+
+    /* Increment the counter... */
+    ++cxt->dst_pos;
+
+    return 0;
+}
+
+static int file_bit(struct prs_dec_cxt *cxt) {
+    int rv;
+
+    /* Did we finish with a full byte last time we were in here? */
+    if(!cxt->bit_pos) {
+        /* Make sure we won't fall off the end of the file by reading the byte
+           from it. */
+        if(cxt->src_pos >= cxt->src_len)
+            return -EBADMSG;
+
+        /* Read the next byte from the file. */
+        if((rv = fgetc((FILE *)cxt->udata)) == EOF) {
+            if(ferror((FILE *)cxt->udata))
+                return -errno;
+            return -EBADMSG;
+        }
+
+        cxt->flags = (uint8_t)rv;
+        ++cxt->src_pos;
+        cxt->bit_pos = 8;
+    }
+
+    /* Fetch the bit and shift it off the end of the byte. */
+    rv = cxt->flags & 1;
+    cxt->flags >>= 1;
+    --cxt->bit_pos;
+
+    return rv;
+}
+
+static int copy_fbyte(struct prs_dec_cxt *cxt) {
+    int b;
+    void *tmp;
+
+    /* Make sure we still have data left in the input file. */
+    if(cxt->src_pos >= cxt->src_len)
+        return -EBADMSG;
+
+    /* Make sure we have space left in the destination buffer. */
+    if(cxt->dst_pos >= cxt->dst_len) {
+        if(!(tmp = realloc(cxt->dst, cxt->dst_len * 2)))
+            return -errno;
+
+        cxt->dst = (uint8_t *)tmp;
+        cxt->dst_len *= 2;
+        PRS_STAT(cxt->stats, dec_reallocs, 1);
+    }
+
+    /* Read the next byte from the file. */
+    if((b = fgetc((FILE *)cxt->udata)) == EOF) {
+        if(ferror((FILE *)cxt->udata))
+            return -errno;
+        return -EBADMSG;
+    }
+
+    /* Copy the byte and increment all the counters/pointers. */
+    *(cxt->dst + cxt->dst_pos) = (uint8_t)b;
+    ++cxt->src_pos;
+    ++cxt->dst_pos;
+
+    return 0;
+}
+
+static int file_byte(struct prs_dec_cxt *cxt) {
+    int rv;
+
+    /* Make sure we still have data left in the input file. */
+    if(cxt->src_pos >= cxt->src_len)
+        return -EBADMSG;
+
+    /* Read the next byte from the file. */
+    if((rv = fgetc((FILE *)cxt->udata)) == EOF) {
+        if(ferror((FILE *)cxt->udata))
+            return -errno;
+        return -EBADMSG;
+    }
+
+    ++cxt->src_pos;
+
+    return (int)rv;
+}
+
+static int file_short(struct prs_dec_cxt *cxt) {
+    uint16_t rv;
+    uint8_t b[2];
+
+    /* Make sure we still have data left in the input file. */
+    if(cxt->src_pos + 1 >= cxt->src_len)
+        return -EBADMSG;
+
+    /* Read the next two bytes from the file. */
+    if(fread(b, 1, 2, (FILE *)cxt->udata) != 2)
+        return -errno;
+
+    /* Combine the bytes into the 16-bit value we're looking for. */
+    rv = b[0] | (b[1] << 8);
+    cxt->src_pos += 2;
+
+    return (int)rv;
+}
+
+static int offset_copy_alloc(struct prs_dec_cxt *cxt, int offset) {
+    int tmp = (int)cxt->dst_pos + offset;
+    void *tmp2;
+
+    /* Make sure the offset is valid. */
+    if(tmp < 0)
+        return -EBADMSG;
+
+    /* Make sure we have space left in the destination buffer. */
+    if(cxt->dst_pos >= cxt->dst_len) {
+        if(!(tmp2 = realloc(cxt->dst, cxt->dst_len * 2)))
+            return -errno;
+
+        cxt->dst = (uint8_t *)tmp2;
+        cxt->dst_len *= 2;
+        PRS_STAT(cxt->stats, dec_reallocs, 1);
+    }
+
+    /* Copy the byte and increment all the counters/pointers. */
+    *(cxt->dst + cxt->dst_pos) = *(cxt->dst + cxt->dst_pos + offset);
+    ++cxt->dst_pos;
+
+    return 0;
+}
+
+/******************************************************************************
+    Public interface functions
+
+    These functions are the public functions used to decompress PRS-compressed
+    data. There are a variety of functions provided here for different purposes.
+
+    prs_decompress_buf:
+        Decompress data from a memory buffer into another memory buffer,
+        allocating space as needed for the destination buffer. It is the
+        caller's responsibility to free the decompressed memory buffer when it
+        is no longer needed.
+
+    prs_decompress_buf2:
+        Decompress data from a memory buffer into another (pre-allocated) memory
+        buffer. If the buffer is not large enough, an error (-ENOSPC) will be
+        returned.
+
+    prs_decompress_exact:
+        Decompress data from a memory buffer into a pre-allocated memory buffer
+        of exactly the size that the data should decompress to (from a file
+        header, for instance). If the data does not decompress to exactly that
+        size, an error (-EBADMSG or -ENOSPC) will be returned.
+
+    prs_decompress_arena:
+        Decompress data from a memory buffer into a scratch buffer that is
+        kept around (and grown as needed) between calls, so that decompressing
+        a bunch of things in a row doesn't have to allocate memory for each
+        one. The output is only valid until the next call with the same arena.
+
+    prs_decompress_size:
+        Determine the decompressed size of a block of memory containing PRS-
+        compressed data.
+
+    prs_decompress_file:
+        Open the specified PRS-compressed file and decompress it into a new
+        memory buffer. It is the caller's responsibility to free the
+        decompressed memory buffer when it is no longer needed.
+
+    All of these functions will return the size of the decompressed data on
+    success, or a negative error code (from errno) on error. Common error codes
+    include the following:
+        -EBADMSG: Invalid compressed data encountered while decoding.
+        -EINVAL: Invalid source length (0) given.
+        -EFAULT: NULL pointer passed in.
+
+    In addition, prs_decompress_file may return many other error codes related
+    to reading from a file. prs_decompress_file and prs_decompress_buf may also
+    return errors related to memory allocation.
+ ******************************************************************************/
+int prs_decompress_buf(const uint8_t *src, uint8_t **dst, size_t src_len) {
+    uint8_t *out;
+    size_t len;
+    int rv;
+
+    if(!src || !dst)
+        return -EFAULT;
+
+    if(!src_len)
+        return -EINVAL;
+
+    /* The minimum length of a PRS compressed file (if you were to "compress" a
+       zero-byte file) is 3 bytes. If we don't have that, then bail out now. */
+    if(src_len < 3)
+        return -EBADMSG;
+
+    /* Allocate some space for the output. Start with two times the length of
+       the input (we will resize this later, as needed). */
+    len = src_len * 2;
+
+    if(!(out = (uint8_t *)malloc(len)))
+        return -errno;
+
+    /* Do the decompression. */
+    if((rv = decompress_mem(src, src_len, &out, &len, 1)) < 0) {
+        free(out);
+        return rv;
+    }
+
+    /* Resize the output (if realloc fails to resize it, then just use the
+       unshortened buffer). */
+    if(!(*dst = realloc(out, rv)))
+        *dst = out;
+
+    return rv;
+}
+
+int prs_decompress_buf2(const uint8_t *src, uint8_t *dst, size_t src_len,
+                        size_t dst_len) {
+    if(!src || !dst)
+        return -EFAULT;
+
+    if(!src_len || !dst_len)
+        return -EINVAL;
+
+    /* The minimum length of a PRS compressed file (if you were to "compress" a
+       zero-byte file) is 3 bytes. If we don't have that, then bail out now. */
+    if(src_len < 3)
+        return -EBADMSG;
+
+    return decompress_mem(src, src_len, &dst, &dst_len, 0);
+}
+
+int prs_decompress_exact(const uint8_t *src, uint8_t *dst, size_t src_len,
+                         size_t dst_len) {
+    int rv;
+
+    if((rv = prs_decompress_buf2(src, dst, src_len, dst_len)) < 0)
+        return rv;
+
+    /* Anything that decompressed short of what we were told is wrong. */
+    if((size_t)rv != dst_len)
+        return -EBADMSG;
+
+    return rv;
+}
+
+int prs_decompress_arena(struct prs_arena *arena, const uint8_t *src,
+                         size_t src_len, size_t size_hint) {
+    uint8_t *tmp;
+    size_t len;
+
+    if(!arena || !src)
+        return -EFAULT;
+
+    if(!src_len)
+        return -EINVAL;
+
+    if(src_len < 3)
+        return -EBADMSG;
+
+    /* Start with as much space as we were told we'd need, or two times the
+       length of the input if we weren't told anything. */
+    if(!(len = size_hint))
+        len = src_len * 2;
+
+    if(arena->size < len) {
+        if(!(tmp = (uint8_t *)realloc(arena->buf, len)))
+            return -errno;
+
+        arena->buf = tmp;
+        arena->size = len;
+    }
+
+    /* Whatever size the buffer ends up being, we keep it around for the next
+       time through. */
+    return decompress_mem(src, src_len, &arena->buf, &arena->size, 1);
+}
+
+void prs_arena_free(struct prs_arena *arena) {
+    if(arena) {
+        free(arena->buf);
+        arena->buf = NULL;
+        arena->size = 0;
+    }
+}
+
+int prs_decompress_size(const uint8_t *src, size_t src_len) {
+    struct prs_dec_cxt cxt =
+        { 0, 0, src, NULL, NULL, src_len, SIZE_MAX, 0, 0, &nocopy_byte,
+          &offset_nocopy, &fetch_bit, &fetch_byte, &fetch_short
+          DEC_STATS_INIT };
+    int rv;
+
+    if(!src)
+        return -EFAULT;
+    
+    if(!src_len)
+        return -EINVAL;
+
+    /* The minimum length of a PRS compressed file (if you were to "compress" a
+       zero-byte file) is 3 bytes. If we don't have that, then bail out now. */
+    if(cxt.src_len < 3)
+        return -EBADMSG;
+
+    rv = do_decompress(&cxt);
+    PRS_STATS_ADD(cxt.stats);
+    return rv;
+}
+
+int prs_decompress_file(const char *fn, uint8_t **dst) {
+    struct prs_dec_cxt cxt =
+        { 0, 0, NULL, NULL, NULL, 0, 0, 0, 0,
+          &copy_fbyte, &offset_copy_alloc, &file_bit, &file_byte, &file_short
+          DEC_STATS_INIT };
+    long len;
+    int rv;
+    FILE *fp;
+
+    if(!fn || !dst)
+        return -EFAULT;
+
+    if(!(fp = fopen(fn, "rb")))
+        return -errno;
+
+    cxt.udata = fp;
+
+    /* Figure out the length of the file. */
+    if(fseek(fp, 0, SEEK_END)) {
+        fclose(fp);
+        return -errno;
+    }
+
+    if((len = ftell(fp)) < 0) {
+        fclose(fp);
+        return -errno;
+    }
+
+    if(fseek(fp, 0, SEEK_SET)) {
+        fclose(fp);
+        return -errno;
+    }
+
+    cxt.src_len = (size_t)len;
+    cxt.dst_len = cxt.src_len * 2;
+
+    /* The minimum length of a PRS compressed file (if you were to "compress" a
+       zero-byte file) is 3 bytes. If we don't have that, then bail out now. */
+    if(cxt.src_len < 3) {
+        fclose(fp);
+        return -EBADMSG;
+    }
+
+    /* Allocate some space for the output. Start with two times the length of
+       the input (we will resize this later, as needed). */
+    if(!(cxt.dst = (uint8_t *)malloc(cxt.dst_len))) {
+        fclose(fp);
+        return -errno;
+    }
+
+    /* Do the decompression. */
+    rv = do_decompress(&cxt);
+    PRS_STATS_ADD(cxt.stats);
+
+    if(rv < 0) {
+        free(cxt.dst);
+        fclose(fp);
+        return rv;
+    }
+
+    fclose(fp);
+
+    /* Resize the output (if realloc fails to resize it, then just use the
+       unshortened buffer). */
+    if(!(*dst = realloc(cxt.dst, rv)))
+        *dst = cxt.dst;
+
+    return rv;
+}
+
+/******************************************************************************
+    Streaming Decompression
+
+    This is yet another version of the decoder loop, for when the compressed
+    data shows up a piece at a time (like quest files being sent in chunks) and
+    the output is wanted a piece at a time too. All the state needed to pick up
+    where we left off lives in the prs_dec_state structure, and the only memory
+    used is a small input buffer and the last 8KiB of output (which is as far
+    back as any copy can ever reach).
+
+    Tokens are always parsed in one go: if the input runs out partway through
+    one, we put everything back the way it was at the start of the token so we
+    can try again once more data has been fed in. Copies, on the other hand,
+    can be split across any number of calls to prs_dec_pull.
+ ******************************************************************************/
+#define DEC_WINDOW      0x2000
+#define DEC_WINDOW_MASK (DEC_WINDOW - 1)
+#define DEC_INPUT       0x1000
+
+struct prs_dec_state {
+    /* Input that has been fed to us, but not yet used. */
+    uint8_t in[DEC_INPUT];
+    size_t in_pos;
+    size_t in_len;
+
+    /* The current flag byte, and how many bits are left in it. */
+    uint8_t flags;
+    int bits_left;
+
+    /* The last DEC_WINDOW bytes of output. */
+    uint8_t window[DEC_WINDOW];
+    size_t out_total;
+
+    /* Whatever is left of a copy that didn't fit in the last pull. */
+    int copy_len;
+    int copy_offset;
+
+    int done;
+    int err;
+
+#ifdef PRS_STATS
+    struct prs_stats stats;
+#endif
+};
+
+struct prs_dec_state *prs_dec_new(void) {
+    struct prs_dec_state *st;
+
+    if(!(st = (struct prs_dec_state *)malloc(sizeof(struct prs_dec_state))))
+        return NULL;
+
+    prs_dec_reset(st);
+    return st;
+}
+
+void prs_dec_reset(struct prs_dec_state *st) {
+    st->in_pos = st->in_len = 0;
+    st->flags = 0;
+    st->bits_left = 0;
+    st->out_total = 0;
+    st->copy_len = st->copy_offset = 0;
+    st->done = st->err = 0;
+
+#ifdef PRS_STATS
+    memset(&st->stats, 0, sizeof(st->stats));
+#endif
+}
+
+void prs_dec_free(struct prs_dec_state *st) {
+    free(st);
+}
+
+int prs_dec_feed(struct prs_dec_state *st, const uint8_t *src, size_t len) {
+    size_t space;
+
+    if(!st || (!src && len))
+        return -EFAULT;
+
+    if(st->err)
+        return st->err;
+
+    /* Anything after the end of the data is just ignored. */
+    if(st->done)
+        return (int)len;
+
+    /* Slide whatever we haven't used yet down to the start of the buffer to
+       make room for more. */
+    if(st->in_pos) {
+        memmove(st->in, st->in + st->in_pos, st->in_len - st->in_pos);
+        st->in_len -= st->in_pos;
+        st->in_pos = 0;
+    }
+
+    space = DEC_INPUT - st->in_len;
+
+    if(len > space)
+        len = space;
+
+    memcpy(st->in + st->in_len, src, len);
+    st->in_len += len;
+
+    return (int)len;
+}
+
+/* Grab the next flag bit from the input, or return -EAGAIN if there isn't
+   enough input to do so. */
+static int stream_bit(struct prs_dec_state *st) {
+    int rv;
+
+    if(!st->bits_left) {
+        if(st->in_pos >= st->in_len)
+            return -EAGAIN;
+
+        st->flags = st->in[st->in_pos++];
+        st->bits_left = 8;
+    }
+
+    rv = st->flags & 1;
+    st->flags >>= 1;
+    --st->bits_left;
+
+    return rv;
+}
+
+static int stream_byte(struct prs_dec_state *st) {
+    if(st->in_pos >= st->in_len)
+        return -EAGAIN;
+
+    return st->in[st->in_pos++];
+}
+
+/* Parse one token from the input. Returns 1 for a literal (stored in *lit), 2
+   for a copy (stored in the state), 0 for the end of the data, or -EAGAIN if
+   the input ran out (in which case nothing has been consumed). */
+static int stream_token(struct prs_dec_state *st, uint8_t *lit) {
+    size_t in_pos = st->in_pos;
+    uint8_t flags = st->flags;
+    int bits_left = st->bits_left;
+    int rv, size, b;
+    int32_t offset;
+
+    if((rv = stream_bit(st)) < 0)
+        goto restore;
+
+    if(rv) {
+        if((rv = stream_byte(st)) < 0)
+            goto restore;
+
+        *lit = (uint8_t)rv;
+        PRS_STAT(st->stats, dec_literals, 1);
+        return 1;
+    }
+
+    if((rv = stream_bit(st)) < 0)
+        goto restore;
+
+    if(rv) {
+        if((rv = stream_byte(st)) < 0 || (b = stream_byte(st)) < 0) {
+            rv = -EAGAIN;
+            goto restore;
+        }
+
+        offset = rv | (b << 8);
+
+        if(!offset)
+            return 0;
+
+        size = offset & 0x0007;
+        offset >>= 3;
+
+        if(!size) {
+            if((size = stream_byte(st)) < 0) {
+                rv = size;
+                goto restore;
+            }
+
+            ++size;
+            PRS_STAT(st->stats, dec_long3_copies, 1);
+        }
+        else {
+            size += 2;
+            PRS_STAT(st->stats, dec_long_copies, 1);
+        }
+
+        offset |= 0xFFFFE000;
+    }
+    else {
+        if((rv = stream_bit(st)) < 0 || (b = stream_bit(st)) < 0) {
+            rv = -EAGAIN;
+            goto restore;
+        }
+
+        size = ((rv << 1) | b) + 2;
+
+        if((rv = stream_byte(st)) < 0)
+            goto restore;
+
+        offset = rv | 0xFFFFFF00;
+        PRS_STAT(st->stats, dec_short_copies, 1);
+    }
+
+    PRS_STAT(st->stats, dec_copy_bytes, size);
+    st->copy_len = size;
+    st->copy_offset = offset;
+    return 2;
+
+restore:
+    st->in_pos = in_pos;
+    st->flags = flags;
+    st->bits_left = bits_left;
+    return rv;
+}
+
+int prs_dec_pull(struct prs_dec_state *st, uint8_t *dst, size_t len) {
+    size_t pos = 0;
+    uint8_t b;
+    int rv;
+
+    if(!st || !dst)
+        return -EFAULT;
+
+    if(st->err)
+        return st->err;
+
+    while(pos < len) {
+        /* Finish off any copy that's in progress first. */
+        if(st->copy_len) {
+            /* Make sure the offset is valid. */
+            if((size_t)-st->copy_offset > st->out_total) {
+                st->err = -EBADMSG;
+                return st->err;
+            }
+
+            while(st->copy_len && pos < len) {
+                b = st->window[(st->out_total + st->copy_offset) &
+                               DEC_WINDOW_MASK];
+                st->window[st->out_total++ & DEC_WINDOW_MASK] = b;
+                dst[pos++] = b;
+                --st->copy_len;
+            }
+
+            continue;
+        }
+
+        if(st->done)
+            break;
+
+        if((rv = stream_token(st, &b)) == -EAGAIN) {
+            /* Give back what we have so far, if anything. */
+            if(pos)
+                break;
+
+            return -EAGAIN;
+        }
+        else if(rv == 1) {
+            st->window[st->out_total++ & DEC_WINDOW_MASK] = b;
+            dst[pos++] = b;
+        }
+        else if(!rv) {
+            st->done = 1;
+            PRS_STATS_ADD(st->stats);
+        }
+    }
+
+    return (int)pos;
+}
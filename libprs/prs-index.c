@@ -0,0 +1,250 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/******************************************************************************
+    Indexed PRS Containers
+
+    See prs.h for the layout. Each block is compressed with the same context,
+    so the hash tables only get allocated (and cleared) once no matter how many
+    blocks there are. Everything in the index and footer is read and written a
+    byte at a time, so none of this cares what endianness the machine is.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "prs.h"
+
+#define INDEX_MAGIC         0x49535250      /* "PRSI" */
+#define FOOTER_SIZE         16
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+        ((uint32_t)p[3] << 24);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+int prs_index_compress(const uint8_t *src, uint8_t **dst, size_t src_len,
+                       size_t block_size, int level) {
+    struct prs_comp_ctx *ctx;
+    uint8_t *out, *tmp;
+    size_t count, cap, pos = 0, i, len;
+    int rv;
+
+    if(!src || !dst)
+        return -EFAULT;
+
+    if(!block_size)
+        block_size = PRS_INDEX_BLOCK_DEFAULT;
+
+    if(!src_len || block_size > UINT32_MAX)
+        return -EINVAL;
+
+    /* Everything has to fit in the 32-bit fields of the index, and the size
+       has to fit in what we return. */
+    count = (src_len - 1) / block_size + 1;
+    cap = (count - 1) * prs_max_compressed_size(block_size) +
+        prs_max_compressed_size(src_len - (count - 1) * block_size) +
+        (count + 1) * 4 + FOOTER_SIZE;
+
+    if(src_len > UINT32_MAX || cap > INT_MAX)
+        return -EFBIG;
+
+    if(!(ctx = prs_comp_ctx_new()))
+        return -errno;
+
+    if((rv = prs_comp_ctx_set_level(ctx, level))) {
+        prs_comp_ctx_free(ctx);
+        return rv;
+    }
+
+    if(!(out = (uint8_t *)malloc(cap))) {
+        rv = -errno;
+        prs_comp_ctx_free(ctx);
+        return rv;
+    }
+
+    /* The offsets are kept off to the side until we know where the blocks
+       end, which is where they go. */
+    if(!(tmp = (uint8_t *)malloc((count + 1) * 4))) {
+        rv = -errno;
+        goto out;
+    }
+
+    for(i = 0; i < count; ++i) {
+        len = src_len - i * block_size;
+
+        if(len > block_size)
+            len = block_size;
+
+        put32(tmp + i * 4, (uint32_t)pos);
+
+        if((rv = prs_compress_into(ctx, src + i * block_size, len, out + pos,
+                                   cap - pos)) < 0) {
+            free(tmp);
+            goto out;
+        }
+
+        pos += (size_t)rv;
+    }
+
+    put32(tmp + count * 4, (uint32_t)pos);
+    memcpy(out + pos, tmp, (count + 1) * 4);
+    pos += (count + 1) * 4;
+    free(tmp);
+
+    put32(out + pos, (uint32_t)block_size);
+    put32(out + pos + 4, (uint32_t)src_len);
+    put32(out + pos + 8, (uint32_t)count);
+    put32(out + pos + 12, INDEX_MAGIC);
+    pos += FOOTER_SIZE;
+
+    prs_comp_ctx_free(ctx);
+
+    /* Resize the output (if realloc fails to resize it, then just use the
+       unshortened buffer). */
+    if(!(*dst = (uint8_t *)realloc(out, pos)))
+        *dst = out;
+
+    return (int)pos;
+
+out:
+    free(out);
+    prs_comp_ctx_free(ctx);
+    return rv;
+}
+
+int prs_index_open(struct prs_index *idx, const uint8_t *src, size_t src_len) {
+    const uint8_t *foot;
+    uint32_t block_size, len, count, i, prev, cur;
+    size_t ipos;
+
+    if(!idx || !src)
+        return -EFAULT;
+
+    if(src_len < FOOTER_SIZE + 4)
+        return -EBADMSG;
+
+    foot = src + src_len - FOOTER_SIZE;
+    block_size = get32(foot);
+    len = get32(foot + 4);
+    count = get32(foot + 8);
+
+    if(get32(foot + 12) != INDEX_MAGIC || !block_size || !len ||
+       count != (len - 1) / block_size + 1)
+        return -EBADMSG;
+
+    /* The index sits right before the footer, and ends with where it starts. */
+    if((src_len - FOOTER_SIZE) / 4 < (size_t)count + 1)
+        return -EBADMSG;
+
+    ipos = src_len - FOOTER_SIZE - ((size_t)count + 1) * 4;
+
+    if(get32(src + ipos + (size_t)count * 4) != ipos)
+        return -EBADMSG;
+
+    /* Every block has to be at least as big as the smallest PRS stream, and
+       they have to be in order. */
+    for(i = 0, prev = get32(src + ipos); i < count; ++i, prev = cur) {
+        cur = get32(src + ipos + ((size_t)i + 1) * 4);
+
+        if(cur < prev || cur - prev < 3)
+            return -EBADMSG;
+    }
+
+    if(get32(src + ipos))
+        return -EBADMSG;
+
+    idx->src = src;
+    idx->offsets = src + ipos;
+    idx->block_size = block_size;
+    idx->count = count;
+    idx->len = len;
+    return 0;
+}
+
+int prs_index_read(const struct prs_index *idx, struct prs_arena *scratch,
+                   size_t offset, uint8_t *dst, size_t len) {
+    struct prs_arena tmp = PRS_ARENA_INIT;
+    const uint8_t *blk;
+    size_t blk_len, start, ulen, skip, n, done = 0;
+    uint32_t i;
+    int rv = 0;
+
+    if(!idx || !dst)
+        return -EFAULT;
+
+    if(offset >= idx->len || !len)
+        return 0;
+
+    if(len > idx->len - offset)
+        len = idx->len - offset;
+
+    if(len > INT_MAX)
+        return -EFBIG;
+
+    if(!scratch)
+        scratch = &tmp;
+
+    for(i = (uint32_t)(offset / idx->block_size); done < len; ++i) {
+        blk = idx->src + get32(idx->offsets + (size_t)i * 4);
+        blk_len = get32(idx->offsets + ((size_t)i + 1) * 4) -
+            get32(idx->offsets + (size_t)i * 4);
+        start = (size_t)i * idx->block_size;
+        ulen = idx->len - start < idx->block_size ? idx->len - start :
+            idx->block_size;
+
+        /* Where in this block we want to start, and how much of it. */
+        skip = offset + done - start;
+        n = ulen - skip < len - done ? ulen - skip : len - done;
+
+        if(!skip && n == ulen) {
+            if((rv = prs_decompress_exact(blk, dst + done, blk_len, ulen)) < 0)
+                goto out;
+        }
+        else {
+            if((rv = prs_decompress_arena(scratch, blk, blk_len, ulen)) < 0)
+                goto out;
+
+            if((size_t)rv != ulen) {
+                rv = -EBADMSG;
+                goto out;
+            }
+
+            memcpy(dst + done, scratch->buf + skip, n);
+        }
+
+        done += n;
+    }
+
+    rv = (int)len;
+
+out:
+    prs_arena_free(&tmp);
+    return rv;
+}
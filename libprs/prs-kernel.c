@@ -0,0 +1,527 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/******************************************************************************
+    PRS Kernels
+
+    The compressor spends most of its time comparing candidate matches against
+    the current position, and the decompressor spends most of its time copying
+    back-references. Both of those can go a good bit faster with vector
+    instructions, but which ones are there depends on the CPU, not on what the
+    library was built for. So each set of instructions gets its own version of
+    the two loops, built with the compiler's per-function target support, and
+    the best one that the CPU can actually run is picked the first time either
+    loop is needed. Picking happens only once, no matter how many threads get
+    there at the same time, and prs_kern is only ever touched atomically.
+
+    The PRS_KERNEL environment variable (scalar, sse4.2, avx2 or neon) can be
+    used to pick one by hand instead, for comparing them. Every kernel gives
+    exactly the same results, so switching between them only changes speed.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "prs.h"
+#include "prs-kernel.h"
+
+/* Little-endian machines with the GCC bit-scanning builtins can compare more
+   than one byte at a time, even without vector instructions. */
+#if defined(__GNUC__) && !defined(__BIG_ENDIAN__) && !defined(WORDS_BIGENDIAN) \
+    && !defined(__ARMEB__) && !defined(__AARCH64EB__)
+#define PRS_WORD_COMPARE
+
+/* The x86 kernels are built with target attributes, so they can be used no
+   matter what -march the rest of the library was built for. NEON can't be
+   turned on per-function like that, but it is always there on 64-bit ARM and
+   has to be asked for at build time on 32-bit ARM anyway. */
+#if defined(__x86_64__) || defined(__i386__)
+#define PRS_KERNEL_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define PRS_KERNEL_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/******************************************************************************
+    Scalar kernel
+
+    This is what everything else has to match. It works on any machine, and is
+    the only kernel on machines that don't have any of the others.
+ ******************************************************************************/
+static inline int match_tail(const uint8_t *s1, const uint8_t *s2, int max) {
+    int i = 0;
+
+#ifdef PRS_WORD_COMPARE
+    while(max - i >= 8) {
+        uint64_t a, b;
+
+        memcpy(&a, s1 + i, 8);
+        memcpy(&b, s2 + i, 8);
+
+        if(a != b)
+            return i + (__builtin_ctzll(a ^ b) >> 3);
+
+        i += 8;
+    }
+#endif
+
+    while(i < max && s1[i] == s2[i])
+        ++i;
+
+    return i;
+}
+
+/* Compare the first 8 bytes of a match (or all of it, if it's shorter than
+   that). Returns 8 if they're all the same. */
+static inline int match_head(const uint8_t *s1, const uint8_t *s2, int max) {
+#ifdef PRS_WORD_COMPARE
+    uint64_t a, b;
+
+    if(max >= 8) {
+        memcpy(&a, s1, 8);
+        memcpy(&b, s2, 8);
+        return a != b ? __builtin_ctzll(a ^ b) >> 3 : 8;
+    }
+#endif
+
+    return match_tail(s1, s2, max);
+}
+
+static int match_len_scalar(const uint8_t *s1, const uint8_t *s2, int max) {
+    return match_tail(s1, s2, max);
+}
+
+static void copy_scalar(uint8_t *dst, size_t dist, int len) {
+    const uint8_t *src = dst - dist;
+    int i;
+
+    if(dist >= (size_t)len) {
+        memcpy(dst, src, len);
+    }
+    else if(dist == 1) {
+        /* Runs of a single byte are common enough to be worth it. */
+        memset(dst, src[0], len);
+    }
+    else {
+        /* The copy overlaps itself, so it has to go one byte at a time to
+           repeat the pattern properly. */
+        for(i = 0; i < len; ++i)
+            dst[i] = src[i];
+    }
+}
+
+static const struct prs_kernel kernel_scalar = {
+    "scalar", match_len_scalar, copy_scalar
+};
+
+/* Copy fewer than 16 bytes that don't overlap. Most copies in PRS data are
+   only a few bytes long, and this beats calling memcpy for them. */
+static inline void copy_short(uint8_t *dst, const uint8_t *src, int len) {
+    uint64_t a, b;
+    uint32_t c, d;
+
+    if(len >= 8) {
+        memcpy(&a, src, 8);
+        memcpy(&b, src + len - 8, 8);
+        memcpy(dst, &a, 8);
+        memcpy(dst + len - 8, &b, 8);
+    }
+    else if(len >= 4) {
+        memcpy(&c, src, 4);
+        memcpy(&d, src + len - 4, 4);
+        memcpy(dst, &c, 4);
+        memcpy(dst + len - 4, &d, 4);
+    }
+    else {
+        while(len--)
+            *dst++ = *src++;
+    }
+}
+
+#ifdef PRS_KERNEL_X86
+/******************************************************************************
+    SSE4.2 kernel
+
+    Matches are compared 16 bytes at a time. PCMPESTRI would seem like the
+    obvious thing for that, but it is slower than a plain compare and mask on
+    everything that has it. Copies from at least 16 bytes back go 16 bytes at
+    a time, and long copies from closer than that (which repeat a short
+    pattern) are done by building the pattern in a register with PSHUFB and
+    storing it over and over, rotating it along as it goes.
+ ******************************************************************************/
+
+/* For each distance under 16, the shuffles that repeat the first dist bytes
+   of a register across all 16, and that move a repeated pattern along by 16
+   bytes. */
+static uint8_t pat_first[16][16];
+static uint8_t pat_next[16][16];
+
+static void init_patterns(void) {
+    int d, i;
+
+    for(d = 1; d < 16; ++d) {
+        for(i = 0; i < 16; ++i) {
+            pat_first[d][i] = (uint8_t)(i % d);
+            pat_next[d][i] = (uint8_t)((i + 16) % d);
+        }
+    }
+}
+
+__attribute__((target("sse4.2")))
+static int match_len_sse42(const uint8_t *s1, const uint8_t *s2, int max) {
+    int i;
+    unsigned int m;
+
+    /* Most candidates don't match for long, so check the first few bytes on
+       their own before bothering with the vector registers. */
+    if((i = match_head(s1, s2, max)) < 8)
+        return i;
+
+    while(max - i >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s1 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s2 + i));
+
+        m = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+
+        if(m)
+            return i + __builtin_ctz(m);
+
+        i += 16;
+    }
+
+    return i + match_tail(s1 + i, s2 + i, max - i);
+}
+
+/* Repeat the dist (< 16) bytes before dst to fill len bytes. */
+__attribute__((target("sse4.2")))
+static void copy_pattern_sse42(uint8_t *dst, size_t dist, int len) {
+    uint8_t tmp[16];
+    __m128i v, next;
+    int i = 0;
+
+    /* Only the dist bytes before dst are there to be read, so they go through
+       a buffer on the stack to get them into a register. */
+    memcpy(tmp, dst - dist, dist);
+    v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)tmp),
+                         _mm_loadu_si128((const __m128i *)pat_first[dist]));
+    next = _mm_loadu_si128((const __m128i *)pat_next[dist]);
+
+    for(; len - i >= 16; i += 16) {
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+        v = _mm_shuffle_epi8(v, next);
+    }
+
+    if(i < len) {
+        _mm_storeu_si128((__m128i *)tmp, v);
+        memcpy(dst + i, tmp, len - i);
+    }
+}
+
+__attribute__((target("sse4.2")))
+static void copy_sse42(uint8_t *dst, size_t dist, int len) {
+    const uint8_t *src = dst - dist;
+    int i;
+
+    if(len < 16) {
+        /* Short copies are most of them, and those that overlap themselves
+           are usually only a few bytes long, so they aren't worth setting up
+           a pattern for. */
+        if(dist >= (size_t)len)
+            copy_short(dst, src, len);
+        else
+            for(i = 0; i < len; ++i)
+                dst[i] = src[i];
+    }
+    else if(dist < 16) {
+        copy_pattern_sse42(dst, dist, len);
+    }
+    else {
+        /* None of the 16 byte pieces overlap what they're copied from. The
+           last one is lined up with the end, overlapping the one before it
+           instead of going past the end. */
+        for(i = 0; len - i >= 16; i += 16)
+            _mm_storeu_si128((__m128i *)(dst + i),
+                             _mm_loadu_si128((const __m128i *)(src + i)));
+
+        if(i < len)
+            _mm_storeu_si128((__m128i *)(dst + len - 16),
+                             _mm_loadu_si128((const __m128i *)(src + len - 16)));
+    }
+}
+
+static const struct prs_kernel kernel_sse42 = {
+    "sse4.2", match_len_sse42, copy_sse42
+};
+
+/******************************************************************************
+    AVX2 kernel
+
+    Matches are compared 32 bytes at a time. Copies are left to the SSE4.2
+    code, since PRS copies are at most 256 bytes long (and hardly ever that),
+    so going 32 bytes at a time made them slower, not faster.
+ ******************************************************************************/
+__attribute__((target("avx2")))
+static int match_len_avx2(const uint8_t *s1, const uint8_t *s2, int max) {
+    int i;
+    unsigned int m;
+
+    if((i = match_head(s1, s2, max)) < 8)
+        return i;
+
+    while(max - i >= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(s1 + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s2 + i));
+
+        m = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+
+        if(m)
+            return i + __builtin_ctz(m);
+
+        i += 32;
+    }
+
+    if(max - i >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s1 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s2 + i));
+
+        m = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xFFFF;
+
+        if(m)
+            return i + __builtin_ctz(m);
+
+        i += 16;
+    }
+
+    return i + match_tail(s1 + i, s2 + i, max - i);
+}
+
+static const struct prs_kernel kernel_avx2 = {
+    "avx2", match_len_avx2, copy_sse42
+};
+#endif /* PRS_KERNEL_X86 */
+
+#ifdef PRS_KERNEL_NEON
+/******************************************************************************
+    NEON kernel
+
+    Matches are compared 16 bytes at a time, and copies from at least 16 bytes
+    back go 16 bytes at a time. Overlapping copies are left to the scalar code.
+ ******************************************************************************/
+static int match_len_neon(const uint8_t *s1, const uint8_t *s2, int max) {
+    int i;
+    uint64_t m;
+
+    if((i = match_head(s1, s2, max)) < 8)
+        return i;
+
+    while(max - i >= 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(s1 + i), vld1q_u8(s2 + i));
+
+        /* Narrow the comparison down to four bits per byte, so that the whole
+           thing fits in a 64-bit value we can scan. */
+        m = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(
+                vreinterpretq_u16_u8(eq), 4)), 0) ^ UINT64_C(~0);
+
+        if(m)
+            return i + (__builtin_ctzll(m) >> 2);
+
+        i += 16;
+    }
+
+    return i + match_tail(s1 + i, s2 + i, max - i);
+}
+
+static void copy_neon(uint8_t *dst, size_t dist, int len) {
+    const uint8_t *src = dst - dist;
+    int i;
+
+    if(dist < (size_t)len && dist < 16) {
+        copy_scalar(dst, dist, len);
+    }
+    else if(len < 16) {
+        copy_short(dst, src, len);
+    }
+    else {
+        for(i = 0; len - i >= 16; i += 16)
+            vst1q_u8(dst + i, vld1q_u8(src + i));
+
+        if(i < len)
+            vst1q_u8(dst + len - 16, vld1q_u8(src + len - 16));
+    }
+}
+
+static const struct prs_kernel kernel_neon = {
+    "neon", match_len_neon, copy_neon
+};
+#endif /* PRS_KERNEL_NEON */
+
+/******************************************************************************
+    Picking a kernel
+ ******************************************************************************/
+
+/* Every kernel that was built, best first. */
+static const struct prs_kernel *const kernels[] = {
+#ifdef PRS_KERNEL_X86
+    &kernel_avx2,
+    &kernel_sse42,
+#endif
+#ifdef PRS_KERNEL_NEON
+    &kernel_neon,
+#endif
+    &kernel_scalar,
+    NULL
+};
+
+static int kernel_supported(const struct prs_kernel *k) {
+#ifdef PRS_KERNEL_X86
+    __builtin_cpu_init();
+
+    if(k == &kernel_avx2)
+        return __builtin_cpu_supports("avx2");
+    else if(k == &kernel_sse42)
+        return __builtin_cpu_supports("sse4.2");
+#endif
+
+    (void)k;
+    return 1;
+}
+
+static const struct prs_kernel *find_kernel(const char *name) {
+    int i;
+
+    for(i = 0; kernels[i]; ++i) {
+        if(!strcmp(kernels[i]->name, name))
+            return kernels[i];
+    }
+
+    return NULL;
+}
+
+/* The kernel that gets picked when nobody says otherwise. */
+static const struct prs_kernel *auto_kern;
+
+/* Set up the tables the kernels use and work out auto_kern, going by
+   PRS_KERNEL if it's set. This only ever runs once (see pick_once). */
+static void pick_kernel(void) {
+    const char *name = getenv("PRS_KERNEL");
+    const struct prs_kernel *k;
+    int i;
+
+#ifdef PRS_KERNEL_X86
+    init_patterns();
+#endif
+
+    if(name && *name && strcmp(name, "auto")) {
+        if((k = find_kernel(name)) && kernel_supported(k)) {
+            auto_kern = k;
+            return;
+        }
+
+        fprintf(stderr, "PRS_KERNEL=%s is not available here, ignoring it\n",
+                name);
+    }
+
+    for(i = 0; !kernel_supported(kernels[i]); ++i) ;
+
+    auto_kern = kernels[i];
+}
+
+#ifdef _WIN32
+static INIT_ONCE pick_init = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK pick_kernel_once(PINIT_ONCE once, PVOID param,
+                                      PVOID *ctx) {
+    (void)once;
+    (void)param;
+    (void)ctx;
+    pick_kernel();
+    return TRUE;
+}
+
+static void pick_once(void) {
+    InitOnceExecuteOnce(&pick_init, &pick_kernel_once, NULL, NULL);
+}
+#else
+static pthread_once_t pick_init = PTHREAD_ONCE_INIT;
+
+static void pick_once(void) {
+    pthread_once(&pick_init, &pick_kernel);
+}
+#endif
+
+/* Switch over to the kernel picked for this CPU. Every thread that gets here
+   before the switch is seen sets prs_kern to the same thing, which is fine
+   since it is stored atomically. */
+static const struct prs_kernel *select_kernel(void) {
+    pick_once();
+    PRS_KERN_SET(auto_kern);
+    return auto_kern;
+}
+
+static int match_len_select(const uint8_t *s1, const uint8_t *s2, int max) {
+    return select_kernel()->match_len(s1, s2, max);
+}
+
+static void copy_select(uint8_t *dst, size_t dist, int len) {
+    select_kernel()->copy(dst, dist, len);
+}
+
+static const struct prs_kernel kernel_select = {
+    NULL, match_len_select, copy_select
+};
+
+const struct prs_kernel *prs_kern = &kernel_select;
+
+const char *prs_kernel_name(void) {
+    if(PRS_KERN() == &kernel_select)
+        select_kernel();
+
+    return PRS_KERN()->name;
+}
+
+int prs_set_kernel(const char *name) {
+    const struct prs_kernel *k;
+
+    if(!name || !strcmp(name, "auto")) {
+        PRS_KERN_SET(&kernel_select);
+        return 0;
+    }
+
+    if(!(k = find_kernel(name)))
+        return -EINVAL;
+
+    if(!kernel_supported(k))
+        return -ENOTSUP;
+
+    /* The tables need to be there, whichever kernel this is. */
+    pick_once();
+    PRS_KERN_SET(k);
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYLVERANT__PRS_KERNEL_H
+#define SYLVERANT__PRS_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The inner loops of the compressor and decompressor, which get picked for
+   the CPU that we're running on (see prs_set_kernel in prs.h). This is only
+   for use inside the library. */
+struct prs_kernel {
+    const char *name;
+
+    /* Return how many bytes at s1 and s2 are the same, up to max. */
+    int (*match_len)(const uint8_t *s1, const uint8_t *s2, int max);
+
+    /* Copy len bytes to dst from dist bytes before it. The two are allowed to
+       overlap (dist can be less than len), in which case the pattern repeats
+       just like it would copying a byte at a time. Nothing past dst + len is
+       read or written. */
+    void (*copy)(uint8_t *dst, size_t dist, int len);
+};
+
+/* The kernel in use. Until one is picked, this points at one that picks when
+   it is first used. Any thread can pick it, so it is always read and written
+   with PRS_KERN and PRS_KERN_SET, which also make sure that anything the
+   kernel needs set up is visible along with it. */
+extern const struct prs_kernel *prs_kern;
+
+#ifdef _MSC_VER
+/* Volatile accesses are acquire and release on x86 and x64 with MSVC. */
+#define PRS_KERN()          (*(const struct prs_kernel *volatile *)&prs_kern)
+#define PRS_KERN_SET(k)     (PRS_KERN() = (k))
+#else
+#define PRS_KERN()          __atomic_load_n(&prs_kern, __ATOMIC_ACQUIRE)
+#define PRS_KERN_SET(k)     __atomic_store_n(&prs_kern, (k), __ATOMIC_RELEASE)
+#endif
+
+/* Counting things for prs_stats. Each compression or decompression counts
+   into its own prs_stats, which is only added to the totals (with
+   prs_stats_add) at the end, so the inner loops never have to touch anything
+   shared. Without PRS_STATS, all of this goes away. */
+#ifdef PRS_STATS
+#define PRS_STAT(s, f, n)   ((s).f += (n))
+#define PRS_STATS_ADD(s)    prs_stats_add(&(s))
+#else
+#define PRS_STAT(s, f, n)   ((void)0)
+#define PRS_STATS_ADD(s)    ((void)0)
+#endif
+
+struct prs_stats;
+extern void prs_stats_add(const struct prs_stats *st);
+
+#endif /* !SYLVERANT__PRS_KERNEL_H */
@@ -0,0 +1,135 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/******************************************************************************
+    PRS Statistics
+
+    The totals of the counters that the compressor and decompressor keep when
+    the library is built with PRS_STATS. Every field of prs_stats is a
+    uint64_t, so adding one set of counters into the totals is just a matter of
+    going through it as an array.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#define STATS_ADD(x, v) \
+    InterlockedExchangeAdd64((LONG64 *)&(x), (LONG64)(v))
+#else
+#define STATS_ADD(x, v)     __sync_fetch_and_add(&(x), (v))
+#endif
+
+#include "prs.h"
+#include "prs-kernel.h"
+
+#define STATS_COUNT         (sizeof(struct prs_stats) / sizeof(uint64_t))
+
+static struct prs_stats totals;
+
+void prs_stats_add(const struct prs_stats *st) {
+    const uint64_t *src = (const uint64_t *)st;
+    uint64_t *dst = (uint64_t *)&totals;
+    size_t i;
+
+    for(i = 0; i < STATS_COUNT; ++i) {
+        if(src[i])
+            STATS_ADD(dst[i], src[i]);
+    }
+}
+
+int prs_stats_get(struct prs_stats *st) {
+#ifdef PRS_STATS
+    uint64_t *src = (uint64_t *)&totals;
+    uint64_t *dst = (uint64_t *)st;
+    size_t i;
+
+    /* Adding zero is just an atomic read. */
+    for(i = 0; i < STATS_COUNT; ++i)
+        dst[i] = STATS_ADD(src[i], 0);
+
+    return 0;
+#else
+    memset(st, 0, sizeof(struct prs_stats));
+    return -ENOTSUP;
+#endif
+}
+
+void prs_stats_reset(void) {
+    memset(&totals, 0, sizeof(struct prs_stats));
+}
+
+/* a / b, without falling over when there wasn't anything to count. */
+static double ratio(uint64_t a, uint64_t b) {
+    return b ? (double)a / (double)b : 0.0;
+}
+
+void prs_stats_print(FILE *fp, const struct prs_stats *st) {
+    uint64_t copies = st->short_copies + st->long_copies + st->long3_copies;
+    uint64_t tokens = st->literals + copies;
+    uint64_t dcopies = st->dec_short_copies + st->dec_long_copies +
+        st->dec_long3_copies;
+    uint64_t dtokens = st->dec_literals + dcopies;
+
+    if(tokens || st->searches) {
+        fprintf(fp, "Compression:\n");
+        fprintf(fp, "  chain walks:     %llu (%.1f steps each)\n",
+                (unsigned long long)st->searches,
+                ratio(st->chain_steps, st->searches));
+        fprintf(fp, "  ended by window: %llu\n",
+                (unsigned long long)st->chain_window);
+        fprintf(fp, "  ended by limit:  %llu\n",
+                (unsigned long long)st->chain_limit);
+        fprintf(fp, "  lazy wins:       %llu\n",
+                (unsigned long long)st->lazy_wins);
+        fprintf(fp, "  lazy losses:     %llu\n",
+                (unsigned long long)st->lazy_losses);
+        fprintf(fp, "  literals:        %llu\n",
+                (unsigned long long)st->literals);
+        fprintf(fp, "  short copies:    %llu\n",
+                (unsigned long long)st->short_copies);
+        fprintf(fp, "  long copies:     %llu\n",
+                (unsigned long long)st->long_copies);
+        fprintf(fp, "  long3 copies:    %llu\n",
+                (unsigned long long)st->long3_copies);
+        fprintf(fp, "  bytes per copy:  %.2f\n",
+                ratio(st->copy_bytes, copies));
+        fprintf(fp, "  bytes per token: %.2f\n",
+                ratio(st->copy_bytes + st->literals, tokens));
+    }
+
+    if(dtokens) {
+        fprintf(fp, "Decompression:\n");
+        fprintf(fp, "  literals:        %llu\n",
+                (unsigned long long)st->dec_literals);
+        fprintf(fp, "  short copies:    %llu\n",
+                (unsigned long long)st->dec_short_copies);
+        fprintf(fp, "  long copies:     %llu\n",
+                (unsigned long long)st->dec_long_copies);
+        fprintf(fp, "  long3 copies:    %llu\n",
+                (unsigned long long)st->dec_long3_copies);
+        fprintf(fp, "  bytes per token: %.2f\n",
+                ratio(st->dec_copy_bytes + st->dec_literals, dtokens));
+        fprintf(fp, "  reallocations:   %llu\n",
+                (unsigned long long)st->dec_reallocs);
+    }
+}
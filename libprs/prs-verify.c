@@ -0,0 +1,360 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/******************************************************************************
+    Archive Verification
+
+    The manifest is read in whole and sorted by name, so each file from the
+    archive is found with a binary search. Nothing in it changes after that
+    except each entry's seen flag, and no two threads look at the same file of
+    the archive, so there's no locking at all. Files in a directory are mapped
+    (where that's possible) and compared in place.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "prs-cache.h"
+#include "prs-verify.h"
+
+struct verify_ent {
+    const char *name;
+    uint64_t hash;
+    uint64_t size;
+    int seen;
+};
+
+struct prs_verify {
+    FILE *out;
+    char *dir;
+
+    /* The manifest, and the entries pointing into it. */
+    char *text;
+    struct verify_ent *ents;
+    size_t ent_count;
+
+    /* Each file of the archive, when a manifest is being made. */
+    struct verify_ent *files;
+    uint32_t count;
+};
+
+static int ent_cmp(const void *a, const void *b) {
+    return strcmp(((const struct verify_ent *)a)->name,
+                  ((const struct verify_ent *)b)->name);
+}
+
+/* Read a whole file into a buffer (with a terminator on the end, so that it
+   can be treated as a string). */
+static int read_file(const char *fn, uint8_t **buf, size_t *len) {
+    FILE *fp;
+    long l;
+    uint8_t *rv;
+
+    if(!(fp = fopen(fn, "rb")))
+        return -errno;
+
+    if(fseek(fp, 0, SEEK_END) || (l = ftell(fp)) < 0 ||
+       fseek(fp, 0, SEEK_SET)) {
+        fclose(fp);
+        return -EIO;
+    }
+
+    if(!(rv = (uint8_t *)malloc(l + 1))) {
+        fclose(fp);
+        return -ENOMEM;
+    }
+
+    if(fread(rv, 1, l, fp) != (size_t)l) {
+        free(rv);
+        fclose(fp);
+        return -EIO;
+    }
+
+    fclose(fp);
+    rv[l] = 0;
+    *buf = rv;
+    *len = (size_t)l;
+    return 0;
+}
+
+#ifndef _WIN32
+/* Map a whole file into memory, read-only. An empty file can't be mapped, but
+   there's nothing in it to look at anyway. */
+static int load_file(const char *fn, uint8_t **buf, size_t *len) {
+    struct stat st;
+    void *map = NULL;
+    int fd, rv;
+
+    if((fd = open(fn, O_RDONLY)) < 0)
+        return -errno;
+
+    if(fstat(fd, &st) ||
+       (st.st_size && (map = mmap(NULL, (size_t)st.st_size, PROT_READ,
+                                  MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+        rv = -errno;
+        close(fd);
+        return rv;
+    }
+
+    close(fd);
+    *buf = (uint8_t *)map;
+    *len = (size_t)st.st_size;
+    return 0;
+}
+
+static void unload_file(uint8_t *buf, size_t len) {
+    if(buf)
+        munmap(buf, len);
+}
+#else
+#define load_file read_file
+
+static void unload_file(uint8_t *buf, size_t len) {
+    (void)len;
+    free(buf);
+}
+#endif
+
+/* Split a manifest up into its entries, in place. */
+static int parse_manifest(struct prs_verify *v) {
+    char *line, *next, *end;
+    size_t count = 0;
+
+    /* There can't be any more entries than lines. */
+    for(line = v->text; *line; ++line) {
+        if(*line == '\n')
+            ++count;
+    }
+
+    if(!(v->ents = (struct verify_ent *)calloc(count + 1,
+                                               sizeof(struct verify_ent))))
+        return -ENOMEM;
+
+    for(line = v->text; *line; line = next) {
+        if((next = strchr(line, '\n')))
+            *next++ = 0;
+        else
+            next = line + strlen(line);
+
+        if((end = strchr(line, '\r')))
+            *end = 0;
+
+        if(!*line || *line == '#')
+            continue;
+
+        v->ents[v->ent_count].hash = strtoull(line, &end, 16);
+
+        if(end != line + 16 || *end != ' ')
+            return -EINVAL;
+
+        line = end + 1;
+        v->ents[v->ent_count].size = strtoull(line, &end, 10);
+
+        if(end == line || *end != ' ' || !end[1])
+            return -EINVAL;
+
+        v->ents[v->ent_count++].name = end + 1;
+    }
+
+    qsort(v->ents, v->ent_count, sizeof(struct verify_ent), &ent_cmp);
+    return 0;
+}
+
+int prs_verify_begin(struct prs_verify **v, const char *against,
+                     uint32_t count, FILE *out) {
+    struct prs_verify *rv;
+    struct stat st;
+    size_t len;
+    int err = -ENOMEM;
+
+    if(!(rv = (struct prs_verify *)calloc(1, sizeof(struct prs_verify))))
+        return -ENOMEM;
+
+    rv->out = out;
+    rv->count = count;
+
+    if(!against) {
+        if(!(rv->files = (struct verify_ent *)calloc(count ? count : 1,
+                                                     sizeof(*rv->files))))
+            goto err;
+    }
+    else if(stat(against, &st)) {
+        err = -errno;
+        goto err;
+    }
+    else if((st.st_mode & S_IFMT) == S_IFDIR) {
+        if(!(rv->dir = strdup(against)))
+            goto err;
+    }
+    else if((err = read_file(against, (uint8_t **)&rv->text, &len)) ||
+            (err = parse_manifest(rv))) {
+        goto err;
+    }
+
+    *v = rv;
+    return 0;
+
+err:
+    free(rv->files);
+    free(rv->ents);
+    free(rv->text);
+    free(rv->dir);
+    free(rv);
+    return err;
+}
+
+/* Compare a file from the archive against the one of the same name in the
+   directory. */
+static int verify_dir(struct prs_verify *v, const char *name,
+                      const uint8_t *data, size_t len) {
+    char *path;
+    uint8_t *ref = NULL;
+    size_t ref_len = 0, i;
+    int rv;
+
+    if(!(path = (char *)malloc(strlen(v->dir) + strlen(name) + 2)))
+        return -ENOMEM;
+
+    sprintf(path, "%s/%s", v->dir, name);
+    rv = load_file(path, &ref, &ref_len);
+    free(path);
+
+    if(rv == -ENOENT) {
+        fprintf(v->out, "%s: not in %s\n", name, v->dir);
+        return 1;
+    }
+    else if(rv) {
+        return rv;
+    }
+
+    if(ref_len != len) {
+        fprintf(v->out, "%s: size is %llu, should be %llu\n", name,
+                (unsigned long long)len, (unsigned long long)ref_len);
+        rv = 1;
+    }
+    else if(len && memcmp(data, ref, len)) {
+        for(i = 0; data[i] == ref[i]; ++i) ;
+
+        fprintf(v->out, "%s: differs at byte %llu\n", name,
+                (unsigned long long)i);
+        rv = 1;
+    }
+
+    unload_file(ref, ref_len);
+    return rv;
+}
+
+/* Look a file from the archive up in the manifest, and check that it's the
+   right size and has the right hash. */
+static int verify_manifest(struct prs_verify *v, const char *name,
+                           const uint8_t *data, size_t len) {
+    struct verify_ent key, *ent;
+    uint64_t hash;
+
+    key.name = name;
+
+    if(!(ent = (struct verify_ent *)bsearch(&key, v->ents, v->ent_count,
+                                            sizeof(struct verify_ent),
+                                            &ent_cmp))) {
+        fprintf(v->out, "%s: not in manifest\n", name);
+        return 1;
+    }
+
+    ent->seen = 1;
+
+    if(ent->size != (uint64_t)len) {
+        fprintf(v->out, "%s: size is %llu, should be %llu\n", name,
+                (unsigned long long)len, (unsigned long long)ent->size);
+        return 1;
+    }
+
+    if((hash = prs_xxh64(data, len, 0)) != ent->hash) {
+        fprintf(v->out, "%s: hash is %016llx, should be %016llx\n", name,
+                (unsigned long long)hash, (unsigned long long)ent->hash);
+        return 1;
+    }
+
+    return 0;
+}
+
+int prs_verify_file(struct prs_verify *v, uint32_t i, const char *name,
+                    const uint8_t *data, size_t len) {
+    struct verify_ent *f;
+
+    if(v->dir)
+        return verify_dir(v, name, data, len);
+    else if(v->ents)
+        return verify_manifest(v, name, data, len);
+
+    /* Making a manifest, so just remember what this one looked like. */
+    if(i >= v->count)
+        return -EINVAL;
+
+    f = &v->files[i];
+
+    if(!(f->name = strdup(name)))
+        return -ENOMEM;
+
+    f->hash = prs_xxh64(data, len, 0);
+    f->size = (uint64_t)len;
+    f->seen = 1;
+    return 0;
+}
+
+int prs_verify_end(struct prs_verify *v) {
+    size_t i;
+    int rv = 0;
+
+    for(i = 0; i < v->ent_count; ++i) {
+        if(!v->ents[i].seen) {
+            fprintf(v->out, "%s: not in archive\n", v->ents[i].name);
+            ++rv;
+        }
+    }
+
+    if(v->files) {
+        for(i = 0; i < v->count; ++i) {
+            if(v->files[i].seen)
+                fprintf(v->out, "%016llx %llu %s\n",
+                        (unsigned long long)v->files[i].hash,
+                        (unsigned long long)v->files[i].size,
+                        v->files[i].name);
+
+            free((char *)v->files[i].name);
+        }
+    }
+
+    free(v->files);
+    free(v->ents);
+    free(v->text);
+    free(v->dir);
+    free(v);
+    return rv;
+}
@@ -0,0 +1,65 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYLVERANT__PRS_VERIFY_H
+#define SYLVERANT__PRS_VERIFY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Checking the files in an archive without extracting them.
+
+   The tools hand each file in an archive over as they read (or decompress) it
+   into memory, and it is checked against either the file of the same name in
+   a directory or its line in a manifest. Nothing is ever written to disk.
+
+   A manifest has one line per file: the XXH64 (seed 0) of its contents as 16
+   hex digits, its size in bytes, then its name, all separated by single
+   spaces. Blank lines and lines starting with # are ignored. Leave out what
+   to check against to have a manifest made for the archive instead.
+*/
+struct prs_verify;
+
+/* Start checking count files against the directory or manifest named by
+   against (or NULL, to make a manifest). Problems are reported to out.
+
+   Returns 0 on success, or a negative error code if against can't be read.
+*/
+extern int prs_verify_begin(struct prs_verify **v, const char *against,
+                            uint32_t count, FILE *out);
+
+/* Check file i of the archive, called name, which holds len bytes of data.
+   This can be called from any number of threads at once, as long as each one
+   has a different i.
+
+   Returns 0 if the file is right, 1 if it isn't (after saying why), or a
+   negative error code if the file it should match can't be read.
+*/
+extern int prs_verify_file(struct prs_verify *v, uint32_t i, const char *name,
+                           const uint8_t *data, size_t len);
+
+/* Finish up, and free v. When checking against a manifest, this reports
+   anything in it that wasn't in the archive. When making a manifest, this
+   prints it to out, in the order of the files in the archive.
+
+   Returns how many files were in the manifest but not in the archive.
+*/
+extern int prs_verify_end(struct prs_verify *v);
+
+#endif /* !SYLVERANT__PRS_VERIFY_H */
@@ -0,0 +1,540 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2014 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYLVERANT__PRS_H
+#define SYLVERANT__PRS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compress a buffer with PRS compression.
+
+   This function compresses the data in the src buffer into a new buffer. This
+   function will never produce output larger than that of the prs_archive
+   function, and will usually beat that function rather significantly.
+
+   In testing, the compressed output of this function actually beats Sega's own
+   compression slightly (by 100 bytes or so on an uncompressed version of the
+   ItemPMT.prs from PSO Episode I & II Plus).
+
+   It is the caller's responsibility to free *dst when it is no longer in use.
+
+   Returns a negative value on failure (specifically something from <errno.h>.
+   Returns the size of the compressed output on success.
+*/
+extern int prs_compress(const uint8_t *src, uint8_t **dst, size_t src_len);
+
+/* Compress a buffer with PRS compression, using an optimal parse.
+
+   This function works just like prs_compress, but rather than making its
+   choices greedily it searches out the cheapest possible sequence of literals
+   and copies for the whole buffer, using the actual bit costs of each of them.
+   The output will (almost always) be smaller than that of prs_compress, at the
+   cost of taking longer and using about 8 bytes of scratch memory per byte of
+   input. The output decompresses with any normal PRS decompressor.
+
+   It is the caller's responsibility to free *dst when it is no longer in use.
+
+   Returns a negative value on failure (specifically something from <errno.h>.
+   Returns the size of the compressed output on success.
+*/
+extern int prs_compress_optimal(const uint8_t *src, uint8_t **dst,
+                                size_t src_len);
+
+/* Compression levels, trading speed for size.
+
+   Level 0 doesn't compress at all (it is prs_archive). Levels 1 to 7 pick
+   matches greedily: each keeps the longest match among the nearest so many
+   candidates, and stops looking early once it has one that is long enough.
+   That goes from 4 candidates and 16 bytes at level 1 up to 8192 candidates
+   and the longest match possible at level 7, and no level looks less far
+   than the one before it. Levels 4 to 7 also check whether waiting a byte
+   finds a better match, and levels 8 and 9 use the optimal parser.
+   PRS_LEVEL_DEFAULT is what prs_compress does and PRS_LEVEL_MAX is what
+   prs_compress_optimal does.
+
+   On the generated corpus that prs-bench uses, with one core of a recent x86
+   machine, they come out to about:
+
+   level       0      1      2      3      4      5      6      7      8      9
+   MB/s      360     66     60     53     34     29     27     24    1.6    0.5
+   ratio  1.1250 .52176 .51510 .51268 .50532 .50463 .50458 .50458 .49375 .49334
+
+   The ratio is compressed size over uncompressed size. Nothing in that corpus
+   has enough candidates within the window to tell levels 6 and 7 apart; they
+   only differ on data with long runs of similar records. Run make bench to see
+   what they look like on your own machine.
+*/
+#define PRS_LEVEL_MIN       0
+#define PRS_LEVEL_DEFAULT   6
+#define PRS_LEVEL_OPTIMAL   8   /* The first level using the optimal parser */
+#define PRS_LEVEL_MAX       9
+
+/* Compress a buffer with PRS compression, at a given level.
+
+   This function works just like prs_compress, but lets you pick how hard it
+   tries (see above). Levels 8 and 9 use the same scratch memory that
+   prs_compress_optimal does.
+
+   It is the caller's responsibility to free *dst when it is no longer in use.
+
+   Returns a negative value on failure (specifically something from <errno.h>,
+   -EINVAL if the level is out of range). Returns the size of the compressed
+   output on success.
+*/
+extern int prs_compress_level(const uint8_t *src, uint8_t **dst,
+                              size_t src_len, int level);
+
+/* Reusable compression context. This is opaque, so use prs_comp_ctx_new to
+   get one and prs_comp_ctx_free to clean it up. */
+struct prs_comp_ctx;
+
+/* Create a new compression context.
+
+   A compression context holds on to the hash tables and output buffer used
+   while compressing, so that compressing many buffers in a row doesn't have to
+   allocate them each time. A context may only be used by one thread at a time,
+   so give each thread its own.
+
+   Returns NULL on failure (with errno set, presumably to ENOMEM).
+*/
+extern struct prs_comp_ctx *prs_comp_ctx_new(void);
+
+/* Reset a compression context.
+
+   This makes the context forget about anything it has compressed before. It
+   doesn't actually clear anything out, so it is cheap to call. Every function
+   that compresses with a context already does this itself, so there's no need
+   to call it between buffers.
+*/
+extern void prs_comp_ctx_reset(struct prs_comp_ctx *ctx);
+
+/* Set the level a compression context compresses at.
+
+   This applies to everything compressed with the context afterwards. New
+   contexts start out at PRS_LEVEL_DEFAULT.
+
+   Returns -EINVAL if the level is out of range, 0 on success.
+*/
+extern int prs_comp_ctx_set_level(struct prs_comp_ctx *ctx, int level);
+
+/* Free a compression context, along with its output buffer. */
+extern void prs_comp_ctx_free(struct prs_comp_ctx *ctx);
+
+/* Compress a buffer with PRS compression into memory owned by the caller.
+
+   This function works just like prs_compress_ctx, except that the output goes
+   into the dst_len bytes at dst instead of a buffer owned by the context.
+   Passing a buffer of prs_max_compressed_size(src_len) bytes guarantees that
+   it will fit. The context's own output buffer is never touched.
+
+   Returns a negative value on failure (specifically something from <errno.h>,
+   -ENOSPC if the output didn't fit). Returns the size of the compressed output
+   on success.
+*/
+extern int prs_compress_into(struct prs_comp_ctx *ctx, const uint8_t *src,
+                             size_t src_len, uint8_t *dst, size_t dst_len);
+
+/* Compress a buffer with PRS compression, using a compression context.
+
+   This function works just like prs_compress_level at the context's level (and
+   produces the same output), except that the output is put in a buffer owned
+   by the context. *dst is set
+   to point at that buffer, which is only valid until the next call using the
+   same context. Do not free it.
+
+   Returns a negative value on failure (specifically something from <errno.h>.
+   Returns the size of the compressed output on success.
+*/
+extern int prs_compress_ctx(struct prs_comp_ctx *ctx, const uint8_t *src,
+                            size_t src_len, const uint8_t **dst);
+
+/* Compress one block of a larger buffer with PRS compression.
+
+   This function compresses the src_len bytes at src into a PRS stream of its
+   own, using a compression context just like prs_compress_ctx does. The
+   prime_len bytes immediately before src (of which only the last 8KiB
+   matter) are used to prime the compressor, so that the block can still refer
+   back into them. This allows a large buffer to be split up into blocks that
+   get compressed on separate threads, then put back together with prs_stitch.
+
+   The resulting stream is only really useful for passing to prs_stitch, since
+   it refers to data that isn't in it (unless prime_len is 0, in which case it
+   is exactly what prs_compress_ctx would produce).
+
+   Returns a negative value on failure (specifically something from <errno.h>.
+   Returns the size of the compressed output on success.
+*/
+extern int prs_compress_block(struct prs_comp_ctx *ctx, const uint8_t *src,
+                              size_t prime_len, size_t src_len,
+                              const uint8_t **dst);
+
+/* Join a set of PRS streams together into one.
+
+   This function takes count PRS streams, each of which was produced by
+   prs_compress_block on consecutive blocks of the same buffer, and joins them
+   into one stream (with only one end marker) in a newly allocated buffer.
+
+   It is the caller's responsibility to free *dst when it is no longer in use.
+
+   Returns a negative value on failure (specifically something from <errno.h>.
+   Returns the size of the joined output on success.
+*/
+extern int prs_stitch(const uint8_t *const *srcs, const size_t *lens,
+                      int count, uint8_t **dst);
+
+/* Compress a stream with PRS compression.
+
+   This function compresses everything that can be read from the in file and
+   writes the compressed data to the out file as it goes. The output is the
+   same sort of thing that prs_compress puts out, but the input doesn't need to
+   be in memory all at once (or even be seekable, so pipes work fine). Memory
+   use is fixed at a bit under 600KiB, no matter how big the input is.
+
+   Returns a negative value on failure (specifically something from <errno.h>.
+   Returns 0 on success.
+*/
+extern int prs_compress_stream(FILE *in, FILE *out);
+
+/* Compress a stream with PRS compression, at a given level.
+
+   This function works just like prs_compress_stream, but at the given level.
+   Levels 8 and 9 need about 512KiB more memory, for the optimal parser's
+   scratch space, and can do a tiny bit worse than prs_compress_level since
+   they only see a block at a time.
+
+   Returns a negative value on failure (specifically something from <errno.h>,
+   -EINVAL if the level is out of range). Returns 0 on success.
+*/
+extern int prs_compress_stream_level(FILE *in, FILE *out, int level);
+
+/* Archive a buffer in PRS format.
+
+   This function archives the data in the src buffer into a new buffer. This
+   function will always produce output that is larger in size than the input
+   data (it does not actually compress the output. There's probably no good
+   reason to ever use this, but it is here if you want it for some reason.
+
+   All the notes about parameters and return values from prs_compress also apply
+   to this function. The size of the output from this function will be equal to
+   the return value of prs_max_compressed_size when called on the same length.
+*/
+extern int prs_archive(const uint8_t *src, uint8_t **dst, size_t src_len);
+
+/* Return the maximum size of archiving a buffer in PRS format.
+
+   This function returns the size that prs_archive will spit out. This is used
+   internally to allocate memory for prs_archive and prs_compress and probably
+   has little utility outside of that.
+*/
+extern size_t prs_max_compressed_size(size_t len);
+
+/* Decompress a PRS archive from a file.
+
+   This function opens the file specified and decompresses the data from the
+   file into a newly allocated memory buffer.
+
+   It is the caller's responsibility to free *dst when it is no longer in use.
+
+   Returns a negative value on failure (specifically something from <errno.h>).
+   Returns the size of the decompressed output on success.
+*/
+extern int prs_decompress_file(const char *fn, uint8_t **dst);
+
+/* Decompress PRS-compressed data from a memory buffer.
+
+   This function decompresses PRS-compressed data from the src buffer into a
+   newly allocated memory buffer.
+
+   It is the caller's responsibility to free *dst when it is no longer in use.
+
+   Returns a negative value on failure (specifically something from <errno.h>).
+   Returns the size of the decompressed output on success.
+*/
+extern int prs_decompress_buf(const uint8_t *src, uint8_t **dst,
+                              size_t src_len);
+
+/* Decompress PRS-compressed data from a memory buffer into a previously
+   allocated memory buffer.
+
+   This function decompresses PRS-compressed data from the src buffer into the
+   previously allocated allocated memory buffer dst. You must have already
+   allocated the buffer at dst, and it should be at least the size returned by
+   prs_decompress_size on the compressed input (otherwise, you will get an error
+   back from the function).
+
+   Returns a negative value on failure (specifically something from <errno.h>).
+   Returns the size of the decompressed output on success.
+*/
+extern int prs_decompress_buf2(const uint8_t *src, uint8_t *dst, size_t src_len,
+                               size_t dst_len);
+
+/* Decompress PRS-compressed data from a memory buffer into a previously
+   allocated memory buffer of exactly the right size.
+
+   This function works like prs_decompress_buf2, but is meant for when the size
+   of the decompressed data is already known (from a BML entry or a quest file
+   header, for instance), so there is no need to call prs_decompress_size first.
+   The data must decompress to exactly dst_len bytes, anything else is treated
+   as an error.
+
+   Returns a negative value on failure (specifically something from <errno.h>).
+   Returns the size of the decompressed output (dst_len) on success.
+*/
+extern int prs_decompress_exact(const uint8_t *src, uint8_t *dst,
+                                size_t src_len, size_t dst_len);
+
+/* Scratch space for decompressing many things in a row. Set both members to
+   zero (or use PRS_ARENA_INIT) before the first use. */
+struct prs_arena {
+    uint8_t *buf;
+    size_t size;
+};
+
+#define PRS_ARENA_INIT { NULL, 0 }
+
+/* Decompress PRS-compressed data from a memory buffer into an arena.
+
+   This function decompresses PRS-compressed data from the src buffer into the
+   arena's buffer, growing it as needed. The buffer is not shrunk afterwards,
+   so after the first few calls there is usually no allocation to be done at
+   all. If you know about how big the output will be, pass it as size_hint
+   (otherwise pass 0).
+
+   The decompressed data is at arena->buf, and is only valid until the next
+   call using the same arena. Use prs_arena_free to clean up the arena when
+   you're done with it.
+
+   Returns a negative value on failure (specifically something from <errno.h>).
+   Returns the size of the decompressed output on success.
+*/
+extern int prs_decompress_arena(struct prs_arena *arena, const uint8_t *src,
+                                size_t src_len, size_t size_hint);
+
+/* Free the memory held by an arena, leaving it ready to be used again. */
+extern void prs_arena_free(struct prs_arena *arena);
+
+/* Incremental decompression state. This is opaque, so use prs_dec_new to get
+   one and prs_dec_free to clean it up. */
+struct prs_dec_state;
+
+/* Create a new incremental decompression state.
+
+   The state takes up a bit over 12KiB of memory (an 8KiB window of the output
+   plus a 4KiB input buffer), no matter how big the data being decompressed is.
+
+   Returns NULL on failure (with errno set, presumably to ENOMEM).
+*/
+extern struct prs_dec_state *prs_dec_new(void);
+
+/* Reset an incremental decompression state to start on a new stream. */
+extern void prs_dec_reset(struct prs_dec_state *st);
+
+/* Free an incremental decompression state. */
+extern void prs_dec_free(struct prs_dec_state *st);
+
+/* Feed compressed data to an incremental decompression state.
+
+   This copies as much of the data at src as will fit into the state's input
+   buffer. If not all of it fits, call prs_dec_pull to use some of it up and
+   then feed the rest. Anything fed after the end of the compressed data has
+   been reached is accepted and ignored.
+
+   Returns a negative value on failure (specifically something from <errno.h>).
+   Returns the number of bytes accepted on success.
+*/
+extern int prs_dec_feed(struct prs_dec_state *st, const uint8_t *src,
+                        size_t len);
+
+/* Pull decompressed data out of an incremental decompression state.
+
+   This decompresses as much as it can (up to len bytes) of the data fed in so
+   far into dst.
+
+   Returns -EAGAIN if no output could be produced until more input is fed in,
+   another negative value (from <errno.h>) on failure, 0 once the end of the
+   compressed data has been reached and all output has been pulled, or the
+   number of bytes written to dst otherwise. If you run out of input while
+   this is still returning -EAGAIN, the compressed data was truncated.
+*/
+extern int prs_dec_pull(struct prs_dec_state *st, uint8_t *dst, size_t len);
+
+/* Determine the size that the PRS-compressed data in a buffer will expand to.
+
+   This function essentially decompresses the PRS-compressed data from the src
+   buffer without writing any output. By doing this, it determines the actual
+   size of the decompressed output and returns it.
+
+   Returns a negative value on failure (specifically something from <errno.h>).
+   Returns the size of the decompressed output on success.
+*/
+extern int prs_decompress_size(const uint8_t *src, size_t src_len);
+
+/* Indexed PRS containers.
+
+   Getting at anything in a PRS stream means decompressing everything before
+   it. For big tables that only ever get read a piece at a time (on the server
+   side, anyway), that's a lot of wasted work. An indexed container splits the
+   data into blocks of a fixed size and compresses each one as its own PRS
+   stream, followed by an index of where each one starts. Reading any range of
+   the data then only means decompressing the blocks that cover it.
+
+   The game itself knows nothing about these, so never use them for anything
+   sent to a client. Everything is little-endian:
+
+     blocks       each one a normal PRS stream, in order
+     offsets      u32 per block, where it starts, plus one for the end of the
+                  last one (which is where the offsets start)
+     footer       u32 block size, u32 uncompressed length, u32 block count,
+                  u32 magic ("PRSI")
+
+   Smaller blocks make reading small pieces cheaper, but compress worse, since
+   nothing can refer back past the start of its own block.
+*/
+#define PRS_INDEX_BLOCK_DEFAULT 0x10000
+
+/* Compress a buffer into an indexed container, with blocks of block_size
+   bytes (0 for PRS_INDEX_BLOCK_DEFAULT), each compressed at the given level.
+
+   It is the caller's responsibility to free *dst when it is no longer in use.
+
+   Returns a negative value on failure (specifically something from <errno.h>,
+   -EINVAL if the level is out of range). Returns the size of the container on
+   success.
+*/
+extern int prs_index_compress(const uint8_t *src, uint8_t **dst,
+                              size_t src_len, size_t block_size, int level);
+
+/* An indexed container that has been checked over by prs_index_open. This
+   points into the container, so it has to stay around as long as this does.
+   len is how much data is in it once it is decompressed. */
+struct prs_index {
+    const uint8_t *src;
+    const uint8_t *offsets;
+    uint32_t block_size;
+    uint32_t count;
+    size_t len;
+};
+
+/* Check that a buffer holds an indexed container, and set up idx to read from
+   it. Only the index is looked at, so this is cheap no matter how big the
+   container is.
+
+   Returns 0 on success, or -EBADMSG if it isn't a container (or is damaged).
+*/
+extern int prs_index_open(struct prs_index *idx, const uint8_t *src,
+                          size_t src_len);
+
+/* Read len bytes, starting at offset, out of an indexed container.
+
+   Only the blocks that cover the range are decompressed. Blocks that are
+   entirely inside it go straight into dst, the (at most two) that are only
+   partly in it are decompressed into scratch first. Pass NULL for scratch to
+   use a temporary arena that is freed before returning. This can be called
+   from any number of threads at once, as long as each has its own scratch.
+
+   Returns a negative value on failure (specifically something from <errno.h>).
+   Returns the number of bytes read on success, which is only less than len if
+   the range goes past the end of the data.
+*/
+extern int prs_index_read(const struct prs_index *idx,
+                          struct prs_arena *scratch, size_t offset,
+                          uint8_t *dst, size_t len);
+
+/* Counters from inside the compressor and decompressor.
+
+   These are for figuring out why a particular file compresses the way it
+   does, and what the level settings are doing with it. Counting things in the
+   inner loops isn't free, so they are only kept if libprs was built with
+   PRS_STATS defined (make STATS=1, after a make clean). The totals are for
+   every thread, since the program started or prs_stats_reset was called.
+
+   Each call adds its counts in when it finishes, apart from the streaming
+   decoder, which adds them in once it reaches the end of the data. prs_stitch
+   isn't counted, since the blocks it joins already were.
+*/
+struct prs_stats {
+    /* Compressor: hash chain walks started, how many entries they looked at in
+       total, and how many of them were ended by the edge of the window or by
+       the level's limit on how far to look. */
+    uint64_t searches;
+    uint64_t chain_steps;
+    uint64_t chain_window;
+    uint64_t chain_limit;
+
+    /* Compressor: how often waiting a byte for a better match did (and didn't)
+       pay off, at the levels that check. */
+    uint64_t lazy_wins;
+    uint64_t lazy_losses;
+
+    /* Compressor: the tokens written out, and the bytes covered by copies. A
+       long copy is two bytes, or three when it needs a separate length byte
+       (the "long3" ones). */
+    uint64_t literals;
+    uint64_t short_copies;
+    uint64_t long_copies;
+    uint64_t long3_copies;
+    uint64_t copy_bytes;
+
+    /* Decompressor: the same for the tokens read, plus how many times a buffer
+       that was too small had to be reallocated. */
+    uint64_t dec_literals;
+    uint64_t dec_short_copies;
+    uint64_t dec_long_copies;
+    uint64_t dec_long3_copies;
+    uint64_t dec_copy_bytes;
+    uint64_t dec_reallocs;
+};
+
+/* Get the counters so far.
+
+   Returns -ENOTSUP (with *st zeroed) if the library was built without
+   PRS_STATS, 0 on success.
+*/
+extern int prs_stats_get(struct prs_stats *st);
+
+/* Zero out the counters. Don't call this while another thread is compressing
+   or decompressing. */
+extern void prs_stats_reset(void);
+
+/* Print out the counters in a human readable form, along with a few things
+   worked out from them (like the average number of bytes per token). */
+extern void prs_stats_print(FILE *fp, const struct prs_stats *st);
+
+/* Choose the kernels that do the heavy lifting.
+
+   The compressor's match finding and the decompressor's copying each come in
+   a few versions, for different sets of vector instructions: "scalar" (which
+   works everywhere), "sse4.2" and "avx2" on x86, and "neon" on ARM. All of
+   them produce exactly the same output. By default, the fastest one that the
+   CPU supports is used, unless the PRS_KERNEL environment variable names
+   another one. This function overrides both of those. Passing NULL or "auto"
+   goes back to the default.
+
+   Don't call this while another thread is compressing or decompressing.
+
+   Returns 0 on success, -EINVAL if name isn't a kernel this library has, or
+   -ENOTSUP if the CPU can't run it.
+*/
+extern int prs_set_kernel(const char *name);
+
+/* Return the name of the kernels in use (as passed to prs_set_kernel). */
+extern const char *prs_kernel_name(void);
+
+#endif /* !SYLVERANT__PRS_H */
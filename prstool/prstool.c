@@ -20,11 +20,20 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "prs.h"
 
 static const char *in_file, *out_file;
 static int operation = 0;
+static int threads = 1;
+static size_t block_size = 0;
+static int ranged = 0;
+static size_t range_start, range_len;
+static int compare = 0;
+static int level = PRS_LEVEL_DEFAULT;
+static int stats = 0;
 
 /* Print information about this program to stdout. */
 static void print_program_info(void) {
@@ -50,12 +59,41 @@ static void print_program_info(void) {
 
 /* Print help to the user to stdout. */
 static void print_help(const char *bin) {
-    printf("Usage: %s arguments [input_file] [output_file]\n"
+    printf("Usage: %s arguments [options] [input_file] [output_file]\n"
            "-----------------------------------------------------------------\n"
            "--help          Print this help and exit\n"
            "--version       Print version info and exit\n"
            "-x              Decompress input_file into output_file\n"
-           "-c              Compress input_file into output_file\n", bin);
+           "-c              Compress input_file into output_file\n"
+           "-O              Compress input_file into output_file, using the\n"
+           "                (slower) optimal parser for smaller output\n"
+           "                (the same as -c -9)\n"
+           "-i              Compress input_file into an indexed container,\n"
+           "                which can be read from at any point without\n"
+           "                decompressing all of it (but which nothing in the\n"
+           "                game can read)\n\n"
+           "Options for -c (and for -i, apart from -j and --compare):\n"
+           "-0 ... -9       Compression level, from 0 (no compression at\n"
+           "                all) through 9 (smallest, and by far the\n"
+           "                slowest). The default is 6. Levels 8 and 9 use\n"
+           "                the optimal parser\n"
+           "-j N            Split the input into blocks and compress them on\n"
+           "                N threads at once\n"
+           "-b KiB          Size of each block for -j (default 1024), or\n"
+           "                how often -i starts a new block (default 64)\n"
+           "--compare       With -j, also compress the input in one piece and\n"
+           "                print how much bigger the threaded output is\n\n"
+           "Options for -x:\n"
+           "--range S L     Only decompress L bytes starting at S (only for\n"
+           "                indexed containers)\n\n"
+           "Options for -c, -i and -x:\n"
+           "--stats         Print counters from inside the compressor or\n"
+           "                decompressor to stderr when done (only if libprs\n"
+           "                was built with make STATS=1)\n\n"
+           "Either file may be given as - to use stdin or stdout instead.\n"
+           "Set PRS_KERNEL to scalar, sse4.2, avx2 or neon to override the\n"
+           "choice of code used for this CPU.\n",
+           bin);
 }
 
 /* Parse any command-line arguments passed in. */
@@ -74,8 +112,8 @@ static void parse_command_line(int argc, char *argv[]) {
         }
     }
 
-    /* Otherwise, we need exactly 4 arguments, so bail if we have more. */
-    if(argc != 4) {
+    /* Otherwise, we need at least 4 arguments, so bail if we have less. */
+    if(argc < 4) {
         print_help(argv[0]);
         exit(EXIT_FAILURE);
     }
@@ -87,26 +125,146 @@ static void parse_command_line(int argc, char *argv[]) {
     else if(!strcmp(argv[1], "-c")) {
         operation = 1;
     }
+    else if(!strcmp(argv[1], "-O")) {
+        operation = 1;
+        level = PRS_LEVEL_MAX;
+    }
+    else if(!strcmp(argv[1], "-i")) {
+        operation = 3;
+    }
     else {
-        printf("Illegal command line argument: %s\n", argv[i]);
+        printf("Illegal command line argument: %s\n", argv[1]);
         print_help(argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    /* Anything between the operation and the files is an option, which
+       (other than --stats) only compression knows about. */
+    for(i = 2; i < argc - 2; ++i) {
+        if(!strcmp(argv[i], "--stats")) {
+            stats = 1;
+        }
+        else if(operation == 1 && !strcmp(argv[i], "-j") &&
+                i + 1 < argc - 2) {
+            if((threads = atoi(argv[++i])) < 1) {
+                printf("Invalid thread count: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(operation != 2 && !strcmp(argv[i], "-b") && i + 1 < argc - 2) {
+            if((block_size = (size_t)atoi(argv[++i]) * 1024) < 1) {
+                printf("Invalid block size: %s\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if(operation == 1 && !strcmp(argv[i], "--compare")) {
+            compare = 1;
+        }
+        else if(operation == 2 && !strcmp(argv[i], "--range") &&
+                i + 2 < argc - 2) {
+            ranged = 1;
+            range_start = (size_t)strtoul(argv[++i], NULL, 0);
+            range_len = (size_t)strtoul(argv[++i], NULL, 0);
+        }
+        else if(operation != 2 && argv[i][0] == '-' && argv[i][1] >= '0' &&
+                argv[i][1] <= '9' && !argv[i][2]) {
+            level = argv[i][1] - '0';
+        }
+        else {
+            printf("Illegal command line argument: %s\n", argv[i]);
+            print_help(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(!block_size)
+        block_size = operation == 3 ? PRS_INDEX_BLOCK_DEFAULT : 1024 * 1024;
+
     /* Save the files we'll be working with. */
-    in_file = argv[2];
-    out_file = argv[3];
+    in_file = argv[argc - 2];
+    out_file = argv[argc - 1];
 }
 
-static uint8_t *read_input(long *len) {
+static FILE *open_input(void) {
     FILE *ifp;
-    uint8_t *rv;
+
+    if(!strcmp(in_file, "-"))
+        return stdin;
 
     if(!(ifp = fopen(in_file, "rb"))) {
         perror("");
         exit(EXIT_FAILURE);
     }
 
+    return ifp;
+}
+
+static FILE *open_output(void) {
+    FILE *ofp;
+
+    if(!strcmp(out_file, "-"))
+        return stdout;
+
+    if(!(ofp = fopen(out_file, "wb"))) {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    return ofp;
+}
+
+static void close_output(FILE *ofp) {
+    if(ofp == stdout) {
+        if(fflush(ofp)) {
+            perror("");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if(fclose(ofp)) {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static uint8_t *read_input(long *len) {
+    FILE *ifp;
+    uint8_t *rv, *tmp;
+    size_t sz = 0, alloc = 0x10000, got;
+
+    ifp = open_input();
+
+    /* If we're reading from a pipe, we can't figure out how big things are in
+       advance, so just keep growing the buffer until we hit the end. */
+    if(ifp == stdin) {
+        if(!(rv = malloc(alloc))) {
+            perror("");
+            exit(EXIT_FAILURE);
+        }
+
+        while((got = fread(rv + sz, 1, alloc - sz, ifp)) > 0) {
+            sz += got;
+
+            if(sz == alloc) {
+                alloc *= 2;
+
+                if(!(tmp = realloc(rv, alloc))) {
+                    perror("");
+                    exit(EXIT_FAILURE);
+                }
+
+                rv = tmp;
+            }
+        }
+
+        if(ferror(ifp)) {
+            perror("");
+            exit(EXIT_FAILURE);
+        }
+
+        *len = (long)sz;
+        return rv;
+    }
+
     /* Figure out the length of the file. */
     if(fseek(ifp, 0, SEEK_END)) {
         perror("");
@@ -143,25 +301,142 @@ static uint8_t *read_input(long *len) {
 static void write_output(int len, const uint8_t *buf) {
     FILE *ofp;
 
-    if(!(ofp = fopen(out_file, "wb"))) {
+    ofp = open_output();
+
+    if(fwrite(buf, 1, len, ofp) != len) {
         perror("");
         exit(EXIT_FAILURE);
     }
 
-    if(fwrite(buf, 1, len, ofp) != len) {
+    close_output(ofp);
+}
+
+/* Decompress from stdin, writing out the data as we go along, since we won't
+   know how much of it there is until we get to the end. */
+static void decompress_stream(void) {
+    struct prs_dec_state *st;
+    uint8_t ibuf[1024], obuf[8192];
+    size_t ilen = 0, ipos = 0;
+    int rv, eof = 0;
+    FILE *ofp;
+
+    if(!(st = prs_dec_new())) {
         perror("");
         exit(EXIT_FAILURE);
     }
 
-    fclose(ofp);
+    ofp = open_output();
+
+    for(;;) {
+        /* Feed in more data, if we have it. */
+        if(ipos == ilen && !eof) {
+            ilen = fread(ibuf, 1, sizeof(ibuf), stdin);
+            ipos = 0;
+
+            if(ilen < sizeof(ibuf)) {
+                if(ferror(stdin)) {
+                    perror("");
+                    exit(EXIT_FAILURE);
+                }
+
+                eof = 1;
+            }
+        }
+
+        if(ipos < ilen) {
+            if((rv = prs_dec_feed(st, ibuf + ipos, ilen - ipos)) < 0)
+                goto err;
+
+            ipos += rv;
+        }
+
+        if((rv = prs_dec_pull(st, obuf, sizeof(obuf))) == -EAGAIN) {
+            /* If there's nothing more to give it, the data was truncated. */
+            if(eof && ipos == ilen) {
+                rv = -EBADMSG;
+                goto err;
+            }
+
+            continue;
+        }
+        else if(rv < 0) {
+            goto err;
+        }
+        else if(!rv) {
+            break;
+        }
+
+        if(fwrite(obuf, 1, rv, ofp) != (size_t)rv) {
+            perror("");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    close_output(ofp);
+    prs_dec_free(st);
+    return;
+
+err:
+    fprintf(stderr, "decompress: %s\n", strerror(-rv));
+    exit(EXIT_FAILURE);
+}
+
+/* Decompress (part of) an indexed container. */
+static int decompress_index(const struct prs_index *idx, uint8_t **dst) {
+    size_t start = 0, len = idx->len;
+
+    if(ranged) {
+        if(range_start > idx->len) {
+            fprintf(stderr, "decompress: range starts past the end of the "
+                    "data (%lu bytes)\n", (unsigned long)idx->len);
+            exit(EXIT_FAILURE);
+        }
+
+        start = range_start;
+        len = range_len < idx->len - start ? range_len : idx->len - start;
+    }
+
+    /* Add one, so that an empty range doesn't look like a failed malloc. */
+    if(!(*dst = (uint8_t *)malloc(len + 1))) {
+        perror("");
+        exit(EXIT_FAILURE);
+    }
+
+    return prs_index_read(idx, NULL, start, *dst, len);
 }
 
 static void decompress(void) {
-    uint8_t *buf;
+    struct prs_index idx;
+    uint8_t *cmp, *buf;
+    long cmp_len;
     int len;
 
-    /* Decompress the file. */
-    if((len = prs_decompress_file(in_file, &buf)) < 0) {
+    if(!strcmp(in_file, "-")) {
+        if(ranged) {
+            fprintf(stderr, "decompress: --range can't read from stdin\n");
+            exit(EXIT_FAILURE);
+        }
+
+        decompress_stream();
+        return;
+    }
+
+    cmp = read_input(&cmp_len);
+
+    /* Decompress the file, whichever kind it is. */
+    if(!prs_index_open(&idx, cmp, (size_t)cmp_len)) {
+        len = decompress_index(&idx, &buf);
+    }
+    else if(ranged) {
+        fprintf(stderr, "decompress: --range only works on indexed "
+                "containers\n");
+        exit(EXIT_FAILURE);
+    }
+    else {
+        len = prs_decompress_buf(cmp, &buf, (size_t)cmp_len);
+    }
+
+    if(len < 0) {
         fprintf(stderr, "decompress: %s\n", strerror(-len));
         exit(EXIT_FAILURE);
     }
@@ -171,6 +446,174 @@ static void decompress(void) {
 
     /* Clean up. */
     free(buf);
+    free(cmp);
+}
+
+/* Compress the whole file into an indexed container. */
+static void compress_index(void) {
+    long unc_len;
+    uint8_t *unc, *cmp;
+    int cmp_len;
+
+    unc = read_input(&unc_len);
+
+    if((cmp_len = prs_index_compress(unc, &cmp, (size_t)unc_len, block_size,
+                                     level)) < 0) {
+        fprintf(stderr, "compress: %s\n", strerror(-cmp_len));
+        exit(EXIT_FAILURE);
+    }
+
+    write_output(cmp_len, cmp);
+
+    free(cmp);
+    free(unc);
+}
+
+/* Compress a block at a time, so that we don't need to have the whole file in
+   memory (and so we can work on pipes). */
+static void compress_stream(void) {
+    FILE *ifp, *ofp;
+    int rv;
+
+    ifp = open_input();
+    ofp = open_output();
+
+    if((rv = prs_compress_stream_level(ifp, ofp, level)) < 0) {
+        fprintf(stderr, "compress: %s\n", strerror(-rv));
+        exit(EXIT_FAILURE);
+    }
+
+    if(ifp != stdin)
+        fclose(ifp);
+
+    close_output(ofp);
+}
+
+/* One block of the input, for compressing on multiple threads. */
+struct block {
+    const uint8_t *src;
+    size_t prime;
+    size_t len;
+
+    uint8_t *out;
+    size_t out_len;
+};
+
+struct worker {
+    pthread_t thd;
+    struct block *blocks;
+    int count;
+    int start;
+    int rv;
+};
+
+/* Each thread compresses every threads'th block, starting at start. */
+static void *compress_thd(void *d) {
+    struct worker *w = (struct worker *)d;
+    struct prs_comp_ctx *ctx;
+    struct block *b;
+    const uint8_t *out;
+    int i, len;
+
+    if(!(ctx = prs_comp_ctx_new())) {
+        w->rv = -errno;
+        return NULL;
+    }
+
+    prs_comp_ctx_set_level(ctx, level);
+
+    for(i = w->start; i < w->count; i += threads) {
+        b = &w->blocks[i];
+
+        if((len = prs_compress_block(ctx, b->src, b->prime, b->len,
+                                     &out)) < 0) {
+            w->rv = len;
+            break;
+        }
+
+        if(!(b->out = (uint8_t *)malloc(len))) {
+            w->rv = -errno;
+            break;
+        }
+
+        memcpy(b->out, out, len);
+        b->out_len = (size_t)len;
+    }
+
+    prs_comp_ctx_free(ctx);
+    return NULL;
+}
+
+static int compress_parallel(const uint8_t *src, size_t len, uint8_t **dst) {
+    struct block *blocks;
+    struct worker *workers;
+    const uint8_t **srcs;
+    size_t *lens;
+    int count, i, started, err, rv = 0;
+
+    count = (int)((len + block_size - 1) / block_size);
+
+    if(threads > count)
+        threads = count;
+
+    blocks = (struct block *)calloc(count, sizeof(struct block));
+    workers = (struct worker *)calloc(threads, sizeof(struct worker));
+    srcs = (const uint8_t **)malloc(count * sizeof(const uint8_t *));
+    lens = (size_t *)malloc(count * sizeof(size_t));
+
+    if(!blocks || !workers || !srcs || !lens) {
+        rv = -errno;
+        goto out;
+    }
+
+    /* Each block gets primed with the window's worth of data before it, or as
+       much of it as there is when the blocks are smaller than the window. */
+    for(i = 0; i < count; ++i) {
+        blocks[i].src = src + i * block_size;
+        blocks[i].prime = i * block_size < 0x2000 ? i * block_size : 0x2000;
+        blocks[i].len = (i == count - 1) ? len - i * block_size : block_size;
+    }
+
+    for(started = 0; started < threads; ++started) {
+        workers[started].blocks = blocks;
+        workers[started].count = count;
+        workers[started].start = started;
+
+        if((err = pthread_create(&workers[started].thd, NULL, &compress_thd,
+                                 &workers[started]))) {
+            rv = -err;
+            break;
+        }
+    }
+
+    for(i = 0; i < started; ++i) {
+        pthread_join(workers[i].thd, NULL);
+
+        if(workers[i].rv)
+            rv = workers[i].rv;
+    }
+
+    if(rv)
+        goto out;
+
+    for(i = 0; i < count; ++i) {
+        srcs[i] = blocks[i].out;
+        lens[i] = blocks[i].out_len;
+    }
+
+    rv = prs_stitch(srcs, lens, count, dst);
+
+out:
+    if(blocks) {
+        for(i = 0; i < count; ++i)
+            free(blocks[i].out);
+    }
+
+    free(lens);
+    free(srcs);
+    free(workers);
+    free(blocks);
+    return rv;
 }
 
 static void compress(void) {
@@ -178,15 +621,45 @@ static void compress(void) {
     uint8_t *unc, *cmp;
     int cmp_len;
 
+    /* The greedy levels don't need the whole file at once. The optimal parser
+       does a little better on it all in one piece though, and --compare needs
+       it all in memory to compress it a second time. */
+    if(threads == 1 && level < PRS_LEVEL_OPTIMAL && !compare) {
+        compress_stream();
+        return;
+    }
+
     /* Read the file in */
     unc = read_input(&unc_len);
 
     /* Compress it. */
-    if((cmp_len = prs_compress(unc, &cmp, (size_t)unc_len)) < 0) {
+    if(threads == 1 || (size_t)unc_len <= block_size)
+        cmp_len = prs_compress_level(unc, &cmp, (size_t)unc_len, level);
+    else
+        cmp_len = compress_parallel(unc, (size_t)unc_len, &cmp);
+
+    if(cmp_len < 0) {
         fprintf(stderr, "compress: %s\n", strerror(-cmp_len));
         exit(EXIT_FAILURE);
     }
 
+    /* See how much we lost by splitting things up, if asked to. */
+    if(compare) {
+        uint8_t *ser;
+        int ser_len;
+
+        if((ser_len = prs_compress_level(unc, &ser, (size_t)unc_len,
+                                         level)) < 0) {
+            fprintf(stderr, "compress: %s\n", strerror(-ser_len));
+            exit(EXIT_FAILURE);
+        }
+
+        fprintf(stderr, "%d threads, %d KiB blocks: %d bytes, serial: %d "
+                "bytes (%+.3f%%)\n", threads, (int)(block_size / 1024),
+                cmp_len, ser_len, (cmp_len - ser_len) * 100.0 / ser_len);
+        free(ser);
+    }
+
     /* Write it out to the output file. */
     write_output(cmp_len, cmp);
 
@@ -195,14 +668,32 @@ static void compress(void) {
     free(unc);
 }
 
+static void print_stats(void) {
+    struct prs_stats st;
+
+    if(prs_stats_get(&st)) {
+        fprintf(stderr, "No statistics: libprs was built without them (build "
+                "it with make STATS=1)\n");
+        return;
+    }
+
+    prs_stats_print(stderr, &st);
+}
+
 int main(int argc, char *argv[]) {
     /* Parse the command line... */
     parse_command_line(argc, argv);
 
     if(operation == 1)
         compress();
+    else if(operation == 3)
+        compress_index();
     else
         decompress();
 
+    /* These go to stderr, since the output might be going to stdout. */
+    if(stats)
+        print_stats();
+
     return 0;
 }
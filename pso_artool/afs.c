@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -30,10 +31,45 @@
 #include <unistd.h>
 #endif
 
+#include <fcntl.h>
+#include <time.h>
+
 #include <psoarchive/AFS.h>
 
+#include "prs-verify.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Every file (and the filename table) starts on a 2KiB boundary. */
+#define AFS_ALIGN       2048
+#define AFS_FNENT_SIZE  48
+
 static int make_fntab = 0;
 
+/* In artool.c */
+extern int read_at(int fd, void *buf, size_t len, off_t off);
+extern int write_at(int fd, const void *buf, size_t len, off_t off);
+extern int copy_range(int dst, off_t doff, int src, off_t soff, size_t len);
+extern int make_temp(const char *fn, char **tmpfn);
+
+/* One file in an archive we're working on directly. The data is at offset in
+   fd, which is either the archive itself or a new file being added. */
+struct afs_ent {
+    int fd;
+    uint32_t offset;
+    uint32_t size;
+    uint8_t fnent[AFS_FNENT_SIZE];
+};
+
+struct afs_dir {
+    int fd;
+    uint32_t count;
+    uint32_t data_start;
+    struct afs_ent *ents;
+};
+
 #ifdef _WIN32
 #include "windows_compat.h"
 #endif
@@ -77,92 +113,945 @@ static int afs_list(const char *fn) {
     return 0;
 }
 
-static int afs_extract(const char *fn) {
-    pso_afs_read_t *cxt;
-    pso_error_t err;
-    uint32_t cnt, i;
+/* Extract one file from the archive into the current directory. */
+static int afs_extract_file(pso_afs_read_t *cxt, uint32_t i) {
     ssize_t sz;
+    pso_error_t err;
     char afn[64];
     FILE *fp;
     uint8_t *buf;
     struct stat st;
     struct timeval tms[2];
 
+    if((sz = pso_afs_file_size(cxt, i)) < 0) {
+        fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(sz));
+        return EXIT_FAILURE;
+    }
+
+    if((err = pso_afs_file_name(cxt, i, afn, 64)) < 0) {
+        fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    if(!(buf = malloc(sz))) {
+        perror("Cannot extract file");
+        return EXIT_FAILURE;
+    }
+
+    if((err = pso_afs_file_read(cxt, i, buf, (size_t)sz)) < 0) {
+        fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(err));
+        free(buf);
+        return EXIT_FAILURE;
+    }
+
+    if(!(fp = fopen(afn, "wb"))) {
+        perror("Cannot extract file");
+        free(buf);
+        return EXIT_FAILURE;
+    }
+
+    if(fwrite(buf, 1, sz, fp) != (size_t)sz) {
+        perror("Cannot extract file");
+        fclose(fp);
+        free(buf);
+        return EXIT_FAILURE;
+    }
+
+    /* Clean up, we're done with this file. */
+    fclose(fp);
+    free(buf);
+
+    /* If we have a filename table, fix the timestamp on the file... */
+    if(make_fntab) {
+        if(pso_afs_file_stat(cxt, i, &st) == PSOARCHIVE_OK) {
+            tms[0].tv_sec = time(NULL);
+            tms[0].tv_usec = 0;
+            tms[1].tv_sec = st.st_mtime;
+            tms[1].tv_usec = 0;
+            utimes(afn, tms);
+        }
+    }
+
+    return 0;
+}
+
+struct afs_worker {
+    pthread_t thd;
+    const char *fn;
+    uint32_t count;
+    uint32_t start;
+    uint32_t step;
+    struct prs_verify *verify;
+    int bad;
+    int rv;
+};
+
+/* Extract every step'th file, starting at start. The archive handle keeps
+   track of its own position in the file, so each thread opens the archive
+   for itself rather than sharing one. */
+static void *afs_extract_thd(void *d) {
+    struct afs_worker *w = (struct afs_worker *)d;
+    pso_afs_read_t *cxt;
+    pso_error_t err;
+    uint32_t i;
+
+    if(!(cxt = pso_afs_read_open(w->fn, make_fntab, &err))) {
+        fprintf(stderr, "Cannot open archive %s: %s\n", w->fn,
+                pso_strerror(err));
+        w->rv = EXIT_FAILURE;
+        return NULL;
+    }
+
+    for(i = w->start; i < w->count; i += w->step) {
+        if((w->rv = afs_extract_file(cxt, i)))
+            break;
+    }
+
+    pso_afs_read_close(cxt);
+    return NULL;
+}
+
+static int afs_extract(const char *fn, int threads) {
+    pso_afs_read_t *cxt;
+    pso_error_t err;
+    struct afs_worker *workers;
+    uint32_t cnt, i;
+    int started, ret, rv = 0;
+
     if(!(cxt = pso_afs_read_open(fn, make_fntab, &err))) {
         fprintf(stderr, "Cannot open archive %s: %s\n", fn, pso_strerror(err));
         return EXIT_FAILURE;
     }
 
-    /* Loop through each file... */
     cnt = pso_afs_file_count(cxt);
 
-    for(i = 0; i < cnt; ++i) {
-        if((sz = pso_afs_file_size(cxt, i)) < 0) {
-            fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(sz));
-            pso_afs_read_close(cxt);
-            return EXIT_FAILURE;
+    /* Loop through each file... */
+    if(threads == 1 || cnt < 2) {
+        for(i = 0; i < cnt; ++i) {
+            if((rv = afs_extract_file(cxt, i)))
+                break;
         }
 
-        if(pso_afs_file_name(cxt, i, afn, 64) < 0) {
-            fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(sz));
-            pso_afs_read_close(cxt);
-            return EXIT_FAILURE;
+        pso_afs_read_close(cxt);
+        return rv;
+    }
+
+    pso_afs_read_close(cxt);
+
+    if((uint32_t)threads > cnt)
+        threads = (int)cnt;
+
+    if(!(workers = (struct afs_worker *)calloc(threads, sizeof(*workers)))) {
+        perror("Cannot extract file");
+        return EXIT_FAILURE;
+    }
+
+    for(started = 0; started < threads; ++started) {
+        workers[started].fn = fn;
+        workers[started].count = cnt;
+        workers[started].start = (uint32_t)started;
+        workers[started].step = (uint32_t)threads;
+
+        if((ret = pthread_create(&workers[started].thd, NULL, &afs_extract_thd,
+                                 &workers[started]))) {
+            fprintf(stderr, "Cannot create thread: %s\n", strerror(ret));
+            rv = EXIT_FAILURE;
+            break;
         }
+    }
 
-        if(!(buf = malloc(sz))) {
-            perror("Cannot extract file");
-            pso_afs_read_close(cxt);
-            return EXIT_FAILURE;
+    for(i = 0; i < (uint32_t)started; ++i) {
+        pthread_join(workers[i].thd, NULL);
+
+        if(workers[i].rv)
+            rv = workers[i].rv;
+    }
+
+    free(workers);
+    return rv;
+}
+
+/* Check every step'th file, starting at start, against w->verify. Each thread
+   reads files into its own buffer, which gets reused for every file it
+   checks. */
+static void *afs_verify_thd(void *d) {
+    struct afs_worker *w = (struct afs_worker *)d;
+    pso_afs_read_t *cxt;
+    pso_error_t err;
+    uint32_t i;
+    ssize_t sz;
+    size_t buf_len = 0;
+    uint8_t *buf = NULL, *tmp;
+    char afn[64];
+    int rv;
+
+    if(!(cxt = pso_afs_read_open(w->fn, make_fntab, &err))) {
+        fprintf(stderr, "Cannot open archive %s: %s\n", w->fn,
+                pso_strerror(err));
+        w->rv = EXIT_FAILURE;
+        return NULL;
+    }
+
+    for(i = w->start; i < w->count; i += w->step) {
+        if((sz = pso_afs_file_size(cxt, i)) < 0 ||
+           (err = pso_afs_file_name(cxt, i, afn, 64)) < 0) {
+            fprintf(stderr, "Cannot read archive %s: %s\n", w->fn,
+                    pso_strerror(sz < 0 ? (pso_error_t)sz : err));
+            w->rv = EXIT_FAILURE;
+            break;
         }
 
-        if((err = pso_afs_file_read(cxt, i, buf, (size_t)sz)) < 0) {
-            fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(sz));
-            free(buf);
-            pso_afs_read_close(cxt);
-            return EXIT_FAILURE;
+        if((size_t)sz >= buf_len) {
+            if(!(tmp = (uint8_t *)realloc(buf, (size_t)sz + 1))) {
+                perror("Cannot read archive");
+                w->rv = EXIT_FAILURE;
+                break;
+            }
+
+            buf = tmp;
+            buf_len = (size_t)sz + 1;
         }
 
-        if(!(fp = fopen(afn, "wb"))) {
-            perror("Cannot extract file");
-            free(buf);
-            pso_afs_read_close(cxt);
-            return EXIT_FAILURE;
+        if(sz && (err = pso_afs_file_read(cxt, i, buf, (size_t)sz)) < 0) {
+            fprintf(stderr, "Cannot read archive %s: %s\n", w->fn,
+                    pso_strerror(err));
+            w->rv = EXIT_FAILURE;
+            break;
         }
 
-        if(fwrite(buf, 1, sz, fp) != (size_t)sz) {
-            perror("Cannot extract file");
-            fclose(fp);
-            free(buf);
-            pso_afs_read_close(cxt);
-            return EXIT_FAILURE;
+        if((rv = prs_verify_file(w->verify, i, afn, buf, (size_t)sz)) < 0) {
+            fprintf(stderr, "Cannot check file %s: %s\n", afn,
+                    strerror(-rv));
+            rv = 1;
         }
 
-        /* Clean up, we're done with this file. */
-        fclose(fp);
-        free(buf);
+        w->bad += rv;
+    }
 
-        /* If we have a filename table, fix the timestamp on the file... */
-        if(make_fntab) {
-            if(pso_afs_file_stat(cxt, i, &st) == PSOARCHIVE_OK) {
-                tms[0].tv_sec = time(NULL);
-                tms[0].tv_usec = 0;
-                tms[1].tv_sec = st.st_mtime;
-                tms[1].tv_usec = 0;
-                utimes(afn, tms);
-            }
-        }
+    free(buf);
+    pso_afs_read_close(cxt);
+    return NULL;
+}
+
+/* Check the files in an archive against a directory or a manifest (or print
+   a manifest for it, if against is NULL), without writing any of them out. */
+static int afs_verify(const char *fn, const char *against, int threads) {
+    pso_afs_read_t *cxt;
+    pso_error_t err;
+    struct afs_worker *workers;
+    struct prs_verify *v;
+    uint32_t cnt, i;
+    int started, ret, bad = 0, rv = 0;
+
+    if(!(cxt = pso_afs_read_open(fn, make_fntab, &err))) {
+        fprintf(stderr, "Cannot open archive %s: %s\n", fn, pso_strerror(err));
+        return EXIT_FAILURE;
     }
 
+    cnt = pso_afs_file_count(cxt);
     pso_afs_read_close(cxt);
+
+    if((uint32_t)threads > cnt)
+        threads = cnt ? (int)cnt : 1;
+
+    if(!(workers = (struct afs_worker *)calloc(threads, sizeof(*workers)))) {
+        perror("Cannot check archive");
+        return EXIT_FAILURE;
+    }
+
+    if((rv = prs_verify_begin(&v, against, cnt, stdout))) {
+        fprintf(stderr, "Cannot read %s: %s\n", against ? against : fn,
+                strerror(-rv));
+        free(workers);
+        return EXIT_FAILURE;
+    }
+
+    for(started = 0; started < threads; ++started) {
+        workers[started].fn = fn;
+        workers[started].count = cnt;
+        workers[started].start = (uint32_t)started;
+        workers[started].step = (uint32_t)threads;
+        workers[started].verify = v;
+
+        if(threads == 1) {
+            afs_verify_thd(&workers[0]);
+        }
+        else if((ret = pthread_create(&workers[started].thd, NULL,
+                                      &afs_verify_thd, &workers[started]))) {
+            fprintf(stderr, "Cannot create thread: %s\n", strerror(ret));
+            rv = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    for(i = 0; i < (uint32_t)started; ++i) {
+        if(threads > 1)
+            pthread_join(workers[i].thd, NULL);
+
+        if(workers[i].rv)
+            rv = workers[i].rv;
+
+        bad += workers[i].bad;
+    }
+
+    bad += prs_verify_end(v);
+    free(workers);
+
+    if(rv)
+        return rv;
+
+    if(against)
+        printf("%s: %d problem(s) found\n", fn, bad);
+
+    return bad ? EXIT_FAILURE : 0;
+}
+
+
+static uint32_t get32(const uint8_t *b) {
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static void put32(uint8_t *b, uint32_t v) {
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+    b[2] = (uint8_t)(v >> 16);
+    b[3] = (uint8_t)(v >> 24);
+}
+
+static void put16(uint8_t *b, int v) {
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+}
+
+static uint32_t afs_align(uint32_t v) {
+    return (v + AFS_ALIGN - 1) & ~(uint32_t)(AFS_ALIGN - 1);
+}
+
+/* Figure out where the data for the last file ends. */
+static uint32_t afs_data_end(const struct afs_dir *dir) {
+    uint32_t i, end = 0;
+
+    for(i = 0; i < dir->count; ++i) {
+        if(dir->ents[i].offset + dir->ents[i].size > end)
+            end = dir->ents[i].offset + dir->ents[i].size;
+    }
+
+    return end;
+}
+
+static void afs_free_dir(struct afs_dir *dir) {
+    uint32_t i;
+
+    if(dir->ents) {
+        for(i = 0; i < dir->count; ++i) {
+            if(dir->ents[i].fd != dir->fd && dir->ents[i].fd >= 0)
+                close(dir->ents[i].fd);
+        }
+
+        free(dir->ents);
+    }
+
+    if(dir->fd >= 0)
+        close(dir->fd);
+
+    dir->ents = NULL;
+    dir->fd = -1;
+}
+
+/* Read in the table of contents (and filename table, if we're supposed to have
+   one) of an archive, so that it can be changed without going through every
+   file in it. Returns 1 if the archive is laid out in some way that this
+   doesn't understand, in which case the caller should fall back to rewriting
+   it the slow way. */
+static int afs_read_dir(const char *fn, struct afs_dir *dir) {
+    uint8_t hdr[8], *toc = NULL, *fnt = NULL;
+    struct stat st;
+    uint32_t i, toc_len, off, sz, fnt_off, fnt_len;
+    int rv = -1;
+
+    memset(dir, 0, sizeof(struct afs_dir));
+
+    if((dir->fd = open(fn, O_RDWR | O_BINARY)) < 0) {
+        fprintf(stderr, "Cannot open archive %s: %s\n", fn, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(dir->fd, &st) || read_at(dir->fd, hdr, 8, 0)) {
+        fprintf(stderr, "Cannot read archive %s: %s\n", fn, strerror(errno));
+        goto err;
+    }
+
+    if(memcmp(hdr, "AFS\0", 4)) {
+        fprintf(stderr, "Cannot open archive %s: Not an AFS archive\n", fn);
+        goto err;
+    }
+
+    /* An empty archive is easy enough to just recreate. */
+    rv = 1;
+    dir->count = get32(hdr + 4);
+    toc_len = dir->count * 8 + (make_fntab ? 8 : 0);
+
+    if(!dir->count || dir->count > (uint32_t)(st.st_size / 8) ||
+       st.st_size > 0xFFFFFFFF)
+        goto err;
+
+    if(!(toc = (uint8_t *)malloc(toc_len)) ||
+       !(dir->ents = (struct afs_ent *)calloc(dir->count,
+                                             sizeof(struct afs_ent)))) {
+        perror("Cannot read archive");
+        rv = -1;
+        goto err;
+    }
+
+    if(read_at(dir->fd, toc, toc_len, 8)) {
+        fprintf(stderr, "Cannot read archive %s: %s\n", fn, strerror(errno));
+        rv = -1;
+        goto err;
+    }
+
+    dir->data_start = (uint32_t)st.st_size;
+
+    for(i = 0; i < dir->count; ++i)
+        dir->ents[i].fd = dir->fd;
+
+    for(i = 0; i < dir->count; ++i) {
+        off = get32(toc + i * 8);
+        sz = get32(toc + i * 8 + 4);
+
+        if(off < 8 + toc_len || (uint64_t)off + sz > (uint64_t)st.st_size)
+            goto err;
+
+        dir->ents[i].offset = off;
+        dir->ents[i].size = sz;
+
+        if(off < dir->data_start)
+            dir->data_start = off;
+    }
+
+    /* The filename table should be after all of the files. */
+    if(make_fntab) {
+        fnt_off = get32(toc + dir->count * 8);
+        fnt_len = dir->count * AFS_FNENT_SIZE;
+
+        if(fnt_off < afs_data_end(dir) ||
+           get32(toc + dir->count * 8 + 4) < fnt_len ||
+           (uint64_t)fnt_off + fnt_len > (uint64_t)st.st_size)
+            goto err;
+
+        if(!(fnt = (uint8_t *)malloc(fnt_len))) {
+            perror("Cannot read archive");
+            rv = -1;
+            goto err;
+        }
+
+        if(read_at(dir->fd, fnt, fnt_len, fnt_off)) {
+            fprintf(stderr, "Cannot read archive %s: %s\n", fn,
+                    strerror(errno));
+            rv = -1;
+            goto err;
+        }
+
+        for(i = 0; i < dir->count; ++i)
+            memcpy(dir->ents[i].fnent, fnt + i * AFS_FNENT_SIZE,
+                   AFS_FNENT_SIZE);
+    }
+
+    free(fnt);
+    free(toc);
     return 0;
+
+err:
+    free(fnt);
+    free(toc);
+    afs_free_dir(dir);
+    return rv;
 }
 
-static int afs_create(const char *fn, int file_cnt, const char *files[]) {
+/* Set up an entry for a new file to be put in the archive. */
+static int afs_new_ent(struct afs_ent *ent, const char *name,
+                       const char *path) {
+    struct stat st;
+    struct tm *tm;
+
+    if((ent->fd = open(path, O_RDONLY | O_BINARY)) < 0 || fstat(ent->fd, &st)) {
+        fprintf(stderr, "Cannot add file '%s' to archive: %s\n", path,
+                strerror(errno));
+        return -1;
+    }
+
+    if(st.st_size > 0xFFFFFFFF - AFS_ALIGN) {
+        fprintf(stderr, "Cannot add file '%s' to archive: File too large\n",
+                path);
+        return -1;
+    }
+
+    ent->offset = 0;
+    ent->size = (uint32_t)st.st_size;
+
+    /* The filename table has the name, the modification time, and the size of
+       the file. */
+    memset(ent->fnent, 0, AFS_FNENT_SIZE);
+    strncpy((char *)ent->fnent, name, 32);
+
+    if((tm = localtime(&st.st_mtime))) {
+        put16(ent->fnent + 32, tm->tm_year + 1900);
+        put16(ent->fnent + 34, tm->tm_mon + 1);
+        put16(ent->fnent + 36, tm->tm_mday);
+        put16(ent->fnent + 38, tm->tm_hour);
+        put16(ent->fnent + 40, tm->tm_min);
+        put16(ent->fnent + 42, tm->tm_sec);
+    }
+
+    put32(ent->fnent + 44, ent->size);
+    return 0;
+}
+
+/* Write out the table of contents (and filename table, at fnt_off) for the
+   archive, and trim the file to end right after the last thing in it. */
+static int afs_write_dir(const struct afs_dir *dir, int fd, uint32_t end) {
+    uint32_t toc_len = 8 + dir->count * 8 + 8, i;
+    uint32_t fnt_len = dir->count * AFS_FNENT_SIZE;
+    uint8_t *buf;
+    int rv = -1;
+
+    if(!(buf = (uint8_t *)calloc(1, toc_len > fnt_len ? toc_len : fnt_len))) {
+        perror("Cannot write archive");
+        return -1;
+    }
+
+    if(make_fntab) {
+        for(i = 0; i < dir->count; ++i)
+            memcpy(buf + i * AFS_FNENT_SIZE, dir->ents[i].fnent,
+                   AFS_FNENT_SIZE);
+
+        if(write_at(fd, buf, fnt_len, end))
+            goto out;
+
+        memset(buf, 0, toc_len);
+        put32(buf + toc_len - 8, end);
+        put32(buf + toc_len - 4, fnt_len);
+        end = afs_align(end + fnt_len);
+    }
+
+    memcpy(buf, "AFS\0", 4);
+    put32(buf + 4, dir->count);
+
+    for(i = 0; i < dir->count; ++i) {
+        put32(buf + 8 + i * 8, dir->ents[i].offset);
+        put32(buf + 12 + i * 8, dir->ents[i].size);
+    }
+
+    /* Write the table last, so that it only points at the new data once it is
+       all there. */
+    if(ftruncate(fd, end) || write_at(fd, buf, toc_len, 0))
+        goto out;
+
+    rv = 0;
+
+out:
+    if(rv)
+        perror("Cannot write archive");
+
+    free(buf);
+    return rv;
+}
+
+/* Copy every file into a brand new archive, at the offsets they'll have in it,
+   then move it over the old one. */
+static int afs_rebuild(const char *fn, struct afs_dir *dir) {
+    char *tmpfn;
+    uint32_t pos, i;
+    int fd, rv = -1;
+
+#ifndef _WIN32
+    mode_t mask;
+#endif
+
+    if((fd = make_temp(fn, &tmpfn)) < 0) {
+        perror("Cannot create temporary file");
+        afs_free_dir(dir);
+        return -1;
+    }
+
+    /* Keep the files where they were if the table still fits before them, in
+       case anything cares about that. */
+    pos = afs_align(8 + dir->count * 8 + 8);
+
+    if(dir->data_start > pos)
+        pos = dir->data_start;
+
+    for(i = 0; i < dir->count; ++i) {
+        if(copy_range(fd, pos, dir->ents[i].fd, dir->ents[i].offset,
+                      dir->ents[i].size)) {
+            perror("Cannot write archive");
+            goto out;
+        }
+
+        dir->ents[i].offset = pos;
+        pos = afs_align(pos + dir->ents[i].size);
+    }
+
+    if(afs_write_dir(dir, fd, pos))
+        goto out;
+
+#ifndef _WIN32
+    mask = umask(0);
+    umask(mask);
+    fchmod(fd, (~mask) & 0666);
+#endif
+
+    rv = 0;
+
+out:
+    close(fd);
+    afs_free_dir(dir);
+
+    if(!rv && rename(tmpfn, fn)) {
+        fprintf(stderr, "Cannot move archive into place: %s\n",
+                strerror(errno));
+        rv = -1;
+    }
+
+    if(rv)
+        unlink(tmpfn);
+
+    free(tmpfn);
+    return rv;
+}
+
+/* Add files to the end of an archive. If there is room for them in the table
+   of contents, only the new files and the tables get written. Returns 1 if the
+   archive needs to be done the slow way. */
+static int afs_append_fast(const char *fn, int file_cnt, const char *files[]) {
+    struct afs_dir dir;
+    struct afs_ent *ents;
+    uint32_t pos, i, data_end;
+    char *tmp;
+    int rv, j;
+
+    if((rv = afs_read_dir(fn, &dir)))
+        return rv;
+
+    data_end = afs_data_end(&dir);
+
+    if(!(ents = (struct afs_ent *)realloc(dir.ents, (dir.count + file_cnt) *
+                                          sizeof(struct afs_ent)))) {
+        perror("Cannot add file to archive");
+        afs_free_dir(&dir);
+        return -1;
+    }
+
+    dir.ents = ents;
+
+    for(j = 0; j < file_cnt; ++j) {
+        if(!(tmp = strdup(files[j]))) {
+            perror("Cannot add file to archive");
+            afs_free_dir(&dir);
+            return -1;
+        }
+
+        rv = afs_new_ent(&dir.ents[dir.count++], basename(tmp), files[j]);
+        free(tmp);
+
+        if(rv) {
+            afs_free_dir(&dir);
+            return -1;
+        }
+    }
+
+    /* If the table of contents would run into the first file, everything has
+       to move anyway. */
+    if(8 + dir.count * 8 + 8 > dir.data_start)
+        return afs_rebuild(fn, &dir);
+
+    pos = afs_align(data_end);
+
+    for(i = dir.count - file_cnt; i < dir.count; ++i) {
+        if(copy_range(dir.fd, pos, dir.ents[i].fd, 0, dir.ents[i].size)) {
+            perror("Cannot add file to archive");
+            afs_free_dir(&dir);
+            return -1;
+        }
+
+        close(dir.ents[i].fd);
+        dir.ents[i].fd = dir.fd;
+        dir.ents[i].offset = pos;
+        pos = afs_align(pos + dir.ents[i].size);
+    }
+
+    rv = afs_write_dir(&dir, dir.fd, pos);
+    afs_free_dir(&dir);
+    return rv;
+}
+
+/* Find a file in an archive, by name or by number depending on whether there's
+   a filename table. */
+static int afs_find(const struct afs_dir *dir, const char *name,
+                    uint32_t *idx) {
+    uint32_t i;
+
+    if(!make_fntab) {
+        errno = 0;
+        i = strtoul(name, NULL, 0);
+
+        if(errno || i >= dir->count)
+            return -1;
+
+        *idx = i;
+        return 0;
+    }
+
+    for(i = 0; i < dir->count; ++i) {
+        if(!strncmp((const char *)dir->ents[i].fnent, name, 32) &&
+           strlen(name) <= 32) {
+            *idx = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Replace one file in an archive. If the new file pads out to the same place
+   the old one did, it is just written over the old one. */
+static int afs_update_fast(const char *fn, const char *oldfn,
+                           const char *newfn) {
+    struct afs_dir dir;
+    struct afs_ent ent;
+    uint32_t i, j, limit;
+    char name[33];
+    int rv;
+
+    if((rv = afs_read_dir(fn, &dir)))
+        return rv;
+
+    /* If it isn't in there, there's nothing to do. */
+    if(afs_find(&dir, oldfn, &i)) {
+        afs_free_dir(&dir);
+        return 0;
+    }
+
+    memcpy(name, dir.ents[i].fnent, 32);
+    name[32] = 0;
+
+    if(afs_new_ent(&ent, make_fntab ? name : "", newfn)) {
+        if(ent.fd >= 0)
+            close(ent.fd);
+
+        afs_free_dir(&dir);
+        return -1;
+    }
+
+    /* See how much room there is before whatever comes after the old file (if
+       it's the last file, it can grow as much as it wants). */
+    limit = 0xFFFFFFFF;
+
+    for(j = 0; j < dir.count; ++j) {
+        if(dir.ents[j].offset > dir.ents[i].offset &&
+           dir.ents[j].offset < limit)
+            limit = dir.ents[j].offset;
+    }
+
+    if((uint64_t)dir.ents[i].offset + ent.size > limit) {
+        dir.ents[i] = ent;
+        return afs_rebuild(fn, &dir);
+    }
+
+    if(copy_range(dir.fd, dir.ents[i].offset, ent.fd, 0, ent.size)) {
+        perror("Cannot update archive");
+        close(ent.fd);
+        afs_free_dir(&dir);
+        return -1;
+    }
+
+    close(ent.fd);
+    ent.fd = dir.fd;
+    ent.offset = dir.ents[i].offset;
+    dir.ents[i] = ent;
+
+    /* Everything else stays where it was. The filename table goes right after
+       whatever is last now. */
+    rv = afs_write_dir(&dir, dir.fd, afs_align(afs_data_end(&dir)));
+    afs_free_dir(&dir);
+    return rv;
+}
+
+/* Take files out of an archive. Everything after them has to move, but the
+   data is copied file to file without going through memory here. */
+static int afs_delete_fast(const char *fn, int file_cnt, const char *files[]) {
+    struct afs_dir dir;
+    uint32_t i, j, *del;
+    int rv, k;
+
+    if((rv = afs_read_dir(fn, &dir)))
+        return rv;
+
+    if(!(del = (uint32_t *)calloc(dir.count, sizeof(uint32_t)))) {
+        perror("Cannot delete file");
+        afs_free_dir(&dir);
+        return -1;
+    }
+
+    for(k = 0; k < file_cnt; ++k) {
+        if(!afs_find(&dir, files[k], &i))
+            del[i] = 1;
+    }
+
+    for(i = j = 0; i < dir.count; ++i) {
+        if(!del[i])
+            dir.ents[j++] = dir.ents[i];
+    }
+
+    free(del);
+
+    /* Nothing to delete? We're done already. */
+    if(j == dir.count) {
+        afs_free_dir(&dir);
+        return 0;
+    }
+
+    dir.count = j;
+    return afs_rebuild(fn, &dir);
+}
+
+/* One thread's share of the files going into a new archive. */
+struct afs_copy_worker {
+    pthread_t thd;
+    struct afs_dir *dir;
+    uint32_t start;
+    uint32_t step;
+    int rv;
+};
+
+/* Copy every step'th file into the archive, starting at start. Where each file
+   goes is worked out before any of them are copied, so the threads never have
+   to wait on each other, and one thread's reads go on while another's writes
+   do. */
+static void *afs_copy_thd(void *d) {
+    struct afs_copy_worker *w = (struct afs_copy_worker *)d;
+    struct afs_ent *ent;
+    uint32_t i;
+
+    for(i = w->start; i < w->dir->count; i += w->step) {
+        ent = &w->dir->ents[i];
+
+        if(copy_range(w->dir->fd, ent->offset, ent->fd, 0, ent->size)) {
+            perror("Cannot add file to archive");
+            w->rv = -1;
+            break;
+        }
+
+        close(ent->fd);
+        ent->fd = w->dir->fd;
+    }
+
+    return NULL;
+}
+
+/* Create an archive with several threads copying files into it at once. The
+   files are laid out the same way as when an archive gets rebuilt. */
+static int afs_create_fast(const char *fn, int file_cnt, const char *files[],
+                           int threads) {
+    struct afs_dir dir;
+    struct afs_copy_worker *workers = NULL;
+    uint64_t pos;
+    uint32_t i;
+    char *tmp;
+    int j, err, started = 0, rv = -1;
+
+    memset(&dir, 0, sizeof(dir));
+    dir.fd = -1;
+
+    if(!(dir.ents = (struct afs_ent *)calloc(file_cnt,
+                                             sizeof(struct afs_ent))) ||
+       !(workers = (struct afs_copy_worker *)calloc(threads,
+                                                    sizeof(*workers)))) {
+        perror("Cannot create archive");
+        goto out;
+    }
+
+    for(j = 0; j < file_cnt; ++j) {
+        if(!(tmp = strdup(files[j]))) {
+            perror("Cannot create archive");
+            goto out;
+        }
+
+        rv = afs_new_ent(&dir.ents[dir.count++], basename(tmp), files[j]);
+        free(tmp);
+
+        if(rv) {
+            rv = -1;
+            goto out;
+        }
+    }
+
+    /* Everything (including the filename table) has to fit in 4GiB. */
+    rv = -1;
+    pos = afs_align(8 + dir.count * 8 + 8);
+
+    for(i = 0; i < dir.count; ++i) {
+        dir.ents[i].offset = (uint32_t)pos;
+        pos = (pos + dir.ents[i].size + AFS_ALIGN - 1) &
+            ~(uint64_t)(AFS_ALIGN - 1);
+    }
+
+    if(pos + dir.count * AFS_FNENT_SIZE > 0xFFFFFFFF - AFS_ALIGN) {
+        fprintf(stderr, "Cannot create archive %s: Archive too large\n", fn);
+        goto out;
+    }
+
+    if((dir.fd = open(fn, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666)) < 0) {
+        fprintf(stderr, "Cannot create archive %s: %s\n", fn, strerror(errno));
+        goto out;
+    }
+
+    if((uint32_t)threads > dir.count)
+        threads = (int)dir.count;
+
+    for(started = 0; started < threads; ++started) {
+        workers[started].dir = &dir;
+        workers[started].start = (uint32_t)started;
+        workers[started].step = (uint32_t)threads;
+
+        if((err = pthread_create(&workers[started].thd, NULL, &afs_copy_thd,
+                                 &workers[started]))) {
+            fprintf(stderr, "Cannot create thread: %s\n", strerror(err));
+            break;
+        }
+    }
+
+    /* If not every thread got going, some files never got copied. */
+    rv = started == threads ? 0 : -1;
+
+    for(j = 0; j < started; ++j) {
+        pthread_join(workers[j].thd, NULL);
+
+        if(workers[j].rv)
+            rv = -1;
+    }
+
+    if(!rv)
+        rv = afs_write_dir(&dir, dir.fd, (uint32_t)pos);
+
+    if(rv)
+        unlink(fn);
+
+out:
+    afs_free_dir(&dir);
+    free(workers);
+    return rv ? EXIT_FAILURE : 0;
+}
+
+static int afs_create(const char *fn, int file_cnt, const char *files[],
+                      int threads) {
     pso_afs_write_t *cxt;
     pso_error_t err;
     int i;
     char *tmp, *bn;
 
+    if(threads > 1 && file_cnt > 1)
+        return afs_create_fast(fn, file_cnt, files, threads);
+
     if(!(cxt = pso_afs_new(fn, make_fntab, &err))) {
         fprintf(stderr, "Cannot create archive %s: %s\n", fn,
                 pso_strerror(err));
@@ -211,6 +1100,10 @@ static int afs_append(const char *fn, int file_cnt, const char *files[]) {
     mode_t mask;
 #endif
 
+    /* Try to just tack the new files on the end first. */
+    if((fd = afs_append_fast(fn, file_cnt, files)) != 1)
+        return fd ? EXIT_FAILURE : 0;
+
     /* Create a temporary file for the new archive... */
     strcpy(tmpfn, "artoolXXXXXX");
     if((fd = mkstemp(tmpfn)) < 0) {
@@ -345,6 +1238,10 @@ static int afs_update(const char *fn, const char *oldfn, const char *newfn) {
         }
     }
 
+    /* See if we can get away without copying everything else. */
+    if((fd = afs_update_fast(fn, oldfn, newfn)) != 1)
+        return fd ? EXIT_FAILURE : 0;
+
     /* Create a temporary file for the new archive... */
     strcpy(tmpfn, "artoolXXXXXX");
     if((fd = mkstemp(tmpfn)) < 0) {
@@ -470,6 +1367,11 @@ static int afs_delete(const char *fn, int file_cnt, const char *files[]) {
     mode_t mask;
 #endif
 
+    /* This only falls back to going through the library if it doesn't know
+       what to make of the archive. */
+    if((fd = afs_delete_fast(fn, file_cnt, files)) != 1)
+        return fd ? EXIT_FAILURE : 0;
+
     /* Create a temporary file for the new archive... */
     strcpy(tmpfn, "artoolXXXXXX");
     if((fd = mkstemp(tmpfn)) < 0) {
@@ -504,6 +1406,8 @@ static int afs_delete(const char *fn, int file_cnt, const char *files[]) {
         }
 
         /* See if this file is in the list to delete. */
+        skip = 0;
+
         if(!make_fntab) {
             for(j = 0; j < file_cnt; ++j) {
                 if(strtoul(files[j], NULL, 0) == i) {
@@ -579,6 +1483,8 @@ err_out:
 }
 
 int afs(int argc, const char *argv[]) {
+    int threads = 1, i;
+
     if(argc < 4)
         return -1;
 
@@ -600,18 +1506,61 @@ int afs(int argc, const char *argv[]) {
         return afs_list(argv[3]);
     }
     else if(!strcmp(argv[2], "-x")) {
-        /* Extract. */
+        /* Extract, with as many threads as asked for. */
+        if(argc == 6 && !strcmp(argv[3], "-j")) {
+            if((threads = atoi(argv[4])) < 1) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[4]);
+                return EXIT_FAILURE;
+            }
+
+            return afs_extract(argv[5], threads);
+        }
+
         if(argc != 4)
             return -1;
 
-        return afs_extract(argv[3]);
+        return afs_extract(argv[3], 1);
+    }
+    else if(!strcmp(argv[2], "-v") || !strcmp(argv[2], "-vm")) {
+        /* Check archive, with as many threads as asked for. */
+        i = 3;
+
+        if(argc > 5 && !strcmp(argv[3], "-j")) {
+            if((threads = atoi(argv[4])) < 1) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[4]);
+                return EXIT_FAILURE;
+            }
+
+            i = 5;
+        }
+
+        if(!strcmp(argv[2], "-v")) {
+            if(argc != i + 2)
+                return -1;
+
+            return afs_verify(argv[i], argv[i + 1], threads);
+        }
+
+        if(argc != i + 1)
+            return -1;
+
+        return afs_verify(argv[i], NULL, threads);
     }
     else if(!strcmp(argv[2], "-c")) {
-        /* Create archive. */
+        /* Create archive, with as many threads as asked for. */
+        if(argc >= 7 && !strcmp(argv[3], "-j")) {
+            if((threads = atoi(argv[4])) < 1) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[4]);
+                return EXIT_FAILURE;
+            }
+
+            return afs_create(argv[5], argc - 6, argv + 6, threads);
+        }
+
         if(argc < 5)
             return -1;
 
-        return afs_create(argv[3], argc - 4, argv + 4);
+        return afs_create(argv[3], argc - 4, argv + 4, 1);
     }
     else if(!strcmp(argv[2], "-r")) {
         /* Append file(s). */
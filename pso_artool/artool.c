@@ -16,10 +16,27 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/* For copy_file_range. */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include "windows_compat.h"
+#endif
+
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define HAVE_COPY_FILE_RANGE
+#endif
 
 /* Available archive types. */
 #define ARCHIVE_TYPE_NONE   -1
@@ -58,6 +75,116 @@ int write_file(const char *fn, const uint8_t *buf, size_t sz) {
     return 0;
 }
 
+/* Read or write exactly len bytes at the given offset in a file. */
+int read_at(int fd, void *buf, size_t len, off_t off) {
+    ssize_t rv;
+
+    while(len) {
+#ifndef _WIN32
+        if((rv = pread(fd, buf, len, off)) <= 0) {
+#else
+        if(lseek(fd, off, SEEK_SET) < 0 || (rv = read(fd, buf, len)) <= 0) {
+#endif
+            if(!rv)
+                errno = EIO;
+            return -1;
+        }
+
+        buf = (uint8_t *)buf + rv;
+        off += rv;
+        len -= (size_t)rv;
+    }
+
+    return 0;
+}
+
+int write_at(int fd, const void *buf, size_t len, off_t off) {
+    ssize_t rv;
+
+    while(len) {
+#ifndef _WIN32
+        if((rv = pwrite(fd, buf, len, off)) < 0)
+#else
+        if(lseek(fd, off, SEEK_SET) < 0 || (rv = write(fd, buf, len)) < 0)
+#endif
+            return -1;
+
+        buf = (const uint8_t *)buf + rv;
+        off += rv;
+        len -= (size_t)rv;
+    }
+
+    return 0;
+}
+
+/* Copy len bytes from one file descriptor to another, at the given offsets.
+   This lets the kernel do the copy if it can (which can avoid copying the data
+   at all on some filesystems), otherwise it goes through a buffer on the stack.
+   Neither file's position is used or changed, except on Windows. */
+int copy_range(int dst, off_t doff, int src, off_t soff, size_t len) {
+    uint8_t buf[65536];
+    size_t sz;
+#ifdef HAVE_COPY_FILE_RANGE
+    ssize_t rv;
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+    while(len) {
+        if((rv = copy_file_range(src, &soff, dst, &doff, len, 0)) <= 0)
+            break;
+
+        len -= (size_t)rv;
+    }
+
+    if(!len)
+        return 0;
+#endif
+
+    while(len) {
+        sz = len > sizeof(buf) ? sizeof(buf) : len;
+
+        if(read_at(src, buf, sz, soff) || write_at(dst, buf, sz, doff))
+            return -1;
+
+        soff += sz;
+        doff += sz;
+        len -= sz;
+    }
+
+    return 0;
+}
+
+/* Create a file to build a new version of fn in. It goes in the same directory
+   as fn, so that it can be renamed over it (which wouldn't work from another
+   filesystem). The name is put in tmpfn, which the caller has to free.
+   Returns the new file's descriptor, or -1 on error. */
+int make_temp(const char *fn, char **tmpfn) {
+    const char *base;
+    char *rv;
+    int fd;
+
+    base = strrchr(fn, '/');
+#ifdef _WIN32
+    if(strrchr(fn, '\\') > base)
+        base = strrchr(fn, '\\');
+#endif
+    base = base ? base + 1 : fn;
+
+    if(!(rv = (char *)malloc((base - fn) + 13)))
+        return -1;
+
+    memcpy(rv, fn, base - fn);
+    strcpy(rv + (base - fn), "artoolXXXXXX");
+
+    if((fd = mkstemp(rv)) < 0) {
+        free(rv);
+        return -1;
+    }
+
+    *tmpfn = rv;
+    return fd;
+}
+
 int read_file(const char *fn, uint8_t **buf) {
     FILE *fp;
     uint8_t *out;
@@ -137,10 +264,19 @@ static void print_help(const char *bin) {
            "files:\n"
            " -t archive\n"
            "    List all files in the archive.\n"
-           " -x archive\n"
-           "    Extract all files from the archive.\n"
-           " -c archive file1 [file2 ...]\n"
-           "    Create a new archive containing the files specified.\n"
+           " -x [-j N] archive\n"
+           "    Extract all files from the archive. If specified, N threads\n"
+           "    will be used to extract the files.\n"
+           " -v [-j N] archive directory_or_manifest\n"
+           "    Check the files in the archive against the files of the same\n"
+           "    names in a directory, or against a manifest, without writing\n"
+           "    anything out.\n"
+           " -vm [-j N] archive\n"
+           "    Print a manifest for the archive: a line for each file with\n"
+           "    its XXH64 hash (16 hex digits), its size and its name.\n"
+           " -c [-j N] archive file1 [file2 ...]\n"
+           "    Create a new archive containing the files specified. If\n"
+           "    specified, N threads will copy the files in at once.\n"
            " -r archive file1 [file2 ...]\n"
            "    Append the files specified to an existing archive.\n"
            " -u archive file_in_archive file_on_disk\n"
@@ -154,7 +290,11 @@ static void print_help(const char *bin) {
            "    specified, the default output filename shall have the same\n"
            "    basename as the archive with the extension .bin appended.\n"
            " -c archive file\n"
-           "    Compress the specified file and store it as archive.\n\n"
+           "    Compress the specified file and store it as archive.\n"
+           " -b [-j N] file1 [file2 ...]\n"
+           "    Compress each of the files specified, storing each one with\n"
+           "    the extension .prs appended to its name. If specified, N\n"
+           "    threads will be used to compress the files.\n\n"
            "For PRSD/PRC (--prsd, --prsd-little, --prsd-big, --prc, \n"
            "              --prc-little, --prc-big) files:\n"
            " -x archive [to]\n"
@@ -178,6 +318,12 @@ static void print_help(const char *bin) {
            "endianness is not specified.\n"
            "Big-endian archives are used in PSO for Gamecube, whereas all\n"
            "other versions of the game use little-endian archives.\n\n");
+    printf("When compressing PRS files, set PRS_CACHE_DIR to a directory to\n"
+           "keep the compressed data in between runs, so that files that\n"
+           "haven't changed don't have to be compressed again. The cache is\n"
+           "limited to PRS_CACHE_SIZE MiB (256 by default).\n\n");
+    printf("Set PRS_KERNEL to scalar, sse4.2, avx2 or neon to override the\n"
+           "choice of PRS code used for this CPU.\n\n");
 }
 
 /* Parse any command-line arguments passed in. */
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <sys/stat.h>
 
@@ -29,14 +30,36 @@
 #include <unistd.h>
 #endif
 
+#include <fcntl.h>
+
 #include <psoarchive/GSL.h>
 
 #ifdef _WIN32
 #include "windows_compat.h"
 #endif
 
+#include "prs-verify.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Each entry in the file table is a 32 byte name, the offset of the file (in
+   2KiB blocks), its size, and 8 bytes of padding. Files start on a 2KiB
+   boundary, and the table runs up to the first one. */
+#define GSL_ALIGN       2048
+#define GSL_ENT_SIZE    48
+#define GSL_NAME_LEN    32
+#define GSL_MAX_TAB     (GSL_ENT_SIZE * 65536)
+
 static uint32_t endian = 0;
 
+/* In artool.c */
+extern int read_at(int fd, void *buf, size_t len, off_t off);
+extern int write_at(int fd, const void *buf, size_t len, off_t off);
+extern int copy_range(int dst, off_t doff, int src, off_t soff, size_t len);
+extern int make_temp(const char *fn, char **tmpfn);
+
 static int digits(uint32_t n) {
     int r = 1;
     while(n /= 10) ++r;
@@ -76,79 +99,891 @@ static int gsl_list(const char *fn) {
     return 0;
 }
 
-static int gsl_extract(const char *fn) {
-    pso_gsl_read_t *cxt;
-    pso_error_t err;
-    uint32_t cnt, i;
+/* Extract one file from the archive into the current directory. */
+static int gsl_extract_file(pso_gsl_read_t *cxt, uint32_t i) {
     ssize_t sz;
+    pso_error_t err;
     char afn[64];
     FILE *fp;
     uint8_t *buf;
 
+    if((sz = pso_gsl_file_size(cxt, i)) < 0) {
+        fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(sz));
+        return EXIT_FAILURE;
+    }
+
+    if((err = pso_gsl_file_name(cxt, i, afn, 64)) < 0) {
+        fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    if(!(buf = malloc(sz))) {
+        perror("Cannot extract file");
+        return EXIT_FAILURE;
+    }
+
+    if((err = pso_gsl_file_read(cxt, i, buf, (size_t)sz)) < 0) {
+        fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(err));
+        free(buf);
+        return EXIT_FAILURE;
+    }
+
+    if(!(fp = fopen(afn, "wb"))) {
+        perror("Cannot extract file");
+        free(buf);
+        return EXIT_FAILURE;
+    }
+
+    if(fwrite(buf, 1, sz, fp) != (size_t)sz) {
+        perror("Cannot extract file");
+        fclose(fp);
+        free(buf);
+        return EXIT_FAILURE;
+    }
+
+    /* Clean up, we're done with this file. */
+    fclose(fp);
+    free(buf);
+
+    return 0;
+}
+
+struct gsl_worker {
+    pthread_t thd;
+    const char *fn;
+    uint32_t count;
+    uint32_t start;
+    uint32_t step;
+    struct prs_verify *verify;
+    int bad;
+    int rv;
+};
+
+/* Extract every step'th file, starting at start. The archive handle keeps
+   track of its own position in the file, so each thread opens the archive
+   for itself rather than sharing one. */
+static void *gsl_extract_thd(void *d) {
+    struct gsl_worker *w = (struct gsl_worker *)d;
+    pso_gsl_read_t *cxt;
+    pso_error_t err;
+    uint32_t i;
+
+    if(!(cxt = pso_gsl_read_open(w->fn, endian, &err))) {
+        fprintf(stderr, "Cannot open archive %s: %s\n", w->fn,
+                pso_strerror(err));
+        w->rv = EXIT_FAILURE;
+        return NULL;
+    }
+
+    for(i = w->start; i < w->count; i += w->step) {
+        if((w->rv = gsl_extract_file(cxt, i)))
+            break;
+    }
+
+    pso_gsl_read_close(cxt);
+    return NULL;
+}
+
+static int gsl_extract(const char *fn, int threads) {
+    pso_gsl_read_t *cxt;
+    pso_error_t err;
+    struct gsl_worker *workers;
+    uint32_t cnt, i;
+    int started, ret, rv = 0;
+
     if(!(cxt = pso_gsl_read_open(fn, endian, &err))) {
         fprintf(stderr, "Cannot open archive %s: %s\n", fn, pso_strerror(err));
         return EXIT_FAILURE;
     }
 
-    /* Loop through each file... */
     cnt = pso_gsl_file_count(cxt);
 
-    for(i = 0; i < cnt; ++i) {
-        if((sz = pso_gsl_file_size(cxt, i)) < 0) {
-            fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(sz));
-            pso_gsl_read_close(cxt);
-            return EXIT_FAILURE;
+    /* Loop through each file... */
+    if(threads == 1 || cnt < 2) {
+        for(i = 0; i < cnt; ++i) {
+            if((rv = gsl_extract_file(cxt, i)))
+                break;
         }
 
-        if(pso_gsl_file_name(cxt, i, afn, 64) < 0) {
-            fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(sz));
-            pso_gsl_read_close(cxt);
-            return EXIT_FAILURE;
+        pso_gsl_read_close(cxt);
+        return rv;
+    }
+
+    pso_gsl_read_close(cxt);
+
+    if((uint32_t)threads > cnt)
+        threads = (int)cnt;
+
+    if(!(workers = (struct gsl_worker *)calloc(threads, sizeof(*workers)))) {
+        perror("Cannot extract file");
+        return EXIT_FAILURE;
+    }
+
+    for(started = 0; started < threads; ++started) {
+        workers[started].fn = fn;
+        workers[started].count = cnt;
+        workers[started].start = (uint32_t)started;
+        workers[started].step = (uint32_t)threads;
+
+        if((ret = pthread_create(&workers[started].thd, NULL, &gsl_extract_thd,
+                                 &workers[started]))) {
+            fprintf(stderr, "Cannot create thread: %s\n", strerror(ret));
+            rv = EXIT_FAILURE;
+            break;
         }
+    }
 
-        if(!(buf = malloc(sz))) {
-            perror("Cannot extract file");
-            pso_gsl_read_close(cxt);
-            return EXIT_FAILURE;
+    for(i = 0; i < (uint32_t)started; ++i) {
+        pthread_join(workers[i].thd, NULL);
+
+        if(workers[i].rv)
+            rv = workers[i].rv;
+    }
+
+    free(workers);
+    return rv;
+}
+
+/* Check every step'th file, starting at start, against w->verify. Each thread
+   reads files into its own buffer, which gets reused for every file it
+   checks. */
+static void *gsl_verify_thd(void *d) {
+    struct gsl_worker *w = (struct gsl_worker *)d;
+    pso_gsl_read_t *cxt;
+    pso_error_t err;
+    uint32_t i;
+    ssize_t sz;
+    size_t buf_len = 0;
+    uint8_t *buf = NULL, *tmp;
+    char afn[64];
+    int rv;
+
+    if(!(cxt = pso_gsl_read_open(w->fn, endian, &err))) {
+        fprintf(stderr, "Cannot open archive %s: %s\n", w->fn,
+                pso_strerror(err));
+        w->rv = EXIT_FAILURE;
+        return NULL;
+    }
+
+    for(i = w->start; i < w->count; i += w->step) {
+        if((sz = pso_gsl_file_size(cxt, i)) < 0 ||
+           (err = pso_gsl_file_name(cxt, i, afn, 64)) < 0) {
+            fprintf(stderr, "Cannot read archive %s: %s\n", w->fn,
+                    pso_strerror(sz < 0 ? (pso_error_t)sz : err));
+            w->rv = EXIT_FAILURE;
+            break;
         }
 
-        if((err = pso_gsl_file_read(cxt, i, buf, (size_t)sz)) < 0) {
-            fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(sz));
-            free(buf);
-            pso_gsl_read_close(cxt);
-            return EXIT_FAILURE;
+        if((size_t)sz >= buf_len) {
+            if(!(tmp = (uint8_t *)realloc(buf, (size_t)sz + 1))) {
+                perror("Cannot read archive");
+                w->rv = EXIT_FAILURE;
+                break;
+            }
+
+            buf = tmp;
+            buf_len = (size_t)sz + 1;
         }
 
-        if(!(fp = fopen(afn, "wb"))) {
-            perror("Cannot extract file");
-            free(buf);
-            pso_gsl_read_close(cxt);
-            return EXIT_FAILURE;
+        if(sz && (err = pso_gsl_file_read(cxt, i, buf, (size_t)sz)) < 0) {
+            fprintf(stderr, "Cannot read archive %s: %s\n", w->fn,
+                    pso_strerror(err));
+            w->rv = EXIT_FAILURE;
+            break;
         }
 
-        if(fwrite(buf, 1, sz, fp) != (size_t)sz) {
-            perror("Cannot extract file");
-            fclose(fp);
-            free(buf);
-            pso_gsl_read_close(cxt);
-            return EXIT_FAILURE;
+        if((rv = prs_verify_file(w->verify, i, afn, buf, (size_t)sz)) < 0) {
+            fprintf(stderr, "Cannot check file %s: %s\n", afn,
+                    strerror(-rv));
+            rv = 1;
         }
 
-        /* Clean up, we're done with this file. */
-        fclose(fp);
-        free(buf);
+        w->bad += rv;
     }
 
+    free(buf);
     pso_gsl_read_close(cxt);
+    return NULL;
+}
+
+/* Check the files in an archive against a directory or a manifest (or print
+   a manifest for it, if against is NULL), without writing any of them out. */
+static int gsl_verify(const char *fn, const char *against, int threads) {
+    pso_gsl_read_t *cxt;
+    pso_error_t err;
+    struct gsl_worker *workers;
+    struct prs_verify *v;
+    uint32_t cnt, i;
+    int started, ret, bad = 0, rv = 0;
+
+    if(!(cxt = pso_gsl_read_open(fn, endian, &err))) {
+        fprintf(stderr, "Cannot open archive %s: %s\n", fn, pso_strerror(err));
+        return EXIT_FAILURE;
+    }
+
+    cnt = pso_gsl_file_count(cxt);
+    pso_gsl_read_close(cxt);
+
+    if((uint32_t)threads > cnt)
+        threads = cnt ? (int)cnt : 1;
+
+    if(!(workers = (struct gsl_worker *)calloc(threads, sizeof(*workers)))) {
+        perror("Cannot check archive");
+        return EXIT_FAILURE;
+    }
+
+    if((rv = prs_verify_begin(&v, against, cnt, stdout))) {
+        fprintf(stderr, "Cannot read %s: %s\n", against ? against : fn,
+                strerror(-rv));
+        free(workers);
+        return EXIT_FAILURE;
+    }
+
+    for(started = 0; started < threads; ++started) {
+        workers[started].fn = fn;
+        workers[started].count = cnt;
+        workers[started].start = (uint32_t)started;
+        workers[started].step = (uint32_t)threads;
+        workers[started].verify = v;
+
+        if(threads == 1) {
+            gsl_verify_thd(&workers[0]);
+        }
+        else if((ret = pthread_create(&workers[started].thd, NULL,
+                                      &gsl_verify_thd, &workers[started]))) {
+            fprintf(stderr, "Cannot create thread: %s\n", strerror(ret));
+            rv = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    for(i = 0; i < (uint32_t)started; ++i) {
+        if(threads > 1)
+            pthread_join(workers[i].thd, NULL);
+
+        if(workers[i].rv)
+            rv = workers[i].rv;
+
+        bad += workers[i].bad;
+    }
+
+    bad += prs_verify_end(v);
+    free(workers);
+
+    if(rv)
+        return rv;
+
+    if(against)
+        printf("%s: %d problem(s) found\n", fn, bad);
+
+    return bad ? EXIT_FAILURE : 0;
+}
+
+
+/* One file in an archive we're working on directly. The data is at offset in
+   fd, which is either the archive itself or a new file being added. */
+struct gsl_ent {
+    int fd;
+    uint32_t offset;
+    uint32_t size;
+    char name[GSL_NAME_LEN + 1];
+};
+
+struct gsl_dir {
+    int fd;
+    int big;
+    uint32_t count;
+    uint32_t data_start;
+    struct gsl_ent *ents;
+};
+
+static uint32_t get32(const uint8_t *b, int big) {
+    if(big)
+        return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static void put32(uint8_t *b, uint32_t v, int big) {
+    int i;
+
+    for(i = 0; i < 4; ++i)
+        b[big ? 3 - i : i] = (uint8_t)(v >> (i * 8));
+}
+
+static uint32_t gsl_align(uint32_t v) {
+    return (v + GSL_ALIGN - 1) & ~(uint32_t)(GSL_ALIGN - 1);
+}
+
+/* Figure out where the data for the last file ends. */
+static uint32_t gsl_data_end(const struct gsl_dir *dir) {
+    uint32_t i, end = dir->data_start;
+
+    for(i = 0; i < dir->count; ++i) {
+        if(dir->ents[i].offset + dir->ents[i].size > end)
+            end = dir->ents[i].offset + dir->ents[i].size;
+    }
+
+    return end;
+}
+
+static void gsl_free_dir(struct gsl_dir *dir) {
+    uint32_t i;
+
+    if(dir->ents) {
+        for(i = 0; i < dir->count; ++i) {
+            if(dir->ents[i].fd != dir->fd && dir->ents[i].fd >= 0)
+                close(dir->ents[i].fd);
+        }
+
+        free(dir->ents);
+    }
+
+    if(dir->fd >= 0)
+        close(dir->fd);
+
+    dir->ents = NULL;
+    dir->fd = -1;
+}
+
+/* Check whether the file table reads sensibly with the given byte order, and
+   count how many files are in it if so. */
+static int gsl_check_tab(const uint8_t *tab, uint32_t len, uint64_t fsize,
+                         int big, uint32_t *cnt) {
+    uint32_t i, off, first = 0xFFFFFFFF;
+
+    /* The table ends at an empty name, or when it runs into the first file,
+       whichever comes first. */
+    for(i = 0; i < len / GSL_ENT_SIZE && tab[i * GSL_ENT_SIZE] &&
+        (uint64_t)i * GSL_ENT_SIZE < (uint64_t)first * GSL_ALIGN; ++i) {
+        off = get32(tab + i * GSL_ENT_SIZE + 32, big);
+
+        if((uint64_t)off * GSL_ALIGN + get32(tab + i * GSL_ENT_SIZE + 36, big) >
+           fsize || off > 0xFFFFFFFF / GSL_ALIGN)
+            return 0;
+
+        if(off < first)
+            first = off;
+
+        /* Don't run into the first file's data. */
+        if((uint64_t)(i + 1) * GSL_ENT_SIZE > (uint64_t)first * GSL_ALIGN)
+            return 0;
+    }
+
+    *cnt = i;
+    return i != 0;
+}
+
+/* Read in the file table of an archive, so that it can be changed without
+   going through every file in it. Returns 1 if the archive is laid out in some
+   way that this doesn't understand (or if it isn't clear which way around the
+   numbers in it go), in which case the caller should fall back to rewriting
+   it the slow way. */
+static int gsl_read_dir(const char *fn, struct gsl_dir *dir) {
+    uint8_t *tab = NULL, *ent;
+    struct stat st;
+    uint32_t i, len, lcnt = 0, bcnt = 0;
+    int rv = -1, little, big;
+
+    memset(dir, 0, sizeof(struct gsl_dir));
+
+    if((dir->fd = open(fn, O_RDWR | O_BINARY)) < 0) {
+        fprintf(stderr, "Cannot open archive %s: %s\n", fn, strerror(errno));
+        return -1;
+    }
+
+    if(fstat(dir->fd, &st)) {
+        fprintf(stderr, "Cannot read archive %s: %s\n", fn, strerror(errno));
+        goto err;
+    }
+
+    rv = 1;
+
+    if(st.st_size < GSL_ENT_SIZE || st.st_size > 0xFFFFFFFF)
+        goto err;
+
+    /* The table can't be any bigger than the space before the first file, so
+       read in as much as could possibly be there and figure it out after. */
+    len = st.st_size < GSL_MAX_TAB ? (uint32_t)st.st_size : GSL_MAX_TAB;
+
+    if(!(tab = (uint8_t *)malloc(len))) {
+        perror("Cannot read archive");
+        rv = -1;
+        goto err;
+    }
+
+    if(read_at(dir->fd, tab, len, 0)) {
+        fprintf(stderr, "Cannot read archive %s: %s\n", fn, strerror(errno));
+        rv = -1;
+        goto err;
+    }
+
+    little = endian != PSO_GSL_BIG_ENDIAN &&
+        gsl_check_tab(tab, len, st.st_size, 0, &lcnt);
+    big = endian != PSO_GSL_LITTLE_ENDIAN &&
+        gsl_check_tab(tab, len, st.st_size, 1, &bcnt);
+
+    if(little == big)
+        goto err;
+
+    dir->big = big;
+    dir->count = big ? bcnt : lcnt;
+    dir->data_start = (uint32_t)st.st_size;
+
+    if(!(dir->ents = (struct gsl_ent *)calloc(dir->count,
+                                             sizeof(struct gsl_ent)))) {
+        perror("Cannot read archive");
+        rv = -1;
+        goto err;
+    }
+
+    for(i = 0; i < dir->count; ++i) {
+        ent = tab + i * GSL_ENT_SIZE;
+        dir->ents[i].fd = dir->fd;
+        memcpy(dir->ents[i].name, ent, GSL_NAME_LEN);
+        dir->ents[i].offset = get32(ent + 32, big) * GSL_ALIGN;
+        dir->ents[i].size = get32(ent + 36, big);
+
+        if(dir->ents[i].offset < dir->data_start)
+            dir->data_start = dir->ents[i].offset;
+    }
+
+    free(tab);
     return 0;
+
+err:
+    free(tab);
+    gsl_free_dir(dir);
+    return rv;
+}
+
+/* Set up an entry for a new file to be put in the archive. */
+static int gsl_new_ent(struct gsl_ent *ent, const char *name,
+                       const char *path) {
+    struct stat st;
+
+    if((ent->fd = open(path, O_RDONLY | O_BINARY)) < 0 || fstat(ent->fd, &st)) {
+        fprintf(stderr, "Cannot add file '%s' to archive: %s\n", path,
+                strerror(errno));
+        return -1;
+    }
+
+    if(st.st_size > 0xFFFFFFFF - GSL_ALIGN) {
+        fprintf(stderr, "Cannot add file '%s' to archive: File too large\n",
+                path);
+        return -1;
+    }
+
+    ent->offset = 0;
+    ent->size = (uint32_t)st.st_size;
+    memset(ent->name, 0, sizeof(ent->name));
+    strncpy(ent->name, name, GSL_NAME_LEN);
+    return 0;
+}
+
+/* Write out the file table for the archive (clearing out any unused space in
+   it), and trim the file to end right after the last thing in it. */
+static int gsl_write_dir(const struct gsl_dir *dir, int fd, uint32_t end) {
+    uint8_t *buf;
+    uint32_t i;
+    int rv = -1;
+
+    if(!(buf = (uint8_t *)calloc(1, dir->data_start))) {
+        perror("Cannot write archive");
+        return -1;
+    }
+
+    for(i = 0; i < dir->count; ++i) {
+        memcpy(buf + i * GSL_ENT_SIZE, dir->ents[i].name, GSL_NAME_LEN);
+        put32(buf + i * GSL_ENT_SIZE + 32, dir->ents[i].offset / GSL_ALIGN,
+              dir->big);
+        put32(buf + i * GSL_ENT_SIZE + 36, dir->ents[i].size, dir->big);
+    }
+
+    if(ftruncate(fd, end) || write_at(fd, buf, dir->data_start, 0))
+        perror("Cannot write archive");
+    else
+        rv = 0;
+
+    free(buf);
+    return rv;
 }
 
-static int gsl_create(const char *fn, int file_cnt, const char *files[]) {
+/* Copy every file into a brand new archive, at the offsets they'll have in it,
+   then move it over the old one. */
+static int gsl_rebuild(const char *fn, struct gsl_dir *dir) {
+    char *tmpfn;
+    uint32_t pos, i;
+    int fd, rv = -1;
+
+#ifndef _WIN32
+    mode_t mask;
+#endif
+
+    if((fd = make_temp(fn, &tmpfn)) < 0) {
+        perror("Cannot create temporary file");
+        gsl_free_dir(dir);
+        return -1;
+    }
+
+    /* Leave room for an empty entry at the end of the table so that it is
+       always terminated, and keep the files where they were if the table
+       still fits before them. */
+    pos = gsl_align((dir->count + 1) * GSL_ENT_SIZE);
+
+    if(dir->data_start > pos)
+        pos = dir->data_start;
+
+    dir->data_start = pos;
+
+    for(i = 0; i < dir->count; ++i) {
+        if(copy_range(fd, pos, dir->ents[i].fd, dir->ents[i].offset,
+                      dir->ents[i].size)) {
+            perror("Cannot write archive");
+            goto out;
+        }
+
+        dir->ents[i].offset = pos;
+        pos = gsl_align(pos + dir->ents[i].size);
+    }
+
+    if(gsl_write_dir(dir, fd, pos))
+        goto out;
+
+#ifndef _WIN32
+    mask = umask(0);
+    umask(mask);
+    fchmod(fd, (~mask) & 0666);
+#endif
+
+    rv = 0;
+
+out:
+    close(fd);
+    gsl_free_dir(dir);
+
+    if(!rv && rename(tmpfn, fn)) {
+        fprintf(stderr, "Cannot move archive into place: %s\n",
+                strerror(errno));
+        rv = -1;
+    }
+
+    if(rv)
+        unlink(tmpfn);
+
+    free(tmpfn);
+    return rv;
+}
+
+/* Add files to the end of an archive. If there is room for them in the file
+   table, only the new files and the table get written. Returns 1 if the
+   archive needs to be done the slow way. */
+static int gsl_append_fast(const char *fn, int file_cnt, const char *files[]) {
+    struct gsl_dir dir;
+    struct gsl_ent *ents;
+    uint32_t pos, i;
+    char *tmp;
+    int rv, j;
+
+    if((rv = gsl_read_dir(fn, &dir)))
+        return rv;
+
+    pos = gsl_align(gsl_data_end(&dir));
+
+    if(!(ents = (struct gsl_ent *)realloc(dir.ents, (dir.count + file_cnt) *
+                                          sizeof(struct gsl_ent)))) {
+        perror("Cannot add file to archive");
+        gsl_free_dir(&dir);
+        return -1;
+    }
+
+    dir.ents = ents;
+
+    for(j = 0; j < file_cnt; ++j) {
+        if(!(tmp = strdup(files[j]))) {
+            perror("Cannot add file to archive");
+            gsl_free_dir(&dir);
+            return -1;
+        }
+
+        rv = gsl_new_ent(&dir.ents[dir.count++], basename(tmp), files[j]);
+        free(tmp);
+
+        if(rv) {
+            gsl_free_dir(&dir);
+            return -1;
+        }
+    }
+
+    /* If the table (and the empty entry after it) would run into the first
+       file, everything has to move anyway. */
+    if((dir.count + 1) * GSL_ENT_SIZE > dir.data_start)
+        return gsl_rebuild(fn, &dir);
+
+    for(i = dir.count - file_cnt; i < dir.count; ++i) {
+        if(copy_range(dir.fd, pos, dir.ents[i].fd, 0, dir.ents[i].size)) {
+            perror("Cannot add file to archive");
+            gsl_free_dir(&dir);
+            return -1;
+        }
+
+        close(dir.ents[i].fd);
+        dir.ents[i].fd = dir.fd;
+        dir.ents[i].offset = pos;
+        pos = gsl_align(pos + dir.ents[i].size);
+    }
+
+    rv = gsl_write_dir(&dir, dir.fd, pos);
+    gsl_free_dir(&dir);
+    return rv;
+}
+
+static int gsl_find(const struct gsl_dir *dir, const char *name,
+                    uint32_t *idx) {
+    uint32_t i;
+
+    for(i = 0; i < dir->count; ++i) {
+        if(!strcmp(dir->ents[i].name, name)) {
+            *idx = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Replace one file in an archive. If the new file fits in before whatever
+   comes after the old one, it is just written over the old one. */
+static int gsl_update_fast(const char *fn, const char *oldfn,
+                           const char *newfn) {
+    struct gsl_dir dir;
+    struct gsl_ent ent;
+    uint32_t i, j, limit;
+    int rv;
+
+    if((rv = gsl_read_dir(fn, &dir)))
+        return rv;
+
+    /* If it isn't in there, there's nothing to do. */
+    if(gsl_find(&dir, oldfn, &i)) {
+        gsl_free_dir(&dir);
+        return 0;
+    }
+
+    if(gsl_new_ent(&ent, dir.ents[i].name, newfn)) {
+        if(ent.fd >= 0)
+            close(ent.fd);
+
+        gsl_free_dir(&dir);
+        return -1;
+    }
+
+    /* See how much room there is before whatever comes after the old file (if
+       it's the last file, it can grow as much as it wants). */
+    limit = 0xFFFFFFFF;
+
+    for(j = 0; j < dir.count; ++j) {
+        if(dir.ents[j].offset > dir.ents[i].offset &&
+           dir.ents[j].offset < limit)
+            limit = dir.ents[j].offset;
+    }
+
+    if((uint64_t)dir.ents[i].offset + ent.size > limit) {
+        dir.ents[i] = ent;
+        return gsl_rebuild(fn, &dir);
+    }
+
+    if(copy_range(dir.fd, dir.ents[i].offset, ent.fd, 0, ent.size)) {
+        perror("Cannot update archive");
+        close(ent.fd);
+        gsl_free_dir(&dir);
+        return -1;
+    }
+
+    close(ent.fd);
+    ent.fd = dir.fd;
+    ent.offset = dir.ents[i].offset;
+    dir.ents[i] = ent;
+
+    rv = gsl_write_dir(&dir, dir.fd, gsl_align(gsl_data_end(&dir)));
+    gsl_free_dir(&dir);
+    return rv;
+}
+
+/* Take files out of an archive. Everything after them has to move, but the
+   data is copied file to file without going through memory here. */
+static int gsl_delete_fast(const char *fn, int file_cnt, const char *files[]) {
+    struct gsl_dir dir;
+    uint32_t i, j;
+    int rv, k;
+
+    if((rv = gsl_read_dir(fn, &dir)))
+        return rv;
+
+    for(i = j = 0; i < dir.count; ++i) {
+        for(k = 0; k < file_cnt; ++k) {
+            if(!strcmp(dir.ents[i].name, files[k]))
+                break;
+        }
+
+        if(k == file_cnt)
+            dir.ents[j++] = dir.ents[i];
+    }
+
+    /* Nothing to delete? We're done already. */
+    if(j == dir.count) {
+        gsl_free_dir(&dir);
+        return 0;
+    }
+
+    dir.count = j;
+    return gsl_rebuild(fn, &dir);
+}
+
+/* One thread's share of the files going into a new archive. */
+struct gsl_copy_worker {
+    pthread_t thd;
+    struct gsl_dir *dir;
+    uint32_t start;
+    uint32_t step;
+    int rv;
+};
+
+/* Copy every step'th file into the archive, starting at start. Where each file
+   goes is worked out before any of them are copied, so the threads never have
+   to wait on each other. */
+static void *gsl_copy_thd(void *d) {
+    struct gsl_copy_worker *w = (struct gsl_copy_worker *)d;
+    struct gsl_ent *ent;
+    uint32_t i;
+
+    for(i = w->start; i < w->dir->count; i += w->step) {
+        ent = &w->dir->ents[i];
+
+        if(copy_range(w->dir->fd, ent->offset, ent->fd, 0, ent->size)) {
+            perror("Cannot add file to archive");
+            w->rv = -1;
+            break;
+        }
+
+        close(ent->fd);
+        ent->fd = w->dir->fd;
+    }
+
+    return NULL;
+}
+
+/* Create an archive with several threads copying files into it at once. The
+   files are laid out the same way as when an archive gets rebuilt. */
+static int gsl_create_fast(const char *fn, int file_cnt, const char *files[],
+                           int threads) {
+    struct gsl_dir dir;
+    struct gsl_copy_worker *workers = NULL;
+    uint64_t pos;
+    uint32_t i;
+    char *tmp;
+    int j, err, started = 0, rv = -1;
+
+    memset(&dir, 0, sizeof(dir));
+    dir.fd = -1;
+    dir.big = endian == PSO_GSL_BIG_ENDIAN;
+
+    if(!(dir.ents = (struct gsl_ent *)calloc(file_cnt,
+                                             sizeof(struct gsl_ent))) ||
+       !(workers = (struct gsl_copy_worker *)calloc(threads,
+                                                    sizeof(*workers)))) {
+        perror("Cannot create archive");
+        goto out;
+    }
+
+    for(j = 0; j < file_cnt; ++j) {
+        if(!(tmp = strdup(files[j]))) {
+            perror("Cannot create archive");
+            goto out;
+        }
+
+        rv = gsl_new_ent(&dir.ents[dir.count++], basename(tmp), files[j]);
+        free(tmp);
+
+        if(rv) {
+            rv = -1;
+            goto out;
+        }
+    }
+
+    /* Leave room for an empty entry at the end of the table, so that it is
+       always terminated. */
+    rv = -1;
+    pos = dir.data_start = gsl_align((dir.count + 1) * GSL_ENT_SIZE);
+
+    if((dir.count + 1) * GSL_ENT_SIZE > GSL_MAX_TAB) {
+        fprintf(stderr, "Cannot create archive %s: Too many files\n", fn);
+        goto out;
+    }
+
+    for(i = 0; i < dir.count; ++i) {
+        dir.ents[i].offset = (uint32_t)pos;
+        pos = (pos + dir.ents[i].size + GSL_ALIGN - 1) &
+            ~(uint64_t)(GSL_ALIGN - 1);
+    }
+
+    if(pos > 0xFFFFFFFF) {
+        fprintf(stderr, "Cannot create archive %s: Archive too large\n", fn);
+        goto out;
+    }
+
+    if((dir.fd = open(fn, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666)) < 0) {
+        fprintf(stderr, "Cannot create archive %s: %s\n", fn, strerror(errno));
+        goto out;
+    }
+
+    if((uint32_t)threads > dir.count)
+        threads = (int)dir.count;
+
+    for(started = 0; started < threads; ++started) {
+        workers[started].dir = &dir;
+        workers[started].start = (uint32_t)started;
+        workers[started].step = (uint32_t)threads;
+
+        if((err = pthread_create(&workers[started].thd, NULL, &gsl_copy_thd,
+                                 &workers[started]))) {
+            fprintf(stderr, "Cannot create thread: %s\n", strerror(err));
+            break;
+        }
+    }
+
+    /* If not every thread got going, some files never got copied. */
+    rv = started == threads ? 0 : -1;
+
+    for(j = 0; j < started; ++j) {
+        pthread_join(workers[j].thd, NULL);
+
+        if(workers[j].rv)
+            rv = -1;
+    }
+
+    if(!rv)
+        rv = gsl_write_dir(&dir, dir.fd, (uint32_t)pos);
+
+    if(rv)
+        unlink(fn);
+
+out:
+    gsl_free_dir(&dir);
+    free(workers);
+    return rv ? EXIT_FAILURE : 0;
+}
+
+static int gsl_create(const char *fn, int file_cnt, const char *files[],
+                      int threads) {
     pso_gsl_write_t *cxt;
     pso_error_t err;
     int i;
     char *tmp, *bn;
 
+    if(threads > 1 && file_cnt > 1)
+        return gsl_create_fast(fn, file_cnt, files, threads);
+
     if(!(cxt = pso_gsl_new(fn, endian, &err))) {
         fprintf(stderr, "Cannot create archive %s: %s\n", fn,
                 pso_strerror(err));
@@ -203,6 +1038,10 @@ static int gsl_append(const char *fn, int file_cnt, const char *files[]) {
     mode_t mask;
 #endif
 
+    /* Try to just tack the new files on the end first. */
+    if((fd = gsl_append_fast(fn, file_cnt, files)) != 1)
+        return fd ? EXIT_FAILURE : 0;
+
     /* Create a temporary file for the new archive... */
     strcpy(tmpfn, "artoolXXXXXX");
     if((fd = mkstemp(tmpfn)) < 0) {
@@ -330,6 +1169,10 @@ static int gsl_update(const char *fn, const char *oldfn, const char *newfn) {
     mode_t mask;
 #endif
 
+    /* Try to just write over the old file first. */
+    if((fd = gsl_update_fast(fn, oldfn, newfn)) != 1)
+        return fd ? EXIT_FAILURE : 0;
+
     /* Create a temporary file for the new archive... */
     strcpy(tmpfn, "artoolXXXXXX");
     if((fd = mkstemp(tmpfn)) < 0) {
@@ -450,6 +1293,10 @@ static int gsl_delete(const char *fn, int file_cnt, const char *files[]) {
     mode_t mask;
 #endif
 
+    /* Try to move the files around without reading them in first. */
+    if((fd = gsl_delete_fast(fn, file_cnt, files)) != 1)
+        return fd ? EXIT_FAILURE : 0;
+
     /* Create a temporary file for the new archive... */
     strcpy(tmpfn, "artoolXXXXXX");
     if((fd = mkstemp(tmpfn)) < 0) {
@@ -485,6 +1332,8 @@ static int gsl_delete(const char *fn, int file_cnt, const char *files[]) {
     }
 
     for(i = 0; i < cnt; ++i) {
+        skip = 0;
+
         if(pso_gsl_file_name(rcxt, i, afn, 64) < 0) {
             fprintf(stderr, "Cannot extract file: %s\n", pso_strerror(sz));
             goto err_out;
@@ -551,6 +1400,8 @@ err_out:
 }
 
 int gsl(int argc, const char *argv[]) {
+    int threads = 1, i;
+
     if(argc < 4)
         return -1;
 
@@ -572,18 +1423,61 @@ int gsl(int argc, const char *argv[]) {
         return gsl_list(argv[3]);
     }
     else if(!strcmp(argv[2], "-x")) {
-        /* Extract. */
+        /* Extract, with as many threads as asked for. */
+        if(argc == 6 && !strcmp(argv[3], "-j")) {
+            if((threads = atoi(argv[4])) < 1) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[4]);
+                return EXIT_FAILURE;
+            }
+
+            return gsl_extract(argv[5], threads);
+        }
+
         if(argc != 4)
             return -1;
 
-        return gsl_extract(argv[3]);
+        return gsl_extract(argv[3], 1);
+    }
+    else if(!strcmp(argv[2], "-v") || !strcmp(argv[2], "-vm")) {
+        /* Check archive, with as many threads as asked for. */
+        i = 3;
+
+        if(argc > 5 && !strcmp(argv[3], "-j")) {
+            if((threads = atoi(argv[4])) < 1) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[4]);
+                return EXIT_FAILURE;
+            }
+
+            i = 5;
+        }
+
+        if(!strcmp(argv[2], "-v")) {
+            if(argc != i + 2)
+                return -1;
+
+            return gsl_verify(argv[i], argv[i + 1], threads);
+        }
+
+        if(argc != i + 1)
+            return -1;
+
+        return gsl_verify(argv[i], NULL, threads);
     }
     else if(!strcmp(argv[2], "-c")) {
-        /* Create archive. */
+        /* Create archive, with as many threads as asked for. */
+        if(argc >= 7 && !strcmp(argv[3], "-j")) {
+            if((threads = atoi(argv[4])) < 1) {
+                fprintf(stderr, "Invalid thread count: %s\n", argv[4]);
+                return EXIT_FAILURE;
+            }
+
+            return gsl_create(argv[5], argc - 6, argv + 6, threads);
+        }
+
         if(argc < 5)
             return -1;
 
-        return gsl_create(argv[3], argc - 4, argv + 4);
+        return gsl_create(argv[3], argc - 4, argv + 4, 1);
     }
     else if(!strcmp(argv[2], "-r")) {
         /* Append file(s). */
@@ -19,7 +19,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <psoarchive/PRS.h>
+#include <errno.h>
+#include <pthread.h>
 
 #ifndef _WIN32
 #include <libgen.h>
@@ -27,14 +28,159 @@
 #include "windows_compat.h"
 #endif
 
+/* From libprs, which does all of the compressing and decompressing. */
+#include "prs.h"
+#include "prs-cache.h"
+
 extern int write_file(const char *fn, const uint8_t *buf, size_t sz);
 extern int read_file(const char *fn, uint8_t **buf);
 
+struct batch_worker {
+    pthread_t thd;
+    const char **files;
+    int count;
+    int start;
+    int step;
+    int rv;
+};
+
+/* Compress every step'th file, starting at start, each into its own .prs file.
+   Each thread keeps one compression context and output buffer around for all
+   of its files, so those only get allocated once per thread (the buffer grows
+   if a bigger file comes along). */
+static void *batch_thd(void *d) {
+    struct batch_worker *w = (struct batch_worker *)d;
+    struct prs_comp_ctx *ctx;
+    struct prs_cache_key key;
+    uint8_t *src, *dst = NULL, *tmp;
+    size_t dst_len = 0;
+    char *fn;
+    int i, sz;
+
+    if(!(ctx = prs_comp_ctx_new())) {
+        perror("Cannot compress");
+        w->rv = EXIT_FAILURE;
+        return NULL;
+    }
+
+    for(i = w->start; i < w->count; i += w->step) {
+        if((sz = read_file(w->files[i], &src)) < 0) {
+            w->rv = EXIT_FAILURE;
+            continue;
+        }
+
+        if(dst_len < prs_max_compressed_size(sz)) {
+            if(!(tmp = (uint8_t *)realloc(dst, prs_max_compressed_size(sz)))) {
+                perror("Cannot compress");
+                free(src);
+                w->rv = EXIT_FAILURE;
+                continue;
+            }
+
+            dst = tmp;
+            dst_len = prs_max_compressed_size(sz);
+        }
+
+        prs_cache_key(&key, src, sz, PRS_CACHE_MODE_NORMAL);
+
+        if((sz = prs_cache_get(&key, dst, dst_len)) < 0 &&
+           (sz = prs_compress_into(ctx, src, key.len, dst, dst_len)) >= 0)
+            prs_cache_put(&key, dst, sz);
+
+        if(sz < 0) {
+            fprintf(stderr, "Cannot compress %s: %s\n", w->files[i],
+                    strerror(-sz));
+            free(src);
+            w->rv = EXIT_FAILURE;
+            continue;
+        }
+
+        free(src);
+
+        if(!(fn = (char *)malloc(strlen(w->files[i]) + 5))) {
+            perror("Cannot write file");
+            w->rv = EXIT_FAILURE;
+            continue;
+        }
+
+        sprintf(fn, "%s.prs", w->files[i]);
+
+        if(write_file(fn, dst, sz))
+            w->rv = EXIT_FAILURE;
+
+        free(fn);
+    }
+
+    free(dst);
+    prs_comp_ctx_free(ctx);
+    return NULL;
+}
+
+static int prs_batch(int argc, const char *argv[]) {
+    struct batch_worker *workers;
+    int i = 3, j, threads = 1, started, err, rv = 0;
+
+    if(argc > 4 && !strcmp(argv[3], "-j")) {
+        if((threads = atoi(argv[4])) < 1) {
+            fprintf(stderr, "Invalid thread count: %s\n", argv[4]);
+            return EXIT_FAILURE;
+        }
+
+        i = 5;
+    }
+
+    if(argc <= i)
+        return -1;
+
+    if(threads > argc - i)
+        threads = argc - i;
+
+    if(!(workers = (struct batch_worker *)calloc(threads, sizeof(*workers)))) {
+        perror("Cannot compress");
+        return EXIT_FAILURE;
+    }
+
+    for(started = 0; started < threads; ++started) {
+        workers[started].files = argv + i;
+        workers[started].count = argc - i;
+        workers[started].start = started;
+        workers[started].step = threads;
+
+        if((err = pthread_create(&workers[started].thd, NULL, &batch_thd,
+                                 &workers[started]))) {
+            fprintf(stderr, "Cannot create thread: %s\n", strerror(err));
+            rv = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    /* If we couldn't start all the threads, some files won't get done, but
+       still wait for the ones that did start. */
+    for(j = 0; j < started; ++j) {
+        pthread_join(workers[j].thd, NULL);
+
+        if(workers[j].rv)
+            rv = workers[j].rv;
+    }
+
+    free(workers);
+    return rv;
+}
+
 int prs(int argc, const char *argv[]) {
+    struct prs_comp_ctx *ctx;
+    struct prs_cache_key key;
     uint8_t *dst, *src;
+    size_t dst_len;
     char *fn, *tmp;
     int sz;
 
+    /* Batch compression takes any number of files. */
+    if(argc >= 4 && !strcmp(argv[2], "-b")) {
+        prs_cache_init();
+        return prs_batch(argc, argv);
+    }
+
     /* Make sure it's sane... */
     if(argc < 4 || argc > 5)
         return -1;
@@ -42,9 +188,9 @@ int prs(int argc, const char *argv[]) {
     /* Parse out the operation requested. */
     if(!strcmp(argv[2], "-x")) {
         /* Extract. */
-        if((sz = pso_prs_decompress_file(argv[3], &dst)) < 0) {
+        if((sz = prs_decompress_file(argv[3], &dst)) < 0) {
             fprintf(stderr, "Cannot extract %s: %s\n", argv[3],
-                    pso_strerror(sz));
+                    strerror(-sz));
             return EXIT_FAILURE;
         }
 
@@ -74,13 +220,32 @@ int prs(int argc, const char *argv[]) {
         if((sz = read_file(argv[4], &src)) < 0)
             return EXIT_FAILURE;
 
-        if((sz = pso_prs_compress(src, &dst, sz)) < 0) {
-            fprintf(stderr, "Cannot compress %s: %s\n", argv[4],
-                    pso_strerror(sz));
+        prs_cache_init();
+        prs_cache_key(&key, src, sz, PRS_CACHE_MODE_NORMAL);
+        dst_len = prs_max_compressed_size(sz);
+
+        if(!(ctx = prs_comp_ctx_new()) ||
+           !(dst = (uint8_t *)malloc(dst_len))) {
+            perror("Cannot compress");
+            prs_comp_ctx_free(ctx);
+            free(src);
             return EXIT_FAILURE;
         }
 
+        if((sz = prs_cache_get(&key, dst, dst_len)) < 0 &&
+           (sz = prs_compress_into(ctx, src, key.len, dst, dst_len)) >= 0)
+            prs_cache_put(&key, dst, sz);
+
+        prs_comp_ctx_free(ctx);
         free(src);
+
+        if(sz < 0) {
+            fprintf(stderr, "Cannot compress %s: %s\n", argv[4],
+                    strerror(-sz));
+            free(dst);
+            return EXIT_FAILURE;
+        }
+
         sz = write_file(argv[3], dst, sz);
         free(dst);
         return sz;
@@ -0,0 +1,658 @@
+/*
+    Sylverant Quest Tool
+    Copyright (C) 2012, 2015, 2019 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "libqst.h"
+
+/* This stuff copied from the packets.h file from Sylverant... */
+#if defined(WORDS_BIGENDIAN) || defined(__BIG_ENDIAN__)
+#define LE16(x) (((x >> 8) & 0xFF) | ((x & 0xFF) << 8))
+#define LE32(x) (((x >> 24) & 0x00FF) | \
+                 ((x >>  8) & 0xFF00) | \
+                 ((x & 0xFF00) <<  8) | \
+                 ((x & 0x00FF) << 24))
+#else
+#define LE16(x) x
+#define LE32(x) x
+#endif
+
+#ifdef PACKED
+#undef PACKED
+#endif
+
+#if defined(_MSC_VER)
+#define PACKED
+#pragma pack(push, 1)
+#elif defined (__GNUC__)
+#define PACKED __attribute__((packed))
+#else
+#error Need to define how to pack structures for your compiler!
+#endif
+
+typedef struct dc_pkt_hdr {
+    uint8_t pkt_type;
+    uint8_t flags;
+    uint16_t pkt_len;
+} PACKED dc_pkt_hdr_t;
+
+typedef struct pc_pkt_hdr {
+    uint16_t pkt_len;
+    uint8_t pkt_type;
+    uint8_t flags;
+} PACKED pc_pkt_hdr_t;
+
+typedef struct bb_pkt_hdr {
+    uint16_t pkt_len;
+    uint16_t pkt_type;
+    uint32_t flags;
+} PACKED bb_pkt_hdr_t;
+
+typedef struct dc_qst_hdr_s {
+    dc_pkt_hdr_t hdr;
+    char name[32];
+    uint8_t unused1[3];
+    char filename[16];
+    uint8_t unused2;
+    uint32_t length;
+} PACKED dc_qst_hdr;
+
+typedef struct pc_qst_hdr_s {
+    pc_pkt_hdr_t hdr;
+    char name[32];
+    uint16_t unused;
+    uint16_t flags;
+    char filename[16];
+    uint32_t length;
+} PACKED pc_qst_hdr;
+
+typedef struct gc_qst_hdr_s {
+    dc_pkt_hdr_t hdr;
+    char name[32];
+    uint16_t unused;
+    uint16_t flags;
+    char filename[16];
+    uint32_t length;
+} PACKED gc_qst_hdr;
+
+typedef struct bb_qst_hdr_s {
+    bb_pkt_hdr_t hdr;
+    char unused1[32];
+    uint16_t unused2;
+    uint16_t flags;
+    char filename[16];
+    uint32_t length;
+    char name[24];
+} PACKED bb_qst_hdr;
+
+typedef struct dc_quest_chunk {
+    union {
+        dc_pkt_hdr_t dc;
+        pc_pkt_hdr_t pc;
+    } hdr;
+    char filename[16];
+    uint8_t data[1024];
+    uint32_t length;
+} PACKED qst_chunk;
+
+typedef struct bb_quest_chunk {
+    bb_pkt_hdr_t hdr;
+    char filename[16];
+    uint8_t data[1024];
+    uint32_t length;
+} PACKED bb_qst_chunk;
+
+#if defined(_MSC_VER)
+#pragma pack(pop)
+#endif
+
+#undef PACKED
+
+#define QUEST_CHUNK_TYPE                0x0013
+#define QUEST_FILE_TYPE                 0x0044
+#define DL_QUEST_FILE_TYPE              0x00A6
+#define DL_QUEST_CHUNK_TYPE             0x00A7
+
+#define DC_CHUNK_SIZE                   0x0418
+#define BB_CHUNK_SIZE                   0x041C
+
+/* Blue Burst quests have four bytes of padding after each chunk. */
+#define BB_CHUNK_PAD                    4
+
+#define CHUNK_DATA_SIZE                 1024
+
+static size_t chunk_size(uint32_t type) {
+    if(type & QUEST_VER_BB)
+        return BB_CHUNK_SIZE + BB_CHUNK_PAD;
+
+    return DC_CHUNK_SIZE;
+}
+
+/* Where the filename and length are in a header of the given type. */
+static char *hdr_filename(uint32_t type, uint8_t *hdr) {
+    switch(type & 0xFF) {
+        case QUEST_VER_DC:
+            return ((dc_qst_hdr *)hdr)->filename;
+
+        case QUEST_VER_PC:
+            return ((pc_qst_hdr *)hdr)->filename;
+
+        case QUEST_VER_GC:
+            return ((gc_qst_hdr *)hdr)->filename;
+
+        default:
+            return ((bb_qst_hdr *)hdr)->filename;
+    }
+}
+
+static void set_hdr_length(uint32_t type, uint8_t *hdr, uint32_t len) {
+    switch(type & 0xFF) {
+        case QUEST_VER_DC:
+            ((dc_qst_hdr *)hdr)->length = LE32(len);
+            break;
+
+        case QUEST_VER_PC:
+            ((pc_qst_hdr *)hdr)->length = LE32(len);
+            break;
+
+        case QUEST_VER_GC:
+            ((gc_qst_hdr *)hdr)->length = LE32(len);
+            break;
+
+        default:
+            ((bb_qst_hdr *)hdr)->length = LE32(len);
+            break;
+    }
+}
+
+static int valid_type(uint32_t type) {
+    switch(type) {
+        case QUEST_VER_DC | QUEST_TYPE_ONLINE:
+        case QUEST_VER_DC | QUEST_TYPE_DOWNLOAD:
+        case QUEST_VER_PC | QUEST_TYPE_ONLINE:
+        case QUEST_VER_PC | QUEST_TYPE_DOWNLOAD:
+        case QUEST_VER_GC | QUEST_TYPE_ONLINE:
+        case QUEST_VER_GC | QUEST_TYPE_DOWNLOAD:
+        case QUEST_VER_BB | QUEST_TYPE_ONLINE:
+            return 1;
+    }
+
+    return 0;
+}
+
+static void make_hdr(uint32_t type, const char *fn, uint8_t *mbuf) {
+    dc_qst_hdr *dc = (dc_qst_hdr *)mbuf;
+    pc_qst_hdr *pc = (pc_qst_hdr *)mbuf;
+    bb_qst_hdr *bb = (bb_qst_hdr *)mbuf;
+
+    memset(mbuf, 0, QST_HDR_SIZE(type));
+
+    /* The Gamecube header is laid out like the PC one, but with the packet
+       header done the Dreamcast way. */
+    switch(type & 0xFF) {
+        case QUEST_VER_DC:
+        case QUEST_VER_GC:
+            dc->hdr.pkt_type = (type & QUEST_TYPE_DOWNLOAD) ?
+                DL_QUEST_FILE_TYPE : QUEST_FILE_TYPE;
+            dc->hdr.pkt_len = LE16(sizeof(dc_qst_hdr));
+            break;
+
+        case QUEST_VER_PC:
+            pc->hdr.pkt_type = (type & QUEST_TYPE_DOWNLOAD) ?
+                DL_QUEST_FILE_TYPE : QUEST_FILE_TYPE;
+            pc->hdr.pkt_len = LE16(sizeof(pc_qst_hdr));
+            break;
+
+        case QUEST_VER_BB:
+            bb->hdr.pkt_type = LE16(QUEST_FILE_TYPE);
+            bb->hdr.pkt_len = LE16(sizeof(bb_qst_hdr));
+            break;
+    }
+
+    strncpy(hdr_filename(type, mbuf), fn, 16);
+}
+
+int qst_check_hdr(uint32_t type, const uint8_t *hdr, size_t len) {
+    const dc_qst_hdr *dc = (const dc_qst_hdr *)hdr;
+    const pc_qst_hdr *pc = (const pc_qst_hdr *)hdr;
+    const gc_qst_hdr *gc = (const gc_qst_hdr *)hdr;
+    const bb_qst_hdr *bb = (const bb_qst_hdr *)hdr;
+
+    if(!valid_type(type) || len != QST_HDR_SIZE(type))
+        return -EINVAL;
+
+    switch(type) {
+        case QUEST_VER_DC | QUEST_TYPE_ONLINE:
+            if(dc->hdr.pkt_type != QUEST_FILE_TYPE ||
+               dc->hdr.pkt_len != LE16(sizeof(dc_qst_hdr)))
+                return -EINVAL;
+            break;
+
+        case QUEST_VER_DC | QUEST_TYPE_DOWNLOAD:
+            if(dc->hdr.pkt_type != DL_QUEST_FILE_TYPE ||
+               dc->hdr.pkt_len != LE16(sizeof(dc_qst_hdr)))
+                return -EINVAL;
+            break;
+
+        case QUEST_VER_PC | QUEST_TYPE_ONLINE:
+            if(pc->hdr.pkt_type != QUEST_FILE_TYPE ||
+               pc->hdr.pkt_len != LE16(sizeof(pc_qst_hdr)))
+                return -EINVAL;
+            break;
+
+        case QUEST_VER_PC | QUEST_TYPE_DOWNLOAD:
+            if(pc->hdr.pkt_type != DL_QUEST_FILE_TYPE ||
+               pc->hdr.pkt_len != LE16(sizeof(pc_qst_hdr)))
+                return -EINVAL;
+            break;
+
+        case QUEST_VER_GC | QUEST_TYPE_ONLINE:
+            if(gc->hdr.pkt_type != QUEST_FILE_TYPE ||
+               gc->hdr.pkt_len != LE16(sizeof(gc_qst_hdr)))
+                return -EINVAL;
+            break;
+
+        case QUEST_VER_GC | QUEST_TYPE_DOWNLOAD:
+            if(gc->hdr.pkt_type != DL_QUEST_FILE_TYPE ||
+               gc->hdr.pkt_len != LE16(sizeof(gc_qst_hdr)))
+                return -EINVAL;
+            break;
+
+        case QUEST_VER_BB | QUEST_TYPE_ONLINE:
+            if(bb->hdr.pkt_type != LE16(QUEST_FILE_TYPE) ||
+               bb->hdr.pkt_len != LE16(sizeof(bb_qst_hdr)))
+                return -EINVAL;
+            break;
+    }
+
+    return 0;
+}
+
+size_t qst_encoded_size(uint32_t type, const struct qst_file files[],
+                        int count) {
+    size_t rv = 0;
+    int i;
+
+    for(i = 0; i < count; ++i) {
+        rv += QST_HDR_SIZE(type);
+        rv += (files[i].len + CHUNK_DATA_SIZE - 1) / CHUNK_DATA_SIZE *
+            chunk_size(type);
+    }
+
+    return rv;
+}
+
+/* Write out one chunk of a file. */
+static void write_chunk(uint32_t type, uint8_t *dst, const char *fn,
+                        const uint8_t *data, size_t len, int num) {
+    qst_chunk *chunk = (qst_chunk *)dst;
+    bb_qst_chunk *bbchunk = (bb_qst_chunk *)dst;
+    uint8_t ctype = (type & QUEST_TYPE_DOWNLOAD) ? DL_QUEST_CHUNK_TYPE :
+        QUEST_CHUNK_TYPE;
+
+    /* Every header field and the name get filled in below, so the only part
+       that needs clearing is whatever the data doesn't cover (and the pad on
+       Blue Burst). Most chunks are full, so that's usually nothing. */
+    if(type & QUEST_VER_BB) {
+        memset(bbchunk->data + len, 0, CHUNK_DATA_SIZE - len);
+        memset(dst + BB_CHUNK_SIZE, 0, BB_CHUNK_PAD);
+    }
+    else {
+        memset(chunk->data + len, 0, CHUNK_DATA_SIZE - len);
+    }
+
+    switch(type & 0xFF) {
+        case QUEST_VER_DC:
+        case QUEST_VER_GC:
+            chunk->hdr.dc.pkt_type = ctype;
+            chunk->hdr.dc.flags = (uint8_t)num;
+            chunk->hdr.dc.pkt_len = LE16(sizeof(qst_chunk));
+            memcpy(chunk->filename, fn, 16);
+            memcpy(chunk->data, data, len);
+            chunk->length = LE32(((uint32_t)len));
+            break;
+
+        case QUEST_VER_PC:
+            chunk->hdr.pc.pkt_type = ctype;
+            chunk->hdr.pc.flags = (uint8_t)num;
+            chunk->hdr.pc.pkt_len = LE16(sizeof(qst_chunk));
+            memcpy(chunk->filename, fn, 16);
+            memcpy(chunk->data, data, len);
+            chunk->length = LE32(((uint32_t)len));
+            break;
+
+        case QUEST_VER_BB:
+            bbchunk->hdr.pkt_type = LE16(QUEST_CHUNK_TYPE);
+            bbchunk->hdr.flags = LE32(((uint32_t)(num & 0xFF)));
+            bbchunk->hdr.pkt_len = LE16(sizeof(bb_qst_chunk));
+            memcpy(bbchunk->filename, fn, 16);
+            memcpy(bbchunk->data, data, len);
+            bbchunk->length = LE32(((uint32_t)len));
+            break;
+    }
+}
+
+int qst_encode(uint32_t type, const struct qst_file files[], int count,
+               uint8_t *dst, size_t dst_len) {
+    uint8_t hdrs[3][0x58];
+    int order[3] = { 0, 1, 2 };
+    size_t len, off, total;
+    int i, j, num, more;
+    char *fn;
+    bb_qst_hdr *bbhdr;
+
+    if(!valid_type(type) || count < 2 || count > 3 ||
+       ((type & QUEST_VER_BB) && count != 2))
+        return -EINVAL;
+
+    if((total = qst_encoded_size(type, files, count)) > dst_len)
+        return -ENOSPC;
+
+    if(total > 0x7FFFFFFF)
+        return -EFBIG;
+
+    /* Build (or check) all the headers first. */
+    for(i = 0; i < count; ++i) {
+        if(files[i].len > 0xFFFFFFFF)
+            return -EFBIG;
+
+        if(files[i].hdr) {
+            if(qst_check_hdr(type, files[i].hdr, QST_HDR_SIZE(type)))
+                return -EINVAL;
+
+            memcpy(hdrs[i], files[i].hdr, QST_HDR_SIZE(type));
+        }
+        else {
+            if(!files[i].name || strlen(files[i].name) > 16)
+                return -EINVAL;
+
+            make_hdr(type, files[i].name, hdrs[i]);
+        }
+
+        set_hdr_length(type, hdrs[i], (uint32_t)files[i].len);
+
+        /* Blue Burst headers have a name for the quest in them too. If one
+           isn't given, the name of the .dat file is used. */
+        if(type & QUEST_VER_BB) {
+            bbhdr = (bb_qst_hdr *)hdrs[i];
+
+            if(bbhdr->name[0] == 0 && files[1].name) {
+                strncpy(bbhdr->name, files[1].name, 24);
+                bbhdr->name[23] = 0;
+            }
+        }
+    }
+
+    /* Qedit makes everything backwards for Blue Burst, doing the .dat first,
+       and everyone else seems to do it that way too. */
+    if(type & QUEST_VER_BB) {
+        order[0] = 1;
+        order[1] = 0;
+    }
+
+    off = 0;
+
+    for(i = 0; i < count; ++i) {
+        memcpy(dst + off, hdrs[order[i]], QST_HDR_SIZE(type));
+        off += QST_HDR_SIZE(type);
+    }
+
+    /* Then, the chunks of each file, taking turns. */
+    for(num = 0, more = 1; more; ++num) {
+        more = 0;
+
+        for(i = 0; i < count; ++i) {
+            j = order[i];
+
+            if((size_t)num * CHUNK_DATA_SIZE >= files[j].len)
+                continue;
+
+            len = files[j].len - (size_t)num * CHUNK_DATA_SIZE;
+
+            if(len > CHUNK_DATA_SIZE)
+                len = CHUNK_DATA_SIZE;
+
+            fn = hdr_filename(type, hdrs[j]);
+            write_chunk(type, dst + off, fn,
+                        files[j].data + (size_t)num * CHUNK_DATA_SIZE, len,
+                        num);
+            off += chunk_size(type);
+            more = 1;
+        }
+    }
+
+    return (int)off;
+}
+
+uint32_t qst_detect_type(const uint8_t *src, size_t len) {
+    const dc_qst_hdr *hdr = (const dc_qst_hdr *)src;
+
+    if(len < sizeof(dc_qst_hdr))
+        return QUEST_TYPE_INVALID;
+
+    if(src[0] == QUEST_FILE_TYPE && src[2] == 0x3C) {
+        if(hdr->filename[0] == 0)
+            /* Sure sign that we're on GC... */
+            return QUEST_VER_GC | QUEST_TYPE_ONLINE;
+        else
+            /* Assume we're on DC for now, I guess... */
+            return QUEST_VER_DC | QUEST_TYPE_ONLINE;
+    }
+    else if(src[0] == 0x3C && src[2] == QUEST_FILE_TYPE) {
+        /* PC */
+        return QUEST_VER_PC | QUEST_TYPE_ONLINE;
+    }
+    else if(src[0] == DL_QUEST_FILE_TYPE && src[2] == 0x3C) {
+        if(hdr->filename[0] == 0)
+            /* Sure sign that we're on GC... */
+            return QUEST_VER_GC | QUEST_TYPE_DOWNLOAD;
+        else
+            /* Assume we're on DC for now, I guess... */
+            return QUEST_VER_DC | QUEST_TYPE_DOWNLOAD;
+    }
+    else if(src[0] == 0x3C && src[2] == DL_QUEST_FILE_TYPE) {
+        /* PC */
+        return QUEST_VER_PC | QUEST_TYPE_DOWNLOAD;
+    }
+    else if(src[0] == 0x58 && src[2] == QUEST_FILE_TYPE) {
+        /* BB -- there is no bb download quest type */
+        return QUEST_VER_BB | QUEST_TYPE_ONLINE;
+    }
+
+    return QUEST_TYPE_INVALID;
+}
+
+int qst_reader_init(struct qst_reader *r, const uint8_t *src, size_t len) {
+    if((r->type = qst_detect_type(src, len)) == QUEST_TYPE_INVALID)
+        return -EINVAL;
+
+    r->src = src;
+    r->len = len;
+    r->pos = 0;
+    r->hdrs = 0;
+    r->hdrs_done = 0;
+    return 0;
+}
+
+/* Is this the header for a file? */
+static int is_hdr(uint32_t type, const uint8_t *p) {
+    switch(type & 0xFF) {
+        case QUEST_VER_DC:
+        case QUEST_VER_GC:
+            return p[0] == DL_QUEST_FILE_TYPE || p[0] == QUEST_FILE_TYPE;
+
+        case QUEST_VER_PC:
+            return p[2] == DL_QUEST_FILE_TYPE || p[2] == QUEST_FILE_TYPE;
+
+        case QUEST_VER_BB:
+            return p[2] == QUEST_FILE_TYPE;
+    }
+
+    return 0;
+}
+
+int qst_next_hdr(struct qst_reader *r, const uint8_t **hdr, char *fn) {
+    size_t hsz = QST_HDR_SIZE(r->type);
+    const uint8_t *p = r->src + r->pos;
+
+    if(r->hdrs_done)
+        return 0;
+
+    /* Every quest has at least a .bin and a .dat, so there have to be at least
+       two headers. Anything after that that isn't a header means they're
+       done. */
+    if(r->len - r->pos < hsz || !is_hdr(r->type, p)) {
+        if(r->hdrs < 2)
+            return -EINVAL;
+
+        r->hdrs_done = 1;
+        return 0;
+    }
+
+    strncpy(fn, hdr_filename(r->type, (uint8_t *)p), 16);
+    fn[16] = 0;
+    *hdr = p;
+    r->pos += hsz;
+    ++r->hdrs;
+    return 1;
+}
+
+int qst_next_chunk(struct qst_reader *r, char *fn, const uint8_t **data,
+                   size_t *len, int *num) {
+    const qst_chunk *chunk;
+    const bb_qst_chunk *bbchunk;
+    const uint8_t *hdr;
+    size_t left, csz;
+    char hfn[17];
+    int rv;
+
+    /* Skip over whatever headers are left. */
+    while((rv = qst_next_hdr(r, &hdr, hfn)) > 0) {
+    }
+
+    if(rv < 0)
+        return rv;
+
+    chunk = (const qst_chunk *)(r->src + r->pos);
+    bbchunk = (const bb_qst_chunk *)(r->src + r->pos);
+    left = r->len - r->pos;
+
+    switch(r->type & 0xFF) {
+        case QUEST_VER_DC:
+        case QUEST_VER_GC:
+            if(left < sizeof(dc_pkt_hdr_t))
+                return 0;
+
+            if((chunk->hdr.dc.pkt_type != QUEST_CHUNK_TYPE &&
+                chunk->hdr.dc.pkt_type != DL_QUEST_CHUNK_TYPE) ||
+               chunk->hdr.dc.pkt_len != LE16(DC_CHUNK_SIZE))
+                return -EINVAL;
+
+            *num = chunk->hdr.dc.flags;
+            csz = DC_CHUNK_SIZE;
+            break;
+
+        case QUEST_VER_PC:
+            if(left < sizeof(pc_pkt_hdr_t))
+                return 0;
+
+            if((chunk->hdr.pc.pkt_type != QUEST_CHUNK_TYPE &&
+                chunk->hdr.pc.pkt_type != DL_QUEST_CHUNK_TYPE) ||
+               chunk->hdr.pc.pkt_len != LE16(DC_CHUNK_SIZE))
+                return -EINVAL;
+
+            *num = chunk->hdr.pc.flags;
+            csz = DC_CHUNK_SIZE;
+            break;
+
+        default:
+            if(left < sizeof(bb_pkt_hdr_t))
+                return 0;
+
+            if(bbchunk->hdr.pkt_type != LE16(QUEST_CHUNK_TYPE) ||
+               bbchunk->hdr.pkt_len != LE16(BB_CHUNK_SIZE))
+                return -EINVAL;
+
+            *num = (int)LE32(bbchunk->hdr.flags);
+            csz = BB_CHUNK_SIZE;
+            break;
+    }
+
+    if(left < csz)
+        return -EINVAL;
+
+    /* The filename, data and length are in the same place in both kinds of
+       chunk, relative to the end of the packet header. */
+    if(r->type & QUEST_VER_BB) {
+        strncpy(fn, bbchunk->filename, 16);
+        *data = bbchunk->data;
+        *len = LE32(bbchunk->length);
+    }
+    else {
+        strncpy(fn, chunk->filename, 16);
+        *data = chunk->data;
+        *len = LE32(chunk->length);
+    }
+
+    fn[16] = 0;
+
+    if(*len > CHUNK_DATA_SIZE)
+        return -EINVAL;
+
+    r->pos += csz;
+
+    /* Sigh... */
+    if(r->type & QUEST_VER_BB)
+        r->pos += left - csz < BB_CHUNK_PAD ? left - csz : BB_CHUNK_PAD;
+
+    return 1;
+}
+
+int qst_reassemble(const uint8_t *src, size_t len, struct qst_out files[],
+                   int count) {
+    struct qst_reader r;
+    const uint8_t *data;
+    size_t clen;
+    char fn[17];
+    int i, num, rv;
+
+    if((rv = qst_reader_init(&r, src, len)))
+        return rv;
+
+    for(i = 0; i < count; ++i)
+        files[i].len = 0;
+
+    while((rv = qst_next_chunk(&r, fn, &data, &clen, &num)) > 0) {
+        for(i = 0; i < count; ++i) {
+            if(!strcmp(files[i].name, fn))
+                break;
+        }
+
+        if(i == count)
+            continue;
+
+        if(files[i].cap - files[i].len < clen)
+            return -ENOSPC;
+
+        memcpy(files[i].buf + files[i].len, data, clen);
+        files[i].len += clen;
+    }
+
+    return rv;
+}
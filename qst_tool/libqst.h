@@ -0,0 +1,135 @@
+/*
+    Sylverant Quest Tool
+    Copyright (C) 2012, 2015, 2019 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIBQST_H
+#define LIBQST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Building and taking apart .qst files in memory.
+
+   A .qst file is just the packets that a server would send to a client to
+   give it a quest: a header packet for each file in the quest, followed by
+   the files themselves, split up into 1024 byte chunks. Nothing in here uses
+   any global state or touches the filesystem, so it's all safe to use from as
+   many threads at once as you'd like.
+
+   Functions that can fail return a negative value from <errno.h> when they
+   do.
+*/
+
+#define QUEST_VER_DC                    0x00000001
+#define QUEST_VER_PC                    0x00000002
+#define QUEST_VER_GC                    0x00000004
+#define QUEST_VER_BB                    0x00000008
+
+#define QUEST_TYPE_ONLINE               0x00000100
+#define QUEST_TYPE_DOWNLOAD             0x00000200
+
+#define QUEST_TYPE_INVALID              0xFFFFFFFF
+
+/* Size of the header for each file in a quest of the given type. Header files
+   (.hdr) are exactly one of these. */
+#define QST_HDR_SIZE(type) \
+    (((type) & QUEST_VER_BB) ? 0x58 : 0x3C)
+
+/* One of the files going into a quest, in the order .bin, .dat, then .pvr (if
+   there is one). If hdr is NULL, a header is made from the name (which can be
+   at most 16 characters). Otherwise, hdr must be QST_HDR_SIZE(type) bytes, and
+   is used as is, apart from the length field. */
+struct qst_file {
+    const char *name;
+    const uint8_t *data;
+    size_t len;
+    const uint8_t *hdr;
+};
+
+/* How many bytes qst_encode will write for these files. */
+extern size_t qst_encoded_size(uint32_t type, const struct qst_file files[],
+                               int count);
+
+/* Check a header (from a .hdr file) for validity for the given quest type. */
+extern int qst_check_hdr(uint32_t type, const uint8_t *hdr, size_t len);
+
+/* Build a quest of the given type (QUEST_VER_* | QUEST_TYPE_*) out of two or
+   three files (a .bin, a .dat and optionally a .pvr -- Blue Burst quests can't
+   have one).
+
+   Returns the number of bytes written to dst on success. If dst_len isn't at
+   least qst_encoded_size bytes, returns -ENOSPC without writing anything.
+*/
+extern int qst_encode(uint32_t type, const struct qst_file files[], int count,
+                      uint8_t *dst, size_t dst_len);
+
+/* Figure out what type of quest is in a buffer. Returns QUEST_TYPE_INVALID if
+   it doesn't look like any of them. */
+extern uint32_t qst_detect_type(const uint8_t *src, size_t len);
+
+/* For going through a quest one packet at a time. Everything that comes out of
+   this points into the buffer the reader was set up with, so nothing gets
+   copied. */
+struct qst_reader {
+    const uint8_t *src;
+    size_t len;
+    size_t pos;
+    uint32_t type;
+    int hdrs;
+    int hdrs_done;
+};
+
+/* Set up a reader for the quest in src. Returns -EINVAL if the type of quest
+   can't be figured out. */
+extern int qst_reader_init(struct qst_reader *r, const uint8_t *src,
+                           size_t len);
+
+/* Get the next file header from the quest. fn must have room for 17 bytes, and
+   gets the name of the file the header is for.
+
+   Returns 1 if there was a header, 0 once they've all been read, or -EINVAL if
+   the quest is damaged (every quest has at least two).
+*/
+extern int qst_next_hdr(struct qst_reader *r, const uint8_t **hdr, char *fn);
+
+/* Get the next chunk of file data from the quest (skipping over any headers
+   that haven't been read). fn must have room for 17 bytes. num is the number
+   of the chunk, which only counts up to 255 before wrapping (and isn't all
+   that useful anyway).
+
+   Returns 1 if there was a chunk, 0 at the end of the quest, or -EINVAL if
+   the quest is damaged. On error, r->pos is where the bad chunk is.
+*/
+extern int qst_next_chunk(struct qst_reader *r, char *fn, const uint8_t **data,
+                          size_t *len, int *num);
+
+/* A file to be put back together from a quest. name is the file to look for.
+   Its chunks are copied into buf, which has room for cap bytes. len is set to
+   how much of it there was. */
+struct qst_out {
+    const char *name;
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+};
+
+/* Put the files in a quest back together. Any chunks for files that aren't in
+   the list are skipped over. Returns -ENOSPC if any of the files doesn't fit in
+   its buffer (the size in its header says how big it should be). */
+extern int qst_reassemble(const uint8_t *src, size_t len,
+                          struct qst_out files[], int count);
+
+#endif /* !LIBQST_H */
@@ -20,11 +20,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <ctype.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #else
 #include <io.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 #endif
 
 /* I really hate you Visual Studio... There is no reason to warn about
@@ -33,134 +43,45 @@
 #pragma warning(disable : 4996)
 #endif
 
-/* This stuff copied from the packets.h file from Sylverant... */
-#if defined(WORDS_BIGENDIAN) || defined(__BIG_ENDIAN__)
-#define LE16(x) (((x >> 8) & 0xFF) | ((x & 0xFF) << 8))
-#define LE32(x) (((x >> 24) & 0x00FF) | \
-                 ((x >>  8) & 0xFF00) | \
-                 ((x & 0xFF00) <<  8) | \
-                 ((x & 0x00FF) << 24))
-#else
-#define LE16(x) x
-#define LE32(x) x
-#endif
-
-#ifdef PACKED
-#undef PACKED
-#endif
-
-#if defined(_MSC_VER)
-#define PACKED
-#pragma pack(push, 1)
-#elif defined (__GNUC__)
-#define PACKED __attribute__((packed))
-#else
-#error Need to define how to pack structures for your compiler!
-#endif
-
-typedef struct dc_pkt_hdr {
-    uint8_t pkt_type;
-    uint8_t flags;
-    uint16_t pkt_len;
-} PACKED dc_pkt_hdr_t;
-
-typedef struct pc_pkt_hdr {
-    uint16_t pkt_len;
-    uint8_t pkt_type;
-    uint8_t flags;
-} PACKED pc_pkt_hdr_t;
-
-typedef struct bb_pkt_hdr {
-    uint16_t pkt_len;
-    uint16_t pkt_type;
-    uint32_t flags;
-} PACKED bb_pkt_hdr_t;
-
-typedef struct dc_qst_hdr_s {
-    dc_pkt_hdr_t hdr;
-    char name[32];
-    uint8_t unused1[3];
-    char filename[16];
-    uint8_t unused2;
-    uint32_t length;
-} PACKED dc_qst_hdr;
-
-typedef struct pc_qst_hdr_s {
-    pc_pkt_hdr_t hdr;
-    char name[32];
-    uint16_t unused;
-    uint16_t flags;
-    char filename[16];
-    uint32_t length;
-} PACKED pc_qst_hdr;
-
-typedef struct gc_qst_hdr_s {
-    dc_pkt_hdr_t hdr;
-    char name[32];
-    uint16_t unused;
-    uint16_t flags;
-    char filename[16];
-    uint32_t length;
-} PACKED gc_qst_hdr;
-
-typedef struct bb_qst_hdr_s {
-    bb_pkt_hdr_t hdr;
-    char unused1[32];
-    uint16_t unused2;
-    uint16_t flags;
-    char filename[16];
-    uint32_t length;
-    char name[24];
-} PACKED bb_qst_hdr;
-
-typedef struct dc_quest_chunk {
-    union {
-        dc_pkt_hdr_t dc;
-        pc_pkt_hdr_t pc;
-    } hdr;
-    char filename[16];
-    uint8_t data[1024];
-    uint32_t length;
-} PACKED qst_chunk;
-
-typedef struct bb_quest_chunk {
-    bb_pkt_hdr_t hdr;
-    char filename[16];
-    uint8_t data[1024];
-    uint32_t length;
-} PACKED bb_qst_chunk;
-
-#if defined(_MSC_VER)
-#pragma pack(pop)
-#endif
-
-#undef PACKED
-
-#define QUEST_CHUNK_TYPE                0x0013
-#define QUEST_FILE_TYPE                 0x0044
-#define DL_QUEST_FILE_TYPE              0x00A6
-#define DL_QUEST_CHUNK_TYPE             0x00A7
+#include "libqst.h"
 
-#define QUEST_VER_DC                    0x00000001
-#define QUEST_VER_PC                    0x00000002
-#define QUEST_VER_GC                    0x00000004
-#define QUEST_VER_BB                    0x00000008
+/* Where each of the files in a quest being extracted is being written. Each
+   one is built up under a name of its own (path with .part on the end), and
+   only renamed into place once the whole quest is extracted. Quests don't
+   usually have more than three files in them, but if one has more than this
+   many open at once, the oldest one is closed to make room (and opened up
+   again to append to if it shows up again). */
+#define MAX_OUT_FILES                   8
 
-#define QUEST_TYPE_ONLINE               0x00000100
-#define QUEST_TYPE_DOWNLOAD             0x00000200
+struct out_file {
+    char fn[17];
+    char *path;
+    char *tmp;
+    FILE *fp;
+};
 
-#define QUEST_TYPE_INVALID              0xFFFFFFFF
+struct out_set {
+    struct out_file *files;
+    int count;
+    int open;
+};
 
-static uint8_t buf[4096];
+/* Print out every chunk as it's done? (-v) */
+static int verbose = 0;
 
 static void usage(const char *argv[]) {
     printf("Usage:\n");
+    printf("Add -v before any of these to list every chunk as it's done.\n");
     printf("To extract a .qst file:\n    %s -x <file.qst>\n", argv[0]);
     printf("To merge a .bin/.dat to a .qst:\n    %s -m <type> <file.bin> "
            "<file.dat> [file.bin.hdr] [file.dat.hdr]\n", argv[0]);
     printf("To merge a .bin/.dat/.pvr to a .qst:\n    %s -mp <type> <file.bin> "
            "<file.dat> <file.pvr> [file.bin.hdr] [file.dat.hdr] "
            "[file.pvr.hdr]\n", argv[0]);
+    printf("To extract every .qst in a directory (or listed in a file):\n"
+           "    %s -b [-j N] -x <dir|list>\n", argv[0]);
+    printf("To merge every .bin/.dat in a directory (or listed in a file):\n"
+           "    %s -b [-j N] -m <type> <dir|list>\n", argv[0]);
     printf("\n");
     printf("For merging, the available types are:\n");
     printf("    dc - Dreamcast (online)\n"
@@ -172,1236 +93,1109 @@ static void usage(const char *argv[]) {
            "    gcdl - PSO for Gamecube (download)\n");
 }
 
-static uint32_t detect_qst_type(void) {
-    uint32_t rv = 0;
-    dc_qst_hdr *hdr = (dc_qst_hdr *)buf;
-
-    if(buf[0] == QUEST_FILE_TYPE && buf[2] == 0x3C) {
-        if(hdr->filename[0] == 0)
-            /* Sure sign that we're on GC... */
-            rv = QUEST_VER_GC | QUEST_TYPE_ONLINE;
-        else
-            /* Assume we're on DC for now, I guess... */
-            rv = QUEST_VER_DC | QUEST_TYPE_ONLINE;
-    }
-    else if(buf[0] == 0x3C && buf[2] == QUEST_FILE_TYPE) {
-        /* PC */
-        rv = QUEST_VER_PC | QUEST_TYPE_ONLINE;
-    }
-    else if(buf[0] == DL_QUEST_FILE_TYPE && buf[2] == 0x3C) {
-        if(hdr->filename[0] == 0)
-        /* Sure sign that we're on GC... */
-            rv = QUEST_VER_GC | QUEST_TYPE_DOWNLOAD;
-        else
-        /* Assume we're on DC for now, I guess... */
-            rv = QUEST_VER_DC | QUEST_TYPE_DOWNLOAD;
-    }
-    else if(buf[0] == 0x3C && buf[2] == DL_QUEST_FILE_TYPE) {
-        /* PC */
-        rv = QUEST_VER_PC | QUEST_TYPE_DOWNLOAD;
-    }
-    else if(buf[0] == 0x58 && buf[2] == QUEST_FILE_TYPE) {
-        /* BB -- there is no bb download quest type */
-        rv = QUEST_VER_BB | QUEST_TYPE_ONLINE;
-    }
-    else {
-        return QUEST_TYPE_INVALID;
-    }
+/* Build the path to a file being extracted, in dir (or the current directory
+   if dir is NULL). */
+static char *out_path(const char *dir, const char *fn) {
+    char *path;
 
-    return rv;
+    if(!dir)
+        return strdup(fn);
+
+    if((path = (char *)malloc(strlen(dir) + strlen(fn) + 2)))
+        sprintf(path, "%s/%s", dir, fn);
+
+    return path;
 }
 
-int process_hdr_file(uint32_t qst_type) {
+static FILE *open_out(const char *dir, const char *fn, const char *mode) {
+    char *path;
     FILE *fp;
-    dc_qst_hdr *dchdr = (dc_qst_hdr *)buf;
-    pc_qst_hdr *pchdr = (pc_qst_hdr *)buf;
-    bb_qst_hdr *bbhdr = (bb_qst_hdr *)buf;
-    char fn[32];
-
-    /* Open the header file */
-    switch(qst_type & 0x000000FF) {
-        case QUEST_VER_DC:
-            if(buf[0] != DL_QUEST_FILE_TYPE && buf[0] != QUEST_FILE_TYPE)
-                return -2;
-
-            strncpy(fn, dchdr->filename, 16);
-            fn[16] = 0;
-            unlink(fn);
-            strcat(fn, ".hdr");
-            fp = fopen(fn, "wb");
-            break;
 
-        case QUEST_VER_PC:
-            if(buf[2] != DL_QUEST_FILE_TYPE && buf[0] != QUEST_FILE_TYPE)
-                return -2;
+    if(!(path = out_path(dir, fn)))
+        return NULL;
+
+    fp = fopen(path, mode);
+    free(path);
+    return fp;
+}
 
-            goto pc_gc_common;
+/* Find the file that a chunk goes to, opening it if it isn't already. */
+static FILE *get_out(struct out_set *s, const char *dir, const char *fn) {
+    struct out_file *f = NULL, *tmp;
+    const char *mode = "ab";
+    int i;
 
-        case QUEST_VER_GC:
-            if(buf[0] != DL_QUEST_FILE_TYPE && buf[0] != QUEST_FILE_TYPE)
-                return -2;
+    for(i = 0; i < s->count; ++i) {
+        if(!strcmp(s->files[i].fn, fn)) {
+            if(s->files[i].fp)
+                return s->files[i].fp;
 
-pc_gc_common:
-            strncpy(fn, pchdr->filename, 16);
-            fn[16] = 0;
-            unlink(fn);
-            strcat(fn, ".hdr");
-            fp = fopen(fn, "wb");
+            f = &s->files[i];
             break;
+        }
+    }
 
-        case QUEST_VER_BB:
-            if(buf[2] != QUEST_FILE_TYPE)
-                return -2;
+    /* Never seen this one before, so start it from scratch. */
+    if(!f) {
+        if(!(tmp = (struct out_file *)realloc(s->files, (s->count + 1) *
+                                              sizeof(struct out_file)))) {
+            perror("realloc");
+            return NULL;
+        }
 
-            strncpy(fn, bbhdr->filename, 16);
-            fn[16] = 0;
-            unlink(fn);
-            strcat(fn, ".hdr");
-            fp = fopen(fn, "wb");
-            break;
+        s->files = tmp;
+        f = &s->files[s->count];
+        memset(f, 0, sizeof(struct out_file));
+        strcpy(f->fn, fn);
 
-        default:
-            fprintf(stderr, "Unknown quest version: %d\n", qst_type & 0xFF);
-            return -1;
-    }
+        if(!(f->path = out_path(dir, fn)) ||
+           !(f->tmp = (char *)malloc(strlen(f->path) + 6))) {
+            perror("malloc");
+            free(f->path);
+            return NULL;
+        }
 
-    if(!fp) {
-        perror("Cannot open header file for writing");
-        return -1;
+        sprintf(f->tmp, "%s.part", f->path);
+        ++s->count;
+        mode = "wb";
     }
 
-    /* Write the file out and clean up */
-    if((qst_type & 0x000000FF) != QUEST_VER_BB) {
-        if(fwrite(buf, 1, sizeof(dc_qst_hdr), fp) != sizeof(dc_qst_hdr)) {
-            perror("fwrite");
-            return -1;
+    /* Make room if we have to. */
+    if(s->open == MAX_OUT_FILES) {
+        for(i = 0; !s->files[i].fp; ++i) ;
+
+        if(fclose(s->files[i].fp)) {
+            perror("fclose");
+            s->files[i].fp = NULL;
+            return NULL;
         }
+
+        s->files[i].fp = NULL;
+        --s->open;
     }
-    else {
-        if(fwrite(buf, 1, sizeof(bb_qst_hdr), fp) != sizeof(bb_qst_hdr)) {
-            perror("fwrite");
-            return -1;
-        }
+
+    if(!(f->fp = fopen(f->tmp, mode))) {
+        fprintf(stderr, "Cannot open \"%s\": %s\n", f->tmp, strerror(errno));
+        return NULL;
     }
 
-    fclose(fp);
-    return 0;
+    ++s->open;
+    return f->fp;
 }
 
-static int convert_dc_qst(FILE *qst) {
-    FILE *wfp;
-    qst_chunk *chunk = (qst_chunk *)buf;
-    char fn[17];
-    uint32_t clen;
-
-    while(fread(buf, 1, 4, qst) == 4) {
-        /* Check the header */
-        if((chunk->hdr.dc.pkt_type != QUEST_CHUNK_TYPE &&
-            chunk->hdr.dc.pkt_type != DL_QUEST_CHUNK_TYPE) ||
-           chunk->hdr.dc.pkt_len != LE16(0x0418)) {
-            fprintf(stderr, "Unknown or damaged chunk at offset %ld\n",
-                    ftell(qst) - 4);
-            return -1;
-        }
+/* Close everything, and if everything went well, move it all into place.
+   Otherwise, nothing that was being built is kept. */
+static int finish_outs(struct out_set *s, int rv) {
+    struct out_file *f;
+    int i;
 
-        /* Read the rest of the chunk in */
-        if(fread(buf + 4, 1, 0x0414, qst) != 0x0414) {
-            perror("fread");
-            return -1;
+    for(i = 0; i < s->count; ++i) {
+        f = &s->files[i];
+
+        if(f->fp && fclose(f->fp)) {
+            perror("fclose");
+            rv = -1;
         }
+    }
 
-        /* Grab our vital information and verify it... */
-        strncpy(fn, chunk->filename, 16);
-        fn[16] = 0;
-        clen = LE32(chunk->length);
+    for(i = 0; i < s->count; ++i) {
+        f = &s->files[i];
 
-        if(clen > 1024) {
-            fprintf(stderr, "Unknown or damaged chunk at offset %ld\n",
-                    ftell(qst) - 4);
-            return -1;
+#ifdef _WIN32
+        /* rename won't replace anything here. */
+        if(!rv)
+            remove(f->path);
+#endif
+
+        if(!rv && rename(f->tmp, f->path)) {
+            fprintf(stderr, "Cannot move \"%s\" into place: %s\n", f->path,
+                    strerror(errno));
+            rv = -1;
         }
 
-        printf("%s chunk %d (%d bytes)\n", fn, chunk->hdr.dc.flags, (int)clen);
+        if(rv)
+            remove(f->tmp);
 
-        /* Open the file we need to write to, and write the chunk to it. */
-        if(!(wfp = fopen(fn, "ab"))) {
-            perror("fopen");
-            return -1;
-        }
+        free(f->tmp);
+        free(f->path);
+    }
 
-        if(fwrite(chunk->data, 1, clen, wfp) != clen) {
-            perror("fwrite");
-            fclose(wfp);
-            return -1;
-        }
+    free(s->files);
+    return rv;
+}
+
+/* Read a whole file into memory. */
+static uint8_t *read_file(const char *fn, size_t *len) {
+    FILE *fp;
+    uint8_t *buf;
+    long sz;
 
-        fclose(wfp);
+    if(!(fp = fopen(fn, "rb"))) {
+        fprintf(stderr, "Error opening \"%s\": %s\n", fn, strerror(errno));
+        return NULL;
     }
 
-    if(feof(qst))
-        return 0;
+    if(fseek(fp, 0, SEEK_END) || (sz = ftell(fp)) < 0 ||
+       fseek(fp, 0, SEEK_SET)) {
+        perror("fseek");
+        fclose(fp);
+        return NULL;
+    }
 
-    perror("fread");
-    return -1;
-}
+    /* Add one, so that empty files don't look like a failed malloc. */
+    if(!(buf = (uint8_t *)malloc((size_t)sz + 1))) {
+        perror("malloc");
+        fclose(fp);
+        return NULL;
+    }
 
-static int convert_pc_qst(FILE *qst) {
-    FILE *wfp;
-    qst_chunk *chunk = (qst_chunk *)buf;
-    char fn[17];
-    uint32_t clen;
-
-    while(fread(buf, 1, 4, qst) == 4) {
-        /* Check the header */
-        if((chunk->hdr.pc.pkt_type != QUEST_CHUNK_TYPE &&
-            chunk->hdr.pc.pkt_type != DL_QUEST_CHUNK_TYPE) ||
-           chunk->hdr.pc.pkt_len != LE16(0x0418)) {
-            fprintf(stderr, "Unknown or damaged chunk at offset %ld\n",
-                    ftell(qst) - 4);
-            return -1;
-        }
+    if(fread(buf, 1, (size_t)sz, fp) != (size_t)sz) {
+        fprintf(stderr, "Cannot read \"%s\"\n", fn);
+        free(buf);
+        fclose(fp);
+        return NULL;
+    }
 
-        /* Read the rest of the chunk in */
-        if(fread(buf + 4, 1, 0x0414, qst) != 0x0414) {
-            perror("fread");
-            return -1;
-        }
+    fclose(fp);
+    *len = (size_t)sz;
+    return buf;
+}
 
-        /* Grab our vital information and verify it... */
-        strncpy(fn, chunk->filename, 16);
-        fn[16] = 0;
-        clen = LE32(chunk->length);
+/* Get a whole file into memory, mapping it where we can. Empty files (and
+   anything on Windows) just get read in. mapped says which one happened, for
+   unload_file. */
+static uint8_t *load_file(const char *fn, size_t *len, int *mapped) {
+#ifndef _WIN32
+    struct stat st;
+    void *rv;
+    int fd;
 
-        if(clen > 1024) {
-            fprintf(stderr, "Unknown or damaged chunk at offset %ld\n",
-                    ftell(qst) - 4);
-            return -1;
-        }
+    if((fd = open(fn, O_RDONLY)) < 0) {
+        fprintf(stderr, "Error opening \"%s\": %s\n", fn, strerror(errno));
+        return NULL;
+    }
 
-        printf("%s chunk %d (%d bytes)\n", fn, chunk->hdr.pc.flags, (int)clen);
+    if(!fstat(fd, &st) && st.st_size > 0) {
+        rv = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-        /* Open the file we need to write to, and write the chunk to it. */
-        if(!(wfp = fopen(fn, "ab"))) {
-            perror("fopen");
-            return -1;
-        }
+        if(rv != MAP_FAILED) {
+            close(fd);
 
-        if(fwrite(chunk->data, 1, clen, wfp) != clen) {
-            perror("fwrite");
-            fclose(wfp);
-            return -1;
-        }
+            /* Everything in here goes straight through from start to end. */
+            madvise(rv, (size_t)st.st_size, MADV_SEQUENTIAL);
 
-        fclose(wfp);
+            *len = (size_t)st.st_size;
+            *mapped = 1;
+            return (uint8_t *)rv;
+        }
     }
 
-    if(feof(qst))
-        return 0;
+    close(fd);
+#endif
 
-    perror("fread");
-    return -1;
+    *mapped = 0;
+    return read_file(fn, len);
 }
 
-static int convert_bb_qst(FILE *qst) {
-    FILE *wfp;
-    bb_qst_chunk *chunk = (bb_qst_chunk *)buf;
-    char fn[17];
-    uint32_t clen;
-
-    while(fread(buf, 1, 8, qst) == 8) {
-        /* Check the header */
-        if(chunk->hdr.pkt_type != LE16(QUEST_CHUNK_TYPE) ||
-           chunk->hdr.pkt_len != LE16(0x041C)) {
-            fprintf(stderr, "Unknown or damaged chunk at offset %ld\n",
-                    ftell(qst) - 8);
-            return -1;
-        }
+static void unload_file(uint8_t *buf, size_t len, int mapped) {
+#ifndef _WIN32
+    if(mapped) {
+        munmap(buf, len);
+        return;
+    }
+#else
+    (void)len;
+    (void)mapped;
+#endif
 
-        /* Read the rest of the chunk in */
-        if(fread(buf + 8, 1, 0x0414, qst) != 0x0414) {
-            perror("fread");
-            return -1;
-        }
+    free(buf);
+}
 
-        /* Grab our vital information and verify it... */
-        strncpy(fn, chunk->filename, 16);
-        fn[16] = 0;
-        clen = LE32(chunk->length);
+/* Write a whole buffer out to a new file. The buffer is already everything
+   that goes in the file, so there's no point in going through stdio. */
+static int write_file(const char *fn, const uint8_t *buf, size_t len) {
+#ifndef _WIN32
+    ssize_t rv;
+    int fd;
 
-        if(clen > 1024) {
-            fprintf(stderr, "Unknown or damaged chunk at offset %ld\n",
-                    ftell(qst) - 4);
-            return -1;
-        }
+    if((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror("Cannot open output file");
+        return -1;
+    }
 
-        printf("%s chunk %d (%d bytes)\n", fn, LE32(chunk->hdr.flags),
-               (int)clen);
+    while(len) {
+        if((rv = write(fd, buf, len)) < 0) {
+            if(errno == EINTR)
+                continue;
 
-        /* Open the file we need to write to, and write the chunk to it. */
-        if(!(wfp = fopen(fn, "ab"))) {
-            perror("fopen");
+            perror("Cannot write to output file");
+            close(fd);
             return -1;
         }
 
-        if(fwrite(chunk->data, 1, clen, wfp) != clen) {
-            perror("fwrite");
-            fclose(wfp);
-            return -1;
-        }
+        buf += rv;
+        len -= (size_t)rv;
+    }
+
+    if(close(fd)) {
+        perror("Cannot write to output file");
+        return -1;
+    }
+#else
+    FILE *fp;
 
-        fclose(wfp);
+    if(!(fp = fopen(fn, "wb"))) {
+        perror("Cannot open output file");
+        return -1;
+    }
 
-        /* Sigh... */
-        fseek(qst, 4, SEEK_CUR);
+    if(fwrite(buf, 1, len, fp) != len) {
+        perror("Cannot write to output file");
+        fclose(fp);
+        return -1;
     }
 
-    if(feof(qst))
-        return 0;
+    if(fclose(fp)) {
+        perror("Cannot write to output file");
+        return -1;
+    }
+#endif
 
-    perror("fread");
-    return -1;
+    return 0;
 }
 
-static int qst_to_bindat(const char *fn) {
+static int write_hdr_file(const uint8_t *hdr, uint32_t qst_type,
+                          const char *fn, const char *dir) {
     FILE *fp;
-    uint32_t qst_type;
-    int rv = 0, morehdr = 0;
-    int hdr_size = sizeof(dc_qst_hdr);
+    char hfn[32];
 
-    if(!(fp = fopen(fn, "rb"))) {
-        perror("fopen");
+    strcpy(hfn, fn);
+    strcat(hfn, ".hdr");
+
+    if(!(fp = open_out(dir, hfn, "wb"))) {
+        perror("Cannot open header file for writing");
         return -1;
     }
 
-    /* Try to figure out what version this quest is for... */
-    if(fread(buf, 1, sizeof(dc_qst_hdr), fp) != sizeof(dc_qst_hdr)) {
-        perror("fread");
-        rv = -1;
-        goto out_close_qst;
+    if(fwrite(hdr, 1, QST_HDR_SIZE(qst_type), fp) != QST_HDR_SIZE(qst_type)) {
+        perror("fwrite");
+        fclose(fp);
+        return -1;
     }
 
-    if((qst_type = detect_qst_type()) == QUEST_TYPE_INVALID) {
+    fclose(fp);
+    return 0;
+}
+
+/* Extract a quest into its .bin/.dat (and whatever else) files, putting them in
+   dir (or the current directory if dir is NULL). */
+static int qst_to_bindat(const char *fn, const char *dir) {
+    struct out_set files = { NULL, 0, 0 };
+    struct qst_reader r;
+    uint8_t *buf;
+    const uint8_t *data;
+    size_t len;
+    size_t buf_len;
+    FILE *wfp;
+    char cfn[17];
+    int rv = 0, num, mapped;
+
+    if(!(buf = load_file(fn, &buf_len, &mapped)))
+        return -1;
+
+    if(qst_reader_init(&r, buf, buf_len)) {
         fprintf(stderr, "Cannot detect quest type!\n");
-        rv = -1;
-        goto out_close_qst;
+        unload_file(buf, buf_len, mapped);
+        return -1;
     }
 
-    /* If it's bb, we have a few more bytes to read... */
-    if(qst_type == (QUEST_TYPE_ONLINE | QUEST_VER_BB)) {
-        hdr_size = sizeof(bb_qst_hdr);
-        if(fread(buf + 0x3C, 1, 0x1C, fp) != 0x1C) {
-            perror("fread");
+    /* Write out the header for each file. */
+    while((rv = qst_next_hdr(&r, &data, cfn)) > 0) {
+        if(write_hdr_file(data, r.type, cfn, dir)) {
             rv = -1;
-            goto out_close_qst;
+            goto out;
         }
     }
 
-    /* Write the first header out */
-    if(process_hdr_file(qst_type)) {
-        rv = -1;
-        goto out_close_qst;
-    }
-
-    /* Read the second header in */
-    if(fread(buf, 1, hdr_size, fp) != hdr_size) {
-        perror("fread");
+    if(rv < 0) {
+        fprintf(stderr, "Quest headers are damaged\n");
         rv = -1;
-        goto out_close_qst;
+        goto out;
     }
 
-    /* Write that out too */
-    if(process_hdr_file(qst_type)) {
-        rv = -1;
-        goto out_close_qst;
-    }
+    /* Then, append each chunk to the file it goes with. */
+    while((rv = qst_next_chunk(&r, cfn, &data, &len, &num)) > 0) {
+        if(verbose)
+            printf("%s chunk %d (%d bytes)\n", cfn, num, (int)len);
 
-    /* Handle any additional files. This is probably limited to one file, but
-       doing it for the generic case is just as easy. */
-    while(!morehdr) {
-        if(fread(buf, 1, hdr_size, fp) != hdr_size) {
-            perror("fread");
+        if(!(wfp = get_out(&files, dir, cfn))) {
             rv = -1;
-            goto out_close_qst;
+            goto out;
         }
 
-        if((morehdr = process_hdr_file(qst_type)) == -1) {
+        if(fwrite(data, 1, len, wfp) != len) {
+            perror("fwrite");
             rv = -1;
-            goto out_close_qst;
+            goto out;
         }
     }
 
-    /* We've read one file header beyond where we belong, so rewind. */
-    if(fseek(fp, -hdr_size, SEEK_CUR)) {
-        perror("fseek");
+    if(rv < 0) {
+        fprintf(stderr, "Unknown or damaged chunk at offset %ld\n",
+                (long)r.pos);
         rv = -1;
-        goto out_close_qst;
-    }
-
-    /* The rest depends on the version... */
-    switch(qst_type & 0xFF) {
-        case QUEST_VER_DC:
-        case QUEST_VER_GC:
-            rv = convert_dc_qst(fp);
-            break;
-
-        case QUEST_VER_PC:
-            rv = convert_pc_qst(fp);
-            break;
-
-        case QUEST_VER_BB:
-            rv = convert_bb_qst(fp);
-            break;
     }
 
-out_close_qst:
-    fclose(fp);
+out:
+    rv = finish_outs(&files, rv);
+    unload_file(buf, buf_len, mapped);
     return rv;
 }
 
-static int read_hdr(const char *fn, uint8_t mbuf[], uint32_t type, char **rfn) {
-    FILE *hfp;
-    dc_qst_hdr *dc = (dc_qst_hdr *)mbuf;
-    pc_qst_hdr *pc = (pc_qst_hdr *)mbuf;
-    gc_qst_hdr *gc = (gc_qst_hdr *)mbuf;
-    bb_qst_hdr *bb = (bb_qst_hdr *)mbuf;
-    long len;
+static int read_hdr(const char *fn, uint8_t mbuf[], uint32_t type) {
+    uint8_t *buf;
+    size_t len;
 
-    if(!(hfp = fopen(fn, "rb"))) {
-        fprintf(stderr, "Error opening \"%s\": %s\n", fn, strerror(errno));
-        return -1;
-    }
-
-    /* Make sure it is the right size */
-    if(fseek(hfp, 0, SEEK_END)) {
-        perror("fseek");
-        fclose(hfp);
+    if(!(buf = read_file(fn, &len)))
         return -1;
-    }
 
-    len = ftell(hfp);
-
-    if(len != sizeof(dc_qst_hdr) && len != sizeof(bb_qst_hdr)) {
+    if(len != QST_HDR_SIZE(type)) {
         fprintf(stderr, "\"%s\" is not of the correct size\n", fn);
-        fclose(hfp);
+        free(buf);
         return -1;
     }
 
-    if(fseek(hfp, 0, SEEK_SET)) {
-        perror("fseek");
-        fclose(hfp);
-        return -1;
-    }
+    memcpy(mbuf, buf, len);
+    free(buf);
 
-    if(fread(mbuf, 1, len, hfp) != len) {
-        fprintf(stderr, "Cannot read \"%s\"\n", fn);
-        fclose(hfp);
+    /* Now, check the header for validity. */
+    if(qst_check_hdr(type, mbuf, len)) {
+        fprintf(stderr, "Header file \"%s\" is invalid\n", fn);
         return -1;
     }
 
-    fclose(hfp);
+    return 0;
+}
 
-    /* Now, check the header for validity. */
-    switch(type) {
-        case QUEST_VER_DC | QUEST_TYPE_ONLINE:
-            if(dc->hdr.pkt_type != QUEST_FILE_TYPE ||
-               dc->hdr.pkt_len != LE16(sizeof(dc_qst_hdr)))
-                goto bad_hdr;
-            *rfn = dc->filename;
-            break;
+static uint32_t parse_qst_type(const char *type) {
+    if(!strcmp(type, "dc"))
+        return QUEST_TYPE_ONLINE | QUEST_VER_DC;
+    else if(!strcmp(type, "pc"))
+        return QUEST_TYPE_ONLINE | QUEST_VER_PC;
+    else if(!strcmp(type, "gc"))
+        return QUEST_TYPE_ONLINE | QUEST_VER_GC;
+    else if(!strcmp(type, "dcdl"))
+        return QUEST_TYPE_DOWNLOAD | QUEST_VER_DC;
+    else if(!strcmp(type, "pcdl"))
+        return QUEST_TYPE_DOWNLOAD | QUEST_VER_PC;
+    else if(!strcmp(type, "gcdl"))
+        return QUEST_TYPE_DOWNLOAD | QUEST_VER_GC;
+    else if(!strcmp(type, "bb"))
+        return QUEST_TYPE_ONLINE | QUEST_VER_BB;
+
+    return QUEST_TYPE_INVALID;
+}
 
-        case QUEST_VER_DC | QUEST_TYPE_DOWNLOAD:
-            if(dc->hdr.pkt_type != DL_QUEST_FILE_TYPE ||
-               dc->hdr.pkt_len != LE16(sizeof(dc_qst_hdr)))
-                goto bad_hdr;
-            *rfn = dc->filename;
-            break;
+/* Merge a .bin, .dat and (optionally) .pvr into a .qst, named after the .bin.
+   The names that go in the headers (if there aren't header files to take them
+   from) are in names. hdrs is either NULL or has a header file for each. */
+static int merge_qst(uint32_t qst_type, int count, const char *paths[],
+                     const char *names[], const char *hdrs[]) {
+    struct qst_file files[3];
+    uint8_t hbuf[3][0x58];
+    uint8_t *data[3] = { NULL, NULL, NULL };
+    int mapped[3];
+    uint8_t *qst = NULL;
+    size_t len;
+    struct qst_reader r;
+    const uint8_t *cdata;
+    char cfn[17];
+    char *qst_name, *tmp;
+    int i, num, rv = -1;
+
+    for(i = 0; i < count; ++i) {
+        if(!(data[i] = load_file(paths[i], &files[i].len, &mapped[i])))
+            goto out;
 
-        case QUEST_VER_PC | QUEST_TYPE_ONLINE:
-            if(pc->hdr.pkt_type != QUEST_FILE_TYPE ||
-               pc->hdr.pkt_len != LE16(sizeof(pc_qst_hdr)))
-                goto bad_hdr;
-            *rfn = pc->filename;
-            break;
+        files[i].name = names[i];
+        files[i].data = data[i];
+        files[i].hdr = NULL;
 
-        case QUEST_VER_PC | QUEST_TYPE_DOWNLOAD:
-            if(pc->hdr.pkt_type != DL_QUEST_FILE_TYPE ||
-               pc->hdr.pkt_len != LE16(sizeof(pc_qst_hdr)))
-                goto bad_hdr;
-            *rfn = pc->filename;
-            break;
+        /* If we have header files, read them in. */
+        if(hdrs) {
+            if(read_hdr(hdrs[i], hbuf[i], qst_type))
+                goto out;
 
-        case QUEST_VER_GC | QUEST_TYPE_ONLINE:
-            if(gc->hdr.pkt_type != QUEST_FILE_TYPE ||
-               gc->hdr.pkt_len != LE16(sizeof(gc_qst_hdr)))
-                goto bad_hdr;
-            *rfn = gc->filename;
-            break;
+            files[i].hdr = hbuf[i];
+        }
+        else if(strlen(names[i]) > 16) {
+            /* We need to construct the headers ourselves, I guess... */
+            fprintf(stderr, "Quest filenames too long without headers\n");
+            goto out;
+        }
+    }
 
-        case QUEST_VER_GC | QUEST_TYPE_DOWNLOAD:
-            if(gc->hdr.pkt_type != DL_QUEST_FILE_TYPE ||
-               gc->hdr.pkt_len != LE16(sizeof(gc_qst_hdr)))
-                goto bad_hdr;
-            *rfn = gc->filename;
-            break;
+    len = qst_encoded_size(qst_type, files, count);
 
-        case QUEST_VER_BB | QUEST_TYPE_ONLINE:
-            if(bb->hdr.pkt_type != LE16(QUEST_FILE_TYPE) ||
-               bb->hdr.pkt_len != LE16(sizeof(bb_qst_hdr)))
-                goto bad_hdr;
-            *rfn = bb->filename;
-            break;
+    if(!(qst = (uint8_t *)malloc(len + 1))) {
+        perror("malloc");
+        goto out;
     }
 
-    return 0;
+    if(qst_encode(qst_type, files, count, qst, len) < 0) {
+        fprintf(stderr, "Cannot build quest\n");
+        goto out;
+    }
 
-bad_hdr:
-    fprintf(stderr, "Header file \"%s\" is invalid\n", fn);
-    return -1;
-}
+    /* Figure out the name of the .qst file */
+    if(!(qst_name = (char *)malloc(strlen(paths[0]) + 5))) {
+        perror("malloc");
+        goto out;
+    }
 
-static int make_hdr(const char *fn, uint8_t mbuf[], uint32_t type, char **rfn) {
-    dc_qst_hdr *dc = (dc_qst_hdr *)mbuf;
-    pc_qst_hdr *pc = (pc_qst_hdr *)mbuf;
-    gc_qst_hdr *gc = (gc_qst_hdr *)mbuf;
-    bb_qst_hdr *bb = (bb_qst_hdr *)mbuf;
-
-    /* Build the appropriate header... */
-    switch(type) {
-        case QUEST_VER_DC | QUEST_TYPE_ONLINE:
-            memset(dc, 0, sizeof(dc_qst_hdr));
-            dc->hdr.pkt_type = QUEST_FILE_TYPE;
-            dc->hdr.pkt_len = LE16(sizeof(dc_qst_hdr));
-            strcpy(dc->filename, fn);
-            *rfn = dc->filename;
-            break;
+    strcpy(qst_name, paths[0]);
 
-        case QUEST_VER_DC | QUEST_TYPE_DOWNLOAD:
-            memset(dc, 0, sizeof(dc_qst_hdr));
-            dc->hdr.pkt_type = DL_QUEST_FILE_TYPE;
-            dc->hdr.pkt_len = LE16(sizeof(dc_qst_hdr));
-            strcpy(dc->filename, fn);
-            *rfn = dc->filename;
-            break;
+    if(!(tmp = strrchr(qst_name, '.')))
+        tmp = qst_name + strlen(qst_name);
 
-        case QUEST_VER_PC | QUEST_TYPE_ONLINE:
-            memset(pc, 0, sizeof(pc_qst_hdr));
-            pc->hdr.pkt_type = QUEST_FILE_TYPE;
-            pc->hdr.pkt_len = LE16(sizeof(pc_qst_hdr));
-            strcpy(pc->filename, fn);
-            *rfn = pc->filename;
-            break;
+    *tmp++ = '.';
+    *tmp++ = 'q';
+    *tmp++ = 's';
+    *tmp++ = 't';
+    *tmp = 0;
 
-        case QUEST_VER_PC | QUEST_TYPE_DOWNLOAD:
-            memset(pc, 0, sizeof(pc_qst_hdr));
-            pc->hdr.pkt_type = DL_QUEST_FILE_TYPE;
-            pc->hdr.pkt_len = LE16(sizeof(pc_qst_hdr));
-            strcpy(pc->filename, fn);
-            *rfn = pc->filename;
-            break;
+    printf("Writing to %s\n", qst_name);
 
-        case QUEST_VER_GC | QUEST_TYPE_ONLINE:
-            memset(gc, 0, sizeof(gc_qst_hdr));
-            gc->hdr.pkt_type = QUEST_FILE_TYPE;
-            gc->hdr.pkt_len = LE16(sizeof(gc_qst_hdr));
-            strcpy(gc->filename, fn);
-            *rfn = gc->filename;
-            break;
+    if(write_file(qst_name, qst, len)) {
+        free(qst_name);
+        goto out;
+    }
 
-        case QUEST_VER_GC | QUEST_TYPE_DOWNLOAD:
-            memset(gc, 0, sizeof(gc_qst_hdr));
-            gc->hdr.pkt_type = DL_QUEST_FILE_TYPE;
-            gc->hdr.pkt_len = LE16(sizeof(gc_qst_hdr));
-            strcpy(gc->filename, fn);
-            *rfn = gc->filename;
-            break;
+    free(qst_name);
 
-        case QUEST_VER_BB | QUEST_TYPE_ONLINE:
-            memset(bb, 0, sizeof(bb_qst_hdr));
-            bb->hdr.pkt_type = LE16(QUEST_FILE_TYPE);
-            bb->hdr.pkt_len = LE16(sizeof(bb_qst_hdr));
-            strcpy(bb->filename, fn);
-            *rfn = bb->filename;
-            break;
+    if(verbose && !qst_reader_init(&r, qst, len)) {
+        while(qst_next_chunk(&r, cfn, &cdata, &len, &num) > 0) {
+            printf("%s chunk %d (%d bytes)\n", cfn, num, (int)len);
+        }
     }
 
-    return 0;
-}
+    rv = 0;
 
-static int merge_chunks(FILE *qst, const char *bfn, const char *dfn, FILE *bfp,
-                        FILE *dfp, uint32_t qst_type, const char *pfn,
-                        FILE *pfp) {
-    qst_chunk *chunk = (qst_chunk *)buf;
-    uint8_t *nptr;
-    int bindone = 0, datdone = 0, pvrdone = 0;
-    ssize_t amt;
-    size_t chsz = sizeof(qst_chunk);
-
-    if(!pfn || !pfp)
-        pvrdone = 1;
-
-    /* Set up the header first. */
-    if(qst_type & QUEST_VER_PC) {
-        chunk->hdr.pc.pkt_len = LE16(sizeof(qst_chunk));
-        nptr = &chunk->hdr.pc.flags;
-        *nptr = 0;
-
-        if(qst_type & QUEST_TYPE_DOWNLOAD)
-            chunk->hdr.pc.pkt_type = DL_QUEST_CHUNK_TYPE;
-        else
-            chunk->hdr.pc.pkt_type = QUEST_CHUNK_TYPE;
+out:
+    free(qst);
+
+    for(i = 0; i < count; ++i) {
+        if(data[i])
+            unload_file(data[i], files[i].len, mapped[i]);
     }
-    else {
-        chunk->hdr.dc.pkt_len = LE16(sizeof(qst_chunk));
-        nptr = &chunk->hdr.dc.flags;
-        *nptr = 0;
-
-        if(qst_type & QUEST_TYPE_DOWNLOAD)
-            chunk->hdr.dc.pkt_type = DL_QUEST_CHUNK_TYPE;
-        else
-            chunk->hdr.dc.pkt_type = QUEST_CHUNK_TYPE;
-    }
-
-    while(!bindone || !datdone || !pvrdone) {
-        /* First, do the bin file if we've got any more to read from it */
-        if(!bindone) {
-            /* Clear the data */
-            memset(chunk->data, 0, 1024);
-
-            /* Fill in what we need to */
-            memcpy(chunk->filename, bfn, 16);
-            amt = fread(chunk->data, 1, 0x400, bfp);
-            chunk->length = LE32(((uint32_t)amt));
-
-            /* Are we done with this file? */
-            if(amt != 0x400)
-                bindone = 1;
-
-            if(amt < 0) {
-                perror("Cannot read input file");
-                return -1;
-            }
 
-            if(amt != 0) {
-                printf("%s chunk %d (%d bytes)\n", bfn, (int)*nptr, (int)amt);
+    return rv;
+}
 
-                if(fwrite(chunk, 1, chsz, qst) != chsz) {
-                    perror("Cannot write to output file");
-                    return -1;
-                }
-            }
-            else {
-                bindone = 1;
-            }
-        }
+static int bindat_to_qst(int argc, const char *argv[]) {
+    uint32_t qst_type;
+
+    if(argc != 5 && argc != 7) {
+        usage(argv);
+        exit(EXIT_FAILURE);
+    }
 
-        /* Next, do the dat file if we've got any more to read from it */
-        if(!datdone) {
-            /* Clear the data */
-            memset(chunk->data, 0, 1024);
+    /* Figure out what type of quest we have */
+    if((qst_type = parse_qst_type(argv[2])) == QUEST_TYPE_INVALID) {
+        fprintf(stderr, "Invalid quest type given!\n");
+        return -1;
+    }
 
-            /* Fill in what we need to */
-            memcpy(chunk->filename, dfn, 16);
-            amt = fread(chunk->data, 1, 0x400, dfp);
-            chunk->length = LE32(((uint32_t)amt));
+    return merge_qst(qst_type, 2, argv + 3, argv + 3,
+                     argc == 7 ? argv + 5 : NULL);
+}
 
-            /* Are we done with this file? */
-            if(amt != 0x400)
-                datdone = 1;
+static int bindatpvr_to_qst(int argc, const char *argv[]) {
+    uint32_t qst_type;
 
-            if(amt < 0) {
-                perror("Cannot read input file");
-                return -1;
-            }
+    if(argc != 6 && argc != 9) {
+        usage(argv);
+        exit(EXIT_FAILURE);
+    }
 
-            if(amt != 0) {
-                printf("%s chunk %d (%d bytes)\n", dfn, (int)*nptr, (int)amt);
+    /* Figure out what type of quest we have. There's no such thing as a Blue
+       Burst quest with a .pvr. */
+    if((qst_type = parse_qst_type(argv[2])) == QUEST_TYPE_INVALID ||
+       (qst_type & QUEST_VER_BB)) {
+        fprintf(stderr, "Invalid quest type given!\n");
+        return -1;
+    }
 
-                if(fwrite(chunk, 1, chsz, qst) != chsz) {
-                    perror("Cannot write to output file");
-                    return -1;
-                }
-            }
-            else {
-                printf("wut?\n");
-                datdone = 1;
-            }
-        }
+    return merge_qst(qst_type, 3, argv + 3, argv + 3,
+                     argc == 9 ? argv + 6 : NULL);
+}
 
-        /* Finally, if there's a .pvr file, do it if we have anything to do */
-        if(!pvrdone) {
-            /* Clear the data */
-            memset(chunk->data, 0, 1024);
+/* One quest to be done in batch mode. For extraction, only args[0] (the .qst)
+   is used. For merging, it is the .bin, .dat, and (optionally) the two header
+   files. */
+struct batch_job {
+    char *args[4];
+    int rv;
+};
+
+struct batch {
+    struct batch_job *jobs;
+    int count;
+    int alloc;
+    int merge;
+    uint32_t qst_type;
+};
 
-            /* Fill in what we need to */
-            memcpy(chunk->filename, pfn, 16);
-            amt = fread(chunk->data, 1, 0x400, pfp);
-            chunk->length = LE32(((uint32_t)amt));
+struct batch_worker {
+#ifndef _WIN32
+    pthread_t thd;
+#endif
+    struct batch *b;
+    int start;
+    int step;
+};
 
-            /* Are we done with this file? */
-            if(amt != 0x400)
-                pvrdone = 1;
+static const char *base_name(const char *path) {
+    const char *p = strrchr(path, '/');
 
-            if(amt < 0) {
-                perror("Cannot read input file");
-                return -1;
-            }
+#ifdef _WIN32
+    const char *p2 = strrchr(path, '\\');
 
-            if(amt != 0) {
-                printf("%s chunk %d (%d bytes)\n", pfn, (int)*nptr, (int)amt);
+    if(p2 > p)
+        p = p2;
+#endif
 
-                if(fwrite(chunk, 1, chsz, qst) != chsz) {
-                    perror("Cannot write to output file");
-                    return -1;
-                }
-            }
-            else {
-                pvrdone = 1;
-            }
-        }
+    return p ? p + 1 : path;
+}
 
-        ++*nptr;
-    }
+static int file_exists(const char *fn) {
+    struct stat st;
 
-    return 0;
+    return !stat(fn, &st) && (st.st_mode & S_IFMT) == S_IFREG;
 }
 
-static int merge_chunks2(FILE *qst, const char *bfn, const char *dfn, FILE *bfp,
-                         FILE *dfp, uint32_t qst_type, const char *pfn,
-                         FILE *pfp) {
-    bb_qst_chunk *chunk = (bb_qst_chunk *)buf;
-    uint8_t *nptr;
-    int bindone = 0, datdone = 0, pvrdone = 0;
-    ssize_t amt;
-    size_t chsz = sizeof(qst_chunk);
-    uint32_t nil = 0;
-
-    if(!pfn || !pfp)
-        pvrdone = 1;
-
-    /* Set up the header first. */
-    chunk->hdr.pkt_len = LE16(sizeof(bb_qst_chunk));
-    nptr = (uint8_t *)&chunk->hdr.flags;
-    *nptr = 0;
-    chunk->hdr.pkt_type = LE16(QUEST_CHUNK_TYPE);
-    chsz = sizeof(bb_qst_chunk);
-
-    while(!bindone || !datdone || !pvrdone) {
-        /* First, do the dat file if we've got any more to read from it */
-        if(!datdone) {
-            /* Clear the data */
-            memset(chunk->data, 0, 1024);
-
-            /* Fill in what we need to */
-            memcpy(chunk->filename, dfn, 16);
-            amt = fread(chunk->data, 1, 0x400, dfp);
-            chunk->length = LE32(((uint32_t)amt));
-
-            /* Are we done with this file? */
-            if(amt != 0x400)
-                datdone = 1;
-
-            if(amt < 0) {
-                perror("Cannot read input file");
-                return -1;
-            }
+static int has_ext(const char *fn, const char *ext) {
+    size_t len = strlen(fn), elen = strlen(ext);
+    size_t i;
 
-            if(amt != 0) {
-                printf("%s chunk %d (%d bytes)\n", dfn, (int)*nptr, (int)amt);
+    if(len <= elen)
+        return 0;
 
-                if(fwrite(chunk, 1, chsz, qst) != chsz) {
-                    perror("Cannot write to output file");
-                    return -1;
-                }
-            }
-            else {
-                datdone = 1;
-            }
+    for(i = 0; i < elen; ++i) {
+        if(tolower((unsigned char)fn[len - elen + i]) != ext[i])
+            return 0;
+    }
 
-            /* Sigh... */
-            fwrite(&nil, 1, 4, qst);
-        }
+    return 1;
+}
 
-        /* Next, do the bin file if we've got any more to read from it */
-        if(!bindone) {
-            /* Clear the data */
-            memset(chunk->data, 0, 1024);
+/* Add a job to the list. The strings are copied. */
+static int add_job(struct batch *b, const char *args[], int nargs) {
+    struct batch_job *tmp;
+    int i;
 
-            /* Fill in what we need to */
-            memcpy(chunk->filename, bfn, 16);
-            amt = fread(chunk->data, 1, 0x400, bfp);
-            chunk->length = LE32(((uint32_t)amt));
+    if(b->count == b->alloc) {
+        if(!(tmp = (struct batch_job *)realloc(b->jobs, (b->alloc + 64) *
+                                               sizeof(struct batch_job)))) {
+            perror("realloc");
+            return -1;
+        }
 
-            /* Are we done with this file? */
-            if(amt != 0x400)
-                bindone = 1;
+        b->jobs = tmp;
+        b->alloc += 64;
+    }
 
-            if(amt < 0) {
-                perror("Cannot read input file");
-                return -1;
-            }
+    memset(&b->jobs[b->count], 0, sizeof(struct batch_job));
 
-            if(amt != 0) {
-                printf("%s chunk %d (%d bytes)\n", bfn, (int)*nptr, (int)amt);
+    for(i = 0; i < nargs; ++i) {
+        if(!(b->jobs[b->count].args[i] = strdup(args[i]))) {
+            perror("strdup");
 
-                if(fwrite(chunk, 1, chsz, qst) != chsz) {
-                    perror("Cannot write to output file");
-                    return -1;
-                }
-            }
-            else {
-                bindone = 1;
-            }
+            while(i--)
+                free(b->jobs[b->count].args[i]);
 
-            /* Sigh... */
-            fwrite(&nil, 1, 4, qst);
+            return -1;
         }
+    }
 
-        /* Finally, if there's a .pvr file, do it if we have anything to do */
-        if(!pvrdone) {
-            /* Clear the data */
-            memset(chunk->data, 0, 1024);
+    ++b->count;
+    return 0;
+}
 
-            /* Fill in what we need to */
-            memcpy(chunk->filename, pfn, 16);
-            amt = fread(chunk->data, 1, 0x400, pfp);
-            chunk->length = LE32(((uint32_t)amt));
+/* Figure out what to do with one file found in a directory. For extraction,
+   that's any .qst file. For merging, it's any .bin file with a .dat file next
+   to it, along with their header files if both of those are there too. */
+static int add_dir_file(struct batch *b, const char *path) {
+    const char *args[4];
+    char *names;
+    size_t len;
+    int rv;
 
-            /* Are we done with this file? */
-            if(amt != 0x400)
-                pvrdone = 1;
+    if(!b->merge) {
+        if(!has_ext(path, ".qst"))
+            return 0;
 
-            if(amt < 0) {
-                perror("Cannot read input file");
-                return -1;
-            }
+        args[0] = path;
+        return add_job(b, args, 1);
+    }
 
-            if(amt != 0) {
-                printf("%s chunk %d (%d bytes)\n", pfn, (int)*nptr, (int)amt);
+    if(!has_ext(path, ".bin"))
+        return 0;
 
-                if(fwrite(chunk, 1, chsz, qst) != chsz) {
-                    perror("Cannot write to output file");
-                    return -1;
-                }
-            }
-            else {
-                pvrdone = 1;
-            }
+    /* Room for the .dat name and both .hdr names. */
+    len = strlen(path) + 1;
 
-            /* Sigh... */
-            fwrite(&nil, 1, 4, qst);
-        }
+    if(!(names = (char *)malloc(len * 3 + 8))) {
+        perror("malloc");
+        return -1;
+    }
+
+    strcpy(names, path);
+    strcpy(names + len - 4, "dat");
 
-        ++*nptr;
+    if(!file_exists(names)) {
+        free(names);
+        return 0;
     }
 
-    return 0;
-}
+    args[0] = path;
+    args[1] = names;
+    args[2] = names + len;
+    args[3] = names + len * 2 + 4;
+    sprintf(names + len, "%s.hdr", path);
+    strcpy(names + len * 2 + 4, names);
+    strcat(names + len * 2 + 4, ".hdr");
 
-static int bindat_to_qst(int argc, const char *argv[]) {
-    FILE *bfp, *dfp, *qst;
-    uint32_t qst_type;
-    uint8_t bhbuf[sizeof(bb_qst_hdr)], dhbuf[sizeof(bb_qst_hdr)];
-    dc_qst_hdr *hdr;
-    bb_qst_hdr *bbhdr;
-    char *qst_name;
-    char *tmp, *bfn, *dfn;
-    size_t hsz = sizeof(dc_qst_hdr);
+    if(file_exists(args[2]) && file_exists(args[3]))
+        rv = add_job(b, args, 4);
+    else
+        rv = add_job(b, args, 2);
 
-    if(argc != 5 && argc != 7) {
-        usage(argv);
-        exit(EXIT_FAILURE);
-    }
+    free(names);
+    return rv;
+}
 
-    /* Figure out what type of quest we have */
-    if(!strcmp(argv[2], "dc"))
-        qst_type = QUEST_TYPE_ONLINE | QUEST_VER_DC;
-    else if(!strcmp(argv[2], "pc"))
-        qst_type = QUEST_TYPE_ONLINE | QUEST_VER_PC;
-    else if(!strcmp(argv[2], "gc"))
-        qst_type = QUEST_TYPE_ONLINE | QUEST_VER_GC;
-    else if(!strcmp(argv[2], "dcdl"))
-        qst_type = QUEST_TYPE_DOWNLOAD | QUEST_VER_DC;
-    else if(!strcmp(argv[2], "pcdl"))
-        qst_type = QUEST_TYPE_DOWNLOAD | QUEST_VER_PC;
-    else if(!strcmp(argv[2], "gcdl"))
-        qst_type = QUEST_TYPE_DOWNLOAD | QUEST_VER_GC;
-    else if(!strcmp(argv[2], "bb")) {
-        qst_type = QUEST_TYPE_ONLINE | QUEST_VER_BB;
-        hsz = sizeof(bb_qst_hdr);
-    }
-    else {
-        fprintf(stderr, "Invalid quest type given!\n");
-        return -1;
-    }
+static int add_dir_jobs(struct batch *b, const char *dir) {
+    char *path;
+    int rv = 0;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h;
 
-    /* Try to open the bin/dat files */
-    if(!(bfp = fopen(argv[3], "rb"))) {
-        fprintf(stderr, "Error opening \"%s\": %s\n", argv[3], strerror(errno));
+    if(!(path = (char *)malloc(strlen(dir) + MAX_PATH + 2))) {
+        perror("malloc");
         return -1;
     }
 
-    if(!(dfp = fopen(argv[4], "rb"))) {
-        fprintf(stderr, "Error opening \"%s\": %s\n", argv[4], strerror(errno));
-        fclose(bfp);
+    sprintf(path, "%s/*", dir);
+
+    if((h = FindFirstFileA(path, &fd)) == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Cannot read directory \"%s\"\n", dir);
+        free(path);
         return -1;
     }
 
-    /* If we have header files, open them and read them in. */
-    if(argc == 7) {
-        /* First up is the .bin header file */
-        if(read_hdr(argv[5], bhbuf, qst_type, &bfn))
-            goto out;
+    do {
+        sprintf(path, "%s/%s", dir, fd.cFileName);
 
-        /* Then, do the .dat header file */
-        if(read_hdr(argv[6], dhbuf, qst_type, &dfn))
-            goto out;
+        if(file_exists(path) && (rv = add_dir_file(b, path)))
+            break;
+    } while(FindNextFileA(h, &fd));
+
+    FindClose(h);
+#else
+    DIR *d;
+    struct dirent *de;
+
+    if(!(d = opendir(dir))) {
+        fprintf(stderr, "Cannot read directory \"%s\": %s\n", dir,
+                strerror(errno));
+        return -1;
     }
-    else {
-        /* We need to construct the headers ourselves, I guess... */
-        if(strlen(argv[3]) > 16 || strlen(argv[4]) > 16) {
-            fprintf(stderr, "Quest filenames too long without headers\n");
-            goto out;
+
+    while((de = readdir(d))) {
+        if(!(path = (char *)malloc(strlen(dir) + strlen(de->d_name) + 2))) {
+            perror("malloc");
+            rv = -1;
+            break;
         }
 
-        make_hdr(argv[3], bhbuf, qst_type, &bfn);
-        make_hdr(argv[4], dhbuf, qst_type, &dfn);
-    }
+        sprintf(path, "%s/%s", dir, de->d_name);
 
-    /* Figure out the name of the .qst file */
-    if(!(qst_name = (char *)malloc(strlen(argv[3]) + 5))) {
-        perror("malloc");
-        goto out;
-    }
+        if(file_exists(path))
+            rv = add_dir_file(b, path);
 
-    strcpy(qst_name, argv[3]);
+        free(path);
 
-    if(!(tmp = strrchr(qst_name, '.')))
-        tmp = qst_name + strlen(qst_name);
+        if(rv)
+            break;
+    }
 
-    *tmp++ = '.';
-    *tmp++ = 'q';
-    *tmp++ = 's';
-    *tmp++ = 't';
-    *tmp = 0;
+    closedir(d);
+    path = NULL;
+#endif
 
-    printf("Writing to %s\n", qst_name);
+    free(path);
+    return rv;
+}
 
-    if(!(qst = fopen(qst_name, "wb"))) {
-        perror("Cannot open output file");
-        free(qst_name);
-        goto out;
+/* Read a list of quests to do from a file. Each line has either a .qst file on
+   it (for extraction), or a .bin and a .dat, and optionally their two header
+   files (for merging). Blank lines and lines starting with # are skipped. */
+static int add_manifest_jobs(struct batch *b, const char *fn) {
+    FILE *fp;
+    char line[4096], *tok;
+    const char *args[4];
+    int nargs, lineno = 0, rv = 0;
+
+    if(!(fp = fopen(fn, "r"))) {
+        fprintf(stderr, "Error opening \"%s\": %s\n", fn, strerror(errno));
+        return -1;
     }
 
-    free(qst_name);
+    while(fgets(line, sizeof(line), fp)) {
+        ++lineno;
+        nargs = 0;
 
-    /* Write out the headers first. */
-    if(hsz == sizeof(dc_qst_hdr)) {
-        hdr = (dc_qst_hdr *)bhbuf;
-        if(fseek(bfp, 0, SEEK_END)) {
-            perror("fseek");
-            goto out_qst;
-        }
+        for(tok = strtok(line, " \t\r\n"); tok && nargs < 5;
+            tok = strtok(NULL, " \t\r\n")) {
+            if(nargs == 0 && tok[0] == '#')
+                break;
 
-        /* Update the length in the .bin header, if needed */
-        hdr->length = LE32(((uint32_t)ftell(bfp)));
+            if(nargs < 4)
+                args[nargs] = tok;
 
-        if(fseek(bfp, 0, SEEK_SET)) {
-            perror("fseek");
-            goto out_qst;
+            ++nargs;
         }
 
-        /* Write the .bin header */
-        if(fwrite(bhbuf, 1, sizeof(dc_qst_hdr), qst) != sizeof(dc_qst_hdr)) {
-            perror("Cannot write to output file");
-            goto out_qst;
-        }
+        if(!nargs)
+            continue;
 
-        hdr = (dc_qst_hdr *)dhbuf;
-        if(fseek(dfp, 0, SEEK_END)) {
-            perror("fseek");
-            goto out_qst;
+        if((!b->merge && nargs != 1) ||
+           (b->merge && nargs != 2 && nargs != 4)) {
+            fprintf(stderr, "%s:%d: wrong number of files\n", fn, lineno);
+            rv = -1;
+            break;
         }
 
-        /* Update the length in the .dat header, if needed */
-        hdr->length = LE32(((uint32_t)ftell(dfp)));
+        if((rv = add_job(b, args, nargs)))
+            break;
+    }
 
-        if(fseek(dfp, 0, SEEK_SET)) {
-            perror("fseek");
-            goto out_qst;
-        }
+    fclose(fp);
+    return rv;
+}
 
-        /* Write the .dat header */
-        if(fwrite(dhbuf, 1, sizeof(dc_qst_hdr), qst) != sizeof(dc_qst_hdr)) {
-            perror("Cannot write to output file");
-            goto out_qst;
+static int job_cmp(const void *a, const void *b) {
+    const struct batch_job *j1 = (const struct batch_job *)a;
+    const struct batch_job *j2 = (const struct batch_job *)b;
+
+    return strcmp(j1->args[0], j2->args[0]);
+}
+
+/* Where a .qst file's contents get extracted to: the directory it's in, or
+   NULL for the current directory. Returns -1 if out of memory. */
+static int job_dir(const struct batch_job *job, char **dir) {
+    size_t len;
+
+    *dir = NULL;
+
+    if((len = base_name(job->args[0]) - job->args[0])) {
+        if(!(*dir = (char *)malloc(len))) {
+            perror("malloc");
+            return -1;
         }
 
-        if(merge_chunks(qst, bfn, dfn, bfp, dfp, qst_type, NULL, NULL))
-            goto out_qst;
+        memcpy(*dir, job->args[0], len - 1);
+        (*dir)[len - 1] = 0;
     }
-    else {
-        /* Ugh... Qedit makes everything backwards for bb >_> */
-        bbhdr = (bb_qst_hdr *)dhbuf;
-        if(fseek(dfp, 0, SEEK_END)) {
-            perror("fseek");
-            goto out_qst;
-        }
 
-        /* Update the length in the .dat header, if needed */
-        bbhdr->length = LE32(((uint32_t)ftell(dfp)));
+    return 0;
+}
 
-        /* Set a name, if one isn't given. */
-        if(bbhdr->name[0] == 0) {
-            strncpy(bbhdr->name, argv[4], 24);
-            bbhdr->name[23] = 0;
-        }
+/* One of the files that a quest will be extracted to. */
+struct out_name {
+    char *path;
+    int job;
+};
 
-        if(fseek(dfp, 0, SEEK_SET)) {
-            perror("fseek");
-            goto out_qst;
-        }
+static int out_name_cmp(const void *a, const void *b) {
+    return strcmp(((const struct out_name *)a)->path,
+                  ((const struct out_name *)b)->path);
+}
 
-        /* Write the .dat header */
-        if(fwrite(dhbuf, 1, sizeof(bb_qst_hdr), qst) != sizeof(bb_qst_hdr)) {
-            perror("Cannot write to output file");
-            goto out_qst;
-        }
+/* Add the files in one quest to the list of everything being extracted. */
+static int add_out_names(struct batch *b, int job, struct out_name **names,
+                         int *count, int *alloc) {
+    struct qst_reader r;
+    struct out_name *tmp;
+    const uint8_t *data;
+    uint8_t *buf;
+    size_t buf_len;
+    char cfn[17], *dir;
+    int rv, mapped;
+
+    if(!(buf = load_file(b->jobs[job].args[0], &buf_len, &mapped)))
+        return -1;
 
-        bbhdr = (bb_qst_hdr *)bhbuf;
-        if(fseek(bfp, 0, SEEK_END)) {
-            perror("fseek");
-            goto out_qst;
-        }
+    if(job_dir(&b->jobs[job], &dir)) {
+        unload_file(buf, buf_len, mapped);
+        return -1;
+    }
 
-        /* Update the length in the .bin header, if needed */
-        bbhdr->length = LE32(((uint32_t)ftell(bfp)));
+    /* Anything that can't be read is left for the job itself to complain
+       about, it just can't clash with anything. */
+    if(qst_reader_init(&r, buf, buf_len)) {
+        rv = 0;
+        goto out;
+    }
 
-        /* Set a name, if one isn't given. */
-        if(bbhdr->name[0] == 0) {
-            strncpy(bbhdr->name, argv[4], 24);
-            bbhdr->name[23] = 0;
-        }
+    while((rv = qst_next_hdr(&r, &data, cfn)) > 0) {
+        if(*count == *alloc) {
+            if(!(tmp = (struct out_name *)realloc(*names, (*alloc + 64) *
+                                                  sizeof(struct out_name)))) {
+                perror("realloc");
+                rv = -1;
+                goto out;
+            }
 
-        if(fseek(bfp, 0, SEEK_SET)) {
-            perror("fseek");
-            goto out_qst;
+            *names = tmp;
+            *alloc += 64;
         }
 
-        /* Write the .bin header */
-        if(fwrite(bhbuf, 1, sizeof(bb_qst_hdr), qst) != sizeof(bb_qst_hdr)) {
-            perror("Cannot write to output file");
-            goto out_qst;
+        if(!((*names)[*count].path = out_path(dir, cfn))) {
+            perror("malloc");
+            rv = -1;
+            goto out;
         }
 
-        if(merge_chunks2(qst, bfn, dfn, bfp, dfp, qst_type, NULL, NULL))
-            goto out_qst;
+        (*names)[(*count)++].job = job;
     }
 
-    fclose(qst);
-    fclose(dfp);
-    fclose(bfp);
-    return 0;
+    rv = 0;
 
-out_qst:
-    fclose(qst);
 out:
-    fclose(dfp);
-    fclose(bfp);
-    return -1;
+    free(dir);
+    unload_file(buf, buf_len, mapped);
+    return rv;
 }
 
-static int bindatpvr_to_qst(int argc, const char *argv[]) {
-    FILE *bfp, *dfp, *pfp, *qst;
-    uint32_t qst_type;
-    uint8_t bhbuf[sizeof(dc_qst_hdr)], dhbuf[sizeof(dc_qst_hdr)];
-    uint8_t phbuf[sizeof(dc_qst_hdr)];
-    dc_qst_hdr *hdr;
-    char *qst_name;
-    char *tmp, *bfn, *dfn, *pfn;
-
-    if(argc != 6 && argc != 9) {
-        usage(argv);
-        exit(EXIT_FAILURE);
+/* Quests in the same directory often have files with the same name in them
+   (like the Episode I and II versions of a quest), which would be extracted
+   right on top of each other, possibly at the same time. Make sure that can't
+   happen before starting on any of them. */
+static int check_out_names(struct batch *b) {
+    struct out_name *names = NULL;
+    int count = 0, alloc = 0, i, rv = 0;
+
+    for(i = 0; i < b->count && !rv; ++i)
+        rv = add_out_names(b, i, &names, &count, &alloc);
+
+    if(!rv) {
+        qsort(names, count, sizeof(struct out_name), &out_name_cmp);
+
+        for(i = 1; i < count; ++i) {
+            if(names[i - 1].job != names[i].job &&
+               !out_name_cmp(&names[i - 1], &names[i])) {
+                fprintf(stderr, "%s and %s would both be extracted to %s\n",
+                        b->jobs[names[i - 1].job].args[0],
+                        b->jobs[names[i].job].args[0], names[i].path);
+                rv = -1;
+            }
+        }
     }
 
-    /* Figure out what type of quest we have */
-    if(!strcmp(argv[2], "dc"))
-        qst_type = QUEST_TYPE_ONLINE | QUEST_VER_DC;
-    else if(!strcmp(argv[2], "pc"))
-        qst_type = QUEST_TYPE_ONLINE | QUEST_VER_PC;
-    else if(!strcmp(argv[2], "gc"))
-        qst_type = QUEST_TYPE_ONLINE | QUEST_VER_GC;
-    else if(!strcmp(argv[2], "dcdl"))
-        qst_type = QUEST_TYPE_DOWNLOAD | QUEST_VER_DC;
-    else if(!strcmp(argv[2], "pcdl"))
-        qst_type = QUEST_TYPE_DOWNLOAD | QUEST_VER_PC;
-    else if(!strcmp(argv[2], "gcdl"))
-        qst_type = QUEST_TYPE_DOWNLOAD | QUEST_VER_GC;
-    else {
-        fprintf(stderr, "Invalid quest type given!\n");
-        return -1;
-    }
+    for(i = 0; i < count; ++i)
+        free(names[i].path);
 
-    /* Try to open the bin/dat files */
-    if(!(bfp = fopen(argv[3], "rb"))) {
-        fprintf(stderr, "Error opening \"%s\": %s\n", argv[3], strerror(errno));
-        return -1;
-    }
+    free(names);
+    return rv;
+}
 
-    if(!(dfp = fopen(argv[4], "rb"))) {
-        fprintf(stderr, "Error opening \"%s\": %s\n", argv[4], strerror(errno));
-        fclose(bfp);
-        return -1;
+static int do_job(struct batch *b, struct batch_job *job) {
+    const char *names[2];
+    char *dir;
+    int rv;
+
+    if(b->merge) {
+        names[0] = base_name(job->args[0]);
+        names[1] = base_name(job->args[1]);
+        return merge_qst(b->qst_type, 2, (const char **)job->args, names,
+                         job->args[2] ? (const char **)job->args + 2 : NULL);
     }
 
-    if(!(pfp = fopen(argv[5], "rb"))) {
-        fprintf(stderr, "Error opening \"%s\": %s\n", argv[4], strerror(errno));
-        fclose(dfp);
-        fclose(bfp);
+    /* Extract everything next to the .qst file. */
+    if(job_dir(job, &dir))
         return -1;
-    }
 
-    /* If we have header files, open them and read them in. */
-    if(argc == 9) {
-        /* First up is the .bin header file */
-        if(read_hdr(argv[6], bhbuf, qst_type, &bfn))
-            goto out;
+    rv = qst_to_bindat(job->args[0], dir);
+    free(dir);
 
-        /* Then, do the .dat header file */
-        if(read_hdr(argv[7], dhbuf, qst_type, &dfn))
-            goto out;
+    if(!rv)
+        printf("Extracted %s\n", job->args[0]);
 
-        /* Then, do the .pvr header file */
-        if(read_hdr(argv[8], phbuf, qst_type, &pfn))
-            goto out;
+    return rv;
+}
+
+static void *batch_thd(void *d) {
+    struct batch_worker *w = (struct batch_worker *)d;
+    int i;
+
+    for(i = w->start; i < w->b->count; i += w->step) {
+        if((w->b->jobs[i].rv = do_job(w->b, &w->b->jobs[i])))
+            fprintf(stderr, "Failed: %s\n", w->b->jobs[i].args[0]);
     }
-    else {
-        /* We need to construct the headers ourselves, I guess... */
-        if(strlen(argv[3]) > 16 || strlen(argv[4]) > 16 ||
-           strlen(argv[5]) > 16) {
-            fprintf(stderr, "Quest filenames too long without headers\n");
-            goto out;
+
+    return NULL;
+}
+
+/* Convert a whole bunch of quests at once, spread over however many threads
+   are asked for. What to convert comes from either a directory (every .qst in
+   it, or every .bin/.dat pair) or a list of files. */
+static int batch_convert(int argc, const char *argv[]) {
+    struct batch b;
+    struct batch_worker *workers;
+    struct stat st;
+    const char *src;
+    int i = 2, j, threads = 1, failed = 0, rv = -1;
+
+    memset(&b, 0, sizeof(b));
+
+    if(argc > i + 1 && !strcmp(argv[i], "-j")) {
+        if((threads = atoi(argv[i + 1])) < 1) {
+            fprintf(stderr, "Invalid thread count: %s\n", argv[i + 1]);
+            return -1;
         }
 
-        make_hdr(argv[3], bhbuf, qst_type, &bfn);
-        make_hdr(argv[4], dhbuf, qst_type, &dfn);
-        make_hdr(argv[5], phbuf, qst_type, &pfn);
+        i += 2;
     }
 
-    /* Figure out the name of the .qst file */
-    if(!(qst_name = (char *)malloc(strlen(argv[3]) + 5))) {
-        perror("malloc");
-        goto out;
+    if(argc == i + 2 && !strcmp(argv[i], "-x")) {
+        src = argv[i + 1];
     }
+    else if(argc == i + 3 && !strcmp(argv[i], "-m")) {
+        b.merge = 1;
+        src = argv[i + 2];
 
-    strcpy(qst_name, argv[3]);
+        if((b.qst_type = parse_qst_type(argv[i + 1])) == QUEST_TYPE_INVALID) {
+            fprintf(stderr, "Invalid quest type given!\n");
+            return -1;
+        }
+    }
+    else {
+        usage(argv);
+        exit(EXIT_FAILURE);
+    }
 
-    if(!(tmp = strrchr(qst_name, '.')))
-        tmp = qst_name + strlen(qst_name);
+    if(stat(src, &st)) {
+        fprintf(stderr, "Error opening \"%s\": %s\n", src, strerror(errno));
+        return -1;
+    }
 
-    *tmp++ = '.';
-    *tmp++ = 'q';
-    *tmp++ = 's';
-    *tmp++ = 't';
-    *tmp = 0;
+    if((st.st_mode & S_IFMT) == S_IFDIR) {
+        if(add_dir_jobs(&b, src))
+            goto out;
 
-    printf("Writing to %s\n", qst_name);
+        /* Do them in a predictable order, at least with one thread. */
+        qsort(b.jobs, b.count, sizeof(struct batch_job), &job_cmp);
+    }
+    else if(add_manifest_jobs(&b, src)) {
+        goto out;
+    }
 
-    if(!(qst = fopen(qst_name, "wb"))) {
-        perror("Cannot open output file");
-        free(qst_name);
+    if(!b.count) {
+        fprintf(stderr, "No quests found in \"%s\"\n", src);
         goto out;
     }
 
-    free(qst_name);
+    if(!b.merge && check_out_names(&b))
+        goto out;
 
-    /* Write out the headers first. */
-    hdr = (dc_qst_hdr *)bhbuf;
-    if(fseek(bfp, 0, SEEK_END)) {
-        perror("fseek");
-        goto out_qst;
-    }
+    /* With more than one quest going at once, the per-chunk output would just
+       be a jumble. */
+    verbose = 0;
 
-    /* Update the length in the .bin header, if needed */
-    hdr->length = LE32(((uint32_t)ftell(bfp)));
+#ifdef _WIN32
+    /* No threads here, just do them all in order. */
+    threads = 1;
+#endif
 
-    if(fseek(bfp, 0, SEEK_SET)) {
-        perror("fseek");
-        goto out_qst;
-    }
+    if(threads > b.count)
+        threads = b.count;
 
-    /* Write the .bin header */
-    if(fwrite(bhbuf, 1, sizeof(dc_qst_hdr), qst) != sizeof(dc_qst_hdr)) {
-        perror("Cannot write to output file");
-        goto out_qst;
+    if(!(workers = (struct batch_worker *)calloc(threads, sizeof(*workers)))) {
+        perror("calloc");
+        goto out;
     }
 
-    hdr = (dc_qst_hdr *)dhbuf;
-    if(fseek(dfp, 0, SEEK_END)) {
-        perror("fseek");
-        goto out_qst;
+    for(j = 0; j < threads; ++j) {
+        workers[j].b = &b;
+        workers[j].start = j;
+        workers[j].step = threads;
     }
 
-    /* Update the length in the .dat header, if needed */
-    hdr->length = LE32(((uint32_t)ftell(dfp)));
+#ifndef _WIN32
+    if(threads > 1) {
+        int started, err;
+
+        for(started = 0; started < threads; ++started) {
+            if((err = pthread_create(&workers[started].thd, NULL, &batch_thd,
+                                     &workers[started]))) {
+                fprintf(stderr, "pthread_create: %s\n", strerror(err));
+                break;
+            }
+        }
 
-    if(fseek(dfp, 0, SEEK_SET)) {
-        perror("fseek");
-        goto out_qst;
-    }
+        /* Whatever didn't get a thread gets done here. */
+        for(j = started; j < threads; ++j)
+            batch_thd(&workers[j]);
 
-    /* Write the .dat header */
-    if(fwrite(dhbuf, 1, sizeof(dc_qst_hdr), qst) != sizeof(dc_qst_hdr)) {
-        perror("Cannot write to output file");
-        goto out_qst;
+        for(j = 0; j < started; ++j)
+            pthread_join(workers[j].thd, NULL);
     }
-
-    hdr = (dc_qst_hdr *)phbuf;
-    if(fseek(pfp, 0, SEEK_END)) {
-        perror("fseek");
-        goto out_qst;
+    else
+#endif
+    {
+        batch_thd(&workers[0]);
     }
 
-    /* Update the length in the .pvr header, if needed */
-    hdr->length = LE32(((uint32_t)ftell(pfp)));
-
-    if(fseek(pfp, 0, SEEK_SET)) {
-        perror("fseek");
-        goto out_qst;
-    }
+    free(workers);
 
-    /* Write the .dat header */
-    if(fwrite(phbuf, 1, sizeof(dc_qst_hdr), qst) != sizeof(dc_qst_hdr)) {
-        perror("Cannot write to output file");
-        goto out_qst;
+    for(j = 0; j < b.count; ++j) {
+        if(b.jobs[j].rv)
+            ++failed;
     }
 
-    if(merge_chunks(qst, bfn, dfn, bfp, dfp, qst_type, pfn, pfp))
-        goto out_qst;
-
-    fclose(qst);
-    fclose(pfp);
-    fclose(dfp);
-    fclose(bfp);
-    return 0;
+    fprintf(stderr, "Converted %d of %d quests\n", b.count - failed, b.count);
+    rv = failed ? -1 : 0;
 
-out_qst:
-    fclose(qst);
 out:
-    fclose(pfp);
-    fclose(dfp);
-    fclose(bfp);
-    return -1;
+    for(j = 0; j < b.count; ++j) {
+        for(i = 0; i < 4; ++i)
+            free(b.jobs[j].args[i]);
+    }
+
+    free(b.jobs);
+    return rv;
 }
 
 int main(int argc, const char *argv[]) {
+    /* Take -v off the front, so everything else sees the same arguments it
+       would have without it. */
+    if(argc > 1 && !strcmp(argv[1], "-v")) {
+        verbose = 1;
+        argv[1] = argv[0];
+        ++argv;
+        --argc;
+    }
+
     if(argc < 3) {
         usage(argv);
         exit(EXIT_FAILURE);
     }
 
     if(!strcmp(argv[1], "-x")) {
-        if(qst_to_bindat(argv[2])) {
+        if(qst_to_bindat(argv[2], NULL)) {
             fprintf(stderr, "Extraction failed.\n");
             exit(EXIT_FAILURE);
         }
@@ -1416,6 +1210,12 @@ int main(int argc, const char *argv[]) {
 
         fprintf(stderr, "Successfully merged quest\n");
     }
+    else if(!strcmp(argv[1], "-b")) {
+        if(batch_convert(argc, argv)) {
+            fprintf(stderr, "Batch conversion failed.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
     else if(!strcmp(argv[1], "-mp")) {
         if(bindatpvr_to_qst(argc, argv)) {
             fprintf(stderr, "Merging failed.\n");
@@ -20,6 +20,11 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
 
 #include "quest_enemies.h"
 #include "packets.h"
@@ -27,7 +32,17 @@
 static int version = CLIENT_VERSION_DC;
 static int episode = 1;
 static int compressed = 1;
-static const char *filename;
+static const char *index_fn;
+static int threads = 1;
+
+/* Every quest file to be scanned. */
+static char **files;
+static int file_count, file_alloc;
+
+/* The next file for a worker thread to grab, and how many have failed. These
+   are only ever updated atomically. */
+static int next_file;
+static int failed;
 
 /* Print information about this program to stdout. */
 static void print_program_info(void) {
@@ -53,7 +68,7 @@ static void print_program_info(void) {
 
 /* Print help to the user to stdout. */
 static void print_help(const char *bin) {
-    printf("Usage: %s [arguments] quest_file\n"
+    printf("Usage: %s [arguments] quest_file [quest_file ...]\n"
            "-----------------------------------------------------------------\n"
            "--help          Print this help and exit\n"
            "--version       Print version info and exit\n"
@@ -64,7 +79,13 @@ static void print_help(const char *bin) {
            "--gc            Quest specified is for Gamecube\n"
            "--bb            Quest specified is for PSO Blue Burst\n"
            "--ep1           Quest specified is for Episode I\n"
-           "--ep2           Quest specified is for Episode II\n\n"
+           "--ep2           Quest specified is for Episode II\n"
+           "--index file    Write a binary index of the enemies in the quest\n"
+           "                to file, instead of printing them out. If more\n"
+           "                than one quest is given, file is a directory to\n"
+           "                write a .qei file for each one to, named after\n"
+           "                the quest file (so foo.qst's is foo.qst.qei).\n"
+           "-j N            Scan N quests at a time\n\n"
            "If an episode is not specified, the quest is assumed to be for\n"
            "Episode I.\n"
            "If a version of the game is not specified, the quest is assumed\n"
@@ -73,7 +94,93 @@ static void print_help(const char *bin) {
            "compressed .dat file from the quest, or an uncompressed .dat\n"
            "file. If using an uncompressed .dat file, make sure to specify\n"
            "the relevant command line option to ensure the file is parsed\n"
-           "correctly.\n", bin);
+           "correctly.\n"
+           "Any directories given are scanned for .qst and .dat files, which\n"
+           "are all parsed with the same options.\n", bin);
+}
+
+static int add_file(const char *fn) {
+    char **tmp;
+
+    if(file_count == file_alloc) {
+        if(!(tmp = (char **)realloc(files, (file_alloc + 64) *
+                                    sizeof(char *)))) {
+            perror("realloc");
+            return -1;
+        }
+
+        files = tmp;
+        file_alloc += 64;
+    }
+
+    if(!(files[file_count] = strdup(fn))) {
+        perror("strdup");
+        return -1;
+    }
+
+    ++file_count;
+    return 0;
+}
+
+static int is_quest_file(const char *fn) {
+    const char *ext = strrchr(fn, '.');
+    char e[5];
+    int i;
+
+    if(!ext || strlen(ext) != 4)
+        return 0;
+
+    for(i = 0; i < 4; ++i) {
+        e[i] = (char)tolower((unsigned char)ext[i]);
+    }
+
+    e[4] = 0;
+    return !strcmp(e, ".qst") || !strcmp(e, ".dat");
+}
+
+static int file_cmp(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Add a quest file, or all of the quest files in a directory. */
+static int add_path(const char *path) {
+    struct stat st;
+    struct dirent *ent;
+    DIR *dir;
+    char *fn;
+    int first = file_count, rv = 0;
+
+    if(stat(path, &st) || !S_ISDIR(st.st_mode))
+        return add_file(path);
+
+    if(!(dir = opendir(path))) {
+        perror("opendir");
+        return -1;
+    }
+
+    while((ent = readdir(dir))) {
+        if(ent->d_name[0] == '.' || !is_quest_file(ent->d_name))
+            continue;
+
+        if(!(fn = (char *)malloc(strlen(path) + strlen(ent->d_name) + 2))) {
+            perror("malloc");
+            rv = -1;
+            break;
+        }
+
+        sprintf(fn, "%s/%s", path, ent->d_name);
+        rv = add_file(fn);
+        free(fn);
+
+        if(rv)
+            break;
+    }
+
+    closedir(dir);
+
+    /* Keep the order the same from run to run. */
+    qsort(files + first, file_count - first, sizeof(char *), file_cmp);
+    return rv;
 }
 
 /* Parse any command-line arguments passed in. */
@@ -85,7 +192,7 @@ static void parse_command_line(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    for(i = 1; i < argc - 1; ++i) {
+    for(i = 1; i < argc && argv[i][0] == '-'; ++i) {
         if(!strcmp(argv[i], "--version")) {
             print_program_info();
             exit(EXIT_SUCCESS);
@@ -115,6 +222,22 @@ static void parse_command_line(int argc, char *argv[]) {
         else if(!strcmp(argv[i], "--uncompressed")) {
             compressed = 0;
         }
+        else if(!strcmp(argv[i], "--index")) {
+            if(i + 1 >= argc) {
+                printf("--index requires an argument\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+
+            index_fn = argv[++i];
+        }
+        else if(!strcmp(argv[i], "-j")) {
+            if(i + 1 >= argc || (threads = atoi(argv[++i])) < 1) {
+                printf("-j requires a positive number\n");
+                print_help(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+        }
         else {
             printf("Illegal command line argument: %s\n", argv[i]);
             print_help(argv[0]);
@@ -122,37 +245,161 @@ static void parse_command_line(int argc, char *argv[]) {
         }
     }
 
-    /* Save the file we'll be working with. */
-    filename = argv[argc - 1];
+    if(i == argc) {
+        print_help(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Save the files we'll be working with. */
+    for(; i < argc; ++i) {
+        if(add_path(argv[i]))
+            exit(EXIT_FAILURE);
+    }
+
+    if(!file_count) {
+        printf("No quest files found\n");
+        exit(EXIT_FAILURE);
+    }
 }
 
-int main(int argc, char *argv[]) {
-    uint8_t *dat = NULL;
+/* Write out the enemies found in the quest as a qei_hdr_t followed by all of
+   the entries, in little-endian byte order. */
+static int write_index(const char *fn, qei_list_t *list, qei_hdr_t *hdr,
+                       FILE *out) {
+    FILE *fp;
+    qei_enemy_t *e;
+    uint32_t i;
+
+    hdr->magic = LE32(QEI_MAGIC);
+    hdr->version = LE32(QEI_VERSION);
+    hdr->episode = LE32(((uint32_t)episode));
+    hdr->enemy_count = LE32(list->count);
+
+    for(i = 0; i < QEI_AREA_COUNT; ++i) {
+        hdr->areas[i].first = LE32(hdr->areas[i].first);
+        hdr->areas[i].count = LE32(hdr->areas[i].count);
+    }
+
+    for(i = 0; i < list->count; ++i) {
+        e = &list->enemies[i];
+        e->map_idx = LE16(e->map_idx);
+        e->base = LE16(e->base);
+        e->rt_index = (int16_t)LE16(((uint16_t)e->rt_index));
+        e->bp_entry = (int16_t)LE16(((uint16_t)e->bp_entry));
+        e->flags = LE16(e->flags);
+        e->area = LE16(e->area);
+    }
+
+    if(!(fp = fopen(fn, "wb"))) {
+        perror("Cannot open index file");
+        return -1;
+    }
+
+    if(fwrite(hdr, 1, sizeof(qei_hdr_t), fp) != sizeof(qei_hdr_t) ||
+       fwrite(list->enemies, sizeof(qei_enemy_t), list->count, fp) !=
+       list->count) {
+        perror("Cannot write index file");
+        fclose(fp);
+        return -1;
+    }
+
+    if(fclose(fp)) {
+        perror("Cannot write index file");
+        return -1;
+    }
+
+    fprintf(out, "Wrote %d enemies to %s\n", (int)list->count, fn);
+    return 0;
+}
+
+static const char *base_name(const char *fn) {
+    const char *base;
+
+    if((base = strrchr(fn, '/')))
+        return base + 1;
+
+    return fn;
+}
+
+/* Where the index for a quest goes. With only one quest, it's just whatever
+   was given on the command line, otherwise that's a directory to put a .qei
+   file named after the quest in. The quest's extension is kept, since a quest
+   is often there as both a .qst and a .dat. */
+static char *index_path(const char *fn) {
+    const char *base;
+    char *rv;
+
+    if(file_count == 1)
+        return strdup(index_fn);
+
+    base = base_name(fn);
+
+    if(!(rv = (char *)malloc(strlen(index_fn) + strlen(base) + 6)))
+        return NULL;
+
+    sprintf(rv, "%s/%s.qei", index_fn, base);
+    return rv;
+}
+
+static int base_cmp(const void *a, const void *b) {
+    return strcmp(base_name(*(char * const *)a), base_name(*(char * const *)b));
+}
+
+/* Make sure that no two quests would have their indexes written to the same
+   file (which they would if they have the same name in different directories),
+   since they could be scanned at the same time. */
+static int check_index_paths(void) {
+    char **sorted;
+    int i, rv = 0;
+
+    if(!(sorted = (char **)malloc(sizeof(char *) * file_count))) {
+        perror("malloc");
+        return -1;
+    }
+
+    memcpy(sorted, files, sizeof(char *) * file_count);
+    qsort(sorted, file_count, sizeof(char *), &base_cmp);
+
+    for(i = 1; i < file_count; ++i) {
+        if(!base_cmp(&sorted[i - 1], &sorted[i])) {
+            printf("%s and %s would both be indexed to %s/%s.qei\n",
+                   sorted[i - 1], sorted[i], index_fn, base_name(sorted[i]));
+            rv = -1;
+        }
+    }
+
+    free(sorted);
+    return rv;
+}
+
+/* Parse one quest, writing the report on it to out. */
+static int scan_quest(quest_reader_t *r, const char *fn, FILE *out) {
+    uint8_t *dat;
     uint32_t sz, ocnt, area;
-    int alt, idx = 0, i, type = 0;
+    int alt, idx = 0, i, rv = 0;
     const quest_dat_hdr_t *ptrs[2][18] = { { 0 } };
     const quest_dat_hdr_t *hdr;
+    qei_list_t list = { NULL, 0, 0 };
+    qei_hdr_t ihdr;
+    char *ifn;
 
-    /* Parse the command line... */
-    parse_command_line(argc, argv);
-
-    /* See if we got a .qst file a .dat file. */
-    type = is_qst(filename, version);
+    if(file_count > 1)
+        fprintf(out, "Quest: %s\n", fn);
 
-    if(type == 1) {
-        dat = read_qst(filename, &sz, version);
-    }
-    else if(!type) {
-        dat = read_dat(filename, &sz, compressed);
+    if(!(dat = read_quest(r, fn, &sz, version, compressed))) {
+        fprintf(out, "Confused by earlier errors, bailing out.\n");
+        return -1;
     }
 
-    if(!dat) {
-        printf("Confused by earlier errors, bailing out.\n");
+    if(parse_quest_objects(dat, sz, &ocnt, ptrs)) {
+        fprintf(out, "Quest data appears to be corrupted!\n");
         return -1;
     }
 
-    parse_quest_objects(dat, sz, &ocnt, ptrs);
-    printf("Found %d objects\n", (int)ocnt);
+    if(!index_fn)
+        fprintf(out, "Found %d objects\n", (int)ocnt);
+
+    memset(&ihdr, 0, sizeof(ihdr));
 
     for(i = 0; i < 18; ++i) {
         if((hdr = ptrs[1][i])) {
@@ -164,13 +411,123 @@ int main(int argc, char *argv[]) {
             if((episode == 3 && area > 5) || (episode == 2 && area > 15))
                 alt = 1;
 
+            ihdr.areas[i].first = list.count;
+
             if(parse_map((map_enemy_t *)(hdr->data), sz / sizeof(map_enemy_t),
-                         episode, alt, &idx, (int)area)) {
-                printf("Cannot parse map!\n");
+                         episode, alt, &idx, (int)area,
+                         index_fn ? &list : NULL, out)) {
+                fprintf(out, "Cannot parse map!\n");
+                free(list.enemies);
                 return -4;
             }
+
+            ihdr.areas[i].count = list.count - ihdr.areas[i].first;
+        }
+    }
+
+    if(index_fn) {
+        if(!(ifn = index_path(fn))) {
+            perror("malloc");
+            rv = -5;
+        }
+        else {
+            if(write_index(ifn, &list, &ihdr, out))
+                rv = -5;
+
+            free(ifn);
+        }
+    }
+
+    free(list.enemies);
+    return rv;
+}
+
+/* Grab quests off of the list until there are none left. Each quest's report
+   is built up in memory and written out all at once, so that the reports from
+   different threads don't get mixed together. */
+static void *scan_thd(void *d) {
+    quest_reader_t r = QUEST_READER_INIT;
+    FILE *out;
+    char *buf;
+    size_t len;
+    int i, rv;
+
+    (void)d;
+
+    while((i = __sync_fetch_and_add(&next_file, 1)) < file_count) {
+        buf = NULL;
+        len = 0;
+
+        if(!(out = open_memstream(&buf, &len))) {
+            perror("open_memstream");
+            __sync_fetch_and_add(&failed, 1);
+            continue;
+        }
+
+        rv = scan_quest(&r, files[i], out);
+        fclose(out);
+
+        flockfile(stdout);
+        fwrite(buf, 1, len, stdout);
+        fflush(stdout);
+        funlockfile(stdout);
+        free(buf);
+
+        if(rv)
+            __sync_fetch_and_add(&failed, 1);
+    }
+
+    quest_reader_free(&r);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    pthread_t *thds;
+    int i, err;
+
+    /* Parse the command line... */
+    parse_command_line(argc, argv);
+
+    if(index_fn && file_count > 1 && check_index_paths())
+        return -1;
+
+    if(threads > file_count)
+        threads = file_count;
+
+    if(!(thds = (pthread_t *)malloc(sizeof(pthread_t) * threads))) {
+        perror("malloc");
+        return -1;
+    }
+
+    /* This thread does its share of the work too. */
+    for(i = 1; i < threads; ++i) {
+        if((err = pthread_create(&thds[i], NULL, &scan_thd, NULL))) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            threads = i;
+            break;
         }
     }
 
+    scan_thd(NULL);
+
+    for(i = 1; i < threads; ++i) {
+        pthread_join(thds[i], NULL);
+    }
+
+    free(thds);
+
+    for(i = 0; i < file_count; ++i) {
+        free(files[i]);
+    }
+
+    free(files);
+
+    if(failed) {
+        if(file_count > 1)
+            printf("%d of %d quests failed\n", failed, file_count);
+
+        return -1;
+    }
+
     return 0;
 }
@@ -19,8 +19,11 @@
 #ifndef QUEST_ENEMIES_H
 #define QUEST_ENEMIES_H
 
+#include <stdio.h>
 #include <stdint.h>
 
+#include "../libprs/prs.h"
+
 #define CLIENT_VERSION_DC       0
 #define CLIENT_VERSION_PC       1
 #define CLIENT_VERSION_GC       2
@@ -75,15 +78,99 @@ typedef struct map_object {
     };
 } PACKED map_object_t;
 
+/* Precompiled enemy index, as written out by --index. This is everything that
+   parse_map figures out about the enemies in a quest, so that a server can use
+   it without reading, decompressing or parsing the quest itself.
+
+   The file is a qei_hdr_t, followed immediately by enemy_count qei_enemy_t
+   entries, all in little-endian byte order. Everything is naturally aligned,
+   so the file can be mmap'd and used in place. Entries are in order of their
+   global index (that is, entry n is the enemy with global index n), and the
+   ones for each area are contiguous, as given by the areas table. */
+#define QEI_MAGIC               0x58494551  /* "QEIX" */
+#define QEI_VERSION             1
+#define QEI_AREA_COUNT          18
+
+/* Set on enemies that are clones of the one before them. */
+#define QEI_ENEMY_CLONE         0x0001
+
+typedef struct qei_area {
+    uint32_t first;
+    uint32_t count;
+} PACKED qei_area_t;
+
+typedef struct qei_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t episode;
+    uint32_t enemy_count;
+    qei_area_t areas[QEI_AREA_COUNT];
+} PACKED qei_hdr_t;
+
+typedef struct qei_enemy {
+    uint16_t map_idx;                   /* Index of the entry in the map */
+    uint16_t base;                      /* Enemy type, from the map */
+    int16_t rt_index;                   /* -1 if there isn't one */
+    int16_t bp_entry;                   /* -1 if there isn't one */
+    uint16_t flags;
+    uint16_t area;
+} PACKED qei_enemy_t;
+
 #undef PACKED
 
-/* In quests.c */
-int is_qst(const char *fn, int ver);
-uint8_t *read_dat(const char *fn, uint32_t *osz, int comp);
-uint8_t *read_qst(const char *fn, uint32_t *osz, int ver);
+/* Enemies collected by parse_map when building an index. */
+typedef struct qei_list {
+    qei_enemy_t *enemies;
+    uint32_t count;
+    uint32_t alloc;
+} qei_list_t;
+
+/* What an entry in a map resolves to: count enemies in a row that are all
+   the same (an enemy's clones, for instance). The whole name is name followed
+   by suffix. */
+typedef struct enemy_run {
+    uint16_t map_idx;
+    uint16_t base;
+    uint16_t flags;                     /* QEI_ENEMY_* */
+    int16_t rt_index;
+    int16_t bp_entry;
+    uint32_t count;
+    const char *name;
+    const char *suffix;
+} enemy_run_t;
+
+/* The most runs that one entry in a map can resolve to. */
+#define ENEMY_MAX_RUNS          4
+
+/* Scratch space for reading quests. Each thread reading quests needs its own
+   one of these. */
+typedef struct quest_reader {
+    struct prs_arena arena;             /* The decompressed .dat */
+    uint8_t *scratch;                   /* The .dat pulled out of a .qst */
+    size_t scratch_size;
+} quest_reader_t;
+
+#define QUEST_READER_INIT       { PRS_ARENA_INIT, NULL, 0 }
+
+/* In quests.c. read_quest reads either a .qst or a .dat (which is assumed to
+   be compressed if comp is nonzero), and gives back the decompressed .dat. That
+   lives in the reader's buffers, so it must not be freed, and is only valid
+   until the next call with the same reader. */
+uint8_t *read_quest(quest_reader_t *r, const char *fn, uint32_t *osz, int ver,
+                    int comp);
+void quest_reader_free(quest_reader_t *r);
+
+/* Work out what each of the enemies in an area's map is, without outputting
+   anything. runs must have room for en_ct * ENEMY_MAX_RUNS entries. Returns
+   the number of runs filled in, in order of global index. */
+int classify_map(const map_enemy_t *en, int en_ct, int ep, int alt,
+                 enemy_run_t *runs);
 
-int parse_map(map_enemy_t *en, int en_ct, int ep, int alt, int *idx, int map);
-void parse_quest_objects(const uint8_t *data, uint32_t len, uint32_t *obj_cnt,
-                         const quest_dat_hdr_t *ptrs[2][18]);
+/* Work out the enemies in one area's map. If list is NULL, they're printed
+   out to out, otherwise they are added to it (in host byte order). */
+int parse_map(map_enemy_t *en, int en_ct, int ep, int alt, int *idx, int map,
+              qei_list_t *list, FILE *out);
+int parse_quest_objects(const uint8_t *data, uint32_t len, uint32_t *obj_cnt,
+                        const quest_dat_hdr_t *ptrs[2][18]);
 
 #endif /* !QUEST_ENEMIES_H */
@@ -19,72 +19,120 @@
 /* This file was borrowed from the ship server code (although with much of the
    functionality stripped from it). */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <pthread.h>
 
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <sylverant/debug.h>
-#include <sylverant/prs.h>
 
+#include "../libprs/prs.h"
 #include "packets.h"
 #include "quest_enemies.h"
 
-static uint8_t *decompress_dat(uint8_t *inbuf, uint32_t insz, uint32_t *osz) {
-    uint8_t *rv;
-    int sz;
+void quest_reader_free(quest_reader_t *r) {
+    prs_arena_free(&r->arena);
+    free(r->scratch);
+    r->scratch = NULL;
+    r->scratch_size = 0;
+}
 
-    if((sz = prs_decompress_buf(inbuf, &rv, (size_t)insz)) < 0) {
-        debug(DBG_WARN, "Cannot decompress data: %s\n", strerror(-sz));
-        return NULL;
+/* Make sure the reader's scratch buffer has room for sz bytes. */
+static uint8_t *get_scratch(quest_reader_t *r, size_t sz) {
+    uint8_t *tmp;
+
+    if(sz > r->scratch_size) {
+        if(!(tmp = (uint8_t *)realloc(r->scratch, sz))) {
+            debug(DBG_WARN, "Cannot allocate memory to read quest: %s\n",
+                  strerror(errno));
+            return NULL;
+        }
+
+        r->scratch = tmp;
+        r->scratch_size = sz;
     }
 
-    *osz = (uint32_t)sz;
-    return rv;
+    return r->scratch;
 }
 
-uint8_t *read_dat(const char *fn, uint32_t *osz, int comp) {
-    FILE *fp;
-    off_t sz;
-    uint8_t *buf, *rv;
+/* Map a whole file into memory, read-only. Empty files give back NULL with a
+   size of zero. */
+static int map_file(const char *fn, uint8_t **buf, size_t *sz) {
+    struct stat st;
+    void *rv;
+    int fd;
 
-    /* Read the file in. */
-    if(!(fp = fopen(fn, "rb"))) {
+    if((fd = open(fn, O_RDONLY)) < 0) {
         debug(DBG_WARN, "Cannot open quest file \"%s\": %s\n", fn,
               strerror(errno));
-        return NULL;
+        return -1;
+    }
+
+    if(fstat(fd, &st)) {
+        debug(DBG_WARN, "Cannot stat quest file \"%s\": %s\n", fn,
+              strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    *buf = NULL;
+    *sz = (size_t)st.st_size;
+
+    if(!*sz) {
+        close(fd);
+        return 0;
     }
 
-    fseeko(fp, 0, SEEK_END);
-    sz = ftello(fp);
-    fseeko(fp, 0, SEEK_SET);
+    rv = mmap(NULL, *sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
 
-    if(!(buf = (uint8_t *)malloc(sz))) {
-        debug(DBG_WARN, "Cannot allocate memory to read dat: %s\n",
+    if(rv == MAP_FAILED) {
+        debug(DBG_WARN, "Cannot map quest file \"%s\": %s\n", fn,
               strerror(errno));
-        fclose(fp);
-        return NULL;
+        return -1;
     }
 
-    if(fread(buf, 1, sz, fp) != sz) {
-        debug(DBG_WARN, "Cannot read dat: %s\n", strerror(errno));
-        free(buf);
-        fclose(fp);
+    *buf = (uint8_t *)rv;
+    return 0;
+}
+
+static uint8_t *decompress_dat(quest_reader_t *r, const uint8_t *inbuf,
+                               uint32_t insz, uint32_t *osz) {
+    int sz;
+
+    if((sz = prs_decompress_arena(&r->arena, inbuf, (size_t)insz, 0)) < 0) {
+        debug(DBG_WARN, "Cannot decompress data: %s\n", strerror(-sz));
         return NULL;
     }
 
-    fclose(fp);
+    *osz = (uint32_t)sz;
+    return r->arena.buf;
+}
+
+static uint8_t *read_dat(quest_reader_t *r, const uint8_t *buf, size_t sz,
+                         uint32_t *osz, int comp) {
+    uint8_t *rv;
 
     if(comp) {
         /* Return it decompressed. */
-        rv = decompress_dat(buf, (uint32_t)sz, osz);
-        free(buf);
-        return rv;
+        return decompress_dat(r, buf, (uint32_t)sz, osz);
     }
 
-    return buf;
+    /* The map is going away, so it has to be copied. */
+    if(!(rv = get_scratch(r, sz ? sz : 1)))
+        return NULL;
+
+    memcpy(rv, buf, sz);
+    *osz = (uint32_t)sz;
+    return rv;
 }
 
 static uint32_t qst_dat_size(const uint8_t *buf, int ver) {
@@ -158,7 +206,7 @@ static uint32_t qst_dat_size(const uint8_t *buf, int ver) {
     return 0;
 }
 
-static int copy_dc_qst_dat(const uint8_t *buf, uint8_t *rbuf, off_t sz,
+static int copy_dc_qst_dat(const uint8_t *buf, uint8_t *rbuf, size_t sz,
                            uint32_t dsz) {
     const dc_quest_chunk_pkt *ck;
     uint32_t ptr = 120, optr = 0;
@@ -169,6 +217,12 @@ static int copy_dc_qst_dat(const uint8_t *buf, uint8_t *rbuf, off_t sz,
     while(ptr < sz) {
         ck = (const dc_quest_chunk_pkt *)(buf + ptr);
 
+        /* Don't run off the end of the file. */
+        if(sz - ptr < 0x0418) {
+            debug(DBG_WARN, "Quest file appears to be truncated!\n");
+            return -1;
+        }
+
         /* Check the chunk for validity. */
         if(ck->hdr.dc.pkt_type != QUEST_CHUNK_TYPE ||
            ck->hdr.dc.pkt_len != LE16(0x0418)) {
@@ -210,7 +264,7 @@ static int copy_dc_qst_dat(const uint8_t *buf, uint8_t *rbuf, off_t sz,
     return 0;
 }
 
-static int copy_pc_qst_dat(const uint8_t *buf, uint8_t *rbuf, off_t sz,
+static int copy_pc_qst_dat(const uint8_t *buf, uint8_t *rbuf, size_t sz,
                            uint32_t dsz) {
     const dc_quest_chunk_pkt *ck;
     uint32_t ptr = 120, optr = 0;
@@ -221,6 +275,12 @@ static int copy_pc_qst_dat(const uint8_t *buf, uint8_t *rbuf, off_t sz,
     while(ptr < sz) {
         ck = (const dc_quest_chunk_pkt *)(buf + ptr);
 
+        /* Don't run off the end of the file. */
+        if(sz - ptr < 0x0418) {
+            debug(DBG_WARN, "Quest file appears to be truncated!\n");
+            return -1;
+        }
+
         /* Check the chunk for validity. */
         if(ck->hdr.pc.pkt_type != QUEST_CHUNK_TYPE ||
            ck->hdr.pc.pkt_len != LE16(0x0418)) {
@@ -262,7 +322,7 @@ static int copy_pc_qst_dat(const uint8_t *buf, uint8_t *rbuf, off_t sz,
     return 0;
 }
 
-static int copy_bb_qst_dat(const uint8_t *buf, uint8_t *rbuf, off_t sz,
+static int copy_bb_qst_dat(const uint8_t *buf, uint8_t *rbuf, size_t sz,
                            uint32_t dsz) {
     const bb_quest_chunk_pkt *ck;
     uint32_t ptr = 176, optr = 0;
@@ -273,6 +333,13 @@ static int copy_bb_qst_dat(const uint8_t *buf, uint8_t *rbuf, off_t sz,
     while(ptr < sz) {
         ck = (const bb_quest_chunk_pkt *)(buf + ptr);
 
+        /* Don't run off the end of the file. The padding after the last
+           chunk isn't always there. */
+        if(sz - ptr < 0x041C) {
+            debug(DBG_WARN, "Quest file appears to be truncated!\n");
+            return -1;
+        }
+
         /* Check the chunk for validity. */
         if(ck->hdr.pkt_type != LE16(QUEST_CHUNK_TYPE) ||
            ck->hdr.pkt_len != LE16(0x041C)) {
@@ -314,786 +381,552 @@ static int copy_bb_qst_dat(const uint8_t *buf, uint8_t *rbuf, off_t sz,
     return 0;
 }
 
-int is_qst(const char *fn, int ver) {
-    FILE *fp;
-    off_t sz;
-    uint8_t *buf, *buf2, *rv;
-    uint32_t dsz;
+static uint8_t *read_qst(quest_reader_t *r, const char *fn,
+                         const uint8_t *buf, size_t sz, uint32_t dsz,
+                         uint32_t *osz, int ver) {
+    uint8_t *buf2;
+    int rv;
 
-    /* Read the file in. */
-    if(!(fp = fopen(fn, "rb"))) {
-        debug(DBG_WARN, "Cannot open quest file \"%s\": %s\n", fn,
-              strerror(errno));
-        return -1;
-    }
+    /* Pull the .dat out of the chunks it is split up into. */
+    if(!(buf2 = get_scratch(r, dsz)))
+        return NULL;
 
-    fseeko(fp, 0, SEEK_END);
-    sz = ftello(fp);
-    fseeko(fp, 0, SEEK_SET);
+    switch(ver) {
+        case CLIENT_VERSION_DC:
+        case CLIENT_VERSION_GC:
+            rv = copy_dc_qst_dat(buf, buf2, sz, dsz);
+            break;
 
-    /* Make sure the file's size is sane. */
-    if(sz < 120) {
-        fclose(fp);
-        return 0;
-    }
+        case CLIENT_VERSION_PC:
+            rv = copy_pc_qst_dat(buf, buf2, sz, dsz);
+            break;
 
-    if(!(buf = (uint8_t *)malloc(sz))) {
-        debug(DBG_WARN, "Cannot allocate memory to read quest: %s\n",
-              strerror(errno));
-        fclose(fp);
-        return -1;
-    }
+        case CLIENT_VERSION_BB:
+            rv = copy_bb_qst_dat(buf, buf2, sz, dsz);
+            break;
 
-    if(fread(buf, 1, sz, fp) != sz) {
-        debug(DBG_WARN, "Cannot read quest file: %s\n", strerror(errno));
-        free(buf);
-        fclose(fp);
-        return -1;
+        default:
+            return NULL;
     }
 
-    fclose(fp);
-
-    /* Figure out how big the .dat portion is. */
-    if(!(dsz = qst_dat_size(buf, ver))) {
-        /* If we don't find it, then it isn't a .qst file. */
-        free(buf);
-        return 0;
+    if(rv) {
+        debug(DBG_WARN, "Error decoding qst \"%s\", see above.\n", fn);
+        return NULL;
     }
 
-    /* We found it, so hopefully we actually have a .qst file. */
-    free(buf);
-    return 1;
+    /* Return the dat decompressed. */
+    return decompress_dat(r, buf2, dsz, osz);
 }
 
-uint8_t *read_qst(const char *fn, uint32_t *osz, int ver) {
-    FILE *fp;
-    off_t sz;
-    uint8_t *buf, *buf2, *rv;
-    uint32_t dsz;
+uint8_t *read_quest(quest_reader_t *r, const char *fn, uint32_t *osz, int ver,
+                    int comp) {
+    uint8_t *buf, *rv;
+    size_t sz;
+    uint32_t dsz = 0;
 
-    /* Read the file in. */
-    if(!(fp = fopen(fn, "rb"))) {
-        debug(DBG_WARN, "Cannot open quest file \"%s\": %s\n", fn,
-              strerror(errno));
+    if(map_file(fn, &buf, &sz))
         return NULL;
-    }
 
-    fseeko(fp, 0, SEEK_END);
-    sz = ftello(fp);
-    fseeko(fp, 0, SEEK_SET);
+    /* See if we got a .qst file or a .dat file. If we can't find the size of
+       the .dat portion, then it isn't a .qst file. */
+    if(sz >= 120)
+        dsz = qst_dat_size(buf, ver);
 
-    /* Make sure the file's size is sane. */
-    if(sz < 120) {
-        debug(DBG_WARN, "Quest file \"%s\" too small\n", fn);
-        fclose(fp);
-        return NULL;
-    }
+    if(dsz)
+        rv = read_qst(r, fn, buf, sz, dsz, osz, ver);
+    else
+        rv = read_dat(r, buf, sz, osz, comp);
 
-    if(!(buf = (uint8_t *)malloc(sz))) {
-        debug(DBG_WARN, "Cannot allocate memory to read qst: %s\n",
-              strerror(errno));
-        fclose(fp);
-        return NULL;
-    }
+    if(buf)
+        munmap(buf, sz);
 
-    if(fread(buf, 1, sz, fp) != sz) {
-        debug(DBG_WARN, "Cannot read qst: %s\n", strerror(errno));
-        free(buf);
-        fclose(fp);
-        return NULL;
-    }
+    return rv;
+}
 
-    fclose(fp);
+/* Enemy classification. Each entry in the map is looked up in enemy_defs by
+   its base type (and the episode and area, for the few enemies that differ
+   between them). The entry says which of up to three variants the enemy is,
+   based on its skin or the "rare" flag, and how many clones follow it. */
+
+#define EP_ANY              0
+
+#define ALT_ANY             0
+#define ALT_NO              1
+#define ALT_YES             2
+
+/* How the variant of an enemy is picked. */
+#define SEL_NONE            0
+#define SEL_SKIN            1       /* skin & 1 */
+#define SEL_SKIN3           2       /* skin % 3 */
+#define SEL_RARE            3       /* reserved[10] & 0x800000 */
+
+/* How many clones an enemy has. */
+#define CLONES_MAP          0       /* However many the map says */
+#define CLONES_FIXED        1       /* Always n_clones */
+#define CLONES_DEFAULT      2       /* n_clones if the map doesn't say */
+
+/* For clone_bp/clone_rt: the clones are the same as the enemy itself. */
+#define SAME                -2
+
+struct enemy_variant {
+    int16_t bp;
+    int16_t rt;
+    const char *name;
+    const char *clone_name;         /* NULL for "<name> (Clone)" */
+};
+
+/* For enemies that are really a set of several different ones. */
+struct enemy_part {
+    uint16_t count;
+    int16_t rt;
+    int16_t bp;
+    const char *name;
+};
+
+struct enemy_def {
+    uint16_t base;
+    uint8_t ep;
+    uint8_t alt;
+    uint8_t sel;
+    uint8_t clones;
+    uint16_t n_clones;
+    int16_t clone_bp;
+    int16_t clone_rt;
+    const struct enemy_part *parts;
+    struct enemy_variant v[3];
+};
+
+static const struct enemy_part pan_arms_parts[] = {
+    { 1, 0x15, 0x31, "Pan Arms" },
+    { 1, 0x16, 0x32, "Migium" },
+    { 1, 0x17, 0x33, "Hidoom" },
+    { 0 }
+};
+
+/* 510 Darvants come first, then all 3 forms of Falz himself. */
+static const struct enemy_part dark_falz_parts[] = {
+    { 510, -1, 0x35, "Darvant" },
+    { 1, 0x2F, 0x38, "Dark Falz (final form)" },
+    { 1, 0x2F, 0x37, "Dark Falz (second form)" },
+    { 1, 0x2F, 0x36, "Dark Falz (first form)" },
+    { 0 }
+};
+
+/* This must be sorted by base. For entries with the same base, the first one
+   that matches the episode and area wins, so the more specific ones go first.
+
+   Episode II and IV enemies (0x00D4 and up) were never finished in the switch
+   statement that this replaced, so they aren't here yet either. */
+static const struct enemy_def enemy_defs[] = {
+    /* Hildebear & Hildeblue */
+    { 0x0040, EP_ANY, ALT_ANY, SEL_SKIN, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x49, 0x01, "Hildebear", NULL },
+        { 0x4A, 0x02, "Hildeblue", NULL } } },
+
+    /* Rappies. Del Rappy & Sand Rappy are in Episode IV. */
+    { 0x0041, 3, ALT_YES, SEL_SKIN, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x17, 0x11, "Del Rappy", NULL },
+        { 0x18, 0x12, "Del Rappy", NULL } } },
+    { 0x0041, 3, ALT_NO, SEL_SKIN, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x05, 0x11, "Sand Rappy", NULL },
+        { 0x06, 0x12, "Sand Rappy", NULL } } },
+    { 0x0041, 1, ALT_ANY, SEL_SKIN, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x18, 0x05, "Rag Rappy", NULL },
+        { 0x19, 0x06, "Al Rappy", NULL } } },
+    /* The Love Rappy's PT/RT index needs to be filled in when we make the
+       lobby, since it's dependent on the event. */
+    { 0x0041, EP_ANY, ALT_ANY, SEL_SKIN, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x18, 0x05, "Rag Rappy", NULL },
+        { 0x19, 51, "Love Rappy", NULL } } },
+
+    /* Monest + 30 Mothmants */
+    { 0x0042, EP_ANY, ALT_ANY, SEL_NONE, CLONES_FIXED, 30, 0x00, 0x03, NULL,
+      { { 0x01, 0x04, "Monest", "Mothmant" } } },
+
+    /* Savage Wolf & Barbarous Wolf */
+    { 0x0043, EP_ANY, ALT_ANY, SEL_RARE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x02, 0x07, "Savage Wolf", NULL },
+        { 0x03, 0x08, "Barbarous Wolf", NULL } } },
+
+    /* Booma family */
+    { 0x0044, EP_ANY, ALT_ANY, SEL_SKIN3, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x4B, 0x09, "Booma", NULL },
+        { 0x4C, 0x0A, "Gobooma", NULL },
+        { 0x4D, 0x0B, "Gigobooma", NULL } } },
+
+    /* Grass Assassin */
+    { 0x0060, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x4E, 0x0C, "Grass Assassin", NULL } } },
+
+    /* Del Lily, Poison Lily, Nar Lily */
+    { 0x0061, 2, ALT_YES, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x25, 0x53, "Del Lily", NULL } } },
+    { 0x0061, EP_ANY, ALT_ANY, SEL_RARE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x04, 0x0D, "Poison Lily", NULL },
+        { 0x05, 0x0E, "Nar Lily", NULL } } },
+
+    /* Nano Dragon */
+    { 0x0062, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x1A, 0x0E, "Nano Dragon", NULL } } },
+
+    /* Shark family */
+    { 0x0063, EP_ANY, ALT_ANY, SEL_SKIN3, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x4F, 0x10, "Evil Shark", NULL },
+        { 0x50, 0x11, "Pal Shark", NULL },
+        { 0x51, 0x12, "Guil Shark", NULL } } },
+
+    /* Slime + 4 clones */
+    { 0x0064, EP_ANY, ALT_ANY, SEL_RARE, CLONES_FIXED, 4, 0x30, 0x13, NULL,
+      { { 0x30, 0x13, "Pofuilly Slime", "Pofuilly Slime (Clone)" },
+        { 0x2F, 0x14, "Pouilly Slime", "Pouilly Slime (Clone)" } } },
+
+    /* Pan Arms, Migium, Hidoom */
+    { 0x0065, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME,
+      pan_arms_parts, { { 0 } } },
+
+    /* Dubchic & Gilchic */
+    { 0x0080, EP_ANY, ALT_ANY, SEL_SKIN, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x1B, 0x18, "Dubchic", NULL },
+        { 0x1C, 0x32, "Gilchic", NULL } } },
+
+    /* Garanz */
+    { 0x0081, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x1D, 0x19, "Garanz", NULL } } },
+
+    /* Sinow Beat & Sinow Gold */
+    { 0x0082, EP_ANY, ALT_ANY, SEL_RARE, CLONES_DEFAULT, 4, SAME, SAME, NULL,
+      { { 0x06, 0x1A, "Sinow Beat", "Sinow Beat (Clone)" },
+        { 0x13, 0x1B, "Sinow Gold", "Sinow Gold (Clone)" } } },
+
+    /* Canadine */
+    { 0x0083, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x07, 0x1C, "Canadine", NULL } } },
+
+    /* Canadine Group */
+    { 0x0084, EP_ANY, ALT_ANY, SEL_NONE, CLONES_FIXED, 8, 0x08, 0x1C, NULL,
+      { { 0x09, 0x1D, "Canane", "Canadine (Grouped)" } } },
+
+    /* Dubwitch */
+    { 0x0085, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { -1, -1, "Dubwitch", NULL } } },
+
+    /* Delsaber */
+    { 0x00A0, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x52, 0x1E, "Delsaber", NULL } } },
+
+    /* Chaos Sorcerer + 2 Bits */
+    { 0x00A1, EP_ANY, ALT_ANY, SEL_NONE, CLONES_FIXED, 2, SAME, SAME, NULL,
+      { { 0x0A, 0x1F, "Chaos Sorcerer", NULL } } },
+
+    /* Dark Gunner */
+    { 0x00A2, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x1E, 0x22, "Dark Gunner", NULL } } },
+
+    /* Death Gunner? */
+    { 0x00A3, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { -1, -1, "Death Gunner", NULL } } },
+
+    /* Chaos Bringer */
+    { 0x00A4, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x0D, 0x24, "Chaos Bringer", NULL } } },
+
+    /* Dark Belra */
+    { 0x00A5, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x0E, 0x25, "Dark Belra", NULL } } },
+
+    /* Dimenian family */
+    { 0x00A6, EP_ANY, ALT_ANY, SEL_SKIN3, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x53, 0x29, "Dimenian", NULL },
+        { 0x54, 0x2A, "La Dimenian", NULL },
+        { 0x55, 0x2B, "So Dimenian", NULL } } },
+
+    /* Bulclaw + 4 Claws */
+    { 0x00A7, EP_ANY, ALT_ANY, SEL_NONE, CLONES_FIXED, 4, 0x20, 0x26, NULL,
+      { { 0x1F, 0x28, "Bulk", "Claw" } } },
+
+    /* Claw */
+    { 0x00A8, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x20, 0x26, "Claw", NULL } } },
+
+    /* Dragon or Gal Gryphon */
+    { 0x00C0, 1, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x12, 0x2C, "Dragon", NULL } } },
+    { 0x00C0, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x1E, 0x4D, "Gal Gryphon", NULL } } },
+
+    /* De Rol Le */
+    { 0x00C1, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x0F, 0x2D, "De Rol Le", NULL } } },
+
+    /* Vol Opt (form 1) */
+    { 0x00C2, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { -1, -1, "Vol Opt (form 1)", NULL } } },
+
+    /* Vol Opt (form 2) */
+    { 0x00C5, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME, NULL,
+      { { 0x25, 0x2E, "Vol Opt (form 2)", NULL } } },
+
+    /* Dark Falz (3 forms) + 510 Darvants */
+    { 0x00C8, EP_ANY, ALT_ANY, SEL_NONE, CLONES_MAP, 0, SAME, SAME,
+      dark_falz_parts, { { 0 } } },
+
+    /* Olga Flow */
+    { 0x00CA, EP_ANY, ALT_ANY, SEL_NONE, CLONES_FIXED, 512, SAME, SAME, NULL,
+      { { 0x2C, 0x4E, "Olga Flow", NULL } } },
+
+    /* Barba Ray */
+    { 0x00CB, EP_ANY, ALT_ANY, SEL_NONE, CLONES_FIXED, 47, SAME, SAME, NULL,
+      { { 0x0F, 0x49, "Barba Ray", NULL } } },
+
+    /* Gol Dragon */
+    { 0x00CC, EP_ANY, ALT_ANY, SEL_NONE, CLONES_FIXED, 5, SAME, SAME, NULL,
+      { { 0x12, 0x4C, "Gol Dragon", NULL } } }
+};
+
+#define ENEMY_DEF_COUNT (sizeof(enemy_defs) / sizeof(enemy_defs[0]))
+#define ENEMY_BASE_MAX      0x00FF
+
+static const struct enemy_variant npc_variant = { -1, -1, "NPC", NULL };
+static const struct enemy_variant unknown_variant = { -1, -1, "Unknown", NULL };
+
+/* Where the entries for each base start in enemy_defs, plus one (so that zero
+   means that there aren't any). This is filled in the first time that it is
+   needed, by whichever thread gets there first. */
+static uint8_t enemy_first[ENEMY_BASE_MAX + 1];
+static pthread_once_t enemy_first_once = PTHREAD_ONCE_INIT;
+
+static void init_enemy_first(void) {
+    size_t i;
 
-    /* Figure out how big the .dat portion is. */
-    if(!(dsz = qst_dat_size(buf, ver))) {
-        debug(DBG_WARN, "Cannot find dat size in qst \"%s\"\n", fn);
-        free(buf);
-        return NULL;
+    for(i = ENEMY_DEF_COUNT; i > 0; --i) {
+        enemy_first[enemy_defs[i - 1].base] = (uint8_t)i;
     }
+}
 
-    /* Allocate space for it. */
-    if(!(buf2 = (uint8_t *)malloc(dsz))) {
-        debug(DBG_WARN, "Cannot allocate memory to decode qst: %s\n",
-              strerror(errno));
-        free(buf);
+static const struct enemy_def *find_enemy_def(uint16_t base, int ep, int alt) {
+    const struct enemy_def *d;
+
+    if(base > ENEMY_BASE_MAX || !enemy_first[base])
         return NULL;
+
+    /* Find the first one of the entries for this base that matches. */
+    for(d = enemy_defs + enemy_first[base] - 1;
+        d < enemy_defs + ENEMY_DEF_COUNT && d->base == base; ++d) {
+        if((d->ep == EP_ANY || d->ep == ep) &&
+           (d->alt == ALT_ANY || (d->alt == ALT_YES) == !!alt))
+            return d;
     }
 
-    switch(ver) {
-        case CLIENT_VERSION_DC:
-        case CLIENT_VERSION_GC:
-            if(copy_dc_qst_dat(buf, buf2, sz, dsz)) {
-                debug(DBG_WARN, "Error decoding qst \"%s\", see above.\n", fn);
-                free(buf2);
-                free(buf);
-                return NULL;
-            }
+    return NULL;
+}
 
-            break;
+static enemy_run_t *add_run(enemy_run_t *r, int i, uint16_t base,
+                            uint32_t count, int rt, int bp, const char *name,
+                            const char *suffix, uint16_t flags) {
+    r->map_idx = (uint16_t)i;
+    r->base = base;
+    r->flags = flags;
+    r->rt_index = (int16_t)rt;
+    r->bp_entry = (int16_t)bp;
+    r->count = count;
+    r->name = name;
+    r->suffix = suffix;
+    return r + 1;
+}
 
-        case CLIENT_VERSION_PC:
-            if(copy_pc_qst_dat(buf, buf2, sz, dsz)) {
-                debug(DBG_WARN, "Error decoding qst \"%s\", see above.\n", fn);
-                free(buf2);
-                free(buf);
-                return NULL;
-            }
+int classify_map(const map_enemy_t *en, int en_ct, int ep, int alt,
+                 enemy_run_t *runs) {
+    const struct enemy_def *d;
+    const struct enemy_variant *v;
+    const struct enemy_part *p;
+    enemy_run_t *r = runs;
+    uint32_t n_clones;
+    uint16_t base;
+    int i, acc;
 
-            break;
+    pthread_once(&enemy_first_once, &init_enemy_first);
 
-        case CLIENT_VERSION_BB:
-            if(copy_bb_qst_dat(buf, buf2, sz, dsz)) {
-                debug(DBG_WARN, "Error decoding qst \"%s\", see above.\n", fn);
-                free(buf2);
-                free(buf);
-                return NULL;
-            }
+    for(i = 0; i < en_ct; ++i) {
+        base = (uint16_t)(en[i].base & 0xFFFF);
+        n_clones = en[i].num_clones;
 
-            break;
+        if((d = find_enemy_def(base, ep, alt))) {
+            if(d->parts) {
+                for(p = d->parts; p->count; ++p) {
+                    r = add_run(r, i, base, p->count, p->rt, p->bp, p->name,
+                                "", 0);
+                }
 
-        default:
-            free(buf2);
-            free(buf);
-            return NULL;
-    }
+                continue;
+            }
 
-    /* We're done with the first buffer, so clean it up. */
-    free(buf);
+            switch(d->sel) {
+                case SEL_SKIN:
+                    acc = en[i].skin & 0x01;
+                    break;
 
-    /* Return the dat decompressed. */
-    rv = decompress_dat(buf2, (uint32_t)dsz, osz);
-    free(buf2);
-    return rv;
-}
+                case SEL_SKIN3:
+                    acc = en[i].skin % 3;
+                    break;
 
-static const char *booma_names[3] = { "Booma", "Gobooma", "Gigobooma" };
-static const char *shark_names[3] = { "Evil Shark", "Pal Shark", "Guil Shark" };
-static const char *dimenian_names[3] = { "Dimenian", "La Dimenian",
-                                         "So Dimenian" };
+                case SEL_RARE:
+                    acc = (en[i].reserved[10] & 0x800000) ? 1 : 0;
+                    break;
 
-int parse_map(map_enemy_t *en, int en_ct, int ep, int alt, int *idx, int map) {
-    int i, j, k = *idx;
-    void *tmp;
-    uint32_t count = 0;
-    uint16_t n_clones;
-    int acc, rt, bp, rtc = -1, bpc = -1;
-    const char *name, *namec;
+                default:
+                    acc = 0;
+            }
 
-    printf("Enemies on Map %d\n", map);
-    printf("Map Idx. | Global Idx. | PT/RT Idx. | BP Entry | Name\n");
+            v = &d->v[acc];
 
-    /* Parse each enemy. */
-    for(i = 0; i < en_ct; ++i, ++k) {
-        n_clones = en[i].num_clones;
+            if(d->clones == CLONES_FIXED ||
+               (d->clones == CLONES_DEFAULT && !n_clones))
+                n_clones = d->n_clones;
+        }
+        else if(base < 0x40) {
+            d = NULL;
+            v = &npc_variant;
+        }
+        else {
+            v = &unknown_variant;
+            debug(DBG_WARN, "Unknown enemy ID: %04X\n", en[i].base);
+            debug(DBG_WARN, "Everything after this point may be "
+                  "completely wrong.\n");
+        }
 
-        switch(en[i].base & 0xFFFF) {
-            case 0x0040:    /* Hildebear & Hildeblue */
-                acc = en[i].skin & 0x01;
-                bp = 0x49 + acc;
-                rt = 0x01 + acc;
-
-                if(acc)
-                    name = "Hildeblue";
-                else
-                    name = "Hildebear";
-                break;
-
-            case 0x0041:    /* Rappies */
-                acc = en[i].skin & 0x01;
-                if(ep == 3) {   /* Del Rappy & Sand Rappy */
-                    if(alt) {
-                        bp = 0x17 + acc;
-                        rt = 0x11 + acc;
-                        name = "Del Rappy";
-                    }
-                    else {
-                        bp = 0x05 + acc;
-                        rt = 0x11 + acc;
-                        name = "Sand Rappy";
-                    }
-                }
-                else {
-                    if(acc) {
-                        bp = 0x19;
-
-                        if(ep == 1) {
-                            rt = 0x06;
-                            name = "Al Rappy";
-                        }
-                        else {
-                            /* We need to fill this in when we make the lobby,
-                               since it's dependent on the event. */
-                            rt = 51;
-                            name = "Love Rappy";
-                        }
-                    }
-                    else {
-                        bp = 0x18;
-                        rt = 0x05;
-                        name = "Rag Rappy";
-                    }
-                }
-                break;
-
-            case 0x0042:    /* Monest + 30 Mothmants */
-                bp = 0x01;
-                rt = 0x04;
-                name = "Monest";
-
-                n_clones = 30;
-                bpc = 0x00;
-                rtc = 0x03;
-                namec = "Mothmant";
-                break;
-
-            case 0x0043:    /* Savage Wolf & Barbarous Wolf */
-                acc = (en[i].reserved[10] & 0x800000) ? 1 : 0;
-                bp = 0x02 + acc;
-                rt = 0x07 + acc;
-
-                if(acc)
-                    name = "Barbarous Wolf";
-                else
-                    name = "Savage Wolf";
-                break;
-
-            case 0x0044:    /* Booma family */
-                acc = en[i].skin % 3;
-                bp = 0x4B + acc;
-                rt = 0x09 + acc;
-                name = booma_names[acc];
-                break;
-
-            case 0x0060:    /* Grass Assassin */
-                bp = 0x4E;
-                rt = 0x0C;
-                name = "Grass Assassin";
-                break;
-
-            case 0x0061:    /* Del Lily, Poison Lily, Nar Lily */
-                if(ep == 2 && alt) {
-                    bp = 0x25;
-                    rt = 0x53;
-                    name = "Del Lily";
-                }
-                else {
-                    acc = (en[i].reserved[10] & 0x800000) ? 1 : 0;
-                    bp = 0x04 + acc;
-                    rt = 0x0D + acc;
+        r = add_run(r, i, base, 1, v->rt, v->bp, v->name, "", 0);
 
-                    if(acc)
-                        name = "Nar Lily";
-                    else
-                        name = "Poison Lily";
-                }
-                break;
-
-            case 0x0062:    /* Nano Dragon */
-                bp = 0x1A;
-                rt = 0x0E;
-                name = "Nano Dragon";
-                break;
-
-            case 0x0063:    /* Shark Family */
-                acc = en[i].skin % 3;
-                bp = 0x4F + acc;
-                rt = 0x10 + acc;
-                name = shark_names[acc];
-                break;
-
-            case 0x0064:    /* Slime + 4 clones */
-                acc = (en[i].reserved[10] & 0x800000) ? 1 : 0;
-                bp = 0x30 - acc;
-                rt = 0x13 + acc;
-
-                if(acc) {
-                    name = "Pouilly Slime";
-                    namec = "Pouilly Slime (Clone)";
-                }
-                else {
-                    name = "Pofuilly Slime";
-                    namec = "Pofuilly Slime (Clone)";
-                }
+        if(!n_clones)
+            continue;
 
-                n_clones = 4;
-                bpc = 0x30;
-                rtc = 0x13;
-                break;
-
-            case 0x0065:    /* Pan Arms, Migium, Hidoom */
-                printf("%-8d   %-11d   %-10d   %-8d   %s\n", i, k++, 0x15, 0x31,
-                       "Pan Arms");
-                printf("%-8d   %-11d   %-10d   %-8d   %s\n", i, k++, 0x16, 0x32,
-                       "Migium");
-                printf("%-8d   %-11d   %-10d   %-8d   %s\n", i, k, 0x17, 0x33,
-                       "Hidoom");
-                continue;
+        if(d && d->clone_bp != SAME)
+            r = add_run(r, i, base, n_clones, d->clone_rt, d->clone_bp,
+                        v->clone_name, "", QEI_ENEMY_CLONE);
+        else if(v->clone_name)
+            r = add_run(r, i, base, n_clones, v->rt, v->bp, v->clone_name,
+                        "", QEI_ENEMY_CLONE);
+        else
+            r = add_run(r, i, base, n_clones, v->rt, v->bp, v->name,
+                        " (Clone)", QEI_ENEMY_CLONE);
+    }
 
-            case 0x0080:    /* Dubchic & Gilchic */
-                acc = en[i].skin & 0x01;
-                bp = 0x1B + acc;
-                rt = (0x18 + acc) << acc;
-
-                if(acc)
-                    name = "Gilchic";
-                else
-                    name = "Dubchic";
-                break;
-
-            case 0x0081:    /* Garanz */
-                bp = 0x1D;
-                rt = 0x19;
-                name = "Garanz";
-                break;
-
-            case 0x0082:    /* Sinow Beat & Sinow Gold */
-                acc = (en[i].reserved[10] & 0x800000) ? 1 : 0;
-                if(acc) {
-                    bp = 0x13;
-                    rt = 0x1B;
-                    name = "Sinow Gold";
-                }
-                else {
-                    bp = 0x06;
-                    rt = 0x1A;
-                    name = "Sinow Beat";
-                }
+    return (int)(r - runs);
+}
 
-                if(!n_clones)
-                    n_clones = 4;
-
-                bpc = bp;
-                rtc = rt;
-
-                if(acc)
-                    namec = "Sinow Gold (Clone)";
-                else
-                    namec = "Sinow Beat (Clone)";
-                break;
-
-            case 0x0083:    /* Canadine */
-                bp = 0x07;
-                rt = 0x1C;
-                name = "Canadine";
-                break;
-
-            case 0x0084:    /* Canadine Group */
-                bp = 0x09;
-                rt = 0x1D;
-                name = "Canane";
-
-                n_clones = 8;
-                bpc = 0x08;
-                rtc = 0x1C;
-                namec = "Canadine (Grouped)";
-                break;
-
-            case 0x0085:    /* Dubwitch */
-                bp = -1;
-                rt = -1;
-                name = "Dubwitch";
-                break;
-
-            case 0x00A0:    /* Delsaber */
-                bp = 0x52;
-                rt = 0x1E;
-                name = "Delsaber";
-                break;
-
-            case 0x00A1:    /* Chaos Sorcerer + 2 Bits */
-                bp = 0x0A;
-                rt = 0x1F;
-                name = "Chaos Sorcerer";
-
-                n_clones = 2;
-                namec = "Bee";
-                bpc = -1;
-                rtc = -1;
-                break;
-
-            case 0x00A2:    /* Dark Gunner */
-                bp = 0x1E;
-                rt = 0x22;
-                name = "Dark Gunner";
-                break;
-
-            case 0x00A3:    /* Death Gunner? */
-                bp = -1;
-                rt = -1;
-                name = "Death Gunner";
-                break;
-
-            case 0x00A4:    /* Chaos Bringer */
-                bp = 0x0D;
-                rt = 0x24;
-                name = "Chaos Bringer";
-                break;
-
-            case 0x00A5:    /* Dark Belra */
-                bp = 0x0E;
-                rt = 0x25;
-                name = "Dark Belra";
-                break;
-
-            case 0x00A6:    /* Dimenian Family */
-                acc = en[i].skin % 3;
-                bp = 0x53 + acc;
-                rt = 0x29 + acc;
-                name = dimenian_names[acc];
-                break;
-
-            case 0x00A7:    /* Bulclaw + 4 Claws */
-                bp = 0x1F;
-                rt = 0x28;
-                name = "Bulk";
-
-                n_clones = 4;
-                bpc = 0x20;
-                rtc = 0x26;
-                namec = "Claw";
-                break;
-
-            case 0x00A8:    /* Claw */
-                bp = 0x20;
-                rt = 0x26;
-                name = "Claw";
-                break;
-
-            case 0x00C0:    /* Dragon or Gal Gryphon */
-                if(ep == 1) {
-                    bp = 0x12;
-                    rt = 0x2C;
-                    name = "Dragon";
-                }
-                else {
-                    bp = 0x1E;
-                    rt = 0x4D;
-                    name = "Gal Gryphon";
-                }
-                break;
-
-            case 0x00C1:    /* De Rol Le */
-                bp = 0x0F;
-                rt = 0x2D;
-                name = "De Rol Le";
-                break;
-
-            case 0x00C2:    /* Vol Opt (form 1) */
-                bp = -1;
-                rt = -1;
-                name = "Vol Opt (form 1)";
-                break;
-
-            case 0x00C5:    /* Vol Opt (form 2) */
-                bp = 0x25;
-                rt = 0x2E;
-                name = "Vol Opt (form 2)";
-                break;
-
-            case 0x00C8:    /* Dark Falz (3 forms) + 510 Darvants */
-                /* 510 Darvants come first. */
-                for(j = 0; j < 510; ++j) {
-                    printf("%-8d   %-11d   %-10d   %-8d   %s\n", i, k++, -1,
-                           0x35, "Darvant");
-                }
+/* Output one enemy: either print it out to out, or add it to the index being
+   built (if there is one). */
+static int add_enemy(qei_list_t *list, FILE *out, const enemy_run_t *r,
+                     int k, int map) {
+    qei_enemy_t *tmp, *e;
 
-                /* Deal with all 3 forms of Falz himself. */
-                printf("%-8d   %-11d   %-10d   %-8d   %s\n", i, k++, 0x2F, 0x38,
-                       "Dark Falz (final form)");
-                printf("%-8d   %-11d   %-10d   %-8d   %s\n", i, k++, 0x2F, 0x37,
-                       "Dark Falz (second form)");
-                printf("%-8d   %-11d   %-10d   %-8d   %s\n", i, k, 0x2F, 0x36,
-                       "Dark Falz (first form)");
-                continue;
+    if(!list) {
+        fprintf(out, "%-8d   %-11d   %-10d   %-8d   %s%s\n", r->map_idx, k,
+                r->rt_index, r->bp_entry, r->name, r->suffix);
+        return 0;
+    }
 
-            case 0x00CA:    /* Olga Flow */
-                bp = 0x2C;
-                rt = 0x4E;
-                name = "Olga Flow";
-
-                n_clones = 512;
-                bpc = -1;
-                rtc = -1;
-                namec = "Olga Flow (Clone)";
-                break;
-
-            case 0x00CB:    /* Barba Ray */
-                bp = 0x0F;
-                rt = 0x49;
-                name = "Barba Ray";
-
-                n_clones = 47;
-                bpc = -1;
-                rtc = -1;
-                namec = "Barba Ray (Clone)";
-                break;
-
-            case 0x00CC:    /* Gol Dragon */
-                bp = 0x12;
-                rt = 0x4C;
-                name = "Gol Dragon";
-
-                n_clones = 5;
-                bpc = -1;
-                rtc = -1;
-                namec = "Gol Dragon (Clone)";
-                break;
-
-#if 0
-            case 0x00D4:    /* Sinow Berill & Spigell */
-                /* XXXX: How to do rare? Tethealla looks at skin, Newserv at the
-                   reserved[10] value... */
-                acc = en[i].skin >= 0x01 ? 1 : 0;
-                if(acc) {
-                    gen[count].bp_entry = 0x13;
-                    gen[count].rt_index = 0x3F;
-                }
-                else {
-                    gen[count].bp_entry = 0x06;
-                    gen[count].rt_index = 0x3E;
-                }
+    if(list->count == list->alloc) {
+        if(!(tmp = (qei_enemy_t *)realloc(list->enemies, (list->alloc + 256) *
+                                          sizeof(qei_enemy_t)))) {
+            debug(DBG_WARN, "Cannot allocate memory: %s\n", strerror(errno));
+            return -1;
+        }
 
-                count += 4; /* Add 4 clones which are never used... */
-                break;
-
-            case 0x00D5:    /* Merillia & Meriltas */
-                acc = en[i].skin & 0x01;
-                gen[count].bp_entry = 0x4B + acc;
-                gen[count].rt_index = 0x34 + acc;
-                break;
-
-            case 0x00D6:    /* Mericus, Merikle, or Mericarol */
-                acc = en[i].skin % 3;
-                if(acc)
-                    gen[count].bp_entry = 0x44 + acc;
-                else
-                    gen[count].bp_entry = 0x3A;
-
-                gen[count].rt_index = 0x38 + acc;
-                break;
-
-            case 0x00D7:    /* Ul Gibbon & Zol Gibbon */
-                acc = en[i].skin & 0x01;
-                gen[count].bp_entry = 0x3B + acc;
-                gen[count].rt_index = 0x3B + acc;
-                break;
-
-            case 0x00D8:    /* Gibbles */
-                gen[count].bp_entry = 0x3D;
-                gen[count].rt_index = 0x3D;
-                break;
-
-            case 0x00D9:    /* Gee */
-                gen[count].bp_entry = 0x07;
-                gen[count].rt_index = 0x36;
-                break;
-
-            case 0x00DA:    /* Gi Gue */
-                gen[count].bp_entry = 0x1A;
-                gen[count].rt_index = 0x37;
-                break;
-
-            case 0x00DB:    /* Deldepth */
-                gen[count].bp_entry = 0x30;
-                gen[count].rt_index = 0x47;
-                break;
-
-            case 0x00DC:    /* Delbiter */
-                gen[count].bp_entry = 0x0D;
-                gen[count].rt_index = 0x48;
-                break;
-
-            case 0x00DD:    /* Dolmolm & Dolmdarl */
-                acc = en[i].skin & 0x01;
-                gen[count].bp_entry = 0x4F + acc;
-                gen[count].rt_index = 0x40 + acc;
-                break;
-
-            case 0x00DE:    /* Morfos */
-                gen[count].bp_entry = 0x41;
-                gen[count].rt_index = 0x42;
-                break;
-
-            case 0x00DF:    /* Recobox & Recons */
-                gen[count].bp_entry = 0x41;
-                gen[count].rt_index = 0x43;
-
-                for(j = 1; j <= n_clones; ++j) {
-                    gen[++count].bp_entry = 0x42;
-                    gen[count].rt_index = 0x44;
-                }
+        list->enemies = tmp;
+        list->alloc += 256;
+    }
 
-                /* Don't double count them. */
-                n_clones = 0;
-                break;
+    e = &list->enemies[list->count++];
+    e->map_idx = r->map_idx;
+    e->base = r->base;
+    e->rt_index = r->rt_index;
+    e->bp_entry = r->bp_entry;
+    e->flags = r->flags;
+    e->area = (uint16_t)map;
+    return 0;
+}
 
-            case 0x00E0:    /* Epsilon, Sinow Zoa & Zele */
-                if(ep == 2 && alt) {
-                    gen[count].bp_entry = 0x23;
-                    gen[count].rt_index = 0x54;
-                    count += 4;
-                }
-                else {
-                    acc = en[i].skin & 0x01;
-                    gen[count].bp_entry = 0x43 + acc;
-                    gen[count].rt_index = 0x45 + acc;
-                }
-                break;
-
-            case 0x00E1:    /* Ill Gill */
-                gen[count].bp_entry = 0x26;
-                gen[count].rt_index = 0x52;
-                break;
-
-            case 0x0110:    /* Astark */
-                gen[count].bp_entry = 0x09;
-                gen[count].rt_index = 0x01;
-                break;
-
-            case 0x0111:    /* Satellite Lizard & Yowie */
-                acc = (en[i].reserved[10] & 0x800000) ? 1 : 0;
-                if(alt)
-                    gen[count].bp_entry = 0x0D + acc + 0x10;
-                else
-                    gen[count].bp_entry = 0x0D + acc;
-
-                gen[count].rt_index = 0x02 + acc;
-                break;
-
-            case 0x0112:    /* Merissa A/AA */
-                acc = en[i].skin & 0x01;
-                gen[count].bp_entry = 0x19 + acc;
-                gen[count].rt_index = 0x04 + acc;
-                break;
-
-            case 0x0113:    /* Girtablulu */
-                gen[count].bp_entry = 0x1F;
-                gen[count].rt_index = 0x06;
-                break;
-
-            case 0x0114:    /* Zu & Pazuzu */
-                acc = en[i].skin & 0x01;
-                if(alt)
-                    gen[count].bp_entry = 0x07 + acc + 0x14;
-                else
-                    gen[count].bp_entry = 0x07 + acc;
-
-                gen[count].rt_index = 7 + acc;
-                break;
-
-            case 0x0115:    /* Boota Family */
-                acc = en[i].skin % 3;
-                gen[count].rt_index = 0x09 + acc;
-                if(en[i].skin & 0x02)
-                    gen[count].bp_entry = 0x03;
-                else
-                    gen[count].bp_entry = 0x00 + acc;
-                break;
-
-            case 0x0116:    /* Dorphon & Eclair */
-                acc = en[i].skin & 0x01;
-                gen[count].bp_entry = 0x0F + acc;
-                gen[count].rt_index = 0x0C + acc;
-                break;
-
-            case 0x0117:    /* Goran Family */
-                acc = en[i].skin % 3;
-                gen[count].bp_entry = 0x11 + acc;
-                if(en[i].skin & 0x02)
-                    gen[count].rt_index = 0x0F;
-                else if(en[i].skin & 0x01)
-                    gen[count].rt_index = 0x10;
-                else
-                    gen[count].rt_index = 0x0E;
-                break;
-
-            case 0x119: /* Saint Million, Shambertin, & Kondrieu */
-                acc = en[i].skin & 0x01;
-                gen[count].bp_entry = 0x22;
-                if(en[i].reserved[10] & 0x800000)
-                    gen[count].rt_index = 0x15;
-                else
-                    gen[count].rt_index = 0x13 + acc;
-                break;
-#endif
-
-            default:
-                if((en[i].base & 0xFFFF) < 0x40) {
-                    rt = -1;
-                    bp = -1;
-                    name = "NPC";
-                }
-                else {
-                    debug(DBG_WARN, "Unknown enemy ID: %04X\n", en[i].base);
-                    debug(DBG_WARN, "Everything after this point may be "
-                          "completely wrong.\n");
-                }
-        }
+/* How many map entries get classified at a time by parse_map. */
+#define CLASSIFY_BATCH      64
 
-        printf("%-8d   %-11d   %-10d   %-8d   %s\n", i, k, rt, bp, name);
+int parse_map(map_enemy_t *en, int en_ct, int ep, int alt, int *idx, int map,
+              qei_list_t *list, FILE *out) {
+    enemy_run_t runs[CLASSIFY_BATCH * ENEMY_MAX_RUNS];
+    int i, n, nruns, first, k = *idx;
+    uint32_t j;
 
-        /* Increment the counter, as needed */
-        if(n_clones) {
-            if(bpc == -1) {
-                rtc = rt;
-                bpc = bp;
-                namec = NULL;
-            }
+    if(!list) {
+        fprintf(out, "Enemies on Map %d\n", map);
+        fprintf(out, "Map Idx. | Global Idx. | PT/RT Idx. | BP Entry | "
+                "Name\n");
+    }
 
-            ++k;
+    for(first = 0; first < en_ct; first += n) {
+        n = en_ct - first > CLASSIFY_BATCH ? CLASSIFY_BATCH : en_ct - first;
+        nruns = classify_map(en + first, n, ep, alt, runs);
 
-            for(j = 0; j < n_clones; ++j, ++k) {
-                if(namec)
-                    printf("%-8d   %-11d   %-10d   %-8d   %s\n", i, k, rtc, bpc,
-                           namec);
-                else
-                    printf("%-8d   %-11d   %-10d   %-8d   %s (Clone)\n", i, k,
-                           rtc, bpc, name);
-            }
+        for(i = 0; i < nruns; ++i) {
+            /* Map indices are relative to the start of the batch. */
+            runs[i].map_idx += (uint16_t)first;
 
-            --k;
+            for(j = 0; j < runs[i].count; ++j, ++k) {
+                if(add_enemy(list, out, &runs[i], k, map))
+                    return -1;
+            }
         }
     }
 
     *idx = k;
-    printf("\n\n");
+
+    if(!list)
+        fprintf(out, "\n\n");
 
     return 0;
 }
 
-void parse_quest_objects(const uint8_t *data, uint32_t len, uint32_t *obj_cnt,
-                         const quest_dat_hdr_t *ptrs[2][18]) {
-    const quest_dat_hdr_t *hdr = (const quest_dat_hdr_t *)data;
-    uint32_t ptr = 0;
+int parse_quest_objects(const uint8_t *data, uint32_t len, uint32_t *obj_cnt,
+                        const quest_dat_hdr_t *ptrs[2][18]) {
+    const quest_dat_hdr_t *hdr;
+    uint32_t ptr = 0, next, area, type;
     uint32_t obj_count = 0;
 
-    while(ptr < len) {
-        switch(LE32(hdr->obj_type)) {
-            case 0x01:                      /* Objects */
-                ptrs[0][LE32(hdr->area)] = hdr;
-                obj_count += LE32(hdr->size) / sizeof(map_object_t);
-                ptr += hdr->next_hdr;
-                hdr = (const quest_dat_hdr_t *)(data + ptr);
-                break;
-
-            case 0x02:                      /* Enemies */
-                ptrs[1][LE32(hdr->area)] = hdr;
-                ptr += hdr->next_hdr;
-                hdr = (const quest_dat_hdr_t *)(data + ptr);
-                break;
-
-            case 0x03:                      /* ??? - Skip */
-                ptr += hdr->next_hdr;
-                hdr = (const quest_dat_hdr_t *)(data + ptr);
-                break;
-
-            default:
-                /* Padding at the end of the file... */
-                ptr = len;
-                break;
+    while(len - ptr >= sizeof(quest_dat_hdr_t)) {
+        hdr = (const quest_dat_hdr_t *)(data + ptr);
+        type = LE32(hdr->obj_type);
+
+        /* Anything else is padding at the end of the file... */
+        if(type < 0x01 || type > 0x03)
+            break;
+
+        next = LE32(hdr->next_hdr);
+        area = LE32(hdr->area);
+
+        /* Make sure the section is all there, and that the next one is after
+           it, so that we don't go off the end or around in circles. */
+        if(next < sizeof(quest_dat_hdr_t) || next > len - ptr ||
+           LE32(hdr->size) > next - sizeof(quest_dat_hdr_t)) {
+            debug(DBG_WARN, "Damaged section in quest data!\n");
+            return -1;
+        }
+
+        if(type != 0x03 && area >= 18) {
+            debug(DBG_WARN, "Quest data has a section for area %d!\n",
+                  (int)area);
+            return -1;
         }
+
+        if(type == 0x01) {                  /* Objects */
+            ptrs[0][area] = hdr;
+            obj_count += LE32(hdr->size) / sizeof(map_object_t);
+        }
+        else if(type == 0x02) {             /* Enemies */
+            ptrs[1][area] = hdr;
+        }
+
+        /* Type 3 is ??? - Skip */
+        ptr += next;
     }
 
     *obj_cnt = obj_count;
+    return 0;
 }
@@ -24,6 +24,21 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
 
 #if defined(WORDS_BIGENDIAN) || defined(__BIG_ENDIAN__)
 #define LE16(x) (((x >> 8) & 0xFF) | ((x & 0xFF) << 8))
@@ -86,168 +101,703 @@ typedef struct dc_quest_chunk {
     uint32_t length;
 } PACKED dc_quest_chunk_pkt;
 
-static int write_xbox_hdr(FILE *fp, gc_quest_file_pkt *gc,
-                          unsigned long quest_id, unsigned long ep,
-                          char lang) {
-    xbox_quest_file_pkt xb;
-    int isbin = 0;
+/* Each of the two file headers grows by this much going from Gamecube to Xbox.
+   Everything else stays the same size. */
+#define HDR_GROWTH  (sizeof(xbox_quest_file_pkt) - sizeof(gc_quest_file_pkt))
 
-    if(ep == 2)
-        ep = 256;
-    else
-        ep = 0;
+/* The smallest a chunk can be and still have a filename in it. */
+#define MIN_CHUNK   (sizeof(dc_pkt_hdr_t) + 16)
 
-    if(strstr(gc->filename, ".bin"))
-        isbin = 1;
+/* Everything about one quest that doesn't come from the file itself. The names
+   the files get on the Xbox side are worked out once here, rather than for
+   every chunk. */
+struct conv_opts {
+    unsigned long qid;
+    unsigned long ep;
+    char lang;
+    char bin_name[16];
+    char dat_name[16];
+    size_t bin_len;
+    size_t dat_len;
+};
+
+/* One quest to be converted in batch mode. */
+struct batch_job {
+    char *in;
+    char *out;
+    struct conv_opts opts;
+    int rv;
+};
 
-    memset(&xb, 0, sizeof(xbox_quest_file_pkt));
-    xb.hdr.pkt_type = 0xA6;
-    xb.hdr.flags = (uint8_t)quest_id;
-    xb.hdr.pkt_len = LE16(0x0054);
+struct batch {
+    struct batch_job *jobs;
+    int count;
+    int alloc;
+};
 
-    memcpy(xb.name, gc->name, 32);
-    xb.quest_id = LE16(quest_id | ep);
-    if(isbin)
-        sprintf(xb.filename, "quest%lu.bin", quest_id | ep);
-    else
-        sprintf(xb.filename, "quest%lu.dat", quest_id | ep);
-    xb.length = gc->length;
+struct batch_worker {
+#ifndef _WIN32
+    pthread_t thd;
+#endif
+    struct batch *b;
+    int start;
+    int step;
+
+    /* Where this worker builds each of its quests, grown as needed and reused
+       for every one after that. */
+    uint8_t *buf;
+    size_t cap;
+};
+
+static int set_opts(struct conv_opts *o, unsigned long qid, unsigned long ep,
+                    char lang) {
+    unsigned long id = qid | (ep == 2 ? 256 : 0);
+
+    memset(o, 0, sizeof(struct conv_opts));
+    o->qid = qid;
+    o->ep = ep;
+    o->lang = lang;
+
+    /* This can't actually be too long with the ids and episodes allowed, but
+       make sure anyway. */
+    if(snprintf(o->bin_name, 16, "quest%lu.bin", id) >= 16)
+        return -1;
+
+    sprintf(o->dat_name, "quest%lu.dat", id);
+
+    /* The name plus its terminator is what gets written over the old one. */
+    o->bin_len = strlen(o->bin_name) + 1;
+    o->dat_len = strlen(o->dat_name) + 1;
+    return 0;
+}
 
-    sprintf(xb.xbox_filename, "quest%lu_%c.dat", quest_id | ep, lang);
-    xb.quest_id2 = LE16(quest_id | ep);
-    xb.flags2 = LE16(0x3000);
+/* Is the (not necessarily terminated) filename from a packet a .bin? */
+static int is_bin(const char *fn) {
+    char tmp[17];
 
-    return fwrite(&xb, sizeof(xbox_quest_file_pkt), 1, fp);
+    memcpy(tmp, fn, 16);
+    tmp[16] = 0;
+    return strstr(tmp, ".bin") != NULL;
 }
 
-static int copy_chunks(FILE *in, FILE *out, unsigned long qid,
-                       unsigned long ep) {
-    dc_quest_chunk_pkt pkt;
-    char fn[17];
-    uint16_t len;
+static void make_xbox_hdr(xbox_quest_file_pkt *xb, const gc_quest_file_pkt *gc,
+                          const struct conv_opts *o) {
+    unsigned long id = o->qid | (o->ep == 2 ? 256 : 0);
 
-    if(ep == 2)
-        ep = 256;
+    memset(xb, 0, sizeof(xbox_quest_file_pkt));
+    xb->hdr.pkt_type = 0xA6;
+    xb->hdr.flags = (uint8_t)o->qid;
+    xb->hdr.pkt_len = LE16(0x0054);
+
+    memcpy(xb->name, gc->name, 32);
+    xb->quest_id = LE16(id);
+
+    if(is_bin(gc->filename))
+        memcpy(xb->filename, o->bin_name, o->bin_len);
     else
-        ep = 0;
+        memcpy(xb->filename, o->dat_name, o->dat_len);
+
+    xb->length = gc->length;
 
-    memset(fn, 0, sizeof(fn));
+    sprintf(xb->xbox_filename, "quest%lu_%c.dat", id, o->lang);
+    xb->quest_id2 = LE16(id);
+    xb->flags2 = LE16(0x3000);
+}
+
+/* How much room the Xbox version of a quest might need. */
+static size_t xbox_size(size_t len) {
+    return len + 2 * HDR_GROWTH;
+}
+
+/* Convert a whole Gamecube download quest in memory. dst must have room for at
+   least xbox_size(len) bytes. Returns how much was written to dst, or -1 if the
+   quest is damaged. As before, a partial chunk header at the very end of the
+   file is ignored. */
+static long convert_qst(const uint8_t *src, size_t len, uint8_t *dst,
+                        const struct conv_opts *o) {
+    const dc_pkt_hdr_t *hdr;
+    dc_quest_chunk_pkt *pkt;
+    size_t pos, off, plen;
+    int i;
+
+    if(len < 2 * sizeof(gc_quest_file_pkt)) {
+        printf("Cannot read from input file\n");
+        return -1;
+    }
+
+    /* First, the headers for the .bin and .dat. */
+    for(i = 0, pos = 0, off = 0; i < 2; ++i) {
+        make_xbox_hdr((xbox_quest_file_pkt *)(dst + off),
+                      (const gc_quest_file_pkt *)(src + pos), o);
+        pos += sizeof(gc_quest_file_pkt);
+        off += sizeof(xbox_quest_file_pkt);
+    }
+
+    /* Then, the chunks, which go over as is apart from their names. */
+    while(len - pos >= sizeof(dc_pkt_hdr_t)) {
+        hdr = (const dc_pkt_hdr_t *)(src + pos);
+        plen = LE16(hdr->pkt_len);
 
-    while(fread(&pkt.hdr, 1, sizeof(dc_pkt_hdr_t), in) == sizeof(dc_pkt_hdr_t)) {
-        len = LE16(pkt.hdr.pkt_len) - sizeof(dc_pkt_hdr_t);
-        if(fread(pkt.filename, 1, len, in) != (ssize_t)len) {
-            perror("Error reading file data");
+        if(plen < MIN_CHUNK || plen > sizeof(dc_quest_chunk_pkt) ||
+           plen > len - pos) {
+            printf("Damaged chunk at offset %lu\n", (unsigned long)pos);
             return -1;
         }
 
-        memcpy(fn, pkt.filename, 16);
-        if(strstr(fn, ".bin"))
-            sprintf(pkt.filename, "quest%lu.bin", qid | ep);
+        memcpy(dst + off, src + pos, plen);
+        pkt = (dc_quest_chunk_pkt *)(dst + off);
+
+        if(is_bin(pkt->filename))
+            memcpy(pkt->filename, o->bin_name, o->bin_len);
         else
-            sprintf(pkt.filename, "quest%lu.dat", qid | ep);
+            memcpy(pkt->filename, o->dat_name, o->dat_len);
 
-        len += sizeof(dc_pkt_hdr_t);
-        if(fwrite(&pkt, 1, len, out) != (ssize_t)len) {
-            perror("Error copying file data");
-            return -1;
+        pos += plen;
+        off += plen;
+    }
+
+    return (long)off;
+}
+
+/* Get a whole file into memory, mapping it where we can. mapped says which one
+   happened, for unload_file. */
+static uint8_t *load_file(const char *fn, size_t *len, int *mapped) {
+    FILE *fp;
+    uint8_t *buf;
+    long sz;
+
+#ifndef _WIN32
+    struct stat st;
+    void *rv;
+    int fd;
+
+    if((fd = open(fn, O_RDONLY)) < 0) {
+        perror("Cannot open input file");
+        return NULL;
+    }
+
+    if(!fstat(fd, &st) && st.st_size > 0) {
+        rv = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(rv != MAP_FAILED) {
+            close(fd);
+            *len = (size_t)st.st_size;
+            *mapped = 1;
+            return (uint8_t *)rv;
         }
     }
 
-    return 0;
+    close(fd);
+#endif
+
+    *mapped = 0;
+
+    if(!(fp = fopen(fn, "rb"))) {
+        perror("Cannot open input file");
+        return NULL;
+    }
+
+    if(fseek(fp, 0, SEEK_END) || (sz = ftell(fp)) < 0 ||
+       fseek(fp, 0, SEEK_SET)) {
+        perror("Cannot read from input file");
+        fclose(fp);
+        return NULL;
+    }
+
+    /* Add one, so that empty files don't look like a failed malloc. */
+    if(!(buf = (uint8_t *)malloc((size_t)sz + 1))) {
+        perror("malloc");
+        fclose(fp);
+        return NULL;
+    }
+
+    if(fread(buf, 1, (size_t)sz, fp) != (size_t)sz) {
+        printf("Cannot read from input file\n");
+        free(buf);
+        fclose(fp);
+        return NULL;
+    }
+
+    fclose(fp);
+    *len = (size_t)sz;
+    return buf;
 }
 
-int main(int argc, char *argv[]) {
-    FILE *in, *out;
-    gc_quest_file_pkt gc;
-    char lang;
-    unsigned long qid, ep;
-    int rv;
+static void unload_file(uint8_t *buf, size_t len, int mapped) {
+#ifndef _WIN32
+    if(mapped) {
+        munmap(buf, len);
+        return;
+    }
+#else
+    (void)len;
+    (void)mapped;
+#endif
 
-    if(argc != 6) {
-        printf("Usage: %s input output quest_id episode l\n", argv[0]);
-        printf("Where l is letter representing a language (j, e, f, s, g)\n");
-        return 1;
+    free(buf);
+}
+
+/* Convert one quest from one file to another. The output is built in *buf
+   (which has room for *cap bytes, and is made bigger if it needs to be), then
+   written out all at once. */
+static int convert_file(const char *in, const char *out,
+                        const struct conv_opts *o, uint8_t **buf,
+                        size_t *cap) {
+    uint8_t *src, *tmp;
+    size_t len;
+    long olen;
+    FILE *fp;
+    int mapped, rv = -1;
+
+    if(!(src = load_file(in, &len, &mapped)))
+        return -1;
+
+    if(xbox_size(len) > *cap) {
+        if(!(tmp = (uint8_t *)realloc(*buf, xbox_size(len)))) {
+            perror("realloc");
+            goto out;
+        }
+
+        *buf = tmp;
+        *cap = xbox_size(len);
     }
 
+    if((olen = convert_qst(src, len, *buf, o)) < 0)
+        goto out;
+
+    if(!(fp = fopen(out, "wb"))) {
+        perror("Cannot open output file");
+        goto out;
+    }
+
+    if(fwrite(*buf, 1, (size_t)olen, fp) != (size_t)olen) {
+        perror("Error copying file data");
+        fclose(fp);
+        goto out;
+    }
+
+    if(fclose(fp)) {
+        perror("Error copying file data");
+        goto out;
+    }
+
+    rv = 0;
+
+out:
+    unload_file(src, len, mapped);
+    return rv;
+}
+
+static int parse_qid(const char *str, unsigned long *qid) {
     errno = 0;
-    qid = strtoul(argv[3], NULL, 0);
+    *qid = strtoul(str, NULL, 0);
     if(errno) {
         perror("Cannot read quest id");
-        return 1;
+        return -1;
     }
 
-    if(qid > 255) {
-        printf("Quest ID '%s' is invalid, must be less than 255.", argv[3]);
-        return 1;
+    if(*qid > 255) {
+        printf("Quest ID '%s' is invalid, must be less than 255.\n", str);
+        return -1;
     }
 
+    return 0;
+}
+
+static int parse_ep(const char *str, unsigned long *ep) {
     errno = 0;
-    ep = strtoul(argv[4], NULL, 0);
+    *ep = strtoul(str, NULL, 0);
     if(errno) {
         perror("Cannot read episode");
-        return 1;
+        return -1;
     }
 
-    if(ep != 1 && ep != 2) {
-        printf("Episode '%s' is invalid, must be 1 or 2.", argv[4]);
-        return 1;
+    if(*ep != 1 && *ep != 2) {
+        printf("Episode '%s' is invalid, must be 1 or 2.\n", str);
+        return -1;
     }
 
-    if(strlen(argv[5]) != 1) {
-        printf("Language code '%s' is invalid\n", argv[4]);
-        return 1;
+    return 0;
+}
+
+static int parse_lang(const char *str, char *lang) {
+    if(strlen(str) != 1 || (str[0] != 'j' && str[0] != 'e' && str[0] != 'f' &&
+                            str[0] != 's' && str[0] != 'g')) {
+        printf("Language code '%s' is invalid\n", str);
+        return -1;
     }
 
-    if(argv[5][0] != 'j' && argv[5][0] != 'e' && argv[5][0] != 'f' &&
-       argv[5][0] != 's' && argv[5][0] != 'g') {
-        printf("Language code '%s' is invalid\n", argv[5]);
-        return 1;
+    *lang = str[0];
+    return 0;
+}
+
+static int parse_opts(const char *qid_str, const char *ep_str,
+                      const char *lang_str, struct conv_opts *o) {
+    unsigned long qid, ep;
+    char lang;
+
+    if(parse_qid(qid_str, &qid) || parse_ep(ep_str, &ep) ||
+       parse_lang(lang_str, &lang))
+        return -1;
+
+    return set_opts(o, qid, ep, lang);
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s input output quest_id episode l\n", prog);
+    printf("Where l is letter representing a language (j, e, f, s, g)\n\n");
+    printf("To convert every .qst in a directory:\n"
+           "    %s -b [-j N] indir outdir episode l\n", prog);
+    printf("The quest id of each is the first number in its file name, and "
+           "the output has\nthe same name as the input, in outdir.\n\n");
+    printf("To convert every quest listed in a file:\n"
+           "    %s -b [-j N] list\n", prog);
+    printf("Where each line of the list has the same five things as a single "
+           "conversion.\nBlank lines and lines starting with # are skipped.\n");
+}
+
+/* Add a job to the list. The file names are copied. */
+static int add_job(struct batch *b, const char *in, const char *out,
+                   const struct conv_opts *o) {
+    struct batch_job *tmp, *job;
+
+    if(b->count == b->alloc) {
+        if(!(tmp = (struct batch_job *)realloc(b->jobs, (b->alloc + 64) *
+                                               sizeof(struct batch_job)))) {
+            perror("realloc");
+            return -1;
+        }
+
+        b->jobs = tmp;
+        b->alloc += 64;
     }
 
-    lang = argv[5][0];
+    job = &b->jobs[b->count];
+    job->in = strdup(in);
+    job->out = strdup(out);
+    job->opts = *o;
+    job->rv = 0;
+
+    if(!job->in || !job->out) {
+        perror("strdup");
+        free(job->in);
+        free(job->out);
+        return -1;
+    }
 
-    if(!(in = fopen(argv[1], "rb"))) {
-        perror("Cannot open input file");
-        return 1;
+    ++b->count;
+    return 0;
+}
+
+static int has_qst_ext(const char *fn) {
+    size_t len = strlen(fn);
+
+    return len > 4 && fn[len - 4] == '.' &&
+        tolower((unsigned char)fn[len - 3]) == 'q' &&
+        tolower((unsigned char)fn[len - 2]) == 's' &&
+        tolower((unsigned char)fn[len - 1]) == 't';
+}
+
+/* Queue up a .qst found in a directory, getting its quest id from the first
+   number in its name. */
+static int add_dir_file(struct batch *b, const char *indir, const char *outdir,
+                        const char *fn, unsigned long ep, char lang) {
+    struct conv_opts o;
+    const char *p;
+    char *in, *out;
+    unsigned long qid;
+    int rv;
+
+    if(!has_qst_ext(fn))
+        return 0;
+
+    for(p = fn; *p && !isdigit((unsigned char)*p); ++p) ;
+
+    if(!*p || (qid = strtoul(p, NULL, 10)) > 255) {
+        printf("No quest id in the name of '%s', skipping it\n", fn);
+        return 0;
     }
 
-    if(!(out = fopen(argv[2], "wb"))) {
-        perror("Cannot open output file");
-        fclose(in);
-        return 1;
+    if(set_opts(&o, qid, ep, lang))
+        return -1;
+
+    in = (char *)malloc(strlen(indir) + strlen(fn) + 2);
+    out = (char *)malloc(strlen(outdir) + strlen(fn) + 2);
+
+    if(!in || !out) {
+        perror("malloc");
+        free(in);
+        free(out);
+        return -1;
     }
 
-    if(fread(&gc, sizeof(gc_quest_file_pkt), 1, in) != 1) {
-        printf("Cannot read from input file\n");
-        fclose(out);
-        fclose(in);
-        return 1;
+    sprintf(in, "%s/%s", indir, fn);
+    sprintf(out, "%s/%s", outdir, fn);
+    rv = add_job(b, in, out, &o);
+    free(in);
+    free(out);
+    return rv;
+}
+
+static int add_dir_jobs(struct batch *b, const char *indir, const char *outdir,
+                        unsigned long ep, char lang) {
+    int rv = 0;
+#ifdef _WIN32
+    WIN32_FIND_DATAA fd;
+    HANDLE h;
+    char *path;
+
+    if(!(path = (char *)malloc(strlen(indir) + 3))) {
+        perror("malloc");
+        return -1;
     }
 
-    if(write_xbox_hdr(out, &gc, qid, ep, lang) != 1) {
-        printf("Cannot write to output file\n");
-        fclose(out);
-        fclose(in);
-        return 1;
+    sprintf(path, "%s/*", indir);
+    h = FindFirstFileA(path, &fd);
+    free(path);
+
+    if(h == INVALID_HANDLE_VALUE) {
+        printf("Cannot read directory '%s'\n", indir);
+        return -1;
     }
 
-    if(fread(&gc, sizeof(gc_quest_file_pkt), 1, in) != 1) {
-        printf("Cannot read from input file\n");
-        fclose(out);
-        fclose(in);
-        return 1;
+    do {
+        if(!(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+           (rv = add_dir_file(b, indir, outdir, fd.cFileName, ep, lang)))
+            break;
+    } while(FindNextFileA(h, &fd));
+
+    FindClose(h);
+#else
+    DIR *d;
+    struct dirent *de;
+
+    if(!(d = opendir(indir))) {
+        printf("Cannot read directory '%s': %s\n", indir, strerror(errno));
+        return -1;
     }
 
-    if(write_xbox_hdr(out, &gc, qid, ep, lang) != 1) {
-        printf("Cannot write to output file\n");
-        fclose(out);
-        fclose(in);
-        return 1;
+    while((de = readdir(d))) {
+        if((rv = add_dir_file(b, indir, outdir, de->d_name, ep, lang)))
+            break;
+    }
+
+    closedir(d);
+#endif
+
+    return rv;
+}
+
+/* Read a list of quests to convert from a file, one per line, with the same
+   five arguments as converting a single quest takes. */
+static int add_list_jobs(struct batch *b, const char *fn) {
+    struct conv_opts o;
+    FILE *fp;
+    char line[4096], *tok, *args[5];
+    int nargs, lineno = 0, rv = 0;
+
+    if(!(fp = fopen(fn, "r"))) {
+        printf("Cannot open '%s': %s\n", fn, strerror(errno));
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp)) {
+        ++lineno;
+        nargs = 0;
+
+        for(tok = strtok(line, " \t\r\n"); tok && nargs < 6;
+            tok = strtok(NULL, " \t\r\n")) {
+            if(nargs == 0 && tok[0] == '#')
+                break;
+
+            if(nargs < 5)
+                args[nargs] = tok;
+
+            ++nargs;
+        }
+
+        if(!nargs)
+            continue;
+
+        if(nargs != 5) {
+            printf("%s:%d: wrong number of arguments\n", fn, lineno);
+            rv = -1;
+            break;
+        }
+
+        if(parse_opts(args[2], args[3], args[4], &o)) {
+            printf("%s:%d: bad quest settings\n", fn, lineno);
+            rv = -1;
+            break;
+        }
+
+        if((rv = add_job(b, args[0], args[1], &o)))
+            break;
+    }
+
+    fclose(fp);
+    return rv;
+}
+
+static int job_cmp(const void *a, const void *b) {
+    const struct batch_job *j1 = (const struct batch_job *)a;
+    const struct batch_job *j2 = (const struct batch_job *)b;
+
+    return strcmp(j1->in, j2->in);
+}
+
+static void *batch_thd(void *d) {
+    struct batch_worker *w = (struct batch_worker *)d;
+    struct batch_job *job;
+    int i;
+
+    for(i = w->start; i < w->b->count; i += w->step) {
+        job = &w->b->jobs[i];
+
+        if((job->rv = convert_file(job->in, job->out, &job->opts, &w->buf,
+                                   &w->cap)))
+            printf("Failed: %s\n", job->in);
+    }
+
+    return NULL;
+}
+
+/* Convert a whole bunch of quests at once, spread over however many threads
+   are asked for. */
+static int batch_convert(int argc, char *argv[]) {
+    struct batch b;
+    struct batch_worker *workers;
+    struct stat st;
+    unsigned long ep;
+    char lang;
+    int i = 2, j, threads = 1, failed = 0, rv = -1;
+
+    memset(&b, 0, sizeof(b));
+
+    if(argc > i + 1 && !strcmp(argv[i], "-j")) {
+        if((threads = atoi(argv[i + 1])) < 1) {
+            printf("Invalid thread count: %s\n", argv[i + 1]);
+            return -1;
+        }
+
+        i += 2;
+    }
+
+    if(argc == i + 4) {
+        if(stat(argv[i], &st) || (st.st_mode & S_IFMT) != S_IFDIR) {
+            printf("'%s' is not a directory\n", argv[i]);
+            return -1;
+        }
+
+        if(parse_ep(argv[i + 2], &ep) || parse_lang(argv[i + 3], &lang))
+            return -1;
+
+        if(add_dir_jobs(&b, argv[i], argv[i + 1], ep, lang))
+            goto out;
+
+        /* Do them in a predictable order, at least with one thread. */
+        qsort(b.jobs, b.count, sizeof(struct batch_job), &job_cmp);
+    }
+    else if(argc == i + 1) {
+        if(add_list_jobs(&b, argv[i]))
+            goto out;
+    }
+    else {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if(!b.count) {
+        printf("No quests to convert\n");
+        goto out;
+    }
+
+#ifdef _WIN32
+    /* No threads here, just do them all in order. */
+    threads = 1;
+#endif
+
+    if(threads > b.count)
+        threads = b.count;
+
+    if(!(workers = (struct batch_worker *)calloc(threads, sizeof(*workers)))) {
+        perror("calloc");
+        goto out;
+    }
+
+    for(j = 0; j < threads; ++j) {
+        workers[j].b = &b;
+        workers[j].start = j;
+        workers[j].step = threads;
+    }
+
+#ifndef _WIN32
+    if(threads > 1) {
+        int started, err;
+
+        for(started = 0; started < threads; ++started) {
+            if((err = pthread_create(&workers[started].thd, NULL, &batch_thd,
+                                     &workers[started]))) {
+                fprintf(stderr, "pthread_create: %s\n", strerror(err));
+                break;
+            }
+        }
+
+        /* Whatever didn't get a thread gets done here. */
+        for(j = started; j < threads; ++j)
+            batch_thd(&workers[j]);
+
+        for(j = 0; j < started; ++j)
+            pthread_join(workers[j].thd, NULL);
+    }
+    else
+#endif
+    {
+        batch_thd(&workers[0]);
     }
 
-    rv = copy_chunks(in, out, qid, ep);
-    fclose(out);
-    fclose(in);
+    for(j = 0; j < threads; ++j)
+        free(workers[j].buf);
+
+    free(workers);
+
+    for(j = 0; j < b.count; ++j) {
+        if(b.jobs[j].rv)
+            ++failed;
+    }
+
+    printf("Converted %d of %d quests\n", b.count - failed, b.count);
+    rv = failed ? -1 : 0;
+
+out:
+    for(j = 0; j < b.count; ++j) {
+        free(b.jobs[j].in);
+        free(b.jobs[j].out);
+    }
 
+    free(b.jobs);
     return rv;
 }
+
+int main(int argc, char *argv[]) {
+    struct conv_opts o;
+    uint8_t *buf = NULL;
+    size_t cap = 0;
+    int rv;
+
+    if(argc > 1 && !strcmp(argv[1], "-b"))
+        return batch_convert(argc, argv) ? 1 : 0;
+
+    if(argc != 6) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(parse_opts(argv[3], argv[4], argv[5], &o))
+        return 1;
+
+    rv = convert_file(argv[1], argv[2], &o, &buf, &cap);
+    free(buf);
+
+    return rv ? 1 : 0;
+}